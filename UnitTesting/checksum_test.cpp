@@ -0,0 +1,123 @@
+#include "../src/include/checksum.hpp"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+class ChecksumTest : public ::testing::Test {
+protected:
+    static std::vector<checksum::Kernel> supported_kernels() {
+        std::vector<checksum::Kernel> kernels;
+        for (auto k : {checksum::Kernel::Portable, checksum::Kernel::Sse42, checksum::Kernel::Sse42Interleaved}) {
+            if (checksum::kernel_supported(k)) {
+                kernels.push_back(k);
+            }
+        }
+        return kernels;
+    }
+
+    static std::vector<char> random_bytes(size_t n, uint64_t seed) {
+        std::mt19937_64 gen(seed);
+        std::vector<char> data(n);
+        for (auto& c : data) {
+            c = static_cast<char>(gen());
+        }
+        return data;
+    }
+};
+
+TEST_F(ChecksumTest, KnownVector) {
+    const char check[] = "123456789";
+    for (auto k : supported_kernels()) {
+        EXPECT_EQ(checksum::crc32c(0, check, 9, k), 0xE3069283u) << checksum::kernel_name(k);
+    }
+    EXPECT_EQ(checksum::crc32c(0, check, 0), 0u);
+}
+
+TEST_F(ChecksumTest, KernelsAgreeAcrossLengthsAndAlignments) {
+    auto data = random_bytes(200000, 7);
+    std::mt19937 gen(11);
+    for (int i = 0; i < 300; ++i) {
+        size_t offset = gen() % 64;
+        size_t len = gen() % (data.size() - offset);
+        uint32_t expected = checksum::crc32c(0, data.data() + offset, len, checksum::Kernel::Portable);
+        for (auto k : supported_kernels()) {
+            ASSERT_EQ(checksum::crc32c(0, data.data() + offset, len, k), expected)
+                << checksum::kernel_name(k) << " offset " << offset << " len " << len;
+        }
+    }
+}
+
+TEST_F(ChecksumTest, IncrementalAndCombine) {
+    auto data = random_bytes(1 << 20, 3);
+    uint32_t whole = checksum::crc32c(0, data.data(), data.size());
+    for (size_t split : {size_t{1}, size_t{4097}, checksum::BLOCK_SIZE, size_t{700001}}) {
+        uint32_t a = checksum::crc32c(0, data.data(), split);
+        EXPECT_EQ(checksum::crc32c(a, data.data() + split, data.size() - split), whole);
+        uint32_t b = checksum::crc32c(0, data.data() + split, data.size() - split);
+        EXPECT_EQ(checksum::crc32c_combine(a, b, data.size() - split), whole);
+    }
+}
+
+TEST_F(ChecksumTest, BlockDigests) {
+    const size_t size = 5 * checksum::BLOCK_SIZE + 1234;
+    auto data = random_bytes(size, 5);
+
+    checksum::BlockChecksummer summer;
+    for (size_t off = 0; off < size; off += 10007) {
+        summer.update(data.data() + off, std::min<size_t>(10007, size - off));
+    }
+    auto digest = summer.finish();
+
+    EXPECT_EQ(digest.size, size);
+    EXPECT_EQ(digest.crc, checksum::crc32c(0, data.data(), size));
+    ASSERT_EQ(digest.blocks.size(), 6u);
+    for (size_t b = 0; b < digest.blocks.size(); ++b) {
+        size_t off = b * checksum::BLOCK_SIZE;
+        EXPECT_EQ(digest.blocks[b], checksum::crc32c(0, data.data() + off, std::min(checksum::BLOCK_SIZE, size - off)));
+    }
+}
+
+TEST_F(ChecksumTest, KernelThroughput) {
+    const size_t size = 64 * 1024 * 1024;
+    const int rounds = 4;
+    auto data = random_bytes(size, 9);
+
+    std::cout << "\n=== Checksum Kernel Throughput (64 MB) ===" << std::endl;
+    std::cout << "Active kernel: " << checksum::kernel_name(checksum::active_kernel()) << std::endl;
+
+    auto report = [&](const std::string& name, auto&& fn) {
+        fn(); // warm up
+        auto start_time = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            fn();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << std::left << std::setw(28) << name << std::fixed << std::setprecision(2)
+                  << (static_cast<double>(size) * rounds / seconds) / (1024.0 * 1024 * 1024) << " GB/s" << std::endl;
+    };
+
+    volatile uint64_t sink = 0;
+    report("legacy hash*31+c", [&] {
+        uint64_t hash = 0;
+        for (char c : data) {
+            hash = hash * 31 + static_cast<uint64_t>(c);
+        }
+        sink = hash;
+    });
+    for (auto k : supported_kernels()) {
+        report(checksum::kernel_name(k), [&] { sink = checksum::crc32c(0, data.data(), size, k); });
+    }
+    report("block digests (active)", [&] {
+        checksum::BlockChecksummer summer;
+        summer.update(data.data(), size);
+        sink = summer.finish().crc;
+    });
+    (void)sink;
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
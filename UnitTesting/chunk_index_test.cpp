@@ -0,0 +1,215 @@
+#include "../src/Cluster_Server/chunk_storage.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class ChunkIndexTest : public ::testing::Test {
+protected:
+    fs::path work_dir;
+
+    void SetUp() override {
+        work_dir = fs::temp_directory_path() / ("chunk_index_test_" + std::to_string(::getpid()));
+        fs::remove_all(work_dir);
+    }
+
+    void TearDown() override { fs::remove_all(work_dir); }
+
+    static std::vector<char> bytes(size_t n, char fill) { return std::vector<char>(n, fill); }
+
+    static std::vector<std::string> sorted(std::vector<std::string> ids) {
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+};
+
+TEST_F(ChunkIndexTest, ChunksSurviveRestart) {
+    {
+        ChunkStorage storage(work_dir.string());
+        ASSERT_TRUE(storage.store_chunk("a", bytes(100, 'a')));
+        ASSERT_TRUE(storage.store_chunk("b", bytes(200, 'b')));
+        ASSERT_TRUE(storage.store_chunk("c", bytes(300, 'c')));
+        ASSERT_TRUE(storage.delete_chunk("b"));
+    }
+    ChunkStorage storage(work_dir.string());
+    EXPECT_EQ(sorted(storage.list_chunks()), (std::vector<std::string>{"a", "c"}));
+    EXPECT_EQ(storage.retrieve_chunk("c"), bytes(300, 'c'));
+    EXPECT_TRUE(storage.retrieve_chunk("b").empty());
+}
+
+TEST_F(ChunkIndexTest, ColdStartScansTheDirectory) {
+    {
+        ChunkStorage storage(work_dir.string());
+        ASSERT_TRUE(storage.store_chunk("x", bytes(10, 'x')));
+        ASSERT_TRUE(storage.store_chunk("y", bytes(20, 'y')));
+    }
+    fs::remove(work_dir / "chunk_index.snap");
+    fs::remove(work_dir / "chunk_index.log");
+
+    {
+        ChunkStorage storage(work_dir.string());
+        EXPECT_EQ(sorted(storage.list_chunks()), (std::vector<std::string>{"x", "y"}));
+        EXPECT_EQ(storage.retrieve_chunk("y"), bytes(20, 'y'));
+    }
+    // The scan leaves a snapshot behind for the next start
+    EXPECT_TRUE(fs::exists(work_dir / "chunk_index.snap"));
+}
+
+TEST_F(ChunkIndexTest, TornLogTailIsDropped) {
+    {
+        ChunkStorage storage(work_dir.string());
+        ASSERT_TRUE(storage.store_chunk("kept", bytes(10, 'k')));
+    }
+    {
+        int fd = ::open((work_dir / "chunk_index.log").c_str(), O_WRONLY | O_APPEND);
+        ASSERT_GE(fd, 0);
+        const char partial[] = "\x01\x02\x03\x04\x01\x20";
+        ASSERT_EQ(::write(fd, partial, sizeof(partial) - 1), static_cast<ssize_t>(sizeof(partial) - 1));
+        ::close(fd);
+    }
+    {
+        ChunkStorage storage(work_dir.string());
+        EXPECT_EQ(storage.list_chunks(), std::vector<std::string>{"kept"});
+        ASSERT_TRUE(storage.store_chunk("after", bytes(10, 'z')));
+    }
+    ChunkStorage storage(work_dir.string());
+    EXPECT_EQ(sorted(storage.list_chunks()), (std::vector<std::string>{"after", "kept"}));
+}
+
+TEST_F(ChunkIndexTest, CompactionFoldsTheLog) {
+    fs::create_directories(work_dir);
+    std::string dir = work_dir.string() + "/";
+    {
+        ChunkIndex index(dir);
+        ASSERT_TRUE(index.compact({}));
+        for (int i = 0; i < 1000; ++i) {
+            ASSERT_TRUE(index.added("c" + std::to_string(i), i));
+        }
+        for (int i = 0; i < 1000; i += 2) {
+            ASSERT_TRUE(index.removed("c" + std::to_string(i)));
+        }
+        EXPECT_EQ(index.log_records(), 1500u);
+    }
+    ChunkIndex index(dir);
+    auto entries = index.load();
+    ASSERT_TRUE(entries.has_value());
+    EXPECT_EQ(entries->size(), 500u);
+    EXPECT_EQ(index.log_records(), 1500u);
+
+    ASSERT_TRUE(index.compact(*entries));
+    EXPECT_EQ(index.log_records(), 0u);
+    EXPECT_EQ(fs::file_size(work_dir / "chunk_index.log"), 0u);
+    auto reloaded = ChunkIndex(dir).load();
+    ASSERT_TRUE(reloaded.has_value());
+    EXPECT_EQ(reloaded->size(), 500u);
+    for (const auto& e : *reloaded) {
+        EXPECT_EQ("c" + std::to_string(e.size), e.chunk_id);
+    }
+}
+
+TEST_F(ChunkIndexTest, OnlineCompactionKeepsConcurrentRecords) {
+    fs::create_directories(work_dir);
+    std::string dir = work_dir.string() + "/";
+    {
+        ChunkIndex index(dir);
+        ASSERT_TRUE(index.compact({}));
+        ASSERT_TRUE(index.added("before", 1));
+        ASSERT_TRUE(index.rotate_log());
+        EXPECT_FALSE(index.rotate_log()); // the first compaction is still running
+        // Lands in the fresh log while the snapshot is being built
+        ASSERT_TRUE(index.added("during", 2));
+        ASSERT_TRUE(index.finish_compaction({{"before", 1}}));
+        EXPECT_FALSE(fs::exists(work_dir / "chunk_index.log.old"));
+        EXPECT_EQ(index.log_records(), 1u);
+    }
+    auto entries = ChunkIndex(dir).load();
+    ASSERT_TRUE(entries.has_value());
+    EXPECT_EQ(entries->size(), 2u);
+}
+
+TEST_F(ChunkIndexTest, InterruptedCompactionIsFinishedAtStartup) {
+    {
+        ChunkStorage storage(work_dir.string());
+        ASSERT_TRUE(storage.store_chunk("a", bytes(10, 'a')));
+        ASSERT_TRUE(storage.store_chunk("b", bytes(20, 'b')));
+    }
+    // As if the server died between rotate_log() and finish_compaction()
+    fs::rename(work_dir / "chunk_index.log", work_dir / "chunk_index.log.old");
+
+    {
+        ChunkStorage storage(work_dir.string());
+        EXPECT_EQ(sorted(storage.list_chunks()), (std::vector<std::string>{"a", "b"}));
+    }
+    EXPECT_FALSE(fs::exists(work_dir / "chunk_index.log.old"));
+    ChunkStorage storage(work_dir.string());
+    EXPECT_EQ(storage.usage().used_bytes, 30u);
+}
+
+TEST_F(ChunkIndexTest, UsageCountersFollowStoresAndDeletes) {
+    {
+        ChunkStorage storage(work_dir.string());
+        ASSERT_TRUE(storage.store_chunk("a", bytes(1000, 'a')));
+        ASSERT_TRUE(storage.store_chunk("b", bytes(500, 'b')));
+        ASSERT_TRUE(storage.store_chunk("a", bytes(300, 'a')));  // replaced, not added
+        ASSERT_TRUE(storage.delete_chunk("b"));
+        auto usage = storage.usage();
+        EXPECT_EQ(usage.used_bytes, 300u);
+        EXPECT_EQ(usage.chunk_count, 1u);
+        EXPECT_GT(usage.disk_total_bytes, 0u);
+        EXPECT_EQ(storage.get_storage_usage(), 300u);
+    }
+    // Restored from the index on restart
+    ChunkStorage storage(work_dir.string());
+    EXPECT_EQ(storage.usage().used_bytes, 300u);
+    EXPECT_EQ(storage.usage().chunk_count, 1u);
+}
+
+TEST_F(ChunkIndexTest, ReconcileCorrectsDrift) {
+    ChunkStorage storage(work_dir.string());
+    ASSERT_TRUE(storage.store_chunk("grown", bytes(100, 'g')));
+    fs::resize_file(work_dir / DirectoryLayout{}.relative_path("grown"), 4096);
+    EXPECT_EQ(storage.usage().used_bytes, 100u);
+
+    storage.reconcile_usage();
+    EXPECT_EQ(storage.usage().used_bytes, 4096u);
+    EXPECT_EQ(storage.usage().chunk_count, 1u);
+}
+
+// Startup cost with many chunks: a cold directory scan versus loading the
+// snapshot it leaves behind.
+TEST_F(ChunkIndexTest, StartupWithManyChunks) {
+    const int CHUNKS = 100000;
+    fs::create_directories(work_dir);
+    for (int i = 0; i < CHUNKS; ++i) {
+        auto path = work_dir / ("chunk_file_" + std::to_string(i) + "_chunk_0.dat");
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        ASSERT_GE(fd, 0);
+        ::close(fd);
+    }
+
+    auto timed = [&] {
+        auto start = std::chrono::steady_clock::now();
+        ChunkStorage storage(work_dir.string(), DirectoryLayout{0});
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        EXPECT_EQ(storage.list_chunks().size(), static_cast<size_t>(CHUNKS));
+        return ms;
+    };
+    double scan_ms = timed();
+    double load_ms = timed();
+
+    std::cout << "\n=== Chunk Index Startup (" << CHUNKS << " chunks) ===" << std::endl;
+    std::cout << "Cold directory scan: " << std::fixed << std::setprecision(1) << scan_ms << " ms" << std::endl;
+    std::cout << "Snapshot load:       " << load_ms << " ms" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,95 @@
+#include "../src/Head_Server/chunk_layout.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+// Range reads map file offsets onto chunk ids and in-chunk offsets.
+class ChunkLayoutTest : public ::testing::Test {
+protected:
+    static constexpr size_t SIZE = 1000;  // small chunks keep the numbers readable
+};
+
+TEST_F(ChunkLayoutTest, RangeInsideOneChunk) {
+    auto spans = chunk_spans(2100, 50, 5, SIZE);
+    ASSERT_EQ(spans.size(), 1u);
+    EXPECT_EQ(spans[0].chunk_id, 2);
+    EXPECT_EQ(spans[0].offset, 100u);
+    EXPECT_EQ(spans[0].length, 50u);
+    EXPECT_EQ(spans[0].range_offset, 0u);
+}
+
+TEST_F(ChunkLayoutTest, RangeAcrossChunks) {
+    auto spans = chunk_spans(1900, 2200, 5, SIZE);
+    ASSERT_EQ(spans.size(), 4u);
+    EXPECT_EQ(spans[0].chunk_id, 1);
+    EXPECT_EQ(spans[0].offset, 900u);
+    EXPECT_EQ(spans[0].length, 100u);
+    EXPECT_EQ(spans[1].chunk_id, 2);
+    EXPECT_EQ(spans[1].offset, 0u);
+    EXPECT_EQ(spans[1].length, SIZE);
+    EXPECT_EQ(spans[1].range_offset, 100u);
+    EXPECT_EQ(spans[3].chunk_id, 4);
+    EXPECT_EQ(spans[3].length, 100u);
+    EXPECT_EQ(spans[3].range_offset, 2100u);
+
+    uint64_t total = 0;
+    for (const auto& span : spans) {
+        total += span.length;
+    }
+    EXPECT_EQ(total, 2200u);
+}
+
+TEST_F(ChunkLayoutTest, RangeIsClippedToTheFile) {
+    // Length 0 reads to the end; the last chunk may turn out shorter
+    auto tail = chunk_spans(4500, 0, 5, SIZE);
+    ASSERT_EQ(tail.size(), 1u);
+    EXPECT_EQ(tail[0].chunk_id, 4);
+    EXPECT_EQ(tail[0].offset, 500u);
+    EXPECT_EQ(tail[0].length, 500u);
+
+    EXPECT_EQ(chunk_spans(3500, 10000, 5, SIZE).size(), 2u);
+    EXPECT_TRUE(chunk_spans(5000, 10, 5, SIZE).empty());
+    EXPECT_TRUE(chunk_spans(0, 10, 0, SIZE).empty());
+}
+
+TEST_F(ChunkLayoutTest, VariableSizedChunks) {
+    // Content-defined chunks of 300, 1200, 50 and 450 bytes
+    const std::vector<uint64_t> ends = {300, 1500, 1550, 2000};
+    auto spans = chunk_spans(250, 1280, ends);
+    ASSERT_EQ(spans.size(), 3u);
+    EXPECT_EQ(spans[0].chunk_id, 0);
+    EXPECT_EQ(spans[0].offset, 250u);
+    EXPECT_EQ(spans[0].length, 50u);
+    EXPECT_EQ(spans[1].chunk_id, 1);
+    EXPECT_EQ(spans[1].offset, 0u);
+    EXPECT_EQ(spans[1].length, 1200u);
+    EXPECT_EQ(spans[1].range_offset, 50u);
+    EXPECT_EQ(spans[2].chunk_id, 2);
+    EXPECT_EQ(spans[2].offset, 0u);
+    EXPECT_EQ(spans[2].length, 30u);
+
+    auto tail = chunk_spans(1550, 0, ends);
+    ASSERT_EQ(tail.size(), 1u);
+    EXPECT_EQ(tail[0].chunk_id, 3);
+    EXPECT_EQ(tail[0].length, 450u);
+    EXPECT_TRUE(chunk_spans(2000, 10, ends).empty());
+    EXPECT_TRUE(chunk_spans(0, 10, std::vector<uint64_t>{}).empty());
+}
+
+TEST_F(ChunkLayoutTest, ContentChunkIds) {
+    const std::string digest(64, 'a');
+    auto id = content_chunk_id(digest, 123456);
+    EXPECT_EQ(id, "cas_" + digest + ".123456");
+    auto parsed = parse_content_chunk_id(id);
+    ASSERT_TRUE(parsed.has_value());
+    EXPECT_EQ(parsed->digest, digest);
+    EXPECT_EQ(parsed->size, 123456u);
+
+    // Fragments of an erasure-coded content chunk name it too
+    auto fragment = parse_content_chunk_id(fragment_id(id, FragmentRef{4, 2, 1, 123456}));
+    ASSERT_TRUE(fragment.has_value());
+    EXPECT_EQ(fragment->size, 123456u);
+
+    EXPECT_FALSE(parse_content_chunk_id("file.bin_chunk_0").has_value());
+    EXPECT_FALSE(parse_content_chunk_id("cas_abc.10").has_value());
+    EXPECT_FALSE(parse_content_chunk_id("cas_" + digest + ".").has_value());
+}
@@ -0,0 +1,228 @@
+#include "../src/Cluster_Server/chunk_service.hpp"
+#include "../src/Head_Server/chunk_client.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class ChunkProtocolTest : public ::testing::Test {
+protected:
+    fs::path work_dir;
+    std::unique_ptr<ChunkStorage> storage;
+    std::unique_ptr<async_hb::Reactor> reactor;
+    std::unique_ptr<ChunkService> service;
+    std::thread server_thread;
+    std::string address;
+
+    void SetUp() override {
+        work_dir = fs::temp_directory_path() / ("chunk_protocol_test_" + std::to_string(::getpid()));
+        storage = std::make_unique<ChunkStorage>(work_dir.string());
+        reactor = std::make_unique<async_hb::Reactor>();
+        service = std::make_unique<ChunkService>(*reactor, *storage);
+        ASSERT_TRUE(service->listen("127.0.0.1", 0));
+        address = "127.0.0.1:" + std::to_string(service->port());
+        service->start();
+        server_thread = std::thread([this] { reactor->run(); });
+    }
+
+    void TearDown() override {
+        service->stop();
+        if (server_thread.joinable()) {
+            server_thread.join();
+        }
+        service.reset();
+        reactor.reset();
+        storage.reset();
+        fs::remove_all(work_dir);
+    }
+
+    static std::vector<char> random_bytes(size_t n, uint64_t seed) {
+        std::mt19937_64 gen(seed);
+        std::vector<char> data(n);
+        for (auto& c : data) {
+            c = static_cast<char>(gen());
+        }
+        return data;
+    }
+
+    bool put(const ChunkClient& client, const std::string& id, const std::vector<char>& data) {
+        auto writer = client.put(id, data.size());
+        if (!writer) {
+            return false;
+        }
+        checksum::BlockChecksummer summer;
+        for (size_t off = 0; off < data.size(); off += IO_SLICE_SIZE) {
+            size_t len = std::min(IO_SLICE_SIZE, data.size() - off);
+            summer.update(data.data() + off, len);
+            if (!writer->write(data.data() + off, len)) {
+                return false;
+            }
+        }
+        return writer->commit(summer.finish()).has_value();
+    }
+
+    static std::vector<char> get(const ChunkClient& client, const std::string& id, size_t offset = 0,
+                                 size_t length = 0) {
+        std::vector<char> out;
+        long long n = client.get(id, offset, length, [&](const char* data, size_t len) {
+            out.insert(out.end(), data, data + len);
+            return true;
+        });
+        EXPECT_EQ(n, static_cast<long long>(out.size()));
+        return out;
+    }
+};
+
+TEST_F(ChunkProtocolTest, PutGetListDelete) {
+    ChunkClient client(address);
+    auto data = random_bytes(3 * 1024 * 1024 + 17, 1);
+
+    ASSERT_TRUE(put(client, "file_chunk_0", data));
+    EXPECT_EQ(get(client, "file_chunk_0"), data);
+
+    auto part = get(client, "file_chunk_0", 1000, 4096);
+    ASSERT_EQ(part.size(), 4096u);
+    EXPECT_TRUE(std::equal(part.begin(), part.end(), data.begin() + 1000));
+
+    // Ranges are clamped to the chunk
+    auto tail = get(client, "file_chunk_0", data.size() - 5, 4096);
+    ASSERT_EQ(tail.size(), 5u);
+    EXPECT_TRUE(std::equal(tail.begin(), tail.end(), data.end() - 5));
+    EXPECT_TRUE(get(client, "file_chunk_0", data.size() + 100, 10).empty());
+
+    auto ids = client.list();
+    ASSERT_TRUE(ids.has_value());
+    EXPECT_EQ(*ids, std::vector<std::string>{"file_chunk_0"});
+
+    EXPECT_TRUE(client.remove("file_chunk_0"));
+    EXPECT_FALSE(client.remove("file_chunk_0"));
+    EXPECT_EQ(client.get("file_chunk_0", 0, 0, [](const char*, size_t) { return true; }),
+              ChunkClient::READ_FAILED);
+}
+
+TEST_F(ChunkProtocolTest, RejectsBadIdsAndShortUploads) {
+    ChunkClient client(address);
+    EXPECT_FALSE(put(client, "../escape", random_bytes(16, 2)));
+
+    // A writer abandoned mid-chunk must not leave a registered chunk behind
+    {
+        auto writer = client.put("partial", 1024);
+        ASSERT_TRUE(writer);
+        auto data = random_bytes(512, 3);
+        ASSERT_TRUE(writer->write(data.data(), data.size()));
+        EXPECT_FALSE(writer->commit(checksum::ChunkDigest{}).has_value());
+    }
+    auto ids = client.list();
+    ASSERT_TRUE(ids.has_value());
+    EXPECT_TRUE(ids->empty());
+}
+
+TEST_F(ChunkProtocolTest, BlockChecksumsCatchCorruption) {
+    ChunkClient client(address);
+    const size_t BLOCK = checksum::BLOCK_SIZE;
+    auto data = random_bytes(2 * 1024 * 1024 + 4321, 5);
+    ASSERT_TRUE(put(client, "crc_chunk", data));
+    const auto chunk_file = work_dir / DirectoryLayout{}.relative_path("crc_chunk");
+    EXPECT_TRUE(fs::exists(chunk_file.string() + ".crc"));
+
+    // Unaligned reads are widened to blocks on the wire but trimmed back
+    auto part = get(client, "crc_chunk", BLOCK - 7, BLOCK + 100);
+    ASSERT_EQ(part.size(), BLOCK + 100);
+    EXPECT_TRUE(std::equal(part.begin(), part.end(), data.begin() + (BLOCK - 7)));
+    auto tail = get(client, "crc_chunk", data.size() - 10);
+    EXPECT_TRUE(std::equal(tail.begin(), tail.end(), data.end() - 10));
+
+    // Flip one byte in block 5
+    {
+        std::fstream f(chunk_file, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(5 * BLOCK + 123);
+        f.put(static_cast<char>(~data[5 * BLOCK + 123]));
+    }
+
+    auto ignore = [](const char*, size_t) { return true; };
+    EXPECT_EQ(client.get("crc_chunk", 0, 0, ignore), ChunkClient::CHECKSUM_FAILED);
+    EXPECT_EQ(client.get("crc_chunk", 5 * BLOCK + 1000, 10, ignore), ChunkClient::CHECKSUM_FAILED);
+    EXPECT_EQ(storage->stream_chunk("crc_chunk", 5 * BLOCK, 1, ignore), -1);
+
+    // Blocks away from the damage still read and verify
+    auto clean = get(client, "crc_chunk", 0, 5 * BLOCK);
+    ASSERT_EQ(clean.size(), 5 * BLOCK);
+    EXPECT_TRUE(std::equal(clean.begin(), clean.end(), data.begin()));
+    EXPECT_EQ(storage->stream_chunk("crc_chunk", 6 * BLOCK, BLOCK, ignore), static_cast<long long>(BLOCK));
+}
+
+// The same service on a multi-threaded runtime, with clients in parallel.
+TEST_F(ChunkProtocolTest, ConcurrentClientsOnRuntime) {
+    const int CLIENTS = 8;
+    const int CHUNKS_EACH = 6;
+    async_hb::Runtime runtime(4);
+    ChunkService threaded(runtime.reactor(0), *storage);
+    ASSERT_TRUE(threaded.listen("127.0.0.1", 0));
+    std::string threaded_address = "127.0.0.1:" + std::to_string(threaded.port());
+    threaded.start();
+    std::thread runtime_thread([&] { runtime.run(); });
+
+    std::atomic<int> verified{0};
+    std::vector<std::thread> clients;
+    for (int c = 0; c < CLIENTS; ++c) {
+        clients.emplace_back([&, c] {
+            ChunkClient client(threaded_address);
+            for (int i = 0; i < CHUNKS_EACH; ++i) {
+                auto id = "rt_" + std::to_string(c) + "_" + std::to_string(i);
+                auto data = random_bytes(256 * 1024 + c * 1000 + i, c * 100 + i);
+                if (put(client, id, data) && get(client, id) == data) {
+                    verified++;
+                }
+            }
+        });
+    }
+    for (auto& t : clients) {
+        t.join();
+    }
+    threaded.stop();
+    runtime_thread.join();
+    EXPECT_EQ(verified.load(), CLIENTS * CHUNKS_EACH);
+}
+
+TEST_F(ChunkProtocolTest, LoopbackThroughput) {
+    const size_t CHUNK_BYTES = 64 * 1024 * 1024;
+    const int CHUNKS = 4;
+    ChunkClient client(address);
+    auto data = random_bytes(CHUNK_BYTES, 4);
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (int i = 0; i < CHUNKS; ++i) {
+        ASSERT_TRUE(put(client, "bench_" + std::to_string(i), data));
+    }
+    double put_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    start_time = std::chrono::steady_clock::now();
+    size_t received = 0;
+    for (int i = 0; i < CHUNKS; ++i) {
+        long long n = client.get("bench_" + std::to_string(i), 0, 0, [](const char*, size_t) { return true; });
+        ASSERT_EQ(n, static_cast<long long>(CHUNK_BYTES));
+        received += static_cast<size_t>(n);
+    }
+    double get_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    double total_mb = static_cast<double>(CHUNK_BYTES) * CHUNKS / (1024 * 1024);
+    std::cout << "\n=== Chunk Protocol Loopback Throughput ===" << std::endl;
+    std::cout << "Chunks: " << CHUNKS << " x " << CHUNK_BYTES / (1024 * 1024) << " MB" << std::endl;
+    std::cout << "PUT: " << std::fixed << std::setprecision(1) << total_mb / put_s << " MB/s" << std::endl;
+    std::cout << "GET: " << total_mb / get_s << " MB/s" << std::endl;
+    EXPECT_EQ(received, CHUNK_BYTES * CHUNKS);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,146 @@
+#include "../src/Cluster_Server/chunk_registry.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// What ChunkStorage used before the registry was sharded: one map, one lock.
+class SingleLockRegistry {
+public:
+    void load(const std::string& chunk_id, RegisteredChunk chunk) { chunks.emplace(chunk_id, std::move(chunk)); }
+
+    bool find(const std::string& chunk_id, RegisteredChunk& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = chunks.find(chunk_id);
+        if (it == chunks.end()) {
+            return false;
+        }
+        out = it->second;
+        return true;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, RegisteredChunk> chunks;
+};
+
+std::string chunk_name(int i) { return "file_" + std::to_string(i) + "_chunk_" + std::to_string(i % 16); }
+
+// Lookups per second with `threads` readers over `keys` loaded chunks.
+template <typename Registry>
+double lookup_rate(const Registry& registry, int keys, int threads, int lookups_per_thread) {
+    std::vector<std::string> names;
+    names.reserve(keys);
+    for (int i = 0; i < keys; ++i) {
+        names.push_back(chunk_name(i));
+    }
+    std::atomic<long> hits{0};
+    std::vector<std::thread> workers;
+    auto start_time = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            RegisteredChunk chunk;
+            long local = 0;
+            for (int i = 0; i < lookups_per_thread; ++i) {
+                local += registry.find(names[(static_cast<size_t>(i) * 7919 + t) % keys], chunk);
+            }
+            hits += local;
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    EXPECT_EQ(hits.load(), static_cast<long>(threads) * lookups_per_thread);
+    return threads * lookups_per_thread / seconds;
+}
+
+} // namespace
+
+TEST(ChunkRegistryTest, UpsertEraseAndHooks) {
+    ChunkRegistry registry;
+    std::vector<int64_t> deltas;
+    auto track = [&](uint64_t size) {
+        return [&, size](const RegisteredChunk* previous) {
+            deltas.push_back(static_cast<int64_t>(size) - static_cast<int64_t>(previous ? previous->size : 0));
+        };
+    };
+
+    registry.upsert("a", RegisteredChunk{"/a", 100}, track(100));
+    registry.upsert("b", RegisteredChunk{"/b", 200}, track(200));
+    registry.upsert("a", RegisteredChunk{"/a2", 150}, track(150));
+    EXPECT_EQ(deltas, (std::vector<int64_t>{100, 200, 50}));
+    EXPECT_EQ(registry.size(), 2u);
+
+    RegisteredChunk chunk;
+    ASSERT_TRUE(registry.find("a", chunk));
+    EXPECT_EQ(chunk.path, "/a2");
+    EXPECT_EQ(chunk.size, 150u);
+
+    uint64_t removed_size = 0;
+    EXPECT_TRUE(registry.erase("b", [&](const RegisteredChunk& c) { removed_size = c.size; }));
+    EXPECT_EQ(removed_size, 200u);
+    EXPECT_FALSE(registry.erase("b", [&](const RegisteredChunk&) { FAIL() << "hook ran for a missing chunk"; }));
+    EXPECT_FALSE(registry.contains("b"));
+    EXPECT_EQ(registry.ids(), (std::vector<std::string>{"a"}));
+}
+
+TEST(ChunkRegistryTest, ListingWhileWritersRun) {
+    const int KEYS = 20000;
+    ChunkRegistry registry;
+    for (int i = 0; i < KEYS; ++i) {
+        registry.load("stable_" + std::to_string(i), RegisteredChunk{"", 1});
+    }
+
+    std::atomic<bool> stop{false};
+    std::thread writer([&] {
+        for (int i = 0; !stop; ++i) {
+            std::string id = "churn_" + std::to_string(i % 1000);
+            registry.upsert(id, RegisteredChunk{"", 2}, [](const RegisteredChunk*) {});
+            registry.erase(id, [](const RegisteredChunk&) {});
+        }
+    });
+    // Every listing holds all stable chunks, whatever the writer is doing
+    for (int round = 0; round < 20; ++round) {
+        auto ids = registry.ids();
+        long stable = std::count_if(ids.begin(), ids.end(), [](const std::string& id) { return id[0] == 's'; });
+        EXPECT_EQ(stable, KEYS);
+    }
+    stop = true;
+    writer.join();
+}
+
+TEST(ChunkRegistryTest, LookupScaling) {
+    const int KEYS = 100000;
+    const int LOOKUPS_PER_THREAD = 500000;
+
+    ChunkRegistry sharded;
+    SingleLockRegistry single;
+    for (int i = 0; i < KEYS; ++i) {
+        std::string id = chunk_name(i);
+        sharded.load(id, RegisteredChunk{"/tmp/cluster_storage/chunk_" + id + ".dat", 64u << 20});
+        single.load(id, RegisteredChunk{"/tmp/cluster_storage/chunk_" + id + ".dat", 64u << 20});
+    }
+
+    std::cout << "\n=== Chunk Registry Lookups (" << std::thread::hardware_concurrency() << " cores) ===" << std::endl;
+    for (int threads : {1, 2, 4, 8}) {
+        double single_rate = lookup_rate(single, KEYS, threads, LOOKUPS_PER_THREAD);
+        double sharded_rate = lookup_rate(sharded, KEYS, threads, LOOKUPS_PER_THREAD);
+        std::cout << "Threads: " << threads << std::fixed << std::setprecision(2)
+                  << "  single lock " << single_rate / 1e6 << " Mops/s"
+                  << "  sharded " << sharded_rate / 1e6 << " Mops/s" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
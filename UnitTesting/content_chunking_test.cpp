@@ -0,0 +1,272 @@
+#include "../src/Head_Server/upload_pipeline.hpp"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <set>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class ContentChunkingTest : public ::testing::Test {
+protected:
+    // Small enough that a few MB hold dozens of chunks
+    static fastcdc::Params small_params() { return {16 * 1024, 64 * 1024, 256 * 1024}; }
+
+    static std::vector<uint8_t> random_bytes(size_t n, uint64_t seed) {
+        std::mt19937_64 gen(seed);
+        std::vector<uint8_t> out(n);
+        for (size_t i = 0; i < n; i += 8) {
+            uint64_t v = gen();
+            std::memcpy(out.data() + i, &v, std::min<size_t>(8, n - i));
+        }
+        return out;
+    }
+
+    static std::vector<size_t> cut(const fastcdc::Chunker& chunker, const std::vector<uint8_t>& data) {
+        std::vector<size_t> sizes;
+        for (size_t pos = 0; pos < data.size();) {
+            size_t n = chunker.next(data.data() + pos, data.size() - pos);
+            sizes.push_back(n);
+            pos += n;
+        }
+        return sizes;
+    }
+
+    static std::set<std::string> chunk_digests(const std::vector<uint8_t>& data, const std::vector<size_t>& sizes) {
+        std::set<std::string> digests;
+        size_t pos = 0;
+        for (size_t n : sizes) {
+            digests.insert(sha256::to_hex(sha256::hash(data.data() + pos, n)));
+            pos += n;
+        }
+        return digests;
+    }
+
+    static std::vector<fastcdc::Kernel> cdc_kernels() {
+        std::vector<fastcdc::Kernel> kernels;
+        for (auto k : {fastcdc::Kernel::Portable, fastcdc::Kernel::Avx2}) {
+            if (fastcdc::kernel_supported(k)) {
+                kernels.push_back(k);
+            }
+        }
+        return kernels;
+    }
+
+    static std::vector<sha256::Kernel> sha_kernels() {
+        std::vector<sha256::Kernel> kernels;
+        for (auto k : {sha256::Kernel::Portable, sha256::Kernel::ShaNi}) {
+            if (sha256::kernel_supported(k)) {
+                kernels.push_back(k);
+            }
+        }
+        return kernels;
+    }
+};
+
+TEST_F(ContentChunkingTest, Sha256KnownAnswers) {
+    const std::string million(1000000, 'a');
+    const std::vector<std::pair<std::string, std::string>> vectors = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {million, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    for (auto kernel : sha_kernels()) {
+        for (const auto& [message, expected] : vectors) {
+            sha256::Hasher one_shot(kernel);
+            one_shot.update(message.data(), message.size());
+            EXPECT_EQ(sha256::to_hex(one_shot.finish()), expected) << sha256::kernel_name(kernel);
+
+            // The same bytes in ragged pieces
+            sha256::Hasher pieces(kernel);
+            for (size_t pos = 0, step = 1; pos < message.size(); pos += step, step = step * 3 % 97 + 1) {
+                pieces.update(message.data() + pos, std::min(step, message.size() - pos));
+            }
+            EXPECT_EQ(sha256::to_hex(pieces.finish()), expected) << sha256::kernel_name(kernel);
+        }
+    }
+}
+
+TEST_F(ContentChunkingTest, KernelsCutIdentically) {
+    auto data = random_bytes(24 * 1024 * 1024 + 333, 7);
+    for (auto params : {small_params(), fastcdc::Params{}}) {
+        auto expected = cut(fastcdc::Chunker(params, fastcdc::Kernel::Portable), data);
+        for (size_t i = 0; i + 1 < expected.size(); ++i) {
+            EXPECT_GT(expected[i], params.min_size);
+            EXPECT_LE(expected[i], params.max_size);
+        }
+        for (auto kernel : cdc_kernels()) {
+            EXPECT_EQ(cut(fastcdc::Chunker(params, kernel), data), expected) << fastcdc::kernel_name(kernel);
+        }
+    }
+}
+
+TEST_F(ContentChunkingTest, InsertionOnlyMovesNearbyCuts) {
+    fastcdc::Chunker chunker(small_params());
+    auto original = random_bytes(8 * 1024 * 1024, 11);
+    auto edited = original;
+    auto inserted = random_bytes(1000, 12);
+    edited.insert(edited.begin() + 3 * 1024 * 1024, inserted.begin(), inserted.end());
+
+    auto before = chunk_digests(original, cut(chunker, original));
+    auto after_sizes = cut(chunker, edited);
+    auto after = chunk_digests(edited, after_sizes);
+    size_t shared = 0;
+    for (const auto& d : after) {
+        shared += before.count(d);
+    }
+    // One or two chunks around the insertion change; every other one matches
+    EXPECT_GE(shared + 2, after.size());
+    EXPECT_LT(shared, after.size());
+}
+
+TEST_F(ContentChunkingTest, NearDuplicateUploadSendsOnlyNewBytes) {
+    const int REPLICAS = 2;
+    auto work_dir = fs::temp_directory_path() / ("content_chunking_test_" + std::to_string(::getpid()));
+    fs::create_directories(work_dir);
+
+    // The second half repeats part of the first, so even the first upload
+    // finds chunks it already sent
+    auto first = random_bytes(6 * 1024 * 1024, 21);
+    first.insert(first.end(), first.begin() + 1024 * 1024, first.begin() + 3 * 1024 * 1024);
+    auto second = first;
+    auto patch = random_bytes(5000, 22);
+    second.insert(second.begin() + 4 * 1024 * 1024, patch.begin(), patch.end());
+    std::memset(second.data() + second.size() - 100, 0, 100);
+
+    // Stand-ins for the cluster servers and the content index
+    class MemoryReplica : public ChunkWriter {
+    public:
+        MemoryReplica(std::map<std::string, std::vector<char>>& store, std::mutex& mutex, std::string id,
+                      std::atomic<uint64_t>& sent)
+            : store(store), mutex(mutex), id(std::move(id)), sent(sent) {}
+        bool write(const char* data, size_t len) override {
+            bytes.insert(bytes.end(), data, data + len);
+            sent += len;
+            return true;
+        }
+        std::optional<std::string> commit(const checksum::ChunkDigest&) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            store[id] = std::move(bytes);
+            return id;
+        }
+
+    private:
+        std::map<std::string, std::vector<char>>& store;
+        std::mutex& mutex;
+        std::string id;
+        std::atomic<uint64_t>& sent;
+        std::vector<char> bytes;
+    };
+    std::map<std::string, std::vector<char>> servers;
+    std::mutex servers_mutex;
+    std::map<std::string, std::vector<ChunkInfo>> index;
+    std::atomic<uint64_t> sent{0};
+
+    auto upload = [&](const std::vector<uint8_t>& data, UploadStats& stats) {
+        auto path = work_dir / "source.bin";
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+
+        UploadPipelineOptions options;
+        options.chunking = Chunking::ContentDefined;
+        options.cdc = small_params();
+        options.workers = 3;
+        std::mutex names_mutex;
+        std::map<int, std::string> names;
+        UploadPipeline pipeline(
+            options, [](int) { return std::vector<std::string>{"server0", "server1"}; },
+            [&](const std::string& server, int chunk_id, size_t) -> std::unique_ptr<ChunkWriter> {
+                std::lock_guard<std::mutex> lock(names_mutex);
+                return std::make_unique<MemoryReplica>(servers, servers_mutex, server + "/" + names.at(chunk_id),
+                                                       sent);
+            },
+            nullptr,
+            [&](int chunk_id, const std::string& content_id) {
+                std::lock_guard<std::mutex> lock(names_mutex);
+                names[chunk_id] = content_id;
+                auto it = index.find(content_id);
+                return it == index.end() ? std::vector<ChunkInfo>{} : it->second;
+            });
+        auto chunks = pipeline.run(path.string());
+        stats = pipeline.stats();
+
+        // Reassemble the file from what the servers hold, and index it
+        std::vector<uint8_t> rebuilt;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            EXPECT_EQ(chunks[i].chunk_id, static_cast<int>(i / REPLICAS));
+            if (i % REPLICAS != 0) {
+                continue;
+            }
+            auto& bytes = servers.at(chunks[i].file_path);
+            rebuilt.insert(rebuilt.end(), bytes.begin(), bytes.end());
+            auto name = chunks[i].file_path.substr(chunks[i].file_path.find('/') + 1);
+            auto content = parse_content_chunk_id(name);
+            EXPECT_TRUE(content.has_value());
+            EXPECT_EQ(content->size, bytes.size());
+            index[name].assign(chunks.begin() + i, chunks.begin() + i + REPLICAS);
+        }
+        EXPECT_EQ(rebuilt, data);
+    };
+
+    UploadStats stats;
+    upload(first, stats);
+    EXPECT_EQ(stats.bytes, first.size());
+    EXPECT_GT(stats.reused_chunks, 0u);
+    EXPECT_EQ(sent.load(), (stats.bytes - stats.reused_bytes) * REPLICAS);
+
+    sent = 0;
+    upload(second, stats);
+    EXPECT_EQ(stats.bytes, second.size());
+    EXPECT_EQ(sent.load(), (stats.bytes - stats.reused_bytes) * REPLICAS);
+    // Only the chunks around the two edits travel again
+    EXPECT_LT(stats.bytes - stats.reused_bytes, 4 * small_params().max_size);
+    std::cout << "Second upload sent " << stats.bytes - stats.reused_bytes << " of " << stats.bytes << " bytes ("
+              << stats.chunks - stats.reused_chunks << " of " << stats.chunks << " chunks)" << std::endl;
+    fs::remove_all(work_dir);
+}
+
+// Cut-point search and chunk hashing per kernel with the default 1 MB
+// average chunk; together they bound how fast a deduplicated upload reads.
+TEST_F(ContentChunkingTest, ChunkingAndHashingThroughput) {
+    const size_t BYTES = 256 * 1024 * 1024;
+    auto data = random_bytes(BYTES, 99);
+
+    std::cout << "\n=== Content-Defined Chunking (" << BYTES / (1024 * 1024) << " MB) ===" << std::endl;
+    std::vector<size_t> expected;
+    for (auto kernel : cdc_kernels()) {
+        fastcdc::Chunker chunker(fastcdc::Params{}, kernel);
+        auto start = std::chrono::steady_clock::now();
+        auto sizes = cut(chunker, data);
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (expected.empty()) {
+            expected = sizes;
+        }
+        EXPECT_EQ(sizes, expected);
+        std::cout << std::setw(18) << std::left << fastcdc::kernel_name(kernel) << std::right << std::fixed
+                  << std::setprecision(2) << "  " << BYTES / secs / 1e9 << " GB/s  (" << sizes.size()
+                  << " chunks, avg " << BYTES / sizes.size() / 1024 << " KB)" << std::endl;
+    }
+
+    std::cout << "\n=== SHA-256 (" << BYTES / (1024 * 1024) << " MB) ===" << std::endl;
+    for (auto kernel : sha_kernels()) {
+        auto start = std::chrono::steady_clock::now();
+        sha256::Hasher hasher(kernel);
+        hasher.update(data.data(), data.size());
+        auto digest = hasher.finish();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        EXPECT_EQ(digest, sha256::hash(data.data(), data.size()));
+        std::cout << std::setw(18) << std::left << sha256::kernel_name(kernel) << std::right << std::fixed
+                  << std::setprecision(2) << "  " << BYTES / secs / 1e9 << " GB/s" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
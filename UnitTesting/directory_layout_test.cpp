@@ -0,0 +1,170 @@
+#include "../src/Cluster_Server/chunk_storage.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <random>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class DirectoryLayoutTest : public ::testing::Test {
+protected:
+    fs::path work_dir;
+
+    void SetUp() override {
+        work_dir = fs::temp_directory_path() / ("directory_layout_test_" + std::to_string(::getpid()));
+        fs::remove_all(work_dir);
+    }
+
+    void TearDown() override { fs::remove_all(work_dir); }
+
+    std::string dir() const { return work_dir.string() + "/"; }
+
+    static std::vector<char> bytes(size_t n, char fill) { return std::vector<char>(n, fill); }
+
+    static std::string id(int i) { return "file_" + std::to_string(i) + "_chunk_" + std::to_string(i % 8); }
+};
+
+TEST_F(DirectoryLayoutTest, PathsFanOutEvenly) {
+    DirectoryLayout two{2};
+    EXPECT_EQ(DirectoryLayout{0}.relative_path("abc"), "chunk_abc.dat");
+    std::string rel = two.relative_path("abc");
+    ASSERT_EQ(rel.size(), 6 + std::string("chunk_abc.dat").size());
+    EXPECT_TRUE(DirectoryLayout::is_fanout_dir(rel.substr(0, 2).c_str()));
+    EXPECT_EQ(rel[2], '/');
+    EXPECT_EQ(rel.substr(6), "chunk_abc.dat");
+    EXPECT_EQ(two.relative_path("abc"), rel); // stable
+
+    std::set<std::string> top;
+    for (int i = 0; i < 20000; ++i) {
+        top.insert(two.subdir(id(i)).substr(0, 2));
+    }
+    EXPECT_EQ(top.size(), 256u);
+    EXPECT_FALSE(DirectoryLayout::is_fanout_dir("AB"));
+    EXPECT_FALSE(DirectoryLayout::is_fanout_dir("abc"));
+}
+
+TEST_F(DirectoryLayoutTest, FlatDirectoryIsMigrated) {
+    const int CHUNKS = 200;
+    {
+        ChunkStorage storage(dir(), DirectoryLayout{0});
+        for (int i = 0; i < CHUNKS; ++i) {
+            ASSERT_TRUE(storage.store_chunk(id(i), bytes(100 + i, static_cast<char>(i))));
+        }
+    }
+    ASSERT_TRUE(fs::exists(work_dir / ("chunk_" + id(7) + ".dat")));
+
+    {
+        ChunkStorage storage(dir(), DirectoryLayout{2});
+        EXPECT_EQ(storage.list_chunks().size(), static_cast<size_t>(CHUNKS));
+        for (int i = 0; i < CHUNKS; ++i) {
+            // Read back through the block checksums, which moved with the data
+            EXPECT_EQ(storage.retrieve_chunk(id(i)), bytes(100 + i, static_cast<char>(i)));
+        }
+        ASSERT_TRUE(storage.store_chunk("new", bytes(10, 'n')));
+    }
+    EXPECT_FALSE(fs::exists(work_dir / ("chunk_" + id(7) + ".dat")));
+    EXPECT_TRUE(fs::exists(work_dir / DirectoryLayout{2}.relative_path(id(7))));
+    EXPECT_TRUE(fs::exists(work_dir / (DirectoryLayout{2}.relative_path(id(7)) + ".crc")));
+    EXPECT_EQ(DirectoryLayout::recorded(dir())->levels, 2);
+
+    // And back, which also clears out the emptied fan-out directories
+    ChunkStorage storage(dir(), DirectoryLayout{0});
+    EXPECT_EQ(storage.retrieve_chunk("new"), bytes(10, 'n'));
+    EXPECT_EQ(storage.retrieve_chunk(id(7)), bytes(107, static_cast<char>(7)));
+    for (const auto& entry : fs::directory_iterator(work_dir)) {
+        EXPECT_FALSE(entry.is_directory() && entry.path().filename() != "incoming") << entry.path();
+    }
+}
+
+TEST_F(DirectoryLayoutTest, InterruptedMigrationFinishes) {
+    {
+        ChunkStorage storage(dir(), DirectoryLayout{0});
+        ASSERT_TRUE(storage.store_chunk("a", bytes(10, 'a')));
+        ASSERT_TRUE(storage.store_chunk("b", bytes(20, 'b')));
+    }
+    // Only "a" was moved before the crash; the flat layout is still recorded
+    std::string moved = dir() + DirectoryLayout{2}.relative_path("a");
+    fs::create_directories(fs::path(moved).parent_path());
+    fs::rename(work_dir / "chunk_a.dat", moved);
+
+    ChunkStorage storage(dir(), DirectoryLayout{2});
+    EXPECT_EQ(storage.retrieve_chunk("a"), bytes(10, 'a'));
+    EXPECT_EQ(storage.retrieve_chunk("b"), bytes(20, 'b'));
+    EXPECT_TRUE(fs::exists(dir() + DirectoryLayout{2}.relative_path("b")));
+}
+
+TEST_F(DirectoryLayoutTest, ColdScanFindsFannedOutChunks) {
+    {
+        ChunkStorage storage(dir());
+        ASSERT_TRUE(storage.store_chunk("x", bytes(10, 'x')));
+        ASSERT_TRUE(storage.store_chunk("y", bytes(20, 'y')));
+    }
+    fs::remove(work_dir / "chunk_index.snap");
+    fs::remove(work_dir / "chunk_index.log");
+
+    ChunkStorage storage(dir());
+    auto ids = storage.list_chunks();
+    std::sort(ids.begin(), ids.end());
+    EXPECT_EQ(ids, (std::vector<std::string>{"x", "y"}));
+    EXPECT_EQ(storage.usage().used_bytes, 30u);
+}
+
+// Creates, stats and opens every chunk file of a layout as the number of
+// chunks grows; the per-operation cost is what the layout decides.
+TEST_F(DirectoryLayoutTest, CreateOpenStatByLayout) {
+    std::cout << "\n=== Chunk File Operations (us/op) ===" << std::endl;
+    for (int count : {10000, 50000}) {
+        std::vector<std::string> ids;
+        for (int i = 0; i < count; ++i) {
+            ids.push_back(id(i));
+        }
+        std::vector<std::string> shuffled = ids;
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+
+        for (int levels : {0, 2}) {
+            fs::remove_all(work_dir);
+            fs::create_directories(work_dir);
+            DirectoryLayout layout{levels};
+            auto per_op = [&](auto&& op, const std::vector<std::string>& order) {
+                auto start = std::chrono::steady_clock::now();
+                for (const auto& chunk_id : order) {
+                    op(layout.path(dir(), chunk_id));
+                }
+                return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() /
+                       order.size();
+            };
+
+            double create_us = per_op([](const std::string& path) {
+                int fd = DirectoryLayout::create_file(path, O_WRONLY | O_CLOEXEC);
+                ASSERT_GE(fd, 0);
+                ::close(fd);
+            }, ids);
+            double stat_us = per_op([](const std::string& path) {
+                struct stat st{};
+                ASSERT_EQ(::stat(path.c_str(), &st), 0);
+            }, shuffled);
+            double open_us = per_op([](const std::string& path) {
+                int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                ASSERT_GE(fd, 0);
+                ::close(fd);
+            }, shuffled);
+
+            std::cout << std::setw(7) << count << " chunks, " << (levels == 0 ? "flat   " : "2-level") << std::fixed
+                      << std::setprecision(2) << "  create " << create_us << "  stat " << stat_us << "  open "
+                      << open_us << std::endl;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
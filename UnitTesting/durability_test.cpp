@@ -0,0 +1,169 @@
+#include "../src/Cluster_Server/chunk_storage.hpp"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class DurabilityTest : public ::testing::Test {
+protected:
+    fs::path work_dir;
+
+    void SetUp() override {
+        work_dir = fs::temp_directory_path() / ("durability_test_" + std::to_string(::getpid()));
+        fs::remove_all(work_dir);
+    }
+
+    void TearDown() override { fs::remove_all(work_dir); }
+
+    std::string dir() const { return work_dir.string() + "/"; }
+
+    static std::vector<char> bytes(size_t n, char fill) { return std::vector<char>(n, fill); }
+
+    size_t files_named(const std::string& prefix) const {
+        size_t n = 0;
+        for (const auto& entry : fs::recursive_directory_iterator(work_dir)) {
+            n += entry.path().filename().string().rfind(prefix, 0) == 0;
+        }
+        return n;
+    }
+};
+
+TEST_F(DurabilityTest, EveryLevelStoresAndReloads) {
+    for (auto level : {Durability::None, Durability::PerChunk, Durability::Group}) {
+        fs::remove_all(work_dir);
+        {
+            ChunkStorage storage(dir(), DirectoryLayout{}, level);
+            ASSERT_TRUE(storage.store_chunk("a", bytes(100000, 'a')));
+            ASSERT_TRUE(storage.store_chunk("b", bytes(10, 'b')));
+            ASSERT_TRUE(storage.store_chunk("a", bytes(50, 'A')));
+        }
+        ChunkStorage storage(dir(), DirectoryLayout{}, level);
+        EXPECT_EQ(storage.retrieve_chunk("a"), bytes(50, 'A'));
+        EXPECT_EQ(storage.retrieve_chunk("b"), bytes(10, 'b'));
+        EXPECT_EQ(storage.usage().used_bytes, 60u);
+        EXPECT_TRUE(fs::is_empty(work_dir / "incoming"));
+    }
+}
+
+TEST_F(DurabilityTest, FailedStoreKeepsThePreviousVersion) {
+    ChunkStorage storage(dir());
+    ASSERT_TRUE(storage.store_chunk("c", bytes(3 * IO_SLICE_SIZE, 'c')));
+
+    // The source fails after a slice has already been written
+    int calls = 0;
+    long long n = storage.store_chunk_stream("c", [&](char* buf, size_t len) -> ssize_t {
+        if (calls++ > 0) {
+            return -1;
+        }
+        std::memset(buf, 'x', len);
+        return static_cast<ssize_t>(len);
+    });
+    EXPECT_EQ(n, -1);
+    EXPECT_EQ(storage.retrieve_chunk("c"), bytes(3 * IO_SLICE_SIZE, 'c'));
+    EXPECT_EQ(storage.usage().used_bytes, 3 * IO_SLICE_SIZE);
+    EXPECT_TRUE(fs::is_empty(work_dir / "incoming"));
+
+    // A new chunk that fails never shows up at all
+    EXPECT_EQ(storage.store_chunk_stream("d", [](char*, size_t) -> ssize_t { return -1; }), -1);
+    EXPECT_EQ(storage.list_chunks(), std::vector<std::string>{"c"});
+    EXPECT_EQ(files_named("chunk_d"), 0u);
+}
+
+TEST_F(DurabilityTest, LeftoverTempFilesAreDropped) {
+    {
+        ChunkStorage storage(dir());
+        ASSERT_TRUE(storage.store_chunk("kept", bytes(10, 'k')));
+    }
+    // As if the server died mid-upload
+    {
+        std::ofstream(work_dir / "incoming" / "7_torn") << "partial";
+    }
+    fs::remove(work_dir / "chunk_index.snap");
+    fs::remove(work_dir / "chunk_index.log");
+
+    ChunkStorage storage(dir());
+    EXPECT_EQ(storage.list_chunks(), std::vector<std::string>{"kept"});
+    EXPECT_TRUE(fs::is_empty(work_dir / "incoming"));
+}
+
+TEST_F(DurabilityTest, ConcurrentBarriersShareSyncs) {
+    fs::create_directories(work_dir);
+    GroupSync sync(dir());
+    const int THREADS = 16, ROUNDS = 20;
+    std::atomic<int> failures{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < ROUNDS; ++i) {
+                failures += !sync.barrier();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_GT(sync.syncs(), 0u);
+    EXPECT_LT(sync.syncs(), static_cast<uint64_t>(THREADS * ROUNDS));
+
+    // Alone, every barrier syncs once more
+    uint64_t before = sync.syncs();
+    EXPECT_TRUE(sync.barrier());
+    EXPECT_EQ(sync.syncs(), before + 1);
+}
+
+// Stores from concurrent writers at each durability level: what crash
+// safety costs, and how many chunks share each group sync.
+TEST_F(DurabilityTest, StoreRateByDurability) {
+    const int THREADS = 8;
+    const int CHUNKS_PER_THREAD = 32;
+    const auto data = bytes(256 * 1024, 'd');
+
+    std::cout << "\n=== Chunk Stores by Durability (" << THREADS << " writers, 256 KB chunks) ===" << std::endl;
+    for (auto level : {Durability::None, Durability::PerChunk, Durability::Group}) {
+        fs::remove_all(work_dir);
+        ChunkStorage storage(dir(), DirectoryLayout{}, level);
+        uint64_t syncs_before = storage.disk(0).sync.syncs();
+
+        std::atomic<int> failures{0};
+        std::vector<std::thread> writers;
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < THREADS; ++t) {
+            writers.emplace_back([&, t] {
+                for (int i = 0; i < CHUNKS_PER_THREAD; ++i) {
+                    failures += !storage.store_chunk("t" + std::to_string(t) + "_" + std::to_string(i), data);
+                }
+            });
+        }
+        for (auto& w : writers) {
+            w.join();
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        EXPECT_EQ(failures.load(), 0);
+
+        const char* name = level == Durability::None       ? "none     "
+                           : level == Durability::PerChunk ? "per-chunk"
+                                                           : "group    ";
+        std::cout << name << std::fixed << std::setprecision(0) << "  " << THREADS * CHUNKS_PER_THREAD / secs
+                  << " chunks/s";
+        if (level == Durability::Group) {
+            std::cout << "  (" << storage.disk(0).sync.syncs() - syncs_before << " syncs for "
+                      << THREADS * CHUNKS_PER_THREAD << " chunks)";
+        }
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,302 @@
+#include "../src/include/erasure_code.hpp"
+#include "../src/Head_Server/upload_pipeline.hpp"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class ErasureCodeTest : public ::testing::Test {
+protected:
+    using Fragments = std::vector<std::vector<uint8_t>>;
+
+    static std::vector<erasure::Kernel> supported_kernels() {
+        std::vector<erasure::Kernel> kernels;
+        for (auto k : {erasure::Kernel::Portable, erasure::Kernel::Ssse3, erasure::Kernel::Avx2}) {
+            if (erasure::kernel_supported(k)) {
+                kernels.push_back(k);
+            }
+        }
+        return kernels;
+    }
+
+    static std::vector<uint8_t> random_bytes(size_t n, uint64_t seed) {
+        std::mt19937_64 gen(seed);
+        std::vector<uint8_t> data(n);
+        for (auto& c : data) {
+            c = static_cast<uint8_t>(gen());
+        }
+        return data;
+    }
+
+    // k random data fragments followed by their m parity fragments.
+    static Fragments encoded_stripe(const erasure::Codec& codec, size_t len, uint64_t seed) {
+        Fragments fragments;
+        for (int i = 0; i < codec.total(); ++i) {
+            fragments.push_back(i < codec.data() ? random_bytes(len, seed + i) : std::vector<uint8_t>(len));
+        }
+        auto ptrs = pointers(fragments);
+        codec.encode(ptrs.data(), ptrs.data() + codec.data(), len);
+        return fragments;
+    }
+
+    static std::vector<uint8_t*> pointers(Fragments& fragments) {
+        std::vector<uint8_t*> ptrs;
+        for (auto& f : fragments) {
+            ptrs.push_back(f.data());
+        }
+        return ptrs;
+    }
+
+    // Drops the fragments in `lost`, decodes them back and compares.
+    static bool rebuilds(const erasure::Codec& codec, const Fragments& stripe, const std::vector<int>& lost) {
+        size_t len = stripe[0].size();
+        std::vector<const uint8_t*> survivors;
+        for (const auto& f : stripe) {
+            survivors.push_back(f.data());
+        }
+        Fragments out(codec.total());
+        std::vector<uint8_t*> rebuilt(codec.total(), nullptr);
+        for (int i : lost) {
+            survivors[i] = nullptr;
+            out[i].assign(len, 0xAA);
+            rebuilt[i] = out[i].data();
+        }
+        if (!codec.decode(survivors.data(), rebuilt.data(), len)) {
+            return false;
+        }
+        for (int i : lost) {
+            if (out[i] != stripe[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+TEST_F(ErasureCodeTest, FieldArithmetic) {
+    using namespace erasure::detail;
+    for (int a = 1; a < 256; ++a) {
+        ASSERT_EQ(gf_mul(static_cast<uint8_t>(a), gf_inv(static_cast<uint8_t>(a))), 1) << a;
+        ASSERT_EQ(gf_mul(static_cast<uint8_t>(a), 1), a);
+        ASSERT_EQ(gf_mul(static_cast<uint8_t>(a), 0), 0);
+    }
+    EXPECT_EQ(gf_mul(2, 0x80), 0x1d); // x * x^7 wraps through the polynomial
+    EXPECT_EQ(gf_mul(0x53, 0xca), gf_mul(0xca, 0x53));
+}
+
+TEST_F(ErasureCodeTest, KernelsAgreeAcrossLengthsAndAlignments) {
+    auto src = random_bytes(100000, 3);
+    auto base = random_bytes(100000, 4);
+    std::mt19937 gen(5);
+    for (int i = 0; i < 200; ++i) {
+        size_t offset = gen() % 64;
+        size_t len = gen() % (src.size() - offset);
+        auto c = static_cast<uint8_t>(gen());
+        bool add = gen() & 1;
+        auto expected = base;
+        erasure::kernel_fn(erasure::Kernel::Portable)(c, src.data() + offset, expected.data() + offset, len, add);
+        for (auto k : supported_kernels()) {
+            auto out = base;
+            erasure::kernel_fn(k)(c, src.data() + offset, out.data() + offset, len, add);
+            ASSERT_EQ(out, expected) << erasure::kernel_name(k) << " c " << int(c) << " len " << len;
+        }
+    }
+}
+
+TEST_F(ErasureCodeTest, AnyDataCountOfFragmentsDecodes) {
+    for (auto [k, m] : {std::pair{4, 2}, std::pair{6, 3}, std::pair{10, 4}, std::pair{1, 2}}) {
+        erasure::Codec codec(k, m);
+        auto stripe = encoded_stripe(codec, 4096 + 37, k * 100 + m);
+        // Every loss pattern of up to m fragments
+        for (uint32_t mask = 1; mask < (1u << codec.total()); ++mask) {
+            std::vector<int> lost;
+            for (int i = 0; i < codec.total(); ++i) {
+                if (mask & (1u << i)) {
+                    lost.push_back(i);
+                }
+            }
+            if (static_cast<int>(lost.size()) > m) {
+                continue;
+            }
+            ASSERT_TRUE(rebuilds(codec, stripe, lost)) << k << "+" << m << " mask " << mask;
+        }
+    }
+
+    // One too many lost
+    erasure::Codec codec(4, 2);
+    auto stripe = encoded_stripe(codec, 100, 1);
+    EXPECT_FALSE(rebuilds(codec, stripe, {0, 2, 5}));
+}
+
+TEST_F(ErasureCodeTest, ParityIsTheSameOnEveryKernel) {
+    auto expected = encoded_stripe(erasure::Codec(4, 2, erasure::Kernel::Portable), 65536 + 13, 9);
+    for (auto k : supported_kernels()) {
+        EXPECT_EQ(encoded_stripe(erasure::Codec(4, 2, k), 65536 + 13, 9), expected) << erasure::kernel_name(k);
+    }
+}
+
+TEST_F(ErasureCodeTest, FragmentIdsRoundTrip) {
+    FragmentRef f{4, 2, 5, 64 * 1024 * 1024 + 3};
+    auto id = fragment_id("dir_file@rs.bin_chunk_7", f);
+    auto parsed = parse_fragment_id(id);
+    ASSERT_TRUE(parsed.has_value());
+    EXPECT_EQ(parsed->data, 4);
+    EXPECT_EQ(parsed->parity, 2);
+    EXPECT_EQ(parsed->index, 5);
+    EXPECT_EQ(parsed->chunk_size, f.chunk_size);
+    EXPECT_EQ(parsed->size(), 16u * 1024 * 1024 + 1);
+
+    EXPECT_FALSE(parse_fragment_id("file.bin_chunk_0").has_value());
+    EXPECT_FALSE(parse_fragment_id("x@rs4+2.6.100").has_value()); // index past the stripe
+    EXPECT_FALSE(parse_fragment_id("x@rs4+2.1.100.bak").has_value());
+}
+
+// Runs the upload pipeline in erasure-coded mode against files standing in
+// for servers, then rebuilds every chunk from parity after losing a server.
+TEST_F(ErasureCodeTest, PipelineStoresDecodableStripes) {
+    const size_t CHUNK = 1024 * 1024;
+    const size_t FILE_SIZE = 3 * CHUNK + 12345; // ragged last chunk
+    const int SERVERS = 3;
+    auto work_dir = fs::temp_directory_path() / ("erasure_code_test_" + std::to_string(::getpid()));
+    fs::create_directories(work_dir);
+    auto source = random_bytes(FILE_SIZE, 21);
+    {
+        std::ofstream(work_dir / "source.bin", std::ios::binary)
+            .write(reinterpret_cast<const char*>(source.data()), source.size());
+    }
+
+    class FileFragment : public ChunkWriter {
+    public:
+        explicit FileFragment(std::string path) : path(std::move(path)), file(this->path, std::ios::binary) {}
+        bool write(const char* data, size_t len) override { return static_cast<bool>(file.write(data, len)); }
+        std::optional<std::string> commit(const checksum::ChunkDigest&) override {
+            file.close();
+            return path;
+        }
+
+    private:
+        std::string path;
+        std::ofstream file;
+    };
+
+    UploadPipelineOptions options;
+    options.chunk_size = CHUNK;
+    options.workers = 2;
+    options.redundancy = Redundancy::erasure_coded(4, 2);
+    UploadPipeline pipeline(
+        options,
+        [](int) {
+            std::vector<std::string> servers;
+            for (int i = 0; i < SERVERS; ++i) {
+                servers.push_back("server" + std::to_string(i));
+            }
+            return servers;
+        },
+        [](const std::string&, int, size_t) { return nullptr; },
+        [&](const std::string& server, int chunk_id, const FragmentRef& fragment) -> std::unique_ptr<ChunkWriter> {
+            auto id = fragment_id(server + "_chunk_" + std::to_string(chunk_id), fragment);
+            return std::make_unique<FileFragment>((work_dir / id).string());
+        });
+    auto stored = pipeline.run((work_dir / "source.bin").string());
+    ASSERT_EQ(stored.size(), 4u * 6);
+
+    std::map<int, std::vector<ChunkInfo>> by_chunk;
+    uint64_t stored_bytes = 0;
+    for (const auto& info : stored) {
+        by_chunk[info.chunk_id].push_back(info);
+        stored_bytes += fs::file_size(info.file_path);
+        EXPECT_EQ(fs::file_size(info.file_path), info.size);
+    }
+    EXPECT_LT(stored_bytes, FILE_SIZE * 16 / 10);
+
+    erasure::Codec codec(4, 2);
+    for (auto& [chunk_id, fragments] : by_chunk) {
+        Fragments stripe(6);
+        std::vector<const uint8_t*> survivors(6, nullptr);
+        std::vector<uint8_t*> rebuilt(6, nullptr);
+        Fragments out(6);
+        uint64_t chunk_size = 0;
+        for (const auto& info : fragments) {
+            auto ref = parse_fragment_id(fs::path(info.file_path).filename().string());
+            ASSERT_TRUE(ref.has_value());
+            chunk_size = ref->chunk_size;
+            stripe[ref->index].resize(info.size);
+            std::ifstream(info.file_path, std::ios::binary)
+                .read(reinterpret_cast<char*>(stripe[ref->index].data()), info.size);
+            // server0 holds fragments 0 and 3 of every stripe; lose it
+            if (info.server_ip == "server0") {
+                out[ref->index].resize(info.size);
+                rebuilt[ref->index] = out[ref->index].data();
+            } else {
+                survivors[ref->index] = stripe[ref->index].data();
+            }
+        }
+        ASSERT_TRUE(codec.decode(survivors.data(), rebuilt.data(), stripe[0].size()));
+        std::vector<uint8_t> chunk;
+        for (int i = 0; i < 4; ++i) {
+            const auto& f = rebuilt[i] ? out[i] : stripe[i];
+            chunk.insert(chunk.end(), f.begin(), f.end());
+        }
+        chunk.resize(chunk_size);
+        ASSERT_TRUE(std::equal(chunk.begin(), chunk.end(), source.begin() + chunk_id * CHUNK)) << chunk_id;
+    }
+    fs::remove_all(work_dir);
+}
+
+// Encode and decode throughput per kernel over 64 MB chunks; decode
+// rebuilds as many data fragments as there is parity, its worst case.
+TEST_F(ErasureCodeTest, EncodeDecodeThroughput) {
+    const size_t CHUNK_BYTES = 64 * 1024 * 1024;
+    const int ROUNDS = 3;
+
+    for (auto [k, m] : {std::pair{4, 2}, std::pair{10, 4}}) {
+        std::cout << "\n=== Reed-Solomon " << k << "+" << m << " (" << CHUNK_BYTES / (1024 * 1024)
+                  << " MB chunks, GB/s of chunk data) ===" << std::endl;
+        size_t len = CHUNK_BYTES / k;
+        for (auto kernel : supported_kernels()) {
+            erasure::Codec codec(k, m, kernel);
+            auto stripe = encoded_stripe(codec, len, 77);
+            auto ptrs = pointers(stripe);
+
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < ROUNDS; ++r) {
+                codec.encode(ptrs.data(), ptrs.data() + k, len);
+            }
+            double encode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::vector<const uint8_t*> survivors(ptrs.begin(), ptrs.end());
+            Fragments out(codec.total());
+            std::vector<uint8_t*> rebuilt(codec.total(), nullptr);
+            for (int i = 0; i < m; ++i) {
+                survivors[i] = nullptr;
+                out[i].resize(len);
+                rebuilt[i] = out[i].data();
+            }
+            start = std::chrono::steady_clock::now();
+            for (int r = 0; r < ROUNDS; ++r) {
+                ASSERT_TRUE(codec.decode(survivors.data(), rebuilt.data(), len));
+            }
+            double decode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            for (int i = 0; i < m; ++i) {
+                ASSERT_EQ(out[i], stripe[i]);
+            }
+
+            double gb = static_cast<double>(CHUNK_BYTES) * ROUNDS / 1e9;
+            std::cout << std::setw(16) << std::left << erasure::kernel_name(kernel) << std::right << std::fixed
+                      << std::setprecision(2) << "  encode " << gb / encode_s << " GB/s  decode " << gb / decode_s
+                      << " GB/s" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,169 @@
+#include "../src/Head_Server/metadata_store.hpp"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class MetadataStoreTest : public ::testing::Test {
+protected:
+    fs::path work_dir;
+
+    void SetUp() override {
+        work_dir = fs::temp_directory_path() / ("metadata_store_test_" + std::to_string(::getpid()));
+        fs::create_directories(work_dir);
+    }
+
+    void TearDown() override {
+        fs::remove_all(work_dir);
+    }
+
+    static FileManifest make_manifest(const std::string& name, int chunks, int replicas = 3) {
+        FileManifest m;
+        m.file_name = name;
+        for (int c = 0; c < chunks; ++c) {
+            for (int r = 0; r < replicas; ++r) {
+                std::string server = "127.0.0.1:808" + std::to_string(r);
+                m.chunks.push_back(ChunkLocation{c, server, name + "_chunk_" + std::to_string(c)});
+            }
+        }
+        return m;
+    }
+};
+
+TEST_F(MetadataStoreTest, PutGetErase) {
+    InMemoryMetadataStore store(InMemoryMetadataStore::Options{});
+    ASSERT_TRUE(store.put(make_manifest("a.txt", 4)));
+
+    auto m = store.get("a.txt");
+    ASSERT_TRUE(m.has_value());
+    EXPECT_EQ(m->chunks.size(), 12u);
+    EXPECT_EQ(m->chunks.front().chunk_id, 0);
+    EXPECT_EQ(m->chunks.back().chunk_id, 3);
+    EXPECT_TRUE(store.exists("a.txt"));
+    EXPECT_FALSE(store.exists("b.txt"));
+
+    EXPECT_EQ(store.erase_chunk("a.txt", 3), 3);
+    EXPECT_EQ(store.get("a.txt")->chunks.size(), 9u);
+    EXPECT_EQ(store.erase("a.txt"), 1);
+    EXPECT_FALSE(store.get("a.txt").has_value());
+}
+
+TEST_F(MetadataStoreTest, ReplaysLogAndIgnoresTornTail) {
+    auto log_path = (work_dir / "metadata.aof").string();
+    {
+        InMemoryMetadataStore::Options opts;
+        opts.log_path = log_path;
+        InMemoryMetadataStore store(opts);
+        ASSERT_TRUE(store.put(make_manifest("keep.bin", 2)));
+        ASSERT_TRUE(store.put(make_manifest("drop.bin", 2)));
+        ASSERT_EQ(store.erase("drop.bin"), 1);
+        ASSERT_EQ(store.erase_chunk("keep.bin", 1), 3);
+    }
+
+    // Simulate a crash in the middle of an append
+    {
+        std::ofstream out(log_path, std::ios::binary | std::ios::app);
+        const char partial[] = {0x40, 0x00, 0x00, 0x00, 'P', 0x01};
+        out.write(partial, sizeof(partial));
+    }
+
+    InMemoryMetadataStore::Options opts;
+    opts.log_path = log_path;
+    InMemoryMetadataStore store(opts);
+    EXPECT_EQ(store.size(), 1u);
+    auto m = store.get("keep.bin");
+    ASSERT_TRUE(m.has_value());
+    EXPECT_EQ(m->chunks.size(), 3u);
+    EXPECT_FALSE(store.exists("drop.bin"));
+
+    // The torn tail was truncated, so new appends replay cleanly
+    ASSERT_TRUE(store.put(make_manifest("after.bin", 1)));
+    InMemoryMetadataStore reopened(opts);
+    EXPECT_EQ(reopened.size(), 2u);
+}
+
+TEST_F(MetadataStoreTest, ContentRefsSurviveReplay) {
+    auto log_path = (work_dir / "metadata.aof").string();
+    const std::string shared = "cas_" + std::string(64, 'a') + ".1024";
+    const std::string single = "cas_" + std::string(64, 'b') + ".2048";
+    const std::vector<ChunkLocation> where = {ChunkLocation{0, "127.0.0.1:8080", shared},
+                                              ChunkLocation{0, "127.0.0.1:8081", shared}};
+    {
+        InMemoryMetadataStore::Options opts;
+        opts.log_path = log_path;
+        InMemoryMetadataStore store(opts);
+        ASSERT_TRUE(store.add_content_ref(shared, where));
+        ASSERT_TRUE(store.add_content_ref(shared, {ChunkLocation{0, "127.0.0.1:8082", shared}}));
+        ASSERT_TRUE(store.add_content_ref(single, {ChunkLocation{0, "127.0.0.1:8080", single}}));
+        EXPECT_EQ(store.release_content(single), 0);
+        EXPECT_EQ(store.release_content(single), 0); // already gone
+        ASSERT_TRUE(store.add_content_ref(shared, where));
+        EXPECT_EQ(store.release_content(shared), 2);
+    }
+
+    InMemoryMetadataStore::Options opts;
+    opts.log_path = log_path;
+    InMemoryMetadataStore store(opts);
+    auto entry = store.find_content(shared);
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->refs, 2);
+    // The first reference decided where the chunk lives
+    ASSERT_EQ(entry->locations.size(), 2u);
+    EXPECT_EQ(entry->locations[1].server_ip, "127.0.0.1:8081");
+    EXPECT_EQ(entry->locations[1].file_path, shared);
+    EXPECT_FALSE(store.find_content(single).has_value());
+
+    EXPECT_EQ(store.release_content(shared), 1);
+    EXPECT_EQ(store.release_content(shared), 0);
+    EXPECT_FALSE(store.find_content(shared).has_value());
+}
+
+TEST_F(MetadataStoreTest, ConcurrentThroughput) {
+    const int NUM_FILES = 20000;
+    const int LOOKUPS_PER_THREAD = 200000;
+
+    InMemoryMetadataStore store(InMemoryMetadataStore::Options{});
+    auto write_start = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM_FILES; ++i) {
+        store.put(make_manifest("file_" + std::to_string(i), 2));
+    }
+    auto write_end = std::chrono::steady_clock::now();
+    double write_s = std::chrono::duration<double>(write_end - write_start).count();
+
+    std::cout << "\n=== Metadata Store Throughput ===" << std::endl;
+    std::cout << "Writes: " << std::fixed << std::setprecision(0) << NUM_FILES / write_s << " ops/s" << std::endl;
+
+    for (int threads : {1, 2, 4, 8}) {
+        std::atomic<long> hits{0};
+        std::vector<std::thread> workers;
+        auto start_time = std::chrono::steady_clock::now();
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                long local = 0;
+                for (int i = 0; i < LOOKUPS_PER_THREAD; ++i) {
+                    local += store.exists("file_" + std::to_string((i * 7919 + t) % NUM_FILES));
+                }
+                hits += local;
+            });
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        EXPECT_EQ(hits.load(), static_cast<long>(threads) * LOOKUPS_PER_THREAD);
+        std::cout << "Lookup threads: " << threads << "  "
+                  << (threads * LOOKUPS_PER_THREAD) / seconds << " ops/s" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
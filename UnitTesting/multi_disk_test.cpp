@@ -0,0 +1,142 @@
+#include "../src/Cluster_Server/chunk_storage.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class MultiDiskTest : public ::testing::Test {
+protected:
+    fs::path work_dir;
+
+    void SetUp() override {
+        work_dir = fs::temp_directory_path() / ("multi_disk_test_" + std::to_string(::getpid()));
+        fs::remove_all(work_dir);
+    }
+
+    void TearDown() override { fs::remove_all(work_dir); }
+
+    std::vector<std::string> dirs(size_t n) const {
+        std::vector<std::string> out;
+        for (size_t i = 0; i < n; ++i) {
+            out.push_back((work_dir / ("disk" + std::to_string(i))).string());
+        }
+        return out;
+    }
+
+    static std::vector<char> bytes(size_t n, char fill) { return std::vector<char>(n, fill); }
+};
+
+TEST_F(MultiDiskTest, ChunksSpreadAcrossDirectories) {
+    const int CHUNKS = 30;
+    {
+        ChunkStorage storage(dirs(3));
+        ASSERT_EQ(storage.disk_count(), 3u);
+        for (int i = 0; i < CHUNKS; ++i) {
+            ASSERT_TRUE(storage.store_chunk("c" + std::to_string(i), bytes(64 * 1024, static_cast<char>('a' + i % 26))));
+        }
+        auto by_disk = storage.usage_by_disk();
+        uint64_t total = 0;
+        for (const auto& u : by_disk) {
+            EXPECT_GT(u.chunk_count, 0u);
+            total += u.chunk_count;
+        }
+        EXPECT_EQ(total, static_cast<uint64_t>(CHUNKS));
+        EXPECT_EQ(storage.usage().chunk_count, static_cast<uint64_t>(CHUNKS));
+        EXPECT_EQ(storage.usage().used_bytes, CHUNKS * 64u * 1024u);
+    }
+
+    // Each directory keeps its own index, so a restart finds every chunk where it was
+    ChunkStorage storage(dirs(3));
+    EXPECT_EQ(storage.list_chunks().size(), static_cast<size_t>(CHUNKS));
+    for (int i = 0; i < CHUNKS; ++i) {
+        EXPECT_EQ(storage.retrieve_chunk("c" + std::to_string(i)), bytes(64 * 1024, static_cast<char>('a' + i % 26)));
+    }
+    EXPECT_TRUE(storage.delete_chunk("c0"));
+    EXPECT_EQ(storage.usage().chunk_count, static_cast<uint64_t>(CHUNKS - 1));
+}
+
+TEST_F(MultiDiskTest, ReplacedChunkStaysOnItsDisk) {
+    ChunkStorage storage(dirs(2));
+    ASSERT_TRUE(storage.store_chunk("x", bytes(1000, 'x')));
+    auto before = storage.usage_by_disk();
+    size_t home = before[0].chunk_count == 1 ? 0 : 1;
+
+    ASSERT_TRUE(storage.store_chunk("x", bytes(500, 'y')));
+    auto after = storage.usage_by_disk();
+    EXPECT_EQ(after[home].chunk_count, 1u);
+    EXPECT_EQ(after[home].used_bytes, 500u);
+    EXPECT_EQ(after[1 - home].chunk_count, 0u);
+    EXPECT_EQ(storage.retrieve_chunk("x"), bytes(500, 'y'));
+}
+
+TEST_F(MultiDiskTest, BusyDiskIsPassedOver) {
+    ChunkStorage storage(dirs(2));
+    // Both directories share a filesystem, so only the queue depth differs
+    storage.disk(0).writers += 8;
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(storage.store_chunk("busy" + std::to_string(i), bytes(4096, 'b')));
+    }
+    storage.disk(0).writers -= 8;
+    auto by_disk = storage.usage_by_disk();
+    EXPECT_EQ(by_disk[0].chunk_count, 0u);
+    EXPECT_EQ(by_disk[1].chunk_count, 4u);
+}
+
+TEST_F(MultiDiskTest, ThroughputByDirectoryCount) {
+    const size_t CHUNK = 8 * 1024 * 1024;
+    const int THREADS = 4;
+    const int CHUNKS_PER_THREAD = 8;
+    std::vector<char> data(CHUNK);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 131 + 7);
+    }
+    const double total_mb = static_cast<double>(CHUNK) * THREADS * CHUNKS_PER_THREAD / (1024 * 1024);
+
+    std::cout << "\n=== Chunk Storage Throughput (" << THREADS << " clients, " << std::thread::hardware_concurrency()
+              << " cores) ===" << std::endl;
+    for (size_t n : {1, 2, 4}) {
+        fs::remove_all(work_dir);
+        ChunkStorage storage(dirs(n));
+
+        auto run = [&](auto&& body) {
+            std::vector<std::thread> clients;
+            auto start = std::chrono::steady_clock::now();
+            for (int t = 0; t < THREADS; ++t) {
+                clients.emplace_back([&, t] {
+                    for (int i = 0; i < CHUNKS_PER_THREAD; ++i) {
+                        body("t" + std::to_string(t) + "_" + std::to_string(i));
+                    }
+                });
+            }
+            for (auto& c : clients) {
+                c.join();
+            }
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        std::atomic<int> failures{0};
+        double write_s = run([&](const std::string& id) { failures += !storage.store_chunk(id, data); });
+        std::atomic<long long> read{0};
+        double read_s = run([&](const std::string& id) {
+            read += storage.stream_chunk(id, 0, 0, [](const char*, size_t) { return true; });
+        });
+        EXPECT_EQ(failures.load(), 0);
+        EXPECT_EQ(read.load(), static_cast<long long>(CHUNK) * THREADS * CHUNKS_PER_THREAD);
+
+        std::cout << "Directories: " << n << std::fixed << std::setprecision(1) << "  write " << total_mb / write_s
+                  << " MB/s  read " << total_mb / read_s << " MB/s" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
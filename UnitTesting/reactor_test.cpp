@@ -0,0 +1,831 @@
+#include "../src/include/heart_beat_signal.hpp"
+#include <gtest/gtest.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <mutex>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// Heap allocations, to check the event loop's hot path makes none.
+static std::atomic<uint64_t> allocations{0};
+
+[[gnu::noinline]] void* operator new(size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+class ReactorTest : public ::testing::Test {
+protected:
+    // The same coroutine shape as async_hb::task, on the global allocator.
+    struct MallocTask {
+        struct promise_type {
+            MallocTask get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void unhandled_exception() { std::terminate(); }
+            void return_void() {}
+        };
+        std::coroutine_handle<promise_type> h;
+    };
+
+    struct SleepStats {
+        double wall_ms = 0;
+        double cpu_ns_per_sleep = 0;
+        double mean_late_us = 0;
+    };
+
+    // `sleepers` coroutines each sleep `rounds` times for 1-20 ms, through
+    // `sleep` (a coroutine body that suspends until the deadline).
+    template <typename SleepFn>
+    static SleepStats run_sleepers(int sleepers, int rounds, SleepFn sleep) {
+        async_hb::Reactor r;
+        std::mt19937 gen(5);
+        std::uniform_int_distribution<int> ms(1, 20);
+        std::vector<int> durations(static_cast<size_t>(sleepers) * rounds);
+        for (auto& d : durations) {
+            d = ms(gen);
+        }
+        double late_us = 0;
+        auto sleeper = [&](int id) -> async_hb::task<> {
+            for (int i = 0; i < rounds; ++i) {
+                auto deadline = Clock::now() + std::chrono::milliseconds(durations[id * rounds + i]);
+                co_await sleep(r, deadline);
+                late_us += std::chrono::duration<double, std::micro>(Clock::now() - deadline).count();
+            }
+        };
+
+        std::clock_t cpu = std::clock();
+        auto start = Clock::now();
+        for (int i = 0; i < sleepers; ++i) {
+            r.spawn(sleeper(i));
+        }
+        r.run();
+        SleepStats stats;
+        stats.wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        stats.cpu_ns_per_sleep = 1e9 * (std::clock() - cpu) / CLOCKS_PER_SEC / durations.size();
+        stats.mean_late_us = late_us / durations.size();
+        EXPECT_EQ(r.pending_timers(), 0u);
+        return stats;
+    }
+
+    // One timerfd per sleep, as the reactor used to sleep: create, arm,
+    // register, wait, read and close.
+    struct TimerfdSleep {
+        async_hb::Reactor& r;
+        Clock::time_point deadline;
+        int tfd = -1;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            tfd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - Clock::now()).count();
+            itimerspec its{};
+            its.it_value.tv_sec = std::max<long long>(ns, 1) / 1000000000;
+            its.it_value.tv_nsec = std::max<long long>(ns, 1) % 1000000000;
+            ::timerfd_settime(tfd, 0, &its, nullptr);
+            r.wait_readable(tfd).await_suspend(h);
+        }
+        void await_resume() {
+            uint64_t expirations = 0;
+            (void)::read(tfd, &expirations, sizeof(expirations));
+            ::close(tfd);
+        }
+    };
+
+    struct PingPongStats {
+        double events_per_sec = 0;
+        double ctl_per_event = 0;
+        double allocs_per_event = 0;
+    };
+
+    // `pairs` socketpairs, each bouncing one byte `rounds` times between an
+    // echo coroutine and a client; every wakeup is one event. Runs twice on
+    // the same reactor and measures the second run, once the fd table has
+    // grown.
+    static PingPongStats ping_pong(int pairs, int rounds, bool watch) {
+        async_hb::Reactor r;
+        std::vector<std::array<int, 2>> fds(pairs);
+        for (auto& sv : fds) {
+            EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv.data()), 0);
+        }
+        auto bounce = [&](int fd, bool first) -> async_hb::task<> {
+            bool watched = watch && r.watch(fd);
+            char c = 0;
+            for (int i = 0; i < rounds; ++i) {
+                if (first) {
+                    while (::write(fd, &c, 1) != 1) {
+                        co_await r.wait_writable(fd);
+                    }
+                }
+                while (::read(fd, &c, 1) != 1) {
+                    co_await r.wait_readable(fd);
+                }
+                if (!first) {
+                    while (::write(fd, &c, 1) != 1) {
+                        co_await r.wait_writable(fd);
+                    }
+                }
+            }
+            if (watched) {
+                r.unwatch(fd);
+            }
+        };
+        PingPongStats stats;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (auto& sv : fds) {
+                r.spawn(bounce(sv[0], false));
+                r.spawn(bounce(sv[1], true));
+            }
+            uint64_t ctl = r.epoll_ctl_calls();
+            uint64_t allocs = allocations.load();
+            auto start = Clock::now();
+            r.run();
+            double secs = std::chrono::duration<double>(Clock::now() - start).count();
+            double events = 2.0 * pairs * rounds;
+            stats = {events / secs, (r.epoll_ctl_calls() - ctl) / events, (allocations.load() - allocs) / events};
+        }
+        for (auto& sv : fds) {
+            ::close(sv[0]);
+            ::close(sv[1]);
+        }
+        return stats;
+    }
+
+    // A replica stand-in: waits `delay_ms`, then reads the `len` bytes
+    // written to it and acks with one byte.
+    static async_hb::task<> replica(async_hb::Reactor& r, int fd, size_t len, int delay_ms) {
+        co_await r.sleep_for(std::chrono::milliseconds(delay_ms));
+        std::vector<uint8_t> buf(len);
+        co_await async_hb::async_read_exact(r, fd, buf.data(), len);
+        uint8_t ack = buf.empty() ? 0 : buf.back();
+        co_await async_hb::async_send_all(r, fd, &ack, 1);
+    }
+
+    // Sends `data` to one replica and returns its ack.
+    static async_hb::task<uint8_t> write_replica(async_hb::Reactor& r, int fd, const std::vector<uint8_t>& data) {
+        co_await async_hb::async_send_all(r, fd, data.data(), data.size());
+        uint8_t ack = 0;
+        co_await async_hb::async_read_exact(r, fd, &ack, 1);
+        co_return ack;
+    }
+
+    // Spins for `us` microseconds of wall time, standing in for request work.
+    static void busy_for(int us) {
+        auto until = Clock::now() + std::chrono::microseconds(us);
+        while (Clock::now() < until) {
+        }
+    }
+
+    // `tasks` coroutines, all spawned on worker 0, each doing `rounds` slices
+    // of `work_us` busy work with a zero sleep between them. Returns wall ms.
+    static double run_busy(size_t threads, int tasks, int rounds, int work_us) {
+        async_hb::Runtime runtime(threads);
+        auto& r = runtime.reactor(0);
+        std::atomic<int> done{0};
+        auto worker = [&]() -> async_hb::task<> {
+            for (int i = 0; i < rounds; ++i) {
+                busy_for(work_us);
+                co_await r.sleep_for(std::chrono::nanoseconds(0));
+            }
+            done++;
+        };
+        auto start = Clock::now();
+        for (int i = 0; i < tasks; ++i) {
+            runtime.spawn_on(0, worker());
+        }
+        runtime.run();
+        EXPECT_EQ(done.load(), tasks);
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+};
+
+TEST_F(ReactorTest, SleepersWakeInDeadlineOrder) {
+    async_hb::Reactor r;
+    std::vector<int> woke;
+    std::vector<double> slept_ms;
+    auto sleeper = [&](int id, int ms) -> async_hb::task<> {
+        auto start = Clock::now();
+        co_await r.sleep_for(std::chrono::milliseconds(ms));
+        slept_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        woke.push_back(id);
+    };
+    r.spawn(sleeper(0, 30));
+    r.spawn(sleeper(1, 10));
+    r.spawn(sleeper(2, 20));
+    r.spawn(sleeper(3, 10)); // same deadline as 1 or later: after it
+    r.run();
+
+    EXPECT_EQ(woke, (std::vector<int>{1, 3, 2, 0}));
+    EXPECT_GE(slept_ms[0], 10.0);
+    EXPECT_GE(slept_ms[2], 20.0);
+    EXPECT_GE(slept_ms[3], 30.0);
+    EXPECT_EQ(r.pending_timers(), 0u);
+}
+
+TEST_F(ReactorTest, PeriodicSleepUntilDoesNotDrift) {
+    async_hb::Reactor r;
+    const auto period = std::chrono::milliseconds(5);
+    const int TICKS = 20;
+    auto start = Clock::now();
+    auto ticker = [&]() -> async_hb::task<> {
+        auto next = start;
+        for (int i = 0; i < TICKS; ++i) {
+            next += period;
+            co_await r.sleep_until(next);
+        }
+    };
+    r.spawn(ticker());
+    r.run();
+    auto elapsed = Clock::now() - start;
+    EXPECT_GE(elapsed, period * TICKS);
+    EXPECT_LT(elapsed, period * TICKS + std::chrono::milliseconds(50));
+}
+
+TEST_F(ReactorTest, ZeroSleepsDoNotStarveSockets) {
+    async_hb::Reactor r;
+    int sv[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv), 0);
+    bool received = false;
+    int spins = 0;
+    std::vector<char> order;
+
+    auto spinner = [&](char name) -> async_hb::task<> {
+        while (!received) {
+            order.push_back(name);
+            spins++;
+            co_await r.sleep_for(std::chrono::nanoseconds(0));
+        }
+    };
+    auto reader = [&]() -> async_hb::task<> {
+        char c;
+        while (::read(sv[0], &c, 1) != 1) {
+            co_await r.wait_readable(sv[0]);
+        }
+        received = true;
+    };
+    r.spawn(spinner('a'));
+    r.spawn(spinner('b'));
+    r.spawn(reader());
+    ASSERT_EQ(::write(sv[1], "x", 1), 1);
+    r.run();
+    ::close(sv[0]);
+    ::close(sv[1]);
+
+    EXPECT_TRUE(received);
+    EXPECT_LT(spins, 100);
+    // Zero-length sleeps take turns
+    for (size_t i = 0; i + 1 < order.size(); ++i) {
+        EXPECT_NE(order[i], order[i + 1]);
+    }
+}
+
+// 100k coroutines sleeping 1-20 ms three times each: CPU per sleep and how
+// late sleepers wake, against a timerfd per sleep at the largest count the
+// fd limit allows.
+TEST_F(ReactorTest, HundredThousandTimers) {
+    const int ROUNDS = 3;
+    auto heap_sleep = [](async_hb::Reactor& r, Clock::time_point deadline) { return r.sleep_until(deadline); };
+    auto fd_sleep = [](async_hb::Reactor& r, Clock::time_point deadline) { return TimerfdSleep{r, deadline}; };
+
+    std::cout << "\n=== Reactor Timers (" << ROUNDS << " sleeps of 1-20 ms per coroutine) ===" << std::endl;
+    auto report = [](const char* name, int sleepers, const SleepStats& s) {
+        std::cout << std::setw(14) << std::left << name << std::right << std::setw(7) << sleepers << " sleepers  "
+                  << std::fixed << std::setprecision(0) << std::setw(6) << s.wall_ms << " ms wall  " << std::setw(6)
+                  << s.cpu_ns_per_sleep << " ns CPU/sleep  " << std::setw(6) << s.mean_late_us << " us late"
+                  << std::endl;
+    };
+    for (int sleepers : {10000, 100000}) {
+        report("timer heap", sleepers, run_sleepers(sleepers, ROUNDS, heap_sleep));
+    }
+    report("timerfd/sleep", 10000, run_sleepers(10000, ROUNDS, fd_sleep));
+}
+
+TEST_F(ReactorTest, WaitersShareAnFdByDirection) {
+    async_hb::Reactor r;
+    int sv[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv), 0);
+    std::vector<std::string> steps;
+    auto reader = [&]() -> async_hb::task<> {
+        char c;
+        while (::read(sv[0], &c, 1) != 1) {
+            co_await r.wait_readable(sv[0]);
+        }
+        steps.push_back("read");
+    };
+    auto writer = [&]() -> async_hb::task<> {
+        co_await r.wait_writable(sv[0]);
+        steps.push_back("writable");
+        co_await r.sleep_for(std::chrono::milliseconds(5));
+        EXPECT_EQ(::write(sv[1], "x", 1), 1);
+    };
+    r.spawn(reader());
+    // The read waiter stays registered while the write side fires
+    r.spawn(writer());
+    r.run();
+    EXPECT_EQ(steps, (std::vector<std::string>{"writable", "read"}));
+
+    // A closed fd's number is reused by the next socket; waits on it must
+    // register afresh
+    ::close(sv[0]);
+    ::close(sv[1]);
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv), 0);
+    steps.clear();
+    r.spawn(reader());
+    r.spawn(writer());
+    r.run();
+    EXPECT_EQ(steps, (std::vector<std::string>{"writable", "read"}));
+    ::close(sv[0]);
+    ::close(sv[1]);
+}
+
+TEST_F(ReactorTest, WatchedFdsLatchEdges) {
+    async_hb::Reactor r;
+    int sv[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv), 0);
+    ASSERT_TRUE(r.watch(sv[0]));
+    int got = 0;
+    auto reader = [&]() -> async_hb::task<> {
+        // The byte arrives while nobody waits; the latched edge lets the
+        // first wait through
+        co_await r.sleep_for(std::chrono::milliseconds(5));
+        co_await r.wait_readable(sv[0]);
+        char buf[8];
+        got += static_cast<int>(::read(sv[0], buf, sizeof(buf)));
+        while (got < 2) {
+            ssize_t n = ::read(sv[0], buf, sizeof(buf));
+            if (n > 0) {
+                got += static_cast<int>(n);
+            } else {
+                co_await r.wait_readable(sv[0]);
+            }
+        }
+    };
+    auto writer = [&]() -> async_hb::task<> {
+        EXPECT_EQ(::write(sv[1], "a", 1), 1);
+        co_await r.sleep_for(std::chrono::milliseconds(10));
+        EXPECT_EQ(::write(sv[1], "b", 1), 1);
+    };
+    r.spawn(reader());
+    r.spawn(writer());
+    uint64_t ctl = r.epoll_ctl_calls();
+    r.run();
+    EXPECT_EQ(got, 2);
+    EXPECT_EQ(r.epoll_ctl_calls(), ctl); // no re-arming
+    r.unwatch(sv[0]);
+    ::close(sv[0]);
+    ::close(sv[1]);
+
+    // Coroutines move between the workers of a runtime, and so would
+    // the registration
+    async_hb::Runtime runtime(2);
+    EXPECT_FALSE(runtime.reactor(0).watch(0));
+    async_hb::Runtime single(1);
+    EXPECT_TRUE(single.reactor(0).watch(sv[0] = ::eventfd(0, EFD_CLOEXEC)));
+    single.reactor(0).unwatch(sv[0]);
+    ::close(sv[0]);
+}
+
+// Ping-pong over socketpairs: events per second, epoll_ctl calls and heap
+// allocations per event, with one-shot waits and with watched fds.
+TEST_F(ReactorTest, EventDispatchRate) {
+    const int PAIRS = 64;
+    const int ROUNDS = 5000;
+    std::cout << "\n=== Reactor Event Dispatch (" << PAIRS << " socketpairs, " << ROUNDS
+              << " round trips each) ===" << std::endl;
+    for (bool watch : {false, true}) {
+        auto s = ping_pong(PAIRS, ROUNDS, watch);
+        std::cout << std::setw(10) << std::left << (watch ? "watched" : "one-shot") << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(8) << s.events_per_sec / 1e6 << " M events/s  "
+                  << s.ctl_per_event << " epoll_ctl/event  " << s.allocs_per_event << " allocs/event" << std::endl;
+        EXPECT_LT(s.allocs_per_event, 0.001); // run()'s event buffer only
+        EXPECT_LE(s.ctl_per_event, watch ? 0.01 : 1.0);
+    }
+}
+
+TEST_F(ReactorTest, FramePoolRecyclesFrames) {
+    async_hb::Reactor r;
+    int finished = 0;
+    auto quick = [&]() -> async_hb::task<> {
+        finished++;
+        co_return;
+    };
+    auto sleeper = [&]() -> async_hb::task<> {
+        co_await r.sleep_for(std::chrono::nanoseconds(0));
+        finished++;
+    };
+    r.spawn(quick());
+    for (int i = 0; i < 500; ++i) {
+        r.spawn(sleeper());
+    }
+    r.run();
+
+    // Same-sized frames come back off the free lists
+    auto before = async_hb::FramePool::stats();
+    uint64_t allocs = allocations.load();
+    for (int i = 0; i < 10000; ++i) {
+        r.spawn(quick());
+    }
+    for (int i = 0; i < 500; ++i) {
+        r.spawn(sleeper());
+    }
+    r.run();
+    auto after = async_hb::FramePool::stats();
+    EXPECT_EQ(finished, 1 + 500 + 10000 + 500);
+    EXPECT_LE(allocations.load() - allocs, 1u); // run()'s event buffer
+    EXPECT_EQ(after.allocations - before.allocations, 10500u);
+    EXPECT_EQ(after.reused - before.reused, 10500u);
+}
+
+// Create, run and destroy short coroutines back to back, as the frame
+// helpers do per message: pooled frames against malloc'd ones.
+TEST_F(ReactorTest, FrameAllocationCost) {
+    const int FRAMES = 1000000;
+    async_hb::Reactor r;
+    long sum = 0;
+    auto small_task = [&](int i) -> async_hb::task<> {
+        sum += i;
+        co_return;
+    };
+    auto large_task = [&](int i) -> async_hb::task<> {
+        char buf[1024];
+        buf[i % sizeof(buf)] = static_cast<char>(i);
+        co_await std::suspend_never{};
+        sum += buf[i % sizeof(buf)];
+    };
+    auto small_plain = [&](int i) -> MallocTask {
+        sum += i;
+        co_return;
+    };
+    auto large_plain = [&](int i) -> MallocTask {
+        char buf[1024];
+        buf[i % sizeof(buf)] = static_cast<char>(i);
+        co_await std::suspend_never{};
+        sum += buf[i % sizeof(buf)];
+    };
+
+    auto measure = [&](const char* name, auto make_and_run) {
+        uint64_t allocs = allocations.load();
+        auto start = Clock::now();
+        for (int i = 0; i < FRAMES; ++i) {
+            make_and_run(i);
+        }
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / FRAMES;
+        double per_frame = static_cast<double>(allocations.load() - allocs) / FRAMES;
+        std::cout << std::setw(18) << std::left << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(7) << ns << " ns/frame  " << std::setprecision(3) << per_frame << " mallocs/frame"
+                  << std::endl;
+        return per_frame;
+    };
+    std::cout << "\n=== Coroutine Frames (" << FRAMES << " create/run/destroy) ===" << std::endl;
+    EXPECT_LT(measure("pool, small", [&](int i) { r.spawn(small_task(i)); }), 0.001);
+    EXPECT_EQ(measure("malloc, small", [&](int i) { small_plain(i).h.resume(); }), 1.0);
+    EXPECT_LT(measure("pool, 1 KB", [&](int i) { r.spawn(large_task(i)); }), 0.001);
+    EXPECT_EQ(measure("malloc, 1 KB", [&](int i) { large_plain(i).h.resume(); }), 1.0);
+    EXPECT_NE(sum, 0);
+}
+
+TEST_F(ReactorTest, TasksReturnValuesAndExceptions) {
+    async_hb::Reactor r;
+    auto square = [&](int x) -> async_hb::task<int> {
+        co_await r.sleep_for(std::chrono::milliseconds(1));
+        co_return x * x;
+    };
+    auto name = [](int x) -> async_hb::task<std::string> { co_return "n" + std::to_string(x); };
+    auto fail = [&]() -> async_hb::task<int> {
+        co_await r.sleep_for(std::chrono::milliseconds(1));
+        throw std::runtime_error("replica down");
+    };
+    std::vector<std::string> seen;
+    auto parent = [&]() -> async_hb::task<> {
+        int a = co_await square(7);
+        std::string b = co_await name(a);
+        seen.push_back(b);
+        try {
+            co_await fail();
+        } catch (const std::runtime_error& e) {
+            seen.push_back(e.what());
+        }
+        // Not awaited: destroyed unstarted
+        auto unused = square(3);
+    };
+    r.spawn(parent());
+    r.run();
+    EXPECT_EQ(seen, (std::vector<std::string>{"n49", "replica down"}));
+}
+
+// Each level awaits the next; symmetric transfer keeps the stack flat both
+// on the way down and when the results come back up.
+TEST_F(ReactorTest, DeepAwaitChainsUseNoStack) {
+    struct Chain {
+        static async_hb::task<long> depth(long n) {
+            if (n == 0) {
+                co_return 0;
+            }
+            co_return 1 + co_await depth(n - 1);
+        }
+    };
+    async_hb::Reactor r;
+    long result = 0;
+    auto root = [&]() -> async_hb::task<> { result = co_await Chain::depth(500000); };
+    r.spawn(root());
+    r.run();
+    EXPECT_EQ(result, 500000);
+}
+
+// Three replicas written at once: when_all takes as long as the slowest,
+// when_any as long as the fastest, and the stragglers still finish.
+TEST_F(ReactorTest, ReplicaFanOut) {
+    const int DELAYS_MS[3] = {10, 30, 20};
+    async_hb::Reactor r;
+    std::vector<std::array<int, 2>> fds(3);
+    for (auto& sv : fds) {
+        ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv.data()), 0);
+    }
+    std::vector<uint8_t> data(200000, 0x5a);
+    std::vector<uint8_t> acks;
+    double all_ms = 0, any_ms = 0;
+    size_t first = 99;
+
+    auto writer = [&]() -> async_hb::task<> {
+        for (int i = 0; i < 3; ++i) {
+            r.spawn(replica(r, fds[i][1], data.size(), DELAYS_MS[i]));
+        }
+        std::vector<async_hb::task<uint8_t>> writes;
+        for (auto& sv : fds) {
+            writes.push_back(write_replica(r, sv[0], data));
+        }
+        auto start = Clock::now();
+        acks = co_await async_hb::when_all(std::move(writes));
+        all_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        for (int i = 0; i < 3; ++i) {
+            r.spawn(replica(r, fds[i][1], data.size(), DELAYS_MS[i]));
+        }
+        for (auto& sv : fds) {
+            writes.push_back(write_replica(r, sv[0], data));
+        }
+        start = Clock::now();
+        auto [index, ack] = co_await async_hb::when_any(r, std::move(writes));
+        any_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        first = index;
+        acks.push_back(ack);
+    };
+    r.spawn(writer());
+    r.run(); // also waits for the two slower replicas of the race
+    for (auto& sv : fds) {
+        ::close(sv[0]);
+        ::close(sv[1]);
+    }
+
+    EXPECT_EQ(acks, (std::vector<uint8_t>{0x5a, 0x5a, 0x5a, 0x5a}));
+    EXPECT_GE(all_ms, 30.0);
+    EXPECT_LT(all_ms, 55.0); // not 10 + 30 + 20
+    EXPECT_EQ(first, 0u);
+    EXPECT_GE(any_ms, 10.0);
+    EXPECT_LT(any_ms, 25.0);
+}
+
+TEST_F(ReactorTest, CombinatorsHandleReadyAndFailingTasks) {
+    async_hb::Reactor r;
+    auto now = [](int x) -> async_hb::task<int> { co_return x; };
+    auto later = [&](int x, int ms) -> async_hb::task<int> {
+        co_await r.sleep_for(std::chrono::milliseconds(ms));
+        if (x < 0) {
+            throw std::runtime_error("failed " + std::to_string(x));
+        }
+        co_return x;
+    };
+    std::vector<int> all;
+    std::string error;
+    size_t first_void = 99;
+    std::pair<size_t, int> first{99, 0};
+    auto parent = [&]() -> async_hb::task<> {
+        std::vector<async_hb::task<int>> tasks;
+        tasks.push_back(now(1));
+        tasks.push_back(later(2, 2));
+        tasks.push_back(now(3));
+        all = co_await async_hb::when_all(std::move(tasks));
+
+        // Every task finishes before the failure surfaces
+        tasks.clear();
+        tasks.push_back(later(-1, 1));
+        tasks.push_back(later(5, 5));
+        try {
+            co_await async_hb::when_all(std::move(tasks));
+        } catch (const std::runtime_error& e) {
+            error = e.what();
+        }
+
+        co_await async_hb::when_all(std::vector<async_hb::task<>>{});
+        tasks.clear();
+        tasks.push_back(later(7, 5));
+        tasks.push_back(now(8)); // done before the race is even set up
+        first = co_await async_hb::when_any(r, std::move(tasks));
+
+        std::vector<async_hb::task<>> sleeps;
+        for (int ms : {8, 2, 5}) {
+            sleeps.push_back([](async_hb::Reactor& r, int ms) -> async_hb::task<> {
+                co_await r.sleep_for(std::chrono::milliseconds(ms));
+            }(r, ms));
+        }
+        first_void = co_await async_hb::when_any(r, std::move(sleeps));
+    };
+    r.spawn(parent());
+    r.run();
+    EXPECT_EQ(all, (std::vector<int>{1, 2, 3}));
+    EXPECT_EQ(error, "failed -1");
+    EXPECT_EQ(first, (std::pair<size_t, int>{1, 8}));
+    EXPECT_EQ(first_void, 1u);
+    EXPECT_EQ(r.pending_timers(), 0u);
+}
+
+TEST_F(ReactorTest, CombinatorsOnARuntime) {
+    async_hb::Runtime runtime(3);
+    auto& r = runtime.reactor(0);
+    std::atomic<int> total{0};
+    auto leaf = [&](int x) -> async_hb::task<int> {
+        busy_for(50);
+        co_await r.sleep_for(std::chrono::microseconds(x % 7 * 100));
+        co_return x;
+    };
+    auto fan_out = [&](int base) -> async_hb::task<> {
+        std::vector<async_hb::task<int>> tasks;
+        for (int i = 0; i < 16; ++i) {
+            tasks.push_back(leaf(base + i));
+        }
+        int sum = 0;
+        for (int v : co_await async_hb::when_all(std::move(tasks))) {
+            sum += v;
+        }
+        tasks.clear();
+        for (int i = 0; i < 4; ++i) {
+            tasks.push_back(leaf(base + i));
+        }
+        auto [index, value] = co_await async_hb::when_any(r, std::move(tasks));
+        EXPECT_EQ(value, base + static_cast<int>(index));
+        total += sum;
+    };
+    for (int i = 0; i < 50; ++i) {
+        runtime.spawn(fan_out(i * 100));
+    }
+    runtime.run();
+    int expected = 0;
+    for (int i = 0; i < 50; ++i) {
+        expected += 16 * i * 100 + 120;
+    }
+    EXPECT_EQ(total.load(), expected);
+}
+
+TEST_F(ReactorTest, RuntimeRunsEveryTaskAcrossWorkers) {
+    async_hb::Runtime runtime(4);
+    ASSERT_EQ(runtime.size(), 4u);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::atomic<int> steps{0};
+    std::atomic<int> finished{0};
+    // Every task starts on worker 0; idle workers steal them
+    auto task = [&](async_hb::Reactor& r) -> async_hb::task<> {
+        for (int i = 0; i < 10; ++i) {
+            busy_for(20);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.insert(std::this_thread::get_id());
+            }
+            steps++;
+            co_await r.sleep_for(std::chrono::microseconds(i % 3 * 100));
+        }
+        finished++;
+    };
+    for (int i = 0; i < 400; ++i) {
+        runtime.spawn_on(0, task(runtime.reactor(i % 4)));
+    }
+    runtime.run();
+
+    EXPECT_EQ(finished.load(), 400);
+    EXPECT_EQ(steps.load(), 4000);
+    EXPECT_GT(threads.size(), 1u);
+    for (size_t i = 0; i < runtime.size(); ++i) {
+        EXPECT_EQ(runtime.reactor(i).pending_timers(), 0u);
+    }
+}
+
+TEST_F(ReactorTest, RuntimeCoroutinesWaitOnSocketsAfterMoving) {
+    const int PAIRS = 64;
+    const int ROUNDS = 50;
+    async_hb::Runtime runtime(3);
+    auto& r = runtime.reactor(0);
+    std::vector<std::array<int, 2>> pairs(PAIRS);
+    for (auto& sv : pairs) {
+        ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv.data()), 0);
+    }
+    std::atomic<int> echoed{0};
+    std::atomic<int> moved{0};
+
+    // Reads a byte at a time and echoes it; each wait may resume elsewhere
+    auto echo = [&](int fd) -> async_hb::task<> {
+        for (int i = 0; i < ROUNDS; ++i) {
+            char c;
+            while (::read(fd, &c, 1) != 1) {
+                co_await r.wait_readable(fd);
+            }
+            while (::write(fd, &c, 1) != 1) {
+                co_await r.wait_writable(fd);
+            }
+        }
+    };
+    auto client = [&](int fd) -> async_hb::task<> {
+        auto thread = std::this_thread::get_id();
+        for (int i = 0; i < ROUNDS; ++i) {
+            char out = static_cast<char>(i), in = 0;
+            while (::write(fd, &out, 1) != 1) {
+                co_await r.wait_writable(fd);
+            }
+            while (::read(fd, &in, 1) != 1) {
+                co_await r.wait_readable(fd);
+            }
+            EXPECT_EQ(in, out);
+            echoed++;
+            co_await r.sleep_for(std::chrono::microseconds(50));
+            if (std::this_thread::get_id() != thread) {
+                moved++;
+                thread = std::this_thread::get_id();
+            }
+        }
+    };
+    for (auto& sv : pairs) {
+        runtime.spawn_on(0, echo(sv[0]));
+        runtime.spawn_on(0, client(sv[1]));
+    }
+    runtime.run();
+    for (auto& sv : pairs) {
+        ::close(sv[0]);
+        ::close(sv[1]);
+    }
+
+    EXPECT_EQ(echoed.load(), PAIRS * ROUNDS);
+    std::cout << "Clients resumed on another thread " << moved.load() << " times" << std::endl;
+}
+
+TEST_F(ReactorTest, RuntimeSpawnFromInsideATask) {
+    async_hb::Runtime runtime(2);
+    std::atomic<int> children{0};
+    auto child = [&]() -> async_hb::task<> {
+        children++;
+        co_return;
+    };
+    auto parent = [&](async_hb::Reactor& r) -> async_hb::task<> {
+        for (int i = 0; i < 100; ++i) {
+            r.spawn(child());
+            co_await r.sleep_for(std::chrono::nanoseconds(0));
+        }
+    };
+    runtime.spawn(parent(runtime.reactor(1)));
+    runtime.spawn(parent(runtime.reactor(0)));
+    runtime.run();
+    EXPECT_EQ(children.load(), 200);
+}
+
+// CPU-bound request work that all arrives on one worker, against the number
+// of worker threads; the speedup is bounded by the cores available.
+TEST_F(ReactorTest, RuntimeScalesBusyTasks) {
+    const int TASKS = 256;
+    const int ROUNDS = 20;
+    const int WORK_US = 50;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "\n=== Work-Stealing Runtime (" << TASKS << " tasks x " << ROUNDS << " x " << WORK_US
+              << " us, " << cores << " cores) ===" << std::endl;
+    double single = 0;
+    for (size_t threads : std::set<size_t>{1, 2, 4, cores}) {
+        double ms = run_busy(threads, TASKS, ROUNDS, WORK_US);
+        if (threads == 1) {
+            single = ms;
+        }
+        std::cout << std::setw(3) << threads << " threads  " << std::fixed << std::setprecision(0) << std::setw(6)
+                  << ms << " ms  " << std::setprecision(2) << single / ms << "x" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
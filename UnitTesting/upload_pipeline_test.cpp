@@ -0,0 +1,161 @@
+#include "../src/Head_Server/upload_pipeline.hpp"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <iomanip>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class UploadPipelineTest : public ::testing::Test {
+protected:
+    static constexpr size_t TEST_CHUNK_SIZE = 4 * 1024 * 1024;  // 4MB keeps the run short
+    static constexpr size_t TEST_FILE_SIZE = 128 * 1024 * 1024 + 12345;  // ragged last chunk
+    static constexpr int REPLICAS = 3;
+
+    fs::path work_dir;
+    fs::path source_file;
+
+    void SetUp() override {
+        work_dir = fs::temp_directory_path() / ("upload_pipeline_test_" + std::to_string(::getpid()));
+        fs::create_directories(work_dir / "replicas");
+        source_file = work_dir / "source.bin";
+
+        std::mt19937_64 gen(42);
+        std::vector<uint64_t> block(1024 * 1024 / sizeof(uint64_t));
+        std::ofstream out(source_file, std::ios::binary);
+        size_t written = 0;
+        while (written < TEST_FILE_SIZE) {
+            for (auto& v : block) {
+                v = gen();
+            }
+            size_t n = std::min(block.size() * sizeof(uint64_t), TEST_FILE_SIZE - written);
+            out.write(reinterpret_cast<const char*>(block.data()), n);
+            written += n;
+        }
+    }
+
+    void TearDown() override {
+        fs::remove_all(work_dir);
+    }
+
+    // Writes one replica to a file under the test's replica directory.
+    class FileReplica : public ChunkWriter {
+    public:
+        explicit FileReplica(std::string path) : path(std::move(path)), file(this->path, std::ios::binary) {}
+
+        bool write(const char* data, size_t len) override {
+            file.write(data, len);
+            return static_cast<bool>(file);
+        }
+
+        std::optional<std::string> commit(const checksum::ChunkDigest&) override {
+            file.close();
+            if (!file) {
+                return std::nullopt;
+            }
+            return path;
+        }
+
+    private:
+        std::string path;
+        std::ofstream file;
+    };
+
+    UploadPipeline make_pipeline(size_t workers, size_t window, BufferPool* buffers = nullptr) {
+        UploadPipelineOptions options;
+        options.chunk_size = TEST_CHUNK_SIZE;
+        options.workers = workers;
+        options.max_inflight_chunks = window;
+        options.buffers = buffers;
+
+        auto replica_dir = work_dir / "replicas";
+        return UploadPipeline(
+            options,
+            [](int) {
+                std::vector<std::string> servers;
+                for (int i = 0; i < REPLICAS; ++i) {
+                    servers.push_back("server" + std::to_string(i));
+                }
+                return servers;
+            },
+            [replica_dir](const std::string& server, int chunk_id, size_t) -> std::unique_ptr<ChunkWriter> {
+                auto path = replica_dir / (server + "_chunk_" + std::to_string(chunk_id));
+                return std::make_unique<FileReplica>(path.string());
+            });
+    }
+};
+
+TEST_F(UploadPipelineTest, StoresEveryReplicaInOrder) {
+    auto pipeline = make_pipeline(4, 4);
+    auto chunks = pipeline.run(source_file.string());
+
+    const size_t expected_chunks = (TEST_FILE_SIZE + TEST_CHUNK_SIZE - 1) / TEST_CHUNK_SIZE;
+    ASSERT_EQ(chunks.size(), expected_chunks * REPLICAS);
+
+    size_t total = 0;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        EXPECT_EQ(chunks[i].chunk_id, static_cast<int>(i / REPLICAS));
+        EXPECT_EQ(fs::file_size(chunks[i].file_path), chunks[i].size);
+        if (i % REPLICAS == 0) {
+            total += chunks[i].size;
+        }
+    }
+    EXPECT_EQ(total, TEST_FILE_SIZE);
+}
+
+TEST_F(UploadPipelineTest, MemoryIsBoundedBySlicePool) {
+    // A two-slice pool must still move 32 chunks through four workers.
+    BufferPool buffers(256 * 1024, 2);
+    auto pipeline = make_pipeline(4, 4, &buffers);
+    auto chunks = pipeline.run(source_file.string());
+
+    ASSERT_FALSE(chunks.empty());
+    EXPECT_LE(buffers.allocated(), 2u);
+
+    std::ifstream src(source_file, std::ios::binary);
+    std::vector<char> expected(TEST_CHUNK_SIZE), actual(TEST_CHUNK_SIZE);
+    for (size_t i = 0; i < chunks.size(); i += REPLICAS) {
+        src.read(expected.data(), chunks[i].size);
+        std::ifstream replica(chunks[i].file_path, std::ios::binary);
+        replica.read(actual.data(), chunks[i].size);
+        ASSERT_TRUE(std::equal(expected.begin(), expected.begin() + chunks[i].size, actual.begin()))
+            << "chunk " << chunks[i].chunk_id << " differs";
+    }
+}
+
+TEST_F(UploadPipelineTest, MissingFileFails) {
+    auto pipeline = make_pipeline(2, 2);
+    EXPECT_TRUE(pipeline.run((work_dir / "does_not_exist").string()).empty());
+}
+
+TEST_F(UploadPipelineTest, ThroughputScalesWithWorkers) {
+    std::cout << "\n=== Upload Pipeline Throughput ===" << std::endl;
+    std::cout << "File Size: " << TEST_FILE_SIZE / (1024 * 1024) << " MB, Chunk Size: "
+              << TEST_CHUNK_SIZE / (1024 * 1024) << " MB, Replicas: " << REPLICAS << std::endl;
+
+    for (size_t workers : {1, 2, 4, 8}) {
+        auto pipeline = make_pipeline(workers, workers * 2);
+
+        auto start_time = std::chrono::steady_clock::now();
+        auto chunks = pipeline.run(source_file.string());
+        auto end_time = std::chrono::steady_clock::now();
+        ASSERT_FALSE(chunks.empty());
+
+        double seconds = std::chrono::duration<double>(end_time - start_time).count();
+        std::cout << "Workers: " << std::setw(2) << workers
+                  << "  Time: " << std::fixed << std::setprecision(3) << seconds << " s"
+                  << "  Throughput: " << std::setprecision(2)
+                  << (TEST_FILE_SIZE / seconds) / (1024.0 * 1024 * 1024) << " GB/s" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
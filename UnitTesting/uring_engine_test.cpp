@@ -0,0 +1,232 @@
+#include "../src/Cluster_Server/chunk_service.hpp"
+#include "../src/Head_Server/chunk_client.hpp"
+#include "../src/include/uring.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class UringEngineTest : public ::testing::Test {
+protected:
+    using Engine = ChunkService::Options::Engine;
+
+    fs::path work_dir;
+    std::unique_ptr<ChunkStorage> storage;
+    std::unique_ptr<async_hb::Reactor> reactor;
+    std::unique_ptr<ChunkService> service;
+    std::thread server_thread;
+    std::string address;
+
+    void SetUp() override {
+        work_dir = fs::temp_directory_path() / ("uring_engine_test_" + std::to_string(::getpid()));
+        fs::remove_all(work_dir);
+    }
+
+    void TearDown() override {
+        stop();
+        fs::remove_all(work_dir);
+    }
+
+    void start(ChunkService::Options options) {
+        storage = std::make_unique<ChunkStorage>(work_dir.string());
+        reactor = std::make_unique<async_hb::Reactor>();
+        service = std::make_unique<ChunkService>(*reactor, *storage, options);
+        ASSERT_TRUE(service->listen("127.0.0.1", 0));
+        address = "127.0.0.1:" + std::to_string(service->port());
+        service->start();
+        server_thread = std::thread([this] { reactor->run(); });
+    }
+
+    void stop() {
+        if (service) {
+            service->stop();
+        }
+        if (server_thread.joinable()) {
+            server_thread.join();
+        }
+        service.reset();
+        reactor.reset();
+        storage.reset();
+    }
+
+    static std::vector<char> random_bytes(size_t n, uint64_t seed) {
+        std::mt19937_64 gen(seed);
+        std::vector<char> data(n);
+        for (auto& c : data) {
+            c = static_cast<char>(gen());
+        }
+        return data;
+    }
+
+    static bool put(const ChunkClient& client, const std::string& id, const std::vector<char>& data) {
+        auto writer = client.put(id, data.size());
+        if (!writer) {
+            return false;
+        }
+        checksum::BlockChecksummer summer;
+        for (size_t off = 0; off < data.size(); off += IO_SLICE_SIZE) {
+            size_t len = std::min(IO_SLICE_SIZE, data.size() - off);
+            summer.update(data.data() + off, len);
+            if (!writer->write(data.data() + off, len)) {
+                return false;
+            }
+        }
+        return writer->commit(summer.finish()).has_value();
+    }
+
+    static std::vector<char> get(const ChunkClient& client, const std::string& id, size_t offset = 0,
+                                 size_t length = 0) {
+        std::vector<char> out;
+        long long n = client.get(id, offset, length, [&](const char* data, size_t len) {
+            out.insert(out.end(), data, data + len);
+            return true;
+        });
+        EXPECT_EQ(n, static_cast<long long>(out.size()));
+        return out;
+    }
+};
+
+TEST_F(UringEngineTest, RingWritesAndReadsBack) {
+    fs::create_directories(work_dir);
+    int fd = ::open((work_dir / "ring").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    ASSERT_GE(fd, 0);
+    async_hb::Reactor r;
+    async_hb::Uring ring(r, 8, 4, 4096);
+    ASSERT_TRUE(ring.ok()) << std::strerror(ring.error());
+
+    std::vector<int> results;
+    bool matched = false;
+    auto body = [&]() -> async_hb::task<> {
+        async_hb::Uring::Buffer bufs[3];
+        async_hb::Uring::Op writes[3];
+        for (int i = 0; i < 3; ++i) {
+            bufs[i] = ring.acquire_buffer();
+            std::memset(bufs[i].data(), 'a' + i, 4096);
+            writes[i] = ring.write(fd, bufs[i], 4096, i * 4096);
+        }
+        for (auto& w : writes) {
+            results.push_back(co_await w);
+        }
+        auto in = ring.acquire_buffer();
+        results.push_back(co_await ring.read(fd, in, 4096, 4096));
+        matched = std::all_of(in.data(), in.data() + 4096, [](char c) { return c == 'b'; });
+        // Past the end of the file
+        results.push_back(co_await ring.read(fd, in, 4096, 3 * 4096));
+        EXPECT_FALSE(ring.acquire_buffer());  // all four are out
+    };
+    r.spawn(body());
+    r.run();
+    ::close(fd);
+
+    EXPECT_EQ(results, (std::vector<int>{4096, 4096, 4096, 4096, 0}));
+    EXPECT_TRUE(matched);
+    EXPECT_EQ(ring.in_flight(), 0u);
+    EXPECT_EQ(fs::file_size(work_dir / "ring"), 3u * 4096);
+}
+
+TEST_F(UringEngineTest, ChunksRoundTrip) {
+    for (bool direct : {false, true}) {
+        SCOPED_TRACE(direct ? "O_DIRECT" : "buffered");
+        fs::remove_all(work_dir);
+        start({Engine::Uring, direct});
+        ASSERT_TRUE(service->using_uring());
+        ChunkClient client(address);
+
+        // Not a whole number of slices or blocks
+        auto data = random_bytes(5 * IO_SLICE_SIZE + 12345, direct);
+        ASSERT_TRUE(put(client, "chunk_a", data));
+        EXPECT_EQ(fs::file_size(work_dir / DirectoryLayout{}.relative_path("chunk_a")), data.size());
+        EXPECT_EQ(get(client, "chunk_a"), data);
+
+        auto part = get(client, "chunk_a", IO_SLICE_SIZE - 3, IO_SLICE_SIZE + 10);
+        ASSERT_EQ(part.size(), IO_SLICE_SIZE + 10);
+        EXPECT_TRUE(std::equal(part.begin(), part.end(), data.begin() + (IO_SLICE_SIZE - 3)));
+        auto tail = get(client, "chunk_a", data.size() - 5);
+        ASSERT_EQ(tail.size(), 5u);
+        EXPECT_TRUE(std::equal(tail.begin(), tail.end(), data.end() - 5));
+
+        // Replaced by a shorter chunk, and an empty one
+        auto small = random_bytes(100, 7);
+        ASSERT_TRUE(put(client, "chunk_a", small));
+        EXPECT_EQ(get(client, "chunk_a"), small);
+        ASSERT_TRUE(put(client, "empty", {}));
+        EXPECT_TRUE(get(client, "empty").empty());
+
+        // Readable by the worker path too
+        EXPECT_EQ(storage->retrieve_chunk("chunk_a"), std::vector<char>(small.begin(), small.end()));
+        stop();
+    }
+}
+
+TEST_F(UringEngineTest, AbandonedUploadLeavesNothing) {
+    start({Engine::Uring});
+    ChunkClient client(address);
+    {
+        auto writer = client.put("partial", 3 * IO_SLICE_SIZE);
+        ASSERT_TRUE(writer);
+        auto data = random_bytes(IO_SLICE_SIZE + 512, 3);
+        ASSERT_TRUE(writer->write(data.data(), data.size()));
+        EXPECT_FALSE(writer->commit(checksum::ChunkDigest{}).has_value());
+    }
+    auto ids = client.list();
+    ASSERT_TRUE(ids.has_value());
+    EXPECT_TRUE(ids->empty());
+
+    // The ring buffers went back: a full-size transfer still works
+    auto data = random_bytes(2 * IO_SLICE_SIZE, 4);
+    ASSERT_TRUE(put(client, "after", data));
+    EXPECT_EQ(get(client, "after"), data);
+}
+
+// Loopback PUT/GET throughput of the disk-worker engine against io_uring,
+// buffered and with O_DIRECT.
+TEST_F(UringEngineTest, EngineThroughput) {
+    const size_t CHUNK_BYTES = 64 * 1024 * 1024;
+    const int CHUNKS = 4;
+    auto data = random_bytes(CHUNK_BYTES, 4);
+    const double total_mb = static_cast<double>(CHUNK_BYTES) * CHUNKS / (1024 * 1024);
+
+    struct Config {
+        const char* name;
+        ChunkService::Options options;
+    };
+    std::cout << "\n=== Chunk Engine Loopback Throughput (" << CHUNKS << " x " << CHUNK_BYTES / (1024 * 1024)
+              << " MB) ===" << std::endl;
+    for (const auto& config : {Config{"workers        ", {Engine::Workers}},
+                               Config{"io_uring       ", {Engine::Uring}},
+                               Config{"io_uring+direct", {Engine::Uring, true}}}) {
+        fs::remove_all(work_dir);
+        start(config.options);
+        ChunkClient client(address);
+
+        auto start_time = std::chrono::steady_clock::now();
+        for (int i = 0; i < CHUNKS; ++i) {
+            ASSERT_TRUE(put(client, "bench_" + std::to_string(i), data));
+        }
+        double put_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+        start_time = std::chrono::steady_clock::now();
+        for (int i = 0; i < CHUNKS; ++i) {
+            long long n = client.get("bench_" + std::to_string(i), 0, 0, [](const char*, size_t) { return true; });
+            ASSERT_EQ(n, static_cast<long long>(CHUNK_BYTES));
+        }
+        double get_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+        std::cout << config.name << std::fixed << std::setprecision(1) << "  PUT " << total_mb / put_s
+                  << " MB/s  GET " << total_mb / get_s << " MB/s" << std::endl;
+        stop();
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
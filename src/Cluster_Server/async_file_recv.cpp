@@ -1,219 +1,207 @@
 #include "../include/heart_beat_signal.hpp"
 #include "../include/system_info.hpp"
-#include <fstream>
-#include <filesystem>
+#include "./chunk_service.hpp"
+#include "./chunk_storage.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <thread>
 #include <chrono>
-#include <unordered_map>
-#include <mutex>
 
-namespace fs = std::filesystem;
-
-class ChunkStorage {
+class ClusterServerService {
 private:
-    std::string storage_path = "/tmp/cluster_storage/";
-    std::unordered_map<std::string, std::string> chunk_registry;
-    std::mutex registry_mutex;
-    
-    void ensure_storage_directory() {
-        fs::create_directories(storage_path);
-    }
-    
-    std::string generate_chunk_path(const std::string& chunk_id) {
-        return storage_path + "chunk_" + chunk_id + ".dat";
-    }
+    int server_id;
+    std::string server_ip;
+    int port;
+    ChunkStorage storage;
+    std::atomic<bool> running{false};
+    std::string health_checker_ip = "127.0.0.1";
+    int health_checker_port = 9000;
+    std::thread status_thread;
+    ChunkService* service = nullptr;
 
-public:
-    ChunkStorage() {
-        ensure_storage_directory();
-    }
-    
-    bool store_chunk(const std::string& chunk_id, const std::vector<char>& data) {
-        try {
-            std::string chunk_path = generate_chunk_path(chunk_id);
-            
-            std::ofstream file(chunk_path, std::ios::binary);
-            if (!file) {
-                std::cerr << "Failed to create chunk file: " << chunk_path << std::endl;
-                return false;
+    // The health checker reads one raw HeartBeat per UDP datagram.
+    async_hb::task<> heartbeat_sender(async_hb::Reactor& reactor) {
+        int sockfd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        sockaddr_in dest{};
+        if (sockfd < 0 || !async_hb::resolve_ipv4(health_checker_ip, static_cast<uint16_t>(health_checker_port), dest)) {
+            std::cerr << "Heartbeat sender disabled: cannot reach health checker" << std::endl;
+            if (sockfd >= 0) {
+                ::close(sockfd);
+            }
+            co_return;
+        }
+
+        heart_beat::v1::HeartBeat hb;
+        hb.set_server_id(server_id);
+        hb.set_ip(server_ip + ":" + std::to_string(port));
+        long cpus = std::max(1L, ::sysconf(_SC_NPROCESSORS_ONLN));
+        while (running) {
+            // Load average stands in for CPU usage; sampling /proc/stat
+            // would stall the reactor for a second.
+            double load[1] = {0};
+            if (::getloadavg(load, 1) == 1) {
+                hb.set_cpu_usage(static_cast<float>(std::min(100.0, load[0] * 100.0 / cpus)));
             }
-            
-            file.write(data.data(), data.size());
-            file.close();
-            
-            // Register chunk in memory
-            {
-                std::lock_guard<std::mutex> lock(registry_mutex);
-                chunk_registry[chunk_id] = chunk_path;
+            hb.set_total_storage_used(static_cast<float>(storage.get_storage_usage()) / (1024 * 1024));
+            *hb.mutable_timestamp() = google::protobuf::util::TimeUtil::GetCurrentTime();
+
+            std::string payload;
+            if (hb.SerializeToString(&payload) &&
+                ::sendto(sockfd, payload.data(), payload.size(), 0, reinterpret_cast<sockaddr*>(&dest),
+                         sizeof(dest)) < 0) {
+                std::cerr << "Failed to send heartbeat: " << std::strerror(errno) << std::endl;
             }
-            
-            std::cout << "Stored chunk " << chunk_id << " (" << data.size() << " bytes)" << std::endl;
-            return true;
-        } catch (const std::exception& e) {
-            std::cerr << "Error storing chunk " << chunk_id << ": " << e.what() << std::endl;
-            return false;
+            co_await reactor.sleep_for(std::chrono::seconds(30));
         }
+        ::close(sockfd);
     }
-    
-    std::vector<char> retrieve_chunk(const std::string& chunk_id) {
-        std::vector<char> data;
-        
-        try {
-            std::string chunk_path;
-            {
-                std::lock_guard<std::mutex> lock(registry_mutex);
-                auto it = chunk_registry.find(chunk_id);
-                if (it == chunk_registry.end()) {
-                    std::cerr << "Chunk " << chunk_id << " not found in registry" << std::endl;
-                    return data;
-                }
-                chunk_path = it->second;
+
+    // system_monitor() samples for a couple of seconds, so it runs off the
+    // reactor. The storage counters are re-measured against the disk hourly.
+    void report_status() {
+        int counter = 0;
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            if (++counter % 3600 == 0) {
+                storage.reconcile_usage();
             }
-            
-            std::ifstream file(chunk_path, std::ios::binary);
-            if (!file) {
-                std::cerr << "Failed to open chunk file: " << chunk_path << std::endl;
-                return data;
+            if (counter % 60 == 0) { // Every minute
+                auto usage = system_monitor();
+                std::cout << "Server " << server_id << " - CPU: " << usage.cpu_usage 
+                         << "%, RAM: " << usage.ram_usage << "%, Disk: " << usage.disk_usage << "%" << std::endl;
+                
+                auto stored = storage.usage();
+                std::cout << "Storage usage: " << stored.used_bytes / (1024*1024) << " MB in " << stored.chunk_count
+                          << " chunks, " << stored.disk_free_bytes / (1024*1024) << " MB free" << std::endl;
+                if (storage.disk_count() > 1) {
+                    auto by_disk = storage.usage_by_disk();
+                    for (size_t i = 0; i < by_disk.size(); ++i) {
+                        std::cout << "  " << storage.disk(i).path << ": " << by_disk[i].used_bytes / (1024*1024)
+                                  << " MB in " << by_disk[i].chunk_count << " chunks, "
+                                  << by_disk[i].disk_free_bytes / (1024*1024) << " MB free" << std::endl;
+                    }
+                }
             }
-            
-            // Get file size
-            file.seekg(0, std::ios::end);
-            size_t file_size = file.tellg();
-            file.seekg(0, std::ios::beg);
-            
-            data.resize(file_size);
-            file.read(data.data(), file_size);
-            file.close();
-            
-            std::cout << "Retrieved chunk " << chunk_id << " (" << data.size() << " bytes)" << std::endl;
-        } catch (const std::exception& e) {
-            std::cerr << "Error retrieving chunk " << chunk_id << ": " << e.what() << std::endl;
         }
-        
-        return data;
     }
-    
-    bool delete_chunk(const std::string& chunk_id) {
-        try {
-            std::string chunk_path;
-            {
-                std::lock_guard<std::mutex> lock(registry_mutex);
-                auto it = chunk_registry.find(chunk_id);
-                if (it == chunk_registry.end()) {
-                    return false;
+
+    // DFG_DATA_DIRS lists the data directories, one per disk, separated by
+    // ':'. Each server keeps its chunks in a server_<id> directory on each.
+    static std::vector<std::string> data_dirs(int id) {
+        std::string subdir = "server_" + std::to_string(id) + "/";
+        std::vector<std::string> dirs;
+        if (const char* list = std::getenv("DFG_DATA_DIRS")) {
+            std::stringstream ss(list);
+            std::string dir;
+            while (std::getline(ss, dir, ':')) {
+                if (!dir.empty()) {
+                    dirs.push_back(dir + (dir.back() == '/' ? "" : "/") + subdir);
                 }
-                chunk_path = it->second;
-                chunk_registry.erase(it);
             }
-            
-            fs::remove(chunk_path);
-            std::cout << "Deleted chunk " << chunk_id << std::endl;
-            return true;
-        } catch (const std::exception& e) {
-            std::cerr << "Error deleting chunk " << chunk_id << ": " << e.what() << std::endl;
-            return false;
         }
+        if (dirs.empty()) {
+            dirs.push_back("/tmp/cluster_storage/" + subdir);
+        }
+        return dirs;
     }
-    
-    std::vector<std::string> list_chunks() {
-        std::vector<std::string> chunks;
-        {
-            std::lock_guard<std::mutex> lock(registry_mutex);
-            for (const auto& [chunk_id, path] : chunk_registry) {
-                chunks.push_back(chunk_id);
-            }
+
+    // DFG_FANOUT_LEVELS sets the hashed subdirectory levels for chunk files
+    // (0 for one flat directory); changing it migrates the files at startup.
+    static DirectoryLayout directory_layout() {
+        DirectoryLayout layout;
+        if (const char* levels = std::getenv("DFG_FANOUT_LEVELS")) {
+            layout.levels = std::clamp(std::atoi(levels), 0, DirectoryLayout::MAX_LEVELS);
         }
-        return chunks;
+        return layout;
     }
-    
-    size_t get_storage_usage() {
-        size_t total_size = 0;
-        try {
-            for (const auto& entry : fs::recursive_directory_iterator(storage_path)) {
-                if (entry.is_regular_file()) {
-                    total_size += entry.file_size();
-                }
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "Error calculating storage usage: " << e.what() << std::endl;
+
+    // DFG_DURABILITY=none|chunk|group; group commit by default.
+    static Durability durability() {
+        const char* level = std::getenv("DFG_DURABILITY");
+        if (!level || std::strcmp(level, "group") == 0) {
+            return Durability::Group;
+        }
+        if (std::strcmp(level, "none") == 0) {
+            return Durability::None;
+        }
+        if (std::strcmp(level, "chunk") != 0) {
+            std::cerr << "Unknown DFG_DURABILITY " << level << ", syncing each chunk" << std::endl;
         }
-        return total_size;
+        return Durability::PerChunk;
     }
-};
 
-class ClusterServerService {
-private:
-    ChunkStorage storage;
-    int server_id;
-    std::string server_ip;
-    int port;
-    bool running = false;
-    
-    async_hb::task heartbeat_sender(async_hb::Reactor& reactor) {
-        while (running) {
-            try {
-                // Send heartbeat to head server
-                int result = async_hb::send_signal("127.0.0.1", server_id, 9000);
-                if (result < 0) {
-                    std::cerr << "Failed to send heartbeat" << std::endl;
-                }
-            } catch (const std::exception& e) {
-                std::cerr << "Heartbeat error: " << e.what() << std::endl;
+    // DFG_IO_ENGINE=uring moves chunk data through io_uring instead of the
+    // disk workers; DFG_DIRECT_IO=1 adds O_DIRECT to it.
+    static ChunkService::Options chunk_service_options() {
+        ChunkService::Options options;
+        if (const char* engine = std::getenv("DFG_IO_ENGINE")) {
+            if (std::strcmp(engine, "uring") == 0) {
+                options.engine = ChunkService::Options::Engine::Uring;
+            } else if (std::strcmp(engine, "workers") != 0) {
+                std::cerr << "Unknown DFG_IO_ENGINE " << engine << ", using the disk workers" << std::endl;
             }
-            
-            // Sleep outside the try-catch to avoid nested co_await
-            co_await reactor.sleep_for(std::chrono::seconds(30));
         }
+        if (const char* direct = std::getenv("DFG_DIRECT_IO")) {
+            options.direct_io = std::strcmp(direct, "1") == 0;
+        }
+        return options;
     }
-    
-    async_hb::task chunk_server(async_hb::Reactor& reactor) {
-        // Simple chunk server implementation
-        // In a real implementation, this would be an HTTP/gRPC server
-        std::cout << "Chunk server started on port " << port << std::endl;
-        
-        while (running) {
-            // Simulate chunk operations
-            co_await reactor.sleep_for(std::chrono::seconds(1));
-            
-            // Report system status periodically
-            static int counter = 0;
-            if (++counter % 60 == 0) { // Every minute
-                auto usage = system_monitor();
-                std::cout << "Server " << server_id << " - CPU: " << usage.cpu_usage 
-                         << "%, RAM: " << usage.ram_usage << "%, Disk: " << usage.disk_usage << "%" << std::endl;
-                
-                size_t storage_usage = storage.get_storage_usage();
-                std::cout << "Storage usage: " << storage_usage / (1024*1024) << " MB" << std::endl;
-            }
+
+    // DFG_REACTOR_THREADS sets how many threads serve connections; one per
+    // core by default.
+    static size_t reactor_threads() {
+        if (const char* threads = std::getenv("DFG_REACTOR_THREADS")) {
+            return static_cast<size_t>(std::max(1, std::atoi(threads)));
         }
+        return std::max(1u, std::thread::hardware_concurrency());
     }
 
 public:
     ClusterServerService(int id, const std::string& ip, int p) 
-        : server_id(id), server_ip(ip), port(p) {}
+        : server_id(id), server_ip(ip), port(p), storage(data_dirs(id), directory_layout(), durability()) {}
     
+    ~ClusterServerService() {
+        running = false;
+        if (status_thread.joinable()) {
+            status_thread.join();
+        }
+    }
+
     void start() {
         running = true;
         std::cout << "Starting Cluster Server " << server_id << " on " << server_ip << ":" << port << std::endl;
         
-        async_hb::Reactor reactor;
+        async_hb::Runtime runtime(reactor_threads());
+        auto& reactor = runtime.reactor(0);
+        ChunkService chunks(reactor, storage, chunk_service_options());
+        if (!chunks.listen(server_ip, port)) {
+            throw std::runtime_error("cannot listen on " + server_ip + ":" + std::to_string(port));
+        }
+        service = &chunks;
         
         // Start heartbeat sender
         reactor.spawn(heartbeat_sender(reactor));
         
         // Start chunk server
-        reactor.spawn(chunk_server(reactor));
+        chunks.start();
+        status_thread = std::thread([this] { report_status(); });
         
-        // Run the reactor
-        reactor.run();
+        // Run the reactor threads
+        runtime.run();
+        service = nullptr;
     }
     
     void stop() {
         running = false;
+        if (service) {
+            service->stop();
+        }
         std::cout << "Stopping Cluster Server " << server_id << std::endl;
     }
     
@@ -0,0 +1,425 @@
+#pragma once
+
+#include "../include/checksum.hpp"
+#include "../include/worker_pool.hpp"
+#include "./directory_layout.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Persistent index of the chunks in one storage directory, so a restarted
+// cluster server knows what it holds without touching every chunk file.
+//
+// It is log-structured: a snapshot of every chunk plus an append-only log of
+// the adds and removes since then. Startup loads the snapshot and replays
+// the log; compact() folds the log into a new snapshot. Both files hold the
+// same records, in native byte order:
+//
+//   [u32 crc][u8 op][u8 id_len][u64 size][chunk id]
+//
+// where crc is the CRC32C of the rest of the record. A torn record at the end
+// of the log (a crash mid-append) is dropped. The snapshot starts with
+// [u32 magic][u32 version][u64 count] and is replaced atomically by rename.
+//
+// Appends are thread-safe. A live server compacts without stopping writers:
+// rotate_log() moves the log aside, the caller collects its entries while
+// new records go to a fresh log, and finish_compaction() writes the snapshot
+// and drops the old log. Replaying the fresh log over that snapshot is
+// harmless because the last record for each chunk decides its state.
+//
+// With no index at all (first start, or an unreadable snapshot) scan() lists
+// the directory, including any fan-out subdirectories (see
+// directory_layout.hpp), and stats the chunk files on several threads.
+class ChunkIndex {
+public:
+    struct Entry {
+        std::string chunk_id;
+        uint64_t size;
+    };
+
+    static constexpr uint32_t MAGIC = 0x49474644; // "DFGI"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t SNAPSHOT_HEADER_SIZE = 16;
+    static constexpr size_t RECORD_HEADER_SIZE = 4 + 1 + 1 + 8;
+
+    // `dir` is the storage directory, with a trailing '/'.
+    explicit ChunkIndex(std::string dir)
+        : snapshot_path(dir + "chunk_index.snap"), log_path(dir + "chunk_index.log"),
+          old_log_path(dir + "chunk_index.log.old") {}
+
+    ~ChunkIndex() {
+        if (log_fd >= 0) {
+            ::close(log_fd);
+        }
+    }
+
+    ChunkIndex(const ChunkIndex&) = delete;
+    ChunkIndex& operator=(const ChunkIndex&) = delete;
+
+    // Snapshot plus replayed log, or std::nullopt if there is no usable
+    // index and the directory has to be scanned.
+    std::optional<std::vector<Entry>> load() {
+        // The first start writes a snapshot, so without one the log alone
+        // is only a partial history.
+        std::vector<char> snapshot, log;
+        if (!read_file(snapshot_path, snapshot)) {
+            return std::nullopt;
+        }
+        std::unordered_map<std::string, uint64_t> chunks;
+        if (!parse_snapshot(snapshot, chunks)) {
+            std::cerr << "Chunk index snapshot " << snapshot_path << " is corrupt, rescanning" << std::endl;
+            return std::nullopt;
+        }
+
+        // A rotated log is left behind if a compaction did not finish
+        std::vector<char> old_log;
+        std::lock_guard<std::mutex> lock(mutex);
+        log_count = 0;
+        interrupted = read_file(old_log_path, old_log);
+        if (interrupted) {
+            replay(old_log, chunks, 0, &log_count);
+        }
+        read_file(log_path, log);
+        size_t good = replay(log, chunks, 0, &log_count);
+        if (good < log.size()) {
+            std::cerr << "Dropping torn chunk index log tail (" << log.size() - good << " bytes)" << std::endl;
+            if (::truncate(log_path.c_str(), static_cast<off_t>(good)) < 0) {
+                std::cerr << "Failed to truncate " << log_path << ": " << std::strerror(errno) << std::endl;
+            }
+        }
+
+        std::vector<Entry> entries;
+        entries.reserve(chunks.size());
+        for (auto& [id, size] : chunks) {
+            entries.push_back(Entry{id, size});
+        }
+        return entries;
+    }
+
+    // Paths, relative to `dir`, of the chunk files in it and in its fan-out
+    // subdirectories, whatever layout each file is in.
+    static std::vector<std::string> list(const std::string& dir) {
+        std::vector<std::string> names;
+        list_into(dir, "", names);
+        return names;
+    }
+
+    // Id of the chunk stored at `name`, a path from list().
+    static std::string chunk_id_of(const std::string& name) {
+        size_t base = name.rfind('/') + 1; // npos + 1 == 0
+        return name.substr(base + PREFIX_LEN, name.size() - base - PREFIX_LEN - SUFFIX_LEN);
+    }
+
+    // Lists every chunk file under `dir`, statting them on `threads` threads.
+    static std::vector<Entry> scan(const std::string& dir, size_t threads) {
+        std::vector<std::string> names = list(dir);
+        DIR* d = ::opendir(dir.c_str());
+        if (!d) {
+            return {};
+        }
+        int dir_fd = ::dirfd(d);
+
+        std::vector<Entry> entries(names.size());
+        std::vector<char> found(names.size(), 0);
+        {
+            WorkerPool pool(std::min(std::max<size_t>(threads, 1), std::max<size_t>(names.size() / 1024, 1)));
+            size_t per_job = (names.size() + pool.size() - 1) / pool.size();
+            for (size_t begin = 0; begin < names.size(); begin += per_job) {
+                size_t end = std::min(names.size(), begin + per_job);
+                pool.submit([&, begin, end] {
+                    for (size_t i = begin; i < end; ++i) {
+                        struct stat st{};
+                        if (::fstatat(dir_fd, names[i].c_str(), &st, 0) == 0 && S_ISREG(st.st_mode)) {
+                            entries[i].chunk_id = chunk_id_of(names[i]);
+                            entries[i].size = static_cast<uint64_t>(st.st_size);
+                            found[i] = 1;
+                        }
+                    }
+                });
+            }
+            pool.wait_idle();
+        }
+        ::closedir(d);
+
+        size_t kept = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (!found[i]) {
+                continue;
+            }
+            if (kept != i) {
+                entries[kept] = std::move(entries[i]);
+            }
+            ++kept;
+        }
+        entries.resize(kept);
+        return entries;
+    }
+
+    bool added(const std::string& chunk_id, uint64_t size) { return append(OP_ADD, chunk_id, size); }
+
+    bool removed(const std::string& chunk_id) { return append(OP_REMOVE, chunk_id, 0); }
+
+    // Makes the records appended so far durable.
+    bool sync() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return log_fd < 0 || ::fdatasync(log_fd) == 0;
+    }
+
+    // True if load() found the rotated log of an unfinished compaction;
+    // compact() clears it.
+    bool interrupted_compaction() const { return interrupted; }
+
+    // Records in the log, i.e. since the last snapshot.
+    size_t log_records() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return log_count;
+    }
+
+    // Writes `entries` as the new snapshot and empties the logs. The caller
+    // must not append concurrently (used at startup).
+    bool compact(const std::vector<Entry>& entries) {
+        if (!write_snapshot(entries)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ::unlink(old_log_path.c_str());
+        interrupted = false;
+        if (log_fd >= 0) {
+            ::close(log_fd);
+        }
+        log_fd = ::open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        log_count = 0;
+        return log_fd >= 0;
+    }
+
+    // First half of an online compaction: later records start a new log.
+    // Fails if an earlier compaction never finished, since its rotated log
+    // would be overwritten; the next startup folds it in.
+    bool rotate_log() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (::access(old_log_path.c_str(), F_OK) == 0) {
+            return false;
+        }
+        if (::rename(log_path.c_str(), old_log_path.c_str()) < 0 && errno != ENOENT) {
+            std::cerr << "Failed to rotate chunk index log: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (log_fd >= 0) {
+            ::close(log_fd);
+            log_fd = -1;
+        }
+        log_count = 0;
+        return true;
+    }
+
+    // Second half: `entries` must have been collected after rotate_log().
+    bool finish_compaction(const std::vector<Entry>& entries) {
+        if (!write_snapshot(entries)) {
+            return false;
+        }
+        ::unlink(old_log_path.c_str());
+        return true;
+    }
+
+private:
+    static constexpr uint8_t OP_ADD = 1;
+    static constexpr uint8_t OP_REMOVE = 2;
+    static constexpr size_t PREFIX_LEN = 6; // "chunk_"
+    static constexpr size_t SUFFIX_LEN = 4; // ".dat"
+    static constexpr size_t WRITE_BATCH = 1 << 20;
+
+    static void list_into(const std::string& dir, const std::string& prefix, std::vector<std::string>& names) {
+        DIR* d = ::opendir((dir + prefix).c_str());
+        if (!d) {
+            return;
+        }
+        std::vector<std::string> subdirs;
+        while (dirent* e = ::readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() > PREFIX_LEN + SUFFIX_LEN && name.compare(0, PREFIX_LEN, "chunk_") == 0 &&
+                name.compare(name.size() - SUFFIX_LEN, SUFFIX_LEN, ".dat") == 0) {
+                names.push_back(prefix + name);
+            } else if (DirectoryLayout::is_fanout_dir(e->d_name) &&
+                       prefix.size() < 3 * DirectoryLayout::MAX_LEVELS) {
+                subdirs.push_back(prefix + name + "/");
+            }
+        }
+        ::closedir(d);
+        for (const auto& sub : subdirs) {
+            list_into(dir, sub, names);
+        }
+    }
+
+    bool write_snapshot(const std::vector<Entry>& entries) {
+        std::string tmp = snapshot_path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "Failed to write chunk index snapshot: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        std::vector<char> buf(SNAPSHOT_HEADER_SIZE);
+        uint32_t magic = MAGIC, version = VERSION;
+        uint64_t count = entries.size();
+        std::memcpy(buf.data(), &magic, 4);
+        std::memcpy(buf.data() + 4, &version, 4);
+        std::memcpy(buf.data() + 8, &count, 8);
+        bool ok = true;
+        for (const auto& e : entries) {
+            encode(buf, OP_ADD, e.chunk_id, e.size);
+            if (buf.size() >= WRITE_BATCH) {
+                ok = ok && write_all(fd, buf.data(), buf.size());
+                buf.clear();
+            }
+        }
+        ok = ok && write_all(fd, buf.data(), buf.size());
+        // Complete on disk before it replaces the old snapshot
+        ok = ok && ::fdatasync(fd) == 0;
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || ::rename(tmp.c_str(), snapshot_path.c_str()) < 0) {
+            std::cerr << "Failed to write chunk index snapshot: " << std::strerror(errno) << std::endl;
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static void encode(std::vector<char>& out, uint8_t op, const std::string& chunk_id, uint64_t size) {
+        size_t at = out.size();
+        out.resize(at + RECORD_HEADER_SIZE + chunk_id.size());
+        char* p = out.data() + at;
+        p[4] = static_cast<char>(op);
+        p[5] = static_cast<char>(static_cast<uint8_t>(chunk_id.size()));
+        std::memcpy(p + 6, &size, 8);
+        std::memcpy(p + RECORD_HEADER_SIZE, chunk_id.data(), chunk_id.size());
+        uint32_t crc = checksum::crc32c(0, p + 4, RECORD_HEADER_SIZE - 4 + chunk_id.size());
+        std::memcpy(p, &crc, 4);
+    }
+
+    // Applies records from data[pos..]; returns the offset after the last
+    // intact record.
+    static size_t replay(const std::vector<char>& data, std::unordered_map<std::string, uint64_t>& chunks,
+                         size_t pos = 0, size_t* applied = nullptr) {
+        while (pos + RECORD_HEADER_SIZE <= data.size()) {
+            const char* p = data.data() + pos;
+            size_t id_len = static_cast<uint8_t>(p[5]);
+            if (pos + RECORD_HEADER_SIZE + id_len > data.size()) {
+                break;
+            }
+            uint32_t crc;
+            std::memcpy(&crc, p, 4);
+            if (crc != checksum::crc32c(0, p + 4, RECORD_HEADER_SIZE - 4 + id_len)) {
+                break;
+            }
+            uint64_t size;
+            std::memcpy(&size, p + 6, 8);
+            std::string id(p + RECORD_HEADER_SIZE, id_len);
+            if (p[4] == OP_ADD) {
+                chunks[std::move(id)] = size;
+            } else {
+                chunks.erase(id);
+            }
+            pos += RECORD_HEADER_SIZE + id_len;
+            if (applied) {
+                ++*applied;
+            }
+        }
+        return pos;
+    }
+
+    static bool parse_snapshot(const std::vector<char>& data, std::unordered_map<std::string, uint64_t>& chunks) {
+        if (data.size() < SNAPSHOT_HEADER_SIZE) {
+            return false;
+        }
+        uint32_t magic, version;
+        uint64_t count;
+        std::memcpy(&magic, data.data(), 4);
+        std::memcpy(&version, data.data() + 4, 4);
+        std::memcpy(&count, data.data() + 8, 8);
+        if (magic != MAGIC || version != VERSION) {
+            return false;
+        }
+        chunks.reserve(count);
+        size_t applied = 0;
+        size_t end = replay(data, chunks, SNAPSHOT_HEADER_SIZE, &applied);
+        return end == data.size() && applied == count;
+    }
+
+    bool append(uint8_t op, const std::string& chunk_id, uint64_t size) {
+        std::vector<char> record;
+        encode(record, op, chunk_id, size);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (log_fd < 0) {
+            log_fd = ::open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (log_fd < 0) {
+                std::cerr << "Failed to open chunk index log: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        // O_APPEND keeps each record contiguous
+        if (!write_all(log_fd, record.data(), record.size())) {
+            std::cerr << "Failed to append to chunk index log: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        ++log_count;
+        return true;
+    }
+
+    static bool read_file(const std::string& path, std::vector<char>& out) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st{};
+        bool ok = ::fstat(fd, &st) == 0;
+        if (ok) {
+            out.resize(static_cast<size_t>(st.st_size));
+            size_t got = 0;
+            while (ok && got < out.size()) {
+                ssize_t n = ::read(fd, out.data() + got, out.size() - got);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                ok = n > 0;
+                got += ok ? static_cast<size_t>(n) : 0;
+            }
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    static bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::string snapshot_path;
+    std::string log_path;
+    std::string old_log_path;
+    // Guards the log descriptor and count.
+    mutable std::mutex mutex;
+    int log_fd = -1;
+    size_t log_count = 0;
+    bool interrupted = false;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct RegisteredChunk {
+    std::string path;
+    uint64_t size;
+    uint32_t disk = 0; // index of the ChunkStorage data directory holding it
+};
+
+// Chunk id -> file map of a ChunkStorage. It is lock-striped like the head
+// server's InMemoryMetadataStore: each id hashes to one of `shards` buckets
+// guarded by its own shared_mutex. Lookups take only a shared lock on one
+// shard, so readers never wait on each other and only wait on a writer of
+// the same shard. Iteration visits one shard at a time and never stalls
+// the whole registry.
+//
+// Mutations accept a hook that runs under the shard lock. Anything the hook
+// records (index log, usage counters) is therefore ordered the same way as
+// the registry itself for each id.
+class ChunkRegistry {
+public:
+    explicit ChunkRegistry(size_t shards = 64) {
+        while (shard_count < shards) {
+            shard_count <<= 1; // power of two for cheap masking
+        }
+        shards_ = std::make_unique<Shard[]>(shard_count);
+    }
+
+    ChunkRegistry(const ChunkRegistry&) = delete;
+    ChunkRegistry& operator=(const ChunkRegistry&) = delete;
+
+    bool find(const std::string& chunk_id, RegisteredChunk& out) const {
+        auto& sh = shard(chunk_id);
+        std::shared_lock<std::shared_mutex> lock(sh.mutex);
+        auto it = sh.chunks.find(chunk_id);
+        if (it == sh.chunks.end()) {
+            return false;
+        }
+        out = it->second;
+        return true;
+    }
+
+    bool contains(const std::string& chunk_id) const {
+        auto& sh = shard(chunk_id);
+        std::shared_lock<std::shared_mutex> lock(sh.mutex);
+        return sh.chunks.count(chunk_id) != 0;
+    }
+
+    // Inserts or replaces a chunk. `hook(previous)` runs under the shard
+    // lock; previous is nullptr for a new chunk.
+    template <typename Hook>
+    void upsert(const std::string& chunk_id, RegisteredChunk chunk, Hook&& hook) {
+        auto& sh = shard(chunk_id);
+        std::unique_lock<std::shared_mutex> lock(sh.mutex);
+        auto it = sh.chunks.find(chunk_id);
+        if (it == sh.chunks.end()) {
+            hook(static_cast<const RegisteredChunk*>(nullptr));
+            sh.chunks.emplace(chunk_id, std::move(chunk));
+            count.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            hook(static_cast<const RegisteredChunk*>(&it->second));
+            it->second = std::move(chunk);
+        }
+    }
+
+    // Removes a chunk, running `hook(removed)` under the shard lock first.
+    // Returns false if the chunk was not registered.
+    template <typename Hook>
+    bool erase(const std::string& chunk_id, Hook&& hook) {
+        auto& sh = shard(chunk_id);
+        std::unique_lock<std::shared_mutex> lock(sh.mutex);
+        auto it = sh.chunks.find(chunk_id);
+        if (it == sh.chunks.end()) {
+            return false;
+        }
+        hook(static_cast<const RegisteredChunk&>(it->second));
+        sh.chunks.erase(it);
+        count.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Visits every chunk, one shard at a time under its shared lock. Each
+    // shard is seen consistently; chunks added or removed in other shards
+    // meanwhile may or may not be included.
+    void for_each(const std::function<void(const std::string&, const RegisteredChunk&)>& fn) const {
+        for (size_t i = 0; i < shard_count; ++i) {
+            std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+            for (const auto& [id, chunk] : shards_[i].chunks) {
+                fn(id, chunk);
+            }
+        }
+    }
+
+    // As for_each(), but under the exclusive lock so chunks can be updated.
+    void update_each(const std::function<void(const std::string&, RegisteredChunk&)>& fn) {
+        for (size_t i = 0; i < shard_count; ++i) {
+            std::unique_lock<std::shared_mutex> lock(shards_[i].mutex);
+            for (auto& [id, chunk] : shards_[i].chunks) {
+                fn(id, chunk);
+            }
+        }
+    }
+
+    std::vector<std::string> ids() const {
+        std::vector<std::string> out;
+        out.reserve(size());
+        for_each([&](const std::string& id, const RegisteredChunk&) { out.push_back(id); });
+        return out;
+    }
+
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+    // Bulk load before the registry is shared; takes no locks.
+    void load(const std::string& chunk_id, RegisteredChunk chunk) {
+        auto& sh = shard(chunk_id);
+        if (sh.chunks.insert_or_assign(chunk_id, std::move(chunk)).second) {
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    // Padded so neighbouring shard locks don't share a cache line.
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, RegisteredChunk> chunks;
+    };
+
+    Shard& shard(const std::string& chunk_id) const {
+        return shards_[std::hash<std::string>{}(chunk_id) & (shard_count - 1)];
+    }
+
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_count = 1;
+    std::atomic<size_t> count{0};
+};
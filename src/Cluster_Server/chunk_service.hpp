@@ -0,0 +1,505 @@
+#pragma once
+
+#include "../include/chunk_protocol.hpp"
+#include "../include/uring.hpp"
+#include "./chunk_storage.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// Serves the chunk protocol (see chunk_protocol.hpp) out of a ChunkStorage
+// on an async_hb::Reactor. Each connection is one coroutine that handles
+// requests back to back; on a reactor of an async_hb::Runtime connections
+// spread over its worker threads. Chunk bytes are spliced from the socket into the
+// chunk file on PUT and sent with sendfile() on GET, so they never pass
+// through user space. The file side of both runs on the I/O worker of the
+// chunk's disk, so a slow disk never stalls the reactor.
+//
+// The io_uring engine instead moves each slice through one of the ring's
+// registered buffers: socket reads and writes wait on the reactor as usual,
+// file reads and writes are ring operations whose completions the reactor
+// sees on an eventfd. Two buffers per transfer keep the disk and the socket
+// busy at once, and O_DIRECT can keep chunk data out of the page cache.
+class ChunkService {
+public:
+    struct Options {
+        enum class Engine {
+            Workers, // splice()/sendfile() on the disks' I/O workers
+            Uring,   // io_uring on the reactor's thread
+        };
+        Engine engine = Engine::Workers;
+        // Uring only: open chunk files with O_DIRECT.
+        bool direct_io = false;
+        unsigned ring_entries = 256;
+        // IO_SLICE_SIZE each; a transfer takes two, and falls back to the
+        // workers when none are left.
+        size_t ring_buffers = 64;
+    };
+
+    ChunkService(async_hb::Reactor& reactor, ChunkStorage& storage) : ChunkService(reactor, storage, Options{}) {}
+
+    ChunkService(async_hb::Reactor& reactor, ChunkStorage& storage, Options options)
+        : reactor(reactor), storage(storage), options(options) {
+        if (options.engine == Options::Engine::Uring && reactor.runtime()) {
+            // A ring belongs to one thread; connections move between workers
+            std::cerr << "io_uring needs a single-threaded reactor, using the disk workers" << std::endl;
+        } else if (options.engine == Options::Engine::Uring) {
+            ring = std::make_unique<async_hb::Uring>(reactor, options.ring_entries, options.ring_buffers,
+                                                     IO_SLICE_SIZE);
+            if (!ring->ok()) {
+                std::cerr << "io_uring unavailable (" << std::strerror(ring->error())
+                          << "), using the disk workers" << std::endl;
+                ring.reset();
+            }
+        }
+    }
+
+    ~ChunkService() {
+        if (listen_fd >= 0) {
+            ::close(listen_fd);
+        }
+    }
+
+    ChunkService(const ChunkService&) = delete;
+    ChunkService& operator=(const ChunkService&) = delete;
+
+    // Port 0 binds an ephemeral port; port() reports the one chosen.
+    bool listen(const std::string& ip, int port) {
+        sockaddr_in addr{};
+        if (!async_hb::resolve_ipv4(ip, static_cast<uint16_t>(port), addr)) {
+            std::cerr << "Could not resolve chunk service address " << ip << std::endl;
+            return false;
+        }
+        listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (listen_fd < 0) {
+            std::cerr << "Chunk service socket failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        int yes = 1;
+        ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            ::listen(listen_fd, SOMAXCONN) < 0) {
+            std::cerr << "Chunk service bind/listen on " << ip << ":" << port
+                      << " failed: " << std::strerror(errno) << std::endl;
+            ::close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        socklen_t len = sizeof(addr);
+        ::getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        bound_port = ntohs(addr.sin_port);
+        return true;
+    }
+
+    int port() const { return bound_port; }
+
+    // False if the io_uring engine was asked for but could not be set up.
+    bool using_uring() const { return ring != nullptr; }
+
+    void start() {
+        running = true;
+        reactor.spawn(accept_loop());
+    }
+
+    // Safe to call from any thread. The accept loop exits at once; open
+    // connections finish when their clients disconnect.
+    void stop() {
+        running = false;
+        if (listen_fd >= 0) {
+            ::shutdown(listen_fd, SHUT_RDWR);
+        }
+    }
+
+private:
+    enum class Io { Done, Again, Closed, Failed };
+
+    static Io recv_exact(int fd, uint8_t* buf, size_t want, size_t& got) {
+        while (got < want) {
+            ssize_t n = ::recv(fd, buf + got, want - got, 0);
+            if (n > 0) {
+                got += static_cast<size_t>(n);
+            } else if (n == 0) {
+                return Io::Closed;
+            } else if (errno != EINTR) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? Io::Again : Io::Failed;
+            }
+        }
+        return Io::Done;
+    }
+
+    static Io send_exact(int fd, const uint8_t* buf, size_t len, size_t& sent) {
+        while (sent < len) {
+            ssize_t n = ::send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                sent += static_cast<size_t>(n);
+            } else if (n < 0 && errno != EINTR) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? Io::Again : Io::Failed;
+            }
+        }
+        return Io::Done;
+    }
+
+    async_hb::task<> accept_loop() {
+        std::cout << "Chunk service listening on port " << bound_port << std::endl;
+        bool watched = reactor.watch(listen_fd);
+        while (running) {
+            int cfd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (cfd >= 0) {
+                chunk_proto::tune_socket(cfd);
+                reactor.spawn(serve(cfd));
+                continue;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                co_await reactor.wait_readable(listen_fd);
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                // Out of descriptors: back off instead of spinning on accept
+                co_await reactor.sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            if (running) {
+                std::cerr << "Chunk service accept failed: " << std::strerror(errno) << std::endl;
+            }
+            break;
+        }
+        if (watched) {
+            reactor.unwatch(listen_fd);
+        }
+        std::cout << "Chunk service stopped accepting" << std::endl;
+    }
+
+    async_hb::task<> serve(int fd) {
+        using chunk_proto::Op;
+        using chunk_proto::Status;
+        constexpr size_t PREFIX = async_hb::FRAME_PREFIX_SIZE;
+        uint8_t head[PREFIX + chunk_proto::MAX_HEADER_BODY];
+        // Requests alternate reads and writes; edge-triggered, neither re-arms
+        bool watched = reactor.watch(fd);
+
+        while (true) {
+            Io io;
+            size_t got = 0;
+            while ((io = recv_exact(fd, head, PREFIX, got)) == Io::Again) {
+                co_await reactor.wait_readable(fd);
+            }
+            if (io != Io::Done) {
+                break;
+            }
+            uint32_t body_len = async_hb::get_frame_length(head);
+            if (body_len > chunk_proto::MAX_HEADER_BODY) {
+                std::cerr << "Chunk service: oversized header (" << body_len << " bytes)" << std::endl;
+                break;
+            }
+            got = 0;
+            while ((io = recv_exact(fd, head + PREFIX, body_len, got)) == Io::Again) {
+                co_await reactor.wait_readable(fd);
+            }
+            chunk_proto::Header req;
+            if (io != Io::Done || !chunk_proto::decode_header(head + PREFIX, body_len, req)) {
+                break;
+            }
+
+            chunk_proto::Header resp;
+            resp.op = req.op;
+            resp.chunk_id = req.chunk_id;
+            // Sent after the header: the LIST reply or a GET's CRC frame
+            std::string payload;
+            ChunkFile file;
+            // A failed PUT leaves unread data in the stream, so the
+            // connection cannot carry another request.
+            bool keep_open = true;
+
+            if (req.op != Op::List && !chunk_proto::valid_chunk_id(req.chunk_id)) {
+                resp.status = Status::Error;
+                keep_open = req.op != Op::Put;
+            } else if (req.op == Op::Put) {
+                // Shared with disk jobs, whose worker may outlive this coroutine
+                std::shared_ptr<IncomingChunk> incoming = storage.begin_chunk(req.chunk_id, ring && options.direct_io);
+                async_hb::Uring::Buffer slices[2];
+                if (incoming && ring) {
+                    slices[0] = ring->acquire_buffer();
+                    slices[1] = ring->acquire_buffer();
+                }
+                if (slices[1]) {
+                    // Receive into one buffer while the ring writes out the other
+                    int cur = 0;
+                    size_t fill = 0;     // received into slices[cur]
+                    uint64_t queued = 0; // handed to the ring
+                    async_hb::Uring::Op write;
+                    size_t write_len = 0, write_bytes = 0;
+                    while (queued < req.length) {
+                        if (fill < IO_SLICE_SIZE && queued + fill < req.length) {
+                            size_t want = static_cast<size_t>(
+                                std::min<uint64_t>(IO_SLICE_SIZE - fill, req.length - queued - fill));
+                            ssize_t n = ::recv(fd, slices[cur].data() + fill, want, 0);
+                            if (n > 0) {
+                                fill += static_cast<size_t>(n);
+                            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                                co_await reactor.wait_readable(fd);
+                            } else if (n == 0 || errno != EINTR) {
+                                break;
+                            }
+                            continue;
+                        }
+                        // Slice complete: let the previous write finish, then queue this one
+                        if (write_len > 0) {
+                            int r = co_await write;
+                            if (r != static_cast<int>(write_len)) {
+                                std::cerr << "io_uring write failed for chunk " << req.chunk_id << ": "
+                                          << std::strerror(r < 0 ? -r : EIO) << std::endl;
+                                write_len = 0;
+                                break;
+                            }
+                            incoming->wrote(write_bytes);
+                        }
+                        write_bytes = fill;
+                        write_len = incoming->direct() ? (fill + 4095) / 4096 * 4096 : fill;
+                        std::memset(slices[cur].data() + fill, 0, write_len - fill);
+                        write = ring->write(incoming->fd(), slices[cur], write_len, queued);
+                        queued += fill;
+                        fill = 0;
+                        cur ^= 1;
+                    }
+                    // Also on failure: the buffer must not go back to the ring mid-write
+                    if (write_len > 0 && co_await write == static_cast<int>(write_len)) {
+                        incoming->wrote(write_bytes);
+                    }
+                }
+                while (incoming && !slices[1] && incoming->received() < req.length) {
+                    // Fill the pipe up to a slice, then write it out on the disk's worker
+                    uint64_t left = req.length - incoming->received() - incoming->buffered();
+                    size_t room = IO_SLICE_SIZE - incoming->buffered();
+                    ssize_t n = left > 0 && room > 0
+                                    ? incoming->fill_from(fd, static_cast<size_t>(std::min<uint64_t>(room, left)))
+                                    : 0;
+                    if (n > 0 && static_cast<uint64_t>(n) < left && static_cast<size_t>(n) < room) {
+                        continue;
+                    }
+                    if (n < 0 || incoming->eof()) {
+                        break;
+                    }
+                    if (incoming->buffered() > 0) {
+                        DiskJob flush(&incoming->disk(), [in = incoming] { return in->flush() ? 0 : -1; });
+                        if (flush.fd() >= 0) {
+                            co_await reactor.wait_readable(flush.fd());
+                        }
+                        if (flush.result() < 0) {
+                            break;
+                        }
+                        continue;
+                    }
+                    co_await reactor.wait_readable(fd);
+                }
+                bool received = incoming && incoming->received() == req.length;
+                if (received && (req.flags & chunk_proto::FLAG_BLOCK_CRCS)) {
+                    // Block CRC trailer: small enough to buffer (4 bytes per 64KB)
+                    size_t count = chunk_proto::block_count(req.length);
+                    std::vector<uint8_t> trailer(PREFIX + 4 * count);
+                    got = 0;
+                    while ((io = recv_exact(fd, trailer.data(), PREFIX, got)) == Io::Again) {
+                        co_await reactor.wait_readable(fd);
+                    }
+                    received = io == Io::Done && async_hb::get_frame_length(trailer.data()) == 4 * count;
+                    got = 0;
+                    while (received && (io = recv_exact(fd, trailer.data() + PREFIX, 4 * count, got)) == Io::Again) {
+                        co_await reactor.wait_readable(fd);
+                    }
+                    checksum::ChunkDigest digest;
+                    digest.size = req.length;
+                    received = received && io == Io::Done &&
+                               chunk_proto::decode_block_crcs(trailer.data() + PREFIX, 4 * count, count, digest.blocks);
+                    for (size_t b = 0; received && b < count; ++b) {
+                        size_t len = std::min<uint64_t>(checksum::BLOCK_SIZE, req.length - b * checksum::BLOCK_SIZE);
+                        digest.crc = b == 0 ? digest.blocks[0] : checksum::crc32c_combine(digest.crc, digest.blocks[b], len);
+                    }
+                    if (received) {
+                        incoming->set_digest(std::move(digest));
+                    }
+                }
+                if (received) {
+                    // Commit waits for the chunk to be durable, off the reactor
+                    DiskJob commit(storage.commit_workers(), [in = incoming] { return in->commit() ? 0 : -1; });
+                    if (commit.fd() >= 0) {
+                        co_await reactor.wait_readable(commit.fd());
+                    }
+                    received = commit.result() == 0;
+                }
+                if (received) {
+                    resp.length = req.length;
+                    std::cout << "Stored chunk " << req.chunk_id << " (" << req.length << " bytes)" << std::endl;
+                } else {
+                    resp.status = Status::Error;
+                    keep_open = false;
+                }
+            } else if (req.op == Op::Get) {
+                file = storage.open_chunk(req.chunk_id, ring && options.direct_io);
+                if (!file) {
+                    resp.status = Status::NotFound;
+                } else {
+                    resp.offset = std::min<uint64_t>(req.offset, file.size());
+                    uint64_t available = file.size() - resp.offset;
+                    resp.length = req.length == 0 ? available : std::min(req.length, available);
+                    if (req.flags & chunk_proto::FLAG_BLOCK_CRCS) {
+                        // Widen to whole blocks so the client can verify them
+                        uint64_t end = resp.offset + resp.length;
+                        size_t first = resp.offset / checksum::BLOCK_SIZE;
+                        size_t last = chunk_proto::block_count(end);
+                        std::vector<uint32_t> crcs;
+                        auto crc_status = storage.block_checksums(req.chunk_id, file.size(), first, last - first, crcs);
+                        if (crc_status == BlockChecksumFile::Status::Ok) {
+                            resp.flags |= chunk_proto::FLAG_BLOCK_CRCS;
+                            resp.offset = first * checksum::BLOCK_SIZE;
+                            resp.length = std::min<uint64_t>(file.size(), last * checksum::BLOCK_SIZE) - resp.offset;
+                            auto crc_frame = chunk_proto::encode_block_crcs(crcs.data(), crcs.size());
+                            payload.assign(crc_frame.begin(), crc_frame.end());
+                        } else if (crc_status == BlockChecksumFile::Status::Corrupt) {
+                            std::cerr << "Block checksums for chunk " << req.chunk_id << " are unusable" << std::endl;
+                            resp.status = Status::Error;
+                        }
+                    }
+                }
+            } else if (req.op == Op::Delete) {
+                resp.status = storage.delete_chunk(req.chunk_id) ? Status::Ok : Status::NotFound;
+            } else {
+                for (const auto& id : storage.list_chunks()) {
+                    payload += id;
+                    payload += '\n';
+                }
+                resp.length = payload.size();
+            }
+
+            auto frame = chunk_proto::encode_header(resp);
+            size_t sent = 0;
+            while ((io = send_exact(fd, frame.data(), frame.size(), sent)) == Io::Again) {
+                co_await reactor.wait_writable(fd);
+            }
+            sent = 0;
+            while (io == Io::Done &&
+                   (io = send_exact(fd, reinterpret_cast<const uint8_t*>(payload.data()), payload.size(),
+                                    sent)) == Io::Again) {
+                co_await reactor.wait_writable(fd);
+            }
+            if (io != Io::Done) {
+                break;
+            }
+
+            if (file && resp.status == Status::Ok) {
+                async_hb::Uring::Buffer slices[2];
+                if (ring) {
+                    slices[0] = ring->acquire_buffer();
+                    slices[1] = ring->acquire_buffer();
+                }
+                if (slices[1]) {
+                    // Read the next slice into one buffer while the other goes out on the
+                    // socket. Reads start and end on block boundaries, as O_DIRECT needs.
+                    constexpr uint64_t ALIGN = 4096;
+                    const uint64_t end = resp.offset + resp.length;
+                    const uint64_t read_end = (end + ALIGN - 1) / ALIGN * ALIGN;
+                    uint64_t next = resp.offset / ALIGN * ALIGN;
+                    uint64_t pos = resp.offset;
+                    async_hb::Uring::Op reads[2];
+                    uint64_t read_at[2]{};
+                    size_t read_len[2]{};
+                    auto read_ahead = [&](int b) {
+                        read_at[b] = next;
+                        read_len[b] = static_cast<size_t>(std::min<uint64_t>(IO_SLICE_SIZE, read_end - next));
+                        reads[b] = ring->read(file.fd(), slices[b], read_len[b], next);
+                        next += read_len[b];
+                    };
+                    for (int b = 0; b < 2 && next < read_end; ++b) {
+                        read_ahead(b);
+                    }
+                    for (int b = 0; pos < end; b ^= 1) {
+                        auto& read = reads[b];
+                        int r = co_await read;
+                        uint64_t want_end = std::min<uint64_t>(read_at[b] + read_len[b], end);
+                        if (r < 0 || read_at[b] + static_cast<uint64_t>(r) < want_end) {
+                            std::cerr << "io_uring read failed for chunk " << req.chunk_id << ": "
+                                      << std::strerror(r < 0 ? -r : ENODATA) << std::endl;
+                            break;
+                        }
+                        const auto* data = reinterpret_cast<const uint8_t*>(slices[b].data() + (pos - read_at[b]));
+                        sent = 0;
+                        while ((io = send_exact(fd, data, static_cast<size_t>(want_end - pos), sent)) == Io::Again) {
+                            co_await reactor.wait_writable(fd);
+                        }
+                        if (io != Io::Done) {
+                            break;
+                        }
+                        pos = want_end;
+                        if (next < read_end) {
+                            read_ahead(b);
+                        }
+                    }
+                    for (auto& r : reads) {
+                        if (r.pending()) {
+                            co_await r;
+                        }
+                    }
+                    if (pos < end) {
+                        break;
+                    }
+                } else {
+                    // The worker may still be sending after this coroutine is
+                    // gone, so the jobs own the file and its offset.
+                    struct Sending {
+                        ChunkFile file;
+                        off_t pos;
+                    };
+                    auto sending = std::make_shared<Sending>(Sending{std::move(file), static_cast<off_t>(resp.offset)});
+                    uint64_t left = resp.length;
+                    while (left > 0) {
+                        // errno belongs to the worker's thread, so it comes back negated
+                        DiskJob send(sending->file.disk(), [sending, fd, left] {
+                            ssize_t n = sending->file.send_to(fd, sending->pos, static_cast<size_t>(left));
+                            return n < 0 ? static_cast<ssize_t>(-errno) : n;
+                        });
+                        if (send.fd() >= 0) {
+                            co_await reactor.wait_readable(send.fd());
+                        }
+                        ssize_t n = send.result();
+                        if (n > 0) {
+                            left -= static_cast<uint64_t>(n);
+                        } else if (n == 0) {
+                            co_await reactor.wait_writable(fd);
+                        } else {
+                            std::cerr << "sendfile failed for chunk " << req.chunk_id << ": "
+                                      << std::strerror(static_cast<int>(-n)) << std::endl;
+                            break;
+                        }
+                    }
+                    if (left > 0) {
+                        break;
+                    }
+                }
+            }
+            if (!keep_open) {
+                break;
+            }
+        }
+        if (watched) {
+            reactor.unwatch(fd);
+        }
+        ::close(fd);
+    }
+
+    async_hb::Reactor& reactor;
+    ChunkStorage& storage;
+    Options options;
+    std::unique_ptr<async_hb::Uring> ring;
+    int listen_fd = -1;
+    int bound_port = 0;
+    std::atomic<bool> running{false};
+};
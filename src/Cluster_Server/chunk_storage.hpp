@@ -0,0 +1,1210 @@
+#pragma once
+
+#include "../include/buffer_pool.hpp"
+#include "../include/checksum.hpp"
+#include "./chunk_index.hpp"
+#include "./chunk_registry.hpp"
+#include "./directory_layout.hpp"
+#include "./durability.hpp"
+#include "../include/worker_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <poll.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static_assert(IO_SLICE_SIZE % checksum::BLOCK_SIZE == 0, "slices must hold whole checksum blocks");
+
+class StorageDisk;
+
+// Chunk file opened for zero-copy serving. Closes the descriptor on scope exit.
+class ChunkFile {
+public:
+    ChunkFile() = default;
+    ChunkFile(int fd, size_t size, StorageDisk* disk = nullptr) : fd_(fd), size_(size), disk_(disk) {}
+    ChunkFile(ChunkFile&& o) noexcept : fd_(std::exchange(o.fd_, -1)), size_(o.size_), disk_(o.disk_) {}
+    ChunkFile& operator=(ChunkFile&& o) noexcept {
+        if (this != &o) {
+            close();
+            fd_ = std::exchange(o.fd_, -1);
+            size_ = o.size_;
+            disk_ = o.disk_;
+        }
+        return *this;
+    }
+    ~ChunkFile() { close(); }
+
+    int fd() const { return fd_; }
+    size_t size() const { return size_; }
+    // The data directory holding the chunk, whose I/O worker should serve it.
+    StorageDisk* disk() const { return disk_; }
+    explicit operator bool() const { return fd_ >= 0; }
+
+    // Moves up to `count` bytes at `offset` from the page cache to `sock_fd`
+    // without a user-space copy, advancing `offset`. Returns the bytes sent,
+    // 0 if a non-blocking socket is full (wait for EPOLLOUT), or -1 on error
+    // (including a file that ends before `count` bytes).
+    ssize_t send_to(int sock_fd, off_t& offset, size_t count) const {
+        while (true) {
+            ssize_t n = ::sendfile(sock_fd, fd_, &offset, count);
+            if (n > 0 || count == 0) {
+                return n;
+            }
+            if (n == 0) {
+                errno = ENODATA;
+                return -1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+    }
+
+private:
+    void close() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int fd_{-1};
+    size_t size_{0};
+    StorageDisk* disk_{nullptr};
+};
+
+// Sidecar "<chunk file>.crc" holding a chunk's per-block CRC32Cs, so a range
+// read verifies only the blocks it touches:
+//
+//   [u32 magic][u32 block_size][u64 chunk_size][u32 chunk_crc][u32 crc]...
+class BlockChecksumFile {
+public:
+    enum class Status { Ok, Missing, Corrupt };
+
+    static constexpr uint32_t MAGIC = 0x43474644; // "DFGC"
+    static constexpr size_t HEADER_SIZE = 4 + 4 + 8 + 4;
+
+    static std::string path_for(const std::string& chunk_path) { return chunk_path + ".crc"; }
+
+    // Written to a temp name and renamed, so readers never see half a
+    // sidecar. `sync` makes it durable before the rename.
+    static bool write(const std::string& chunk_path, const checksum::ChunkDigest& digest, bool sync = false) {
+        std::string path = path_for(chunk_path);
+        std::string tmp = path + ".tmp";
+        std::vector<char> buf(HEADER_SIZE + 4 * digest.blocks.size());
+        uint32_t magic = MAGIC;
+        uint32_t block_size = static_cast<uint32_t>(checksum::BLOCK_SIZE);
+        std::memcpy(buf.data(), &magic, 4);
+        std::memcpy(buf.data() + 4, &block_size, 4);
+        std::memcpy(buf.data() + 8, &digest.size, 8);
+        std::memcpy(buf.data() + 16, &digest.crc, 4);
+        std::memcpy(buf.data() + HEADER_SIZE, digest.blocks.data(), 4 * digest.blocks.size());
+
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = ::write(fd, buf.data(), buf.size()) == static_cast<ssize_t>(buf.size()) &&
+                  (!sync || ::fdatasync(fd) == 0);
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || ::rename(tmp.c_str(), path.c_str()) < 0) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Loads the CRCs of blocks [first, first + count) of a chunk whose data
+    // file is `chunk_size` bytes. Corrupt means the sidecar exists but does
+    // not describe that file.
+    static Status read(const std::string& chunk_path, uint64_t chunk_size, size_t first, size_t count,
+                       std::vector<uint32_t>& out) {
+        int fd = ::open(path_for(chunk_path).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return errno == ENOENT ? Status::Missing : Status::Corrupt;
+        }
+        char header[HEADER_SIZE];
+        uint32_t magic = 0, block_size = 0;
+        uint64_t size = 0;
+        bool ok = ::pread(fd, header, HEADER_SIZE, 0) == static_cast<ssize_t>(HEADER_SIZE);
+        if (ok) {
+            std::memcpy(&magic, header, 4);
+            std::memcpy(&block_size, header + 4, 4);
+            std::memcpy(&size, header + 8, 8);
+            ok = magic == MAGIC && block_size == checksum::BLOCK_SIZE && size == chunk_size &&
+                 first + count <= (size + checksum::BLOCK_SIZE - 1) / checksum::BLOCK_SIZE;
+        }
+        if (ok) {
+            out.resize(count);
+            ssize_t want = static_cast<ssize_t>(4 * count);
+            ok = ::pread(fd, out.data(), want, static_cast<off_t>(HEADER_SIZE + 4 * first)) == want;
+        }
+        ::close(fd);
+        return ok ? Status::Ok : Status::Corrupt;
+    }
+};
+
+// One data directory of a ChunkStorage, normally a disk of its own, with
+// its own chunk index and usage counters. Chunk data on it is read and
+// written by its single I/O worker, so the disks of a server work in
+// parallel while each one sees a sequential queue.
+class StorageDisk {
+public:
+    // `path` has a trailing '/' and must exist.
+    StorageDisk(uint32_t id, std::string path) : id(id), path(std::move(path)), index(this->path), sync(this->path) {}
+
+    StorageDisk(const StorageDisk&) = delete;
+    StorageDisk& operator=(const StorageDisk&) = delete;
+
+    const uint32_t id;
+    const std::string path;
+    ChunkIndex index;
+    std::atomic<bool> compacting{false};
+    // Group commit barrier for chunks stored on this disk.
+    GroupSync sync;
+
+    // Changed with the registry so reading them is free. Free space is
+    // measured by measure() and estimated in between.
+    std::atomic<uint64_t> used_bytes{0};
+    std::atomic<uint64_t> chunk_count{0};
+    std::atomic<int64_t> free_bytes{0};
+    std::atomic<uint64_t> total_bytes{0};
+    dev_t device{0};
+
+    // Queue depth: jobs waiting for or running on the I/O worker, and
+    // chunks being received (they will queue writes shortly).
+    std::atomic<int> queued{0};
+    std::atomic<int> writers{0};
+
+    void account(int64_t size_delta, int64_t count_delta) {
+        used_bytes.fetch_add(static_cast<uint64_t>(size_delta), std::memory_order_relaxed);
+        chunk_count.fetch_add(static_cast<uint64_t>(count_delta), std::memory_order_relaxed);
+        free_bytes.fetch_sub(size_delta, std::memory_order_relaxed);
+    }
+
+    void measure() {
+        struct statvfs vfs{};
+        if (::statvfs(path.c_str(), &vfs) == 0) {
+            free_bytes.store(static_cast<int64_t>(vfs.f_bavail) * static_cast<int64_t>(vfs.f_frsize),
+                             std::memory_order_relaxed);
+            total_bytes.store(static_cast<uint64_t>(vfs.f_blocks) * vfs.f_frsize, std::memory_order_relaxed);
+        }
+        struct stat st{};
+        if (::stat(path.c_str(), &st) == 0) {
+            device = st.st_dev;
+        }
+    }
+
+    // Chunks are written under a temp name in <path>/incoming/ and renamed
+    // into place once complete. Anything left there at startup is from a
+    // store that never finished.
+    std::string temp_path(const std::string& chunk_id) {
+        return path + INCOMING_DIR + std::to_string(temp_seq.fetch_add(1, std::memory_order_relaxed)) + "_" +
+               chunk_id;
+    }
+
+    void clear_incoming() {
+        std::error_code ec;
+        fs::remove_all(path + INCOMING_DIR, ec);
+        fs::create_directories(path + INCOMING_DIR, ec);
+    }
+
+    // Where a new chunk should go: the free space each queued job would
+    // leave it, so a busy disk is passed over until the others catch up.
+    double placement_score() const {
+        int64_t free = free_bytes.load(std::memory_order_relaxed);
+        int depth = queued.load(std::memory_order_relaxed) + writers.load(std::memory_order_relaxed);
+        return free <= 0 ? 0.0 : static_cast<double>(free) / (1 + depth);
+    }
+
+    // Queues `job` on the I/O worker; the future holds its result.
+    template <typename Job>
+    auto schedule(Job&& job) -> std::future<decltype(job())> {
+        using Result = decltype(job());
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<Job>(job));
+        auto result = packaged->get_future();
+        queued.fetch_add(1, std::memory_order_relaxed);
+        io.submit([this, packaged] {
+            current = this;
+            (*packaged)();
+            current = nullptr;
+            queued.fetch_sub(1, std::memory_order_relaxed);
+        });
+        return result;
+    }
+
+    // Runs `job` on the I/O worker and waits for it; runs it in place when
+    // already on that worker.
+    template <typename Job>
+    auto run(Job&& job) -> decltype(job()) {
+        if (current == this) {
+            return job();
+        }
+        return schedule(std::forward<Job>(job)).get();
+    }
+
+private:
+    static constexpr const char* INCOMING_DIR = "incoming/";
+
+    std::atomic<uint64_t> temp_seq{0};
+    static inline thread_local const StorageDisk* current = nullptr;
+    // Last, so the worker stops before anything its jobs use goes away.
+    WorkerPool io{1};
+};
+
+// Runs a job on a disk's I/O worker without blocking the caller. Its fd()
+// becomes readable once the job is done, so a coroutine can wait on it with
+// the reactor. Without a disk (or an eventfd) the job runs in place.
+class DiskJob {
+public:
+    DiskJob(StorageDisk* disk, std::function<ssize_t()> job) : state(std::make_shared<State>()) {
+        state->efd = disk ? ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK) : -1;
+        if (state->efd < 0) {
+            state->result.store(job(), std::memory_order_relaxed);
+            return;
+        }
+        disk->schedule(finisher(std::move(job)));
+    }
+
+    // Runs the job on `pool` instead, for work that may block for a while
+    // (waiting for a sync) without holding up a disk's queue.
+    DiskJob(WorkerPool& pool, std::function<ssize_t()> job) : state(std::make_shared<State>()) {
+        state->efd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (state->efd < 0) {
+            state->result.store(job(), std::memory_order_relaxed);
+            return;
+        }
+        pool.submit(finisher(std::move(job)));
+    }
+
+    DiskJob(const DiskJob&) = delete;
+    DiskJob& operator=(const DiskJob&) = delete;
+
+    // -1 if the job already ran.
+    int fd() const { return state->efd; }
+    ssize_t result() const { return state->result.load(std::memory_order_acquire); }
+
+private:
+    std::function<void()> finisher(std::function<ssize_t()> job) {
+        return [state = state, job = std::move(job)] {
+            state->result.store(job(), std::memory_order_release);
+            uint64_t one = 1;
+            (void)::write(state->efd, &one, sizeof(one));
+        };
+    }
+
+    // Shared with the worker, which may finish after the waiter gave up.
+    struct State {
+        int efd{-1};
+        std::atomic<ssize_t> result{-1};
+        ~State() {
+            if (efd >= 0) {
+                ::close(efd);
+            }
+        }
+    };
+    std::shared_ptr<State> state;
+};
+
+// Chunk being received from a socket. Bytes travel socket -> pipe -> file via
+// splice(), so they never enter user space. The file is a temp file, and
+// nothing is visible in the registry until commit(); an abandoned upload
+// removes it.
+//
+// fill_from() only touches the socket and the pipe, so it never waits on the
+// disk; flush() does the file half and belongs on the disk's I/O worker.
+// Callers with their own way to the file (an io_uring) write to fd() and
+// report the bytes with wrote() instead.
+class IncomingChunk {
+public:
+    // Puts the complete file in place and registers it, given its
+    // descriptor, size and any block CRCs the sender supplied.
+    using OnCommit = std::function<bool(int fd, size_t size, const checksum::ChunkDigest* digest)>;
+
+    // `path` is the temp file open as `fd`. A `direct` file was opened with
+    // O_DIRECT.
+    IncomingChunk(OnCommit on_commit, std::string path, int fd, StorageDisk& disk, bool direct = false)
+        : on_commit_(std::move(on_commit)), path_(std::move(path)), fd_(fd), disk_(disk), direct_(direct) {
+        disk_.writers.fetch_add(1, std::memory_order_relaxed);
+        if (::pipe2(pipe_, O_CLOEXEC | O_NONBLOCK) < 0) {
+            pipe_[0] = pipe_[1] = -1;
+            return;
+        }
+        // One slice per round trip instead of the default 64KB pipe.
+        ::fcntl(pipe_[1], F_SETPIPE_SZ, static_cast<int>(IO_SLICE_SIZE));
+    }
+    IncomingChunk(const IncomingChunk&) = delete;
+    IncomingChunk& operator=(const IncomingChunk&) = delete;
+
+    ~IncomingChunk() {
+        for (int p : pipe_) {
+            if (p >= 0) {
+                ::close(p);
+            }
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        if (!committed_) {
+            std::error_code ec;
+            fs::remove(path_, ec);
+            fs::remove(BlockChecksumFile::path_for(path_), ec);
+        }
+        disk_.writers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    bool ok() const { return fd_ >= 0 && pipe_[0] >= 0; }
+    StorageDisk& disk() const { return disk_; }
+    int fd() const { return fd_; }
+    // O_DIRECT writes must be whole blocks; commit() trims the padding of
+    // the last one.
+    bool direct() const { return direct_; }
+    // Bytes in the chunk file, and bytes still in the pipe.
+    size_t received() const { return received_; }
+    size_t buffered() const { return buffered_; }
+
+    // Moves up to `max` bytes from `sock_fd` into the pipe. Returns the bytes
+    // moved, 0 if the socket has nothing ready or the pipe is full (flush,
+    // or wait for EPOLLIN) or the socket hit EOF (check `eof()`), or -1 on
+    // error.
+    ssize_t fill_from(int sock_fd, size_t max) {
+        ssize_t in;
+        do {
+            in = ::splice(sock_fd, nullptr, pipe_[1], nullptr, max, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        } while (in < 0 && errno == EINTR);
+        if (in < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (in == 0) {
+            eof_ = true;
+            return 0;
+        }
+        buffered_ += static_cast<size_t>(in);
+        return in;
+    }
+
+    // Writes everything in the pipe to the chunk file, leaving it empty.
+    bool flush() {
+        while (buffered_ > 0) {
+            ssize_t out = ::splice(pipe_[0], nullptr, fd_, nullptr, buffered_, SPLICE_F_MOVE);
+            if (out < 0 && errno == EINTR) {
+                continue;
+            }
+            if (out <= 0) {
+                return false;
+            }
+            buffered_ -= static_cast<size_t>(out);
+            received_ += static_cast<size_t>(out);
+        }
+        return true;
+    }
+
+    // fill_from() and flush() in one go, for blocking callers.
+    ssize_t splice_from(int sock_fd, size_t max) {
+        ssize_t in = fill_from(sock_fd, max);
+        return in > 0 && !flush() ? -1 : in;
+    }
+
+    bool eof() const { return eof_; }
+
+    // Records `n` bytes written to fd() at offset received().
+    void wrote(size_t n) { received_ += n; }
+
+    // Block CRCs supplied by the sender, stored beside the chunk on commit.
+    void set_digest(checksum::ChunkDigest digest) { digest_ = std::move(digest); }
+
+    bool commit() {
+        if (committed_ || fd_ < 0) {
+            return committed_;
+        }
+        if (!flush()) {
+            return false;
+        }
+        if (direct_ && ::ftruncate(fd_, static_cast<off_t>(received_)) < 0) {
+            return false;
+        }
+        if (digest_) {
+            size_t blocks = (received_ + checksum::BLOCK_SIZE - 1) / checksum::BLOCK_SIZE;
+            if (digest_->size != received_ || digest_->blocks.size() != blocks) {
+                std::cerr << "Rejecting chunk " << path_ << ": bad block checksums" << std::endl;
+                return false;
+            }
+        }
+        if (!on_commit_(fd_, received_, digest_ ? &*digest_ : nullptr)) {
+            return false;
+        }
+        committed_ = true;
+        ::close(fd_);
+        fd_ = -1;
+        return true;
+    }
+
+private:
+    OnCommit on_commit_;
+    std::string path_;
+    int fd_;
+    StorageDisk& disk_;
+    bool direct_;
+    int pipe_[2]{-1, -1};
+    size_t received_{0};
+    size_t buffered_{0};
+    std::optional<checksum::ChunkDigest> digest_;
+    bool eof_{false};
+    bool committed_{false};
+};
+
+// Capacity figures for heartbeats and status reports.
+struct StorageUsage {
+    uint64_t used_bytes;       // chunk data, excluding checksum sidecars and the index
+    uint64_t chunk_count;
+    uint64_t disk_free_bytes;  // available to this process on the storage filesystem(s)
+    uint64_t disk_total_bytes;
+};
+
+class ChunkStorage {
+public:
+    // Receives consecutive slices of a chunk; returning false aborts the stream.
+    using SliceSink = std::function<bool(const char* data, size_t len)>;
+    // Fills up to `len` bytes; returns the count, 0 at end of input, -1 on error.
+    using SliceSource = std::function<ssize_t(char* data, size_t len)>;
+
+private:
+    // A disk's log is folded into a new snapshot once it outgrows both this
+    // and the number of chunks on the disk, so compaction stays amortised O(1).
+    static constexpr size_t COMPACT_MIN_RECORDS = 64 * 1024;
+
+    // Threads for commits that wait on a sync; as many chunks as this can
+    // share one group commit barrier.
+    static constexpr size_t COMMIT_WORKERS = 16;
+
+    ChunkRegistry registry;
+    DirectoryLayout layout;
+    Durability durability;
+    BufferPool& buffers = shared_io_buffers();
+    // After the registry: the I/O workers stop before it goes away.
+    std::vector<std::unique_ptr<StorageDisk>> disks;
+    WorkerPool committers{COMMIT_WORKERS};
+
+    void open_storage(std::vector<std::string> paths) {
+        if (paths.empty()) {
+            paths.push_back("/tmp/cluster_storage/");
+        }
+        for (auto& path : paths) {
+            if (path.back() != '/') {
+                path += '/';
+            }
+            fs::create_directories(path);
+            disks.push_back(std::make_unique<StorageDisk>(static_cast<uint32_t>(disks.size()), path));
+        }
+
+        // Every disk loads (or scans) its own index on its I/O worker
+        struct Loaded {
+            std::vector<ChunkIndex::Entry> entries;
+            bool scanned;
+            std::chrono::milliseconds took;
+        };
+        size_t scan_threads = std::max<size_t>(2, std::thread::hardware_concurrency() / disks.size());
+        std::vector<std::future<Loaded>> loading;
+        for (auto& disk : disks) {
+            loading.push_back(disk->schedule([this, d = disk.get(), scan_threads] {
+                auto started = std::chrono::steady_clock::now();
+                d->clear_incoming();
+                migrate_layout(*d);
+                auto entries = d->index.load();
+                bool scanned = !entries;
+                if (scanned) {
+                    entries = ChunkIndex::scan(d->path, scan_threads);
+                }
+                return Loaded{std::move(*entries), scanned,
+                              std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::steady_clock::now() - started)};
+            }));
+        }
+
+        std::vector<std::future<bool>> compacting;
+        for (auto& disk : disks) {
+            Loaded loaded = loading[disk->id].get();
+            uint64_t used = 0, count = 0;
+            for (auto& e : loaded.entries) {
+                RegisteredChunk other;
+                if (registry.find(e.chunk_id, other)) {
+                    std::cerr << "Chunk " << e.chunk_id << " is in both " << disks[other.disk]->path << " and "
+                              << disk->path << ", using the first" << std::endl;
+                    continue;
+                }
+                registry.load(e.chunk_id, RegisteredChunk{chunk_path_on(*disk, e.chunk_id), e.size, disk->id});
+                used += e.size;
+                ++count;
+            }
+            disk->used_bytes = used;
+            disk->chunk_count = count;
+            disk->measure();
+            // Start from a clean snapshot after a scan or an unfinished compaction
+            if (loaded.scanned || disk->index.interrupted_compaction() ||
+                disk->index.log_records() >= std::max<size_t>(COMPACT_MIN_RECORDS, count)) {
+                compacting.push_back(disk->schedule([d = disk.get(), entries = std::move(loaded.entries)] {
+                    return d->index.compact(entries);
+                }));
+            }
+            std::cout << (loaded.scanned ? "Indexed " : "Loaded ") << count << " chunks "
+                      << (loaded.scanned ? "by scanning " : "from the index of ") << disk->path << " in "
+                      << loaded.took.count() << " ms" << std::endl;
+        }
+        for (auto& done : compacting) {
+            done.get();
+        }
+    }
+
+    // A chunk that is already stored stays on its disk. A new one goes to
+    // the disk with the best placement score.
+    StorageDisk& place(const std::string& chunk_id) {
+        RegisteredChunk existing;
+        if (registry.find(chunk_id, existing)) {
+            return *disks[existing.disk];
+        }
+        StorageDisk* best = disks.front().get();
+        double best_score = best->placement_score();
+        for (size_t i = 1; i < disks.size(); ++i) {
+            double score = disks[i]->placement_score();
+            if (score > best_score) {
+                best = disks[i].get();
+                best_score = score;
+            }
+        }
+        return *best;
+    }
+
+    void register_chunk(StorageDisk& disk, const std::string& chunk_id, const std::string& chunk_path,
+                        uint64_t size) {
+        // Two first uploads of a chunk can race onto different disks; the
+        // later one wins and the other copy is dropped.
+        StorageDisk* moved_from = nullptr;
+        std::string stale_path;
+        registry.upsert(chunk_id, RegisteredChunk{chunk_path, size, disk.id}, [&](const RegisteredChunk* previous) {
+            if (previous && previous->disk != disk.id) {
+                moved_from = disks[previous->disk].get();
+                stale_path = previous->path;
+                moved_from->account(-static_cast<int64_t>(previous->size), -1);
+                moved_from->index.removed(chunk_id);
+                previous = nullptr;
+            }
+            disk.account(static_cast<int64_t>(size) - static_cast<int64_t>(previous ? previous->size : 0),
+                         previous ? 0 : 1);
+            disk.index.added(chunk_id, size);
+        });
+        if (moved_from) {
+            std::error_code ec;
+            fs::remove(stale_path, ec);
+            fs::remove(BlockChecksumFile::path_for(stale_path), ec);
+            maybe_compact(*moved_from);
+        }
+        maybe_compact(disk);
+    }
+
+    // Makes a complete temp file the chunk: synced as `durability` asks,
+    // renamed over the chunk's path with its block CRCs beside it, and
+    // registered. The rename and the index record are then synced as well,
+    // so a chunk reported stored is still there after a crash. Until the
+    // rename, readers see the previous version. Blocks while syncing.
+    bool publish_chunk(StorageDisk& disk, int fd, const std::string& temp_path, const std::string& chunk_id,
+                       const std::string& chunk_path, uint64_t size, const checksum::ChunkDigest* digest) {
+        if (digest && !BlockChecksumFile::write(temp_path, *digest, durability == Durability::PerChunk)) {
+            std::cerr << "Failed to write block checksums for chunk " << chunk_id << std::endl;
+            return false;
+        }
+        bool synced = durability == Durability::None ||
+                      (durability == Durability::PerChunk ? ::fdatasync(fd) == 0 : disk.sync.barrier());
+        if (!synced) {
+            std::cerr << "Failed to sync chunk " << chunk_id << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        // A replaced chunk must not be checked against its predecessor's CRCs
+        std::error_code ec;
+        fs::remove(BlockChecksumFile::path_for(chunk_path), ec);
+        if (!DirectoryLayout::rename_into(temp_path, chunk_path)) {
+            std::cerr << "Failed to move chunk " << chunk_id << " into place: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (digest && ::rename(BlockChecksumFile::path_for(temp_path).c_str(),
+                               BlockChecksumFile::path_for(chunk_path).c_str()) < 0) {
+            // The data is in place; its reads just go unverified
+            std::cerr << "Failed to move block checksums of chunk " << chunk_id << std::endl;
+        }
+        register_chunk(disk, chunk_id, chunk_path, size);
+
+        if (durability == Durability::PerChunk) {
+            synced = sync_dir(chunk_path.substr(0, chunk_path.rfind('/') + 1)) && disk.index.sync();
+        } else if (durability == Durability::Group) {
+            synced = disk.sync.barrier();
+        }
+        if (!synced) {
+            std::cerr << "Failed to sync the entry of chunk " << chunk_id << ": " << std::strerror(errno) << std::endl;
+        }
+        return synced;
+    }
+
+    static bool sync_dir(const std::string& dir) {
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = ::fsync(fd) == 0;
+        ::close(fd);
+        return ok;
+    }
+
+    // Runs on the writer that crossed the threshold, outside any shard lock;
+    // other writers carry on into the rotated log meanwhile.
+    void maybe_compact(StorageDisk& disk) {
+        if (disk.index.log_records() < std::max<size_t>(COMPACT_MIN_RECORDS, disk.chunk_count.load()) ||
+            disk.compacting.exchange(true)) {
+            return;
+        }
+        if (disk.index.rotate_log()) {
+            std::vector<ChunkIndex::Entry> entries;
+            entries.reserve(disk.chunk_count.load());
+            registry.for_each([&](const std::string& id, const RegisteredChunk& chunk) {
+                if (chunk.disk == disk.id) {
+                    entries.push_back(ChunkIndex::Entry{id, chunk.size});
+                }
+            });
+            disk.index.finish_compaction(entries);
+        }
+        disk.compacting = false;
+    }
+
+    std::string chunk_path_on(const StorageDisk& disk, const std::string& chunk_id) const {
+        return layout.path(disk.path, chunk_id);
+    }
+
+    // Moves chunk files written under another layout to where this one puts
+    // them. The index only records ids, so it stays valid. The new layout
+    // is recorded last, so an interrupted migration simply runs again.
+    void migrate_layout(const StorageDisk& disk) {
+        auto recorded = DirectoryLayout::recorded(disk.path);
+        if (recorded && recorded->levels == layout.levels) {
+            return;
+        }
+        size_t moved = 0;
+        for (const auto& name : ChunkIndex::list(disk.path)) {
+            std::string target = layout.relative_path(ChunkIndex::chunk_id_of(name));
+            if (name == target) {
+                continue;
+            }
+            std::string from = disk.path + name, to = disk.path + target;
+            std::error_code ec;
+            fs::create_directories(fs::path(to).parent_path(), ec);
+            if (::rename(from.c_str(), to.c_str()) < 0) {
+                std::cerr << "Failed to move " << from << " to " << to << ": " << std::strerror(errno) << std::endl;
+                return; // keep the old marker and retry on the next start
+            }
+            ::rename(BlockChecksumFile::path_for(from).c_str(), BlockChecksumFile::path_for(to).c_str());
+            ++moved;
+        }
+        if (layout.levels < (recorded ? recorded->levels : 0)) {
+            remove_empty_fanout_dirs(disk.path);
+        }
+        layout.record(disk.path);
+        if (moved > 0) {
+            std::cout << "Moved " << moved << " chunk files in " << disk.path << " to the " << layout.levels
+                      << "-level directory layout" << std::endl;
+        }
+    }
+
+    static void remove_empty_fanout_dirs(const std::string& dir) {
+        std::error_code ec;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            std::string name = it->path().filename().string();
+            if (it->is_directory(ec) && DirectoryLayout::is_fanout_dir(name.c_str())) {
+                remove_empty_fanout_dirs(it->path().string() + "/");
+                ::rmdir(it->path().c_str()); // fails, harmlessly, unless empty
+            }
+        }
+    }
+
+    static bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool pread_full(int fd, char* data, size_t len, size_t offset) {
+        while (len > 0) {
+            ssize_t n = ::pread(fd, data, len, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+            offset += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // Fills the temp file `fd` from `source`, computing its block CRCs.
+    long long write_chunk_file(const std::string& chunk_id, int fd, const SliceSource& source,
+                               checksum::ChunkDigest& digest) {
+        auto slice = buffers.acquire();
+        checksum::BlockChecksummer summer;
+        long long total = 0;
+        while (true) {
+            ssize_t n = source(slice.data(), slice.size());
+            if (n == 0) {
+                break;
+            }
+            if (n > 0) {
+                summer.update(slice.data(), static_cast<size_t>(n));
+            }
+            if (n < 0 || !write_all(fd, slice.data(), static_cast<size_t>(n))) {
+                std::cerr << "Error storing chunk " << chunk_id << std::endl;
+                return -1;
+            }
+            total += n;
+        }
+        digest = summer.finish();
+        return total;
+    }
+
+    long long read_chunk_file(const std::string& chunk_id, const std::string& chunk_path, size_t offset,
+                              size_t length, const SliceSink& sink) {
+        int fd = ::open(chunk_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Failed to open chunk file: " << chunk_path << std::endl;
+            return -1;
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) < 0) {
+            ::close(fd);
+            return -1;
+        }
+        offset = std::min(offset, static_cast<size_t>(st.st_size));
+        size_t remaining = static_cast<size_t>(st.st_size) - offset;
+        if (length != 0) {
+            remaining = std::min(remaining, length);
+        }
+        const size_t file_size = static_cast<size_t>(st.st_size);
+        const size_t end = offset + remaining;
+
+        // Widen the read to whole blocks when there are checksums to verify.
+        size_t first_block = offset / checksum::BLOCK_SIZE;
+        size_t end_block = (end + checksum::BLOCK_SIZE - 1) / checksum::BLOCK_SIZE;
+        std::vector<uint32_t> crcs;
+        auto status = BlockChecksumFile::read(chunk_path, file_size, first_block, end_block - first_block, crcs);
+        if (status == BlockChecksumFile::Status::Corrupt) {
+            std::cerr << "Block checksums for chunk " << chunk_id << " do not match its data file" << std::endl;
+            ::close(fd);
+            return -1;
+        }
+        const bool verify = status == BlockChecksumFile::Status::Ok;
+        size_t pos = verify ? first_block * checksum::BLOCK_SIZE : offset;
+        const size_t read_end = verify ? std::min(file_size, end_block * checksum::BLOCK_SIZE) : end;
+        ::posix_fadvise(fd, static_cast<off_t>(pos), static_cast<off_t>(read_end - pos), POSIX_FADV_SEQUENTIAL);
+
+        // Slices are a whole number of blocks, so every slice but the last
+        // holds complete blocks.
+        auto slice = buffers.acquire();
+        long long total = 0;
+        while (pos < read_end) {
+            size_t want = std::min(slice.size(), read_end - pos);
+            if (!pread_full(fd, slice.data(), want, pos)) {
+                ::close(fd);
+                return -1;
+            }
+            if (verify) {
+                for (size_t b = 0; b < want; b += checksum::BLOCK_SIZE) {
+                    size_t block = (pos + b) / checksum::BLOCK_SIZE;
+                    size_t len = std::min(checksum::BLOCK_SIZE, want - b);
+                    if (checksum::crc32c(0, slice.data() + b, len) != crcs[block - first_block]) {
+                        std::cerr << "Checksum mismatch in chunk " << chunk_id << " block " << block << std::endl;
+                        ::close(fd);
+                        return -1;
+                    }
+                }
+            }
+            size_t from = std::max(pos, offset);
+            size_t to = std::min(pos + want, end);
+            if (from < to && !sink(slice.data() + (from - pos), to - from)) {
+                ::close(fd);
+                return -1;
+            }
+            total += static_cast<long long>(to > from ? to - from : 0);
+            pos += want;
+        }
+        ::close(fd);
+        return total;
+    }
+
+public:
+    // Chunks stored before a restart are found through each directory's
+    // persistent index (see chunk_index.hpp), or by scanning it if it has none.
+    // Chunk files are laid out per `layout`; files from another layout are
+    // moved over at startup.
+    ChunkStorage() : durability(Durability::Group) {
+        open_storage({});
+    }
+
+    // Separate directories let several cluster servers share one host.
+    explicit ChunkStorage(std::string path, DirectoryLayout layout = {},
+                          Durability durability = Durability::Group)
+        : layout(layout), durability(durability) {
+        open_storage({std::move(path)});
+    }
+
+    // One directory per disk (JBOD). Each gets its own I/O worker, and new
+    // chunks are spread over them by free space and queue depth.
+    explicit ChunkStorage(std::vector<std::string> paths, DirectoryLayout layout = {},
+                          Durability durability = Durability::Group)
+        : layout(layout), durability(durability) {
+        open_storage(std::move(paths));
+    }
+
+    // The first data directory.
+    const std::string& path() const { return disks.front()->path; }
+
+    // Threads to run IncomingChunk::commit() on from an event loop, since it
+    // blocks until its chunk is durable (see DiskJob).
+    WorkerPool& commit_workers() { return committers; }
+
+    size_t disk_count() const { return disks.size(); }
+    StorageDisk& disk(size_t i) { return *disks[i]; }
+
+    // Pulls a chunk from `source` one pooled slice at a time, so a chunk of any
+    // size costs one slice of memory. `source` runs on the I/O worker of the
+    // chosen disk. Returns the number of bytes stored, or -1.
+    long long store_chunk_stream(const std::string& chunk_id, const SliceSource& source) {
+        StorageDisk& disk = place(chunk_id);
+        std::string chunk_path = chunk_path_on(disk, chunk_id);
+        std::string temp_path = disk.temp_path(chunk_id);
+        int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "Failed to create chunk file: " << temp_path << std::endl;
+            return -1;
+        }
+        checksum::ChunkDigest digest;
+        disk.writers.fetch_add(1, std::memory_order_relaxed);
+        long long total = disk.run([&] { return write_chunk_file(chunk_id, fd, source, digest); });
+        disk.writers.fetch_sub(1, std::memory_order_relaxed);
+        // Syncing waits here rather than on the worker, so concurrent stores
+        // can share a barrier
+        bool stored = total >= 0 && publish_chunk(disk, fd, temp_path, chunk_id, chunk_path,
+                                                  static_cast<uint64_t>(total), &digest);
+        ::close(fd);
+        if (!stored) {
+            std::error_code ec;
+            fs::remove(temp_path, ec);
+            fs::remove(BlockChecksumFile::path_for(temp_path), ec);
+            return -1;
+        }
+
+        std::cout << "Stored chunk " << chunk_id << " (" << total << " bytes)" << std::endl;
+        return total;
+    }
+
+    bool store_chunk(const std::string& chunk_id, const std::vector<char>& data) {
+        size_t offset = 0;
+        return store_chunk_stream(chunk_id, [&](char* buf, size_t len) -> ssize_t {
+            size_t n = std::min(len, data.size() - offset);
+            std::memcpy(buf, data.data() + offset, n);
+            offset += n;
+            return static_cast<ssize_t>(n);
+        }) >= 0;
+    }
+
+    // Streams [offset, offset + length) of a chunk to `sink` in pooled slices;
+    // length 0 means "to the end" and a range past the end is empty. Each
+    // block the range touches is checked against the chunk's sidecar before
+    // any of its bytes reach the sink. The read runs on the I/O worker of the
+    // chunk's disk.
+    // Returns the bytes delivered, or -1 on error or checksum mismatch.
+    long long stream_chunk(const std::string& chunk_id, size_t offset, size_t length,
+                           const SliceSink& sink) {
+        RegisteredChunk chunk;
+        if (!registry.find(chunk_id, chunk)) {
+            std::cerr << "Chunk " << chunk_id << " not found in registry" << std::endl;
+            return -1;
+        }
+        return disks[chunk.disk]->run([&] { return read_chunk_file(chunk_id, chunk.path, offset, length, sink); });
+    }
+
+    // Loads the stored CRCs of blocks [first, first + count) of a chunk whose
+    // data file is `chunk_size` bytes, for serving them alongside the data.
+    BlockChecksumFile::Status block_checksums(const std::string& chunk_id, uint64_t chunk_size, size_t first,
+                                              size_t count, std::vector<uint32_t>& out) {
+        RegisteredChunk chunk;
+        if (!registry.find(chunk_id, chunk)) {
+            return BlockChecksumFile::Status::Missing;
+        }
+        return BlockChecksumFile::read(chunk.path, chunk_size, first, count, out);
+    }
+
+    // Opens a chunk for zero-copy serving with ChunkFile::send_to(), on the
+    // I/O worker of ChunkFile::disk(). `direct` asks for O_DIRECT, where the
+    // filesystem supports it.
+    ChunkFile open_chunk(const std::string& chunk_id, bool direct = false) {
+        RegisteredChunk chunk;
+        if (!registry.find(chunk_id, chunk)) {
+            std::cerr << "Chunk " << chunk_id << " not found in registry" << std::endl;
+            return {};
+        }
+        int fd = direct ? ::open(chunk.path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT) : -1;
+        if (fd < 0) {
+            fd = ::open(chunk.path.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        struct stat st{};
+        if (fd < 0 || ::fstat(fd, &st) < 0) {
+            std::cerr << "Failed to open chunk file: " << chunk.path << std::endl;
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return {};
+        }
+        return ChunkFile(fd, static_cast<size_t>(st.st_size), disks[chunk.disk].get());
+    }
+
+    // Starts receiving a chunk with IncomingChunk::fill_from() and flush();
+    // the chunk is put in place and registered when the upload commits,
+    // which waits for syncs (see commit_workers()). `direct` asks for
+    // O_DIRECT, where the filesystem supports it (see IncomingChunk::direct()).
+    std::unique_ptr<IncomingChunk> begin_chunk(const std::string& chunk_id, bool direct = false) {
+        StorageDisk& disk = place(chunk_id);
+        std::string chunk_path = chunk_path_on(disk, chunk_id);
+        std::string temp_path = disk.temp_path(chunk_id);
+        const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        int fd = direct ? ::open(temp_path.c_str(), flags | O_DIRECT, 0644) : -1;
+        direct = fd >= 0;
+        if (fd < 0) {
+            fd = ::open(temp_path.c_str(), flags, 0644);
+        }
+        if (fd < 0) {
+            std::cerr << "Failed to create chunk file: " << temp_path << std::endl;
+            return nullptr;
+        }
+        auto incoming = std::make_unique<IncomingChunk>(
+            [this, &disk, chunk_id, chunk_path, temp_path](int fd, size_t size, const checksum::ChunkDigest* digest) {
+                return publish_chunk(disk, fd, temp_path, chunk_id, chunk_path, size, digest);
+            },
+            temp_path, fd, disk, direct);
+        if (!incoming->ok()) {
+            std::cerr << "Failed to set up splice pipe for chunk " << chunk_id << std::endl;
+            return nullptr;
+        }
+        return incoming;
+    }
+
+    // Blocking zero-copy send of [offset, offset + length) to a socket;
+    // length 0 means "to the end". Returns the bytes sent, or -1.
+    long long send_chunk(const std::string& chunk_id, size_t offset, size_t length, int sock_fd) {
+        ChunkFile file = open_chunk(chunk_id);
+        if (!file || offset > file.size()) {
+            return -1;
+        }
+        size_t remaining = file.size() - offset;
+        if (length != 0) {
+            remaining = std::min(remaining, length);
+        }
+        off_t pos = static_cast<off_t>(offset);
+        long long total = 0;
+        while (remaining > 0) {
+            ssize_t n = file.send_to(sock_fd, pos, remaining);
+            if (n < 0) {
+                std::cerr << "sendfile failed for chunk " << chunk_id << ": " << std::strerror(errno) << std::endl;
+                return -1;
+            }
+            if (n == 0) {
+                pollfd pfd{sock_fd, POLLOUT, 0};
+                ::poll(&pfd, 1, -1);
+                continue;
+            }
+            total += n;
+            remaining -= static_cast<size_t>(n);
+        }
+        return total;
+    }
+
+    // Blocking zero-copy receive of exactly `length` bytes from a socket.
+    // Returns the bytes stored, or -1 (nothing is registered on failure).
+    long long receive_chunk(const std::string& chunk_id, size_t length, int sock_fd) {
+        auto incoming = begin_chunk(chunk_id);
+        if (!incoming) {
+            return -1;
+        }
+        while (incoming->received() < length) {
+            ssize_t n = incoming->splice_from(sock_fd, std::min(IO_SLICE_SIZE, length - incoming->received()));
+            if (n < 0 || incoming->eof()) {
+                std::cerr << "Error receiving chunk " << chunk_id << std::endl;
+                return -1;
+            }
+            if (n == 0) {
+                pollfd pfd{sock_fd, POLLIN, 0};
+                ::poll(&pfd, 1, -1);
+            }
+        }
+        if (!incoming->commit()) {
+            return -1;
+        }
+        std::cout << "Stored chunk " << chunk_id << " (" << length << " bytes)" << std::endl;
+        return static_cast<long long>(length);
+    }
+
+    // Whole-chunk convenience for small chunks and tests; the serving path
+    // uses stream_chunk() so it never materialises a chunk in memory.
+    std::vector<char> retrieve_chunk(const std::string& chunk_id) {
+        std::vector<char> data;
+        long long n = stream_chunk(chunk_id, 0, 0, [&](const char* buf, size_t len) {
+            data.insert(data.end(), buf, buf + len);
+            return true;
+        });
+        if (n < 0) {
+            data.clear();
+            return data;
+        }
+        std::cout << "Retrieved chunk " << chunk_id << " (" << data.size() << " bytes)" << std::endl;
+        return data;
+    }
+
+    bool delete_chunk(const std::string& chunk_id) {
+        try {
+            std::string chunk_path;
+            StorageDisk* disk = nullptr;
+            bool found = registry.erase(chunk_id, [&](const RegisteredChunk& chunk) {
+                chunk_path = chunk.path;
+                disk = disks[chunk.disk].get();
+                disk->account(-static_cast<int64_t>(chunk.size), -1);
+                disk->index.removed(chunk_id);
+            });
+            if (!found) {
+                return false;
+            }
+            maybe_compact(*disk);
+
+            fs::remove(chunk_path);
+            std::error_code ec;
+            fs::remove(BlockChecksumFile::path_for(chunk_path), ec);
+            std::cout << "Deleted chunk " << chunk_id << std::endl;
+            return true;
+        } catch (const std::exception& e) {
+            std::cerr << "Error deleting chunk " << chunk_id << ": " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    // Snapshot of the registered ids; stores and deletes carry on meanwhile.
+    std::vector<std::string> list_chunks() const {
+        return registry.ids();
+    }
+
+    // Bytes of chunk data stored; O(1), see usage().
+    size_t get_storage_usage() const {
+        size_t used = 0;
+        for (const auto& disk : disks) {
+            used += disk->used_bytes.load(std::memory_order_relaxed);
+        }
+        return used;
+    }
+
+    // Totals over all disks. Directories sharing a filesystem count its
+    // space once.
+    StorageUsage usage() const {
+        StorageUsage total{0, registry.size(), 0, 0};
+        std::vector<dev_t> counted;
+        for (const auto& disk : disks) {
+            total.used_bytes += disk->used_bytes.load(std::memory_order_relaxed);
+            if (std::find(counted.begin(), counted.end(), disk->device) == counted.end()) {
+                counted.push_back(disk->device);
+                total.disk_free_bytes += static_cast<uint64_t>(
+                    std::max<int64_t>(disk->free_bytes.load(std::memory_order_relaxed), 0));
+                total.disk_total_bytes += disk->total_bytes.load(std::memory_order_relaxed);
+            }
+        }
+        return total;
+    }
+
+    // One entry per data directory, in the order they were given.
+    std::vector<StorageUsage> usage_by_disk() const {
+        std::vector<StorageUsage> out;
+        for (const auto& disk : disks) {
+            out.push_back(StorageUsage{disk->used_bytes.load(std::memory_order_relaxed),
+                                       disk->chunk_count.load(std::memory_order_relaxed),
+                                       static_cast<uint64_t>(
+                                           std::max<int64_t>(disk->free_bytes.load(std::memory_order_relaxed), 0)),
+                                       disk->total_bytes.load(std::memory_order_relaxed)});
+        }
+        return out;
+    }
+
+    // Re-measures the counters against the disks: stats every chunk file and
+    // the filesystems. The counters only drift if files change behind the
+    // storage's back, so this runs rarely.
+    void reconcile_usage() {
+        std::vector<std::future<std::vector<ChunkIndex::Entry>>> scanning;
+        for (auto& disk : disks) {
+            scanning.push_back(disk->schedule([d = disk.get(), n = disks.size()] {
+                return ChunkIndex::scan(d->path, std::max<size_t>(2, std::thread::hardware_concurrency() / n));
+            }));
+        }
+        std::vector<std::unordered_map<std::string, uint64_t>> sizes(disks.size());
+        for (size_t i = 0; i < disks.size(); ++i) {
+            auto on_disk = scanning[i].get();
+            sizes[i].reserve(on_disk.size());
+            for (auto& e : on_disk) {
+                sizes[i].emplace(std::move(e.chunk_id), e.size);
+            }
+        }
+
+        // Shard by shard, so a store racing with this can be counted twice
+        // or not at all; the next reconcile settles it.
+        std::vector<uint64_t> used(disks.size(), 0), count(disks.size(), 0);
+        registry.update_each([&](const std::string& id, RegisteredChunk& chunk) {
+            // Chunks committed after the scan keep their registered size
+            if (auto it = sizes[chunk.disk].find(id); it != sizes[chunk.disk].end()) {
+                chunk.size = it->second;
+            }
+            used[chunk.disk] += chunk.size;
+            ++count[chunk.disk];
+        });
+        for (auto& disk : disks) {
+            uint64_t before = disk->used_bytes.exchange(used[disk->id], std::memory_order_relaxed);
+            disk->chunk_count = count[disk->id];
+            disk->measure();
+            if (before != used[disk->id]) {
+                std::cout << "Storage accounting for " << disk->path << " drifted by "
+                          << static_cast<int64_t>(used[disk->id] - before) << " bytes" << std::endl;
+            }
+        }
+    }
+};
@@ -3,6 +3,8 @@
 #include <cstring> // for std::strcmp
 #include <iostream>
 
+extern "C" int start_cluster_server(int server_id, const char* ip, int port);
+
 int main(int argc, char **argv) {
   if (argc > 1) {
     std::string arg = argv[1];
@@ -14,6 +16,7 @@ int main(int argc, char **argv) {
       std::cout << "  -v, --version  Show program's version number and exit\n";
       std::cout << "  --server-id ID Set the server ID\n";
       std::cout << "  --port PORT    Set the port number\n";
+      std::cout << "  --ip IP        Set the address to listen on\n";
       return 0;
     }
     if (arg == "-v" || arg == "-V" || arg == "--version") {
@@ -37,13 +40,9 @@ int main(int argc, char **argv) {
       }
     }
     
-    // Start cluster server service
-    std::cout << "Starting Cluster Server " << server_id << " on " << ip << ":" << port << std::endl;
+    // Start cluster server service; blocks serving chunks until stopped
     std::cout << "Note: Heartbeat functionality requires health checker to be running" << std::endl;
-    
-    // For now, just simulate running without the problematic heartbeat
-    std::cout << "Cluster Server is ready (simulation mode)" << std::endl;
-    return 0;
+    return start_cluster_server(server_id, ip.c_str(), port) == 0 ? 0 : 1;
   }
   
   std::cout << "Usage: cluster_server [OPTIONS]" << std::endl;
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "../include/checksum.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Where chunk files go under a data directory. With `levels` of fan-out,
+// chunk_<id>.dat lives in <dir>/ab/cd/..., one two-hex-digit directory per
+// level taken from the CRC32C of the id. Two levels give 65536 leaf
+// directories, so even tens of millions of chunks leave each directory
+// small enough that lookups and creates stay cheap. Level 0 is the old flat
+// layout, every chunk directly in <dir>.
+//
+// The layout a directory uses is recorded in a "layout" file beside the
+// chunk index; a directory without one is flat.
+struct DirectoryLayout {
+    static constexpr int MAX_LEVELS = 4; // one per byte of the hash
+
+    int levels = 2;
+
+    // "ab/cd/" for two levels, "" for the flat layout.
+    std::string subdir(const std::string& chunk_id) const {
+        static const char hex[] = "0123456789abcdef";
+        uint32_t hash = checksum::crc32c(0, chunk_id.data(), chunk_id.size());
+        std::string out;
+        for (int i = 0; i < levels; ++i) {
+            uint8_t byte = static_cast<uint8_t>(hash >> (8 * i));
+            out += hex[byte >> 4];
+            out += hex[byte & 0xf];
+            out += '/';
+        }
+        return out;
+    }
+
+    // Relative to the data directory.
+    std::string relative_path(const std::string& chunk_id) const {
+        return subdir(chunk_id) + "chunk_" + chunk_id + ".dat";
+    }
+
+    // `dir` has a trailing '/'.
+    std::string path(const std::string& dir, const std::string& chunk_id) const {
+        return dir + relative_path(chunk_id);
+    }
+
+    // Two lowercase hex digits, as subdir() generates.
+    static bool is_fanout_dir(const char* name) {
+        auto hex = [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); };
+        return hex(name[0]) && hex(name[1]) && name[2] == '\0';
+    }
+
+    // Creates `path` for writing, making its fan-out directories on first
+    // use. Returns the descriptor, or -1 with errno set.
+    static int create_file(const std::string& path, int flags) {
+        int fd = ::open(path.c_str(), flags | O_CREAT, 0644);
+        if (fd >= 0 || errno != ENOENT || !make_parents(path)) {
+            return fd;
+        }
+        return ::open(path.c_str(), flags | O_CREAT, 0644);
+    }
+
+    // Renames `from` to `to`, making the fan-out directories of `to` on
+    // first use. Returns false with errno set.
+    static bool rename_into(const std::string& from, const std::string& to) {
+        if (::rename(from.c_str(), to.c_str()) == 0) {
+            return true;
+        }
+        if (errno != ENOENT || !make_parents(to)) {
+            return false;
+        }
+        return ::rename(from.c_str(), to.c_str()) == 0;
+    }
+
+    // Creates the directories above `path`.
+    static bool make_parents(const std::string& path) {
+        for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            if (::mkdir(path.substr(0, slash).c_str(), 0755) < 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static std::string marker_path(const std::string& dir) { return dir + "layout"; }
+
+    // The layout recorded in `dir`, or std::nullopt if it has none.
+    static std::optional<DirectoryLayout> recorded(const std::string& dir) {
+        std::ifstream in(marker_path(dir));
+        int levels = -1;
+        if (!(in >> levels) || levels < 0 || levels > MAX_LEVELS) {
+            return std::nullopt;
+        }
+        return DirectoryLayout{levels};
+    }
+
+    // Written to a temp name and renamed, so a crash leaves the old marker.
+    bool record(const std::string& dir) const {
+        std::string tmp = marker_path(dir) + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << levels << '\n';
+            if (!out) {
+                return false;
+            }
+        }
+        return ::rename(tmp.c_str(), marker_path(dir).c_str()) == 0;
+    }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+
+// How hard a stored chunk is pushed to disk before the store reports
+// success. Chunks are always written under a temp name and renamed into
+// place, so a crash never leaves a partial file under a chunk's name; the
+// level decides whether a chunk reported stored is sure to survive one.
+enum class Durability {
+    None,     // leave it to the kernel's writeback
+    PerChunk, // fdatasync() each chunk, then fsync() its directory
+    Group,    // concurrent stores share syncfs() barriers (see GroupSync)
+};
+
+// Group commit for one filesystem. barrier() returns once a sync that
+// started after the call has finished, so everything the caller wrote before
+// calling is on disk. Callers arriving while a sync runs wait for the next
+// one, which a single one of them issues for all, so under load many
+// chunks cost one syncfs() instead of an fsync each.
+class GroupSync {
+public:
+    // `dir` is any directory on the filesystem.
+    explicit GroupSync(const std::string& dir) : fd(::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) {}
+
+    ~GroupSync() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    GroupSync(const GroupSync&) = delete;
+    GroupSync& operator=(const GroupSync&) = delete;
+
+    bool barrier() {
+        std::unique_lock<std::mutex> lock(mutex);
+        const uint64_t target = started + 1;
+        while (finished < target) {
+            if (running) {
+                cv.wait(lock);
+                continue;
+            }
+            running = true;
+            ++started;
+            lock.unlock();
+            int rc = fd >= 0 ? ::syncfs(fd) : -1;
+            lock.lock();
+            running = false;
+            finished = started;
+            if (rc < 0) {
+                failed = started;
+            }
+            cv.notify_all();
+        }
+        // A later failure also fails earlier waiters still in line: the
+        // pages their sync wrote may be the ones that failed.
+        return failed < target;
+    }
+
+    // syncfs() calls so far, for seeing how well barriers are shared.
+    uint64_t syncs() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return finished;
+    }
+
+private:
+    int fd;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t started = 0;
+    uint64_t finished = 0;
+    uint64_t failed = 0;
+    bool running = false;
+};
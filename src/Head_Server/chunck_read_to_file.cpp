@@ -1,4 +1,9 @@
+#include "../include/buffer_pool.hpp"
+#include "../include/erasure_code.hpp"
 #include "../include/heart_beat_signal.hpp"
+#include "../include/worker_pool.hpp"
+#include "./chunk_client.hpp"
+#include "./chunk_layout.hpp"
 #include "./redis_handler.hpp"
 #include <fstream>
 #include <filesystem>
@@ -7,153 +12,467 @@
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <optional>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <cstring>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
-struct ChunkLocation {
-    int chunk_id;
-    std::string server_ip;
-    std::string file_path;
+// Tracks per-server load and observed latency so each chunk is fetched from
+// the replica expected to answer first. Servers that fail are benched for a
+// cooldown period and only tried when no other replica is left.
+class ReplicaSelector {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<ChunkLocation> rank(std::vector<ChunkLocation> replicas) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = Clock::now();
+        std::stable_sort(replicas.begin(), replicas.end(),
+                         [&](const ChunkLocation& a, const ChunkLocation& b) {
+                             return score(a.server_ip, now) < score(b.server_ip, now);
+                         });
+        return replicas;
+    }
+
+    void begin(const std::string& server) {
+        std::lock_guard<std::mutex> lock(mutex);
+        servers[server].inflight++;
+    }
+
+    void succeeded(const std::string& server, size_t bytes, Clock::duration elapsed) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& stats = servers[server];
+        stats.inflight--;
+        double mb = std::max(1.0, bytes / (1024.0 * 1024.0));
+        double ms_per_mb = std::chrono::duration<double, std::milli>(elapsed).count() / mb;
+        stats.ms_per_mb = stats.samples == 0 ? ms_per_mb : 0.8 * stats.ms_per_mb + 0.2 * ms_per_mb;
+        stats.samples++;
+    }
+
+    void failed(const std::string& server) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& stats = servers[server];
+        stats.inflight--;
+        stats.benched_until = Clock::now() + FAILURE_COOLDOWN;
+    }
+
+private:
+    static constexpr auto FAILURE_COOLDOWN = std::chrono::seconds(10);
+
+    struct ServerStats {
+        int inflight = 0;
+        double ms_per_mb = 0.0; // EWMA of transfer time
+        uint64_t samples = 0;
+        Clock::time_point benched_until{};
+    };
+
+    // Expected wait: queued requests times per-request cost. Unmeasured
+    // servers score zero so they get probed early.
+    double score(const std::string& server, Clock::time_point now) {
+        auto& stats = servers[server];
+        double expected = (stats.inflight + 1) * stats.ms_per_mb;
+        if (stats.benched_until > now) {
+            expected += 1e12;
+        }
+        return expected;
+    }
+
+    std::mutex mutex;
+    std::unordered_map<std::string, ServerStats> servers;
 };
 
 class FileReconstructor {
 private:
     std::vector<ChunkLocation> get_chunk_locations_from_redis(const std::string& filename) {
-        std::vector<ChunkLocation> locations;
+        auto manifest = read_manifest(filename);
+        if (!manifest) {
+            return {};
+        }
+        return std::move(manifest->chunks);
+    }
+    
+    // Receives a chunk slice by slice: (data, len, offset within the chunk).
+    using ChunkSink = std::function<bool(const char* data, size_t len, size_t offset)>;
+
+    static constexpr long long READ_FAILED = ChunkClient::READ_FAILED;
+    static constexpr long long SINK_FAILED = ChunkClient::SINK_FAILED;
+    static constexpr long long CHECKSUM_FAILED = ChunkClient::CHECKSUM_FAILED;
+
+    // Streams [offset, offset + length) of one replica from its cluster
+    // server (length 0 = to the end); sink offsets are relative to `offset`.
+    // Returns bytes delivered, READ_FAILED if the replica could not be read,
+    // CHECKSUM_FAILED if its data failed verification, or SINK_FAILED if the
+    // sink rejected a slice.
+    long long read_chunk_from_server(const ChunkLocation& location, size_t offset, size_t length,
+                                     const ChunkSink& sink) {
+        size_t total = 0;
+        long long n = ChunkClient(location.server_ip).get(location.file_path, offset, length, [&](const char* data, size_t len) {
+            bool ok = sink(data, len, total);
+            total += len;
+            return ok;
+        });
+        if (n < 0) {
+            if (n == READ_FAILED) {
+                std::cerr << "Failed to read chunk " << location.file_path << " from " << location.server_ip << std::endl;
+            } else if (n == CHECKSUM_FAILED) {
+                std::cerr << "Chunk " << location.file_path << " from " << location.server_ip
+                          << " failed checksum verification" << std::endl;
+            }
+            return n;
+        }
         
-        try {
-            // Use the read_entry function to get chunk information
-            std::stringstream request;
-            request << filename;
-            
-            // Capture output from read_entry
-            std::streambuf* orig = std::cout.rdbuf();
-            std::ostringstream captured;
-            std::cout.rdbuf(captured.rdbuf());
-            
-            read_entry(request.str());
-            
-            std::cout.rdbuf(orig);
-            std::string output = captured.str();
-            
-            // Parse the output to extract chunk locations
-            std::istringstream iss(output);
-            std::string line;
-            while (std::getline(iss, line)) {
-                if (line.find("chunk:") != std::string::npos) {
-                    // Parse line format: "chunk:X server=Y path=Z"
-                    size_t chunk_pos = line.find("chunk:");
-                    size_t server_pos = line.find("server=");
-                    size_t path_pos = line.find("path=");
-                    
-                    if (chunk_pos != std::string::npos && server_pos != std::string::npos && path_pos != std::string::npos) {
-                        ChunkLocation loc;
-                        
-                        // Extract chunk ID
-                        std::string chunk_str = line.substr(chunk_pos + 6);
-                        size_t space_pos = chunk_str.find(' ');
-                        if (space_pos != std::string::npos) {
-                            loc.chunk_id = std::stoi(chunk_str.substr(0, space_pos));
-                        }
-                        
-                        // Extract server IP
-                        std::string server_str = line.substr(server_pos + 7);
-                        space_pos = server_str.find(' ');
-                        if (space_pos != std::string::npos) {
-                            loc.server_ip = server_str.substr(0, space_pos);
-                        }
-                        
-                        // Extract file path
-                        loc.file_path = line.substr(path_pos + 5);
-                        
-                        locations.push_back(loc);
-                    }
+        std::cout << "Read chunk " << location.chunk_id << " (" << total << " bytes) from " << location.server_ip << std::endl;
+        return static_cast<long long>(total);
+    }
+
+    // Tries replicas best-first until one delivers the chunk, or the given
+    // part of it; updates selector stats. Returns the bytes delivered or a
+    // negative error. A replica that fails part-way is simply restarted on
+    // the next one, since the sink writes at absolute offsets. `expected` is
+    // how many bytes a good replica delivers (0 if unknown, as for the last
+    // fixed-size chunk); a replica that delivers fewer is treated as failed.
+    long long fetch_chunk(const std::vector<ChunkLocation>& replicas, const ChunkSink& sink,
+                          size_t offset = 0, size_t length = 0, size_t expected = 0) {
+        if (auto stripe = stripe_of(replicas)) {
+            return fetch_coded_chunk(*stripe, sink, offset, length);
+        }
+        for (const auto& location : replica_selector.rank(replicas)) {
+            replica_selector.begin(location.server_ip);
+            auto started = ReplicaSelector::Clock::now();
+            long long bytes = read_chunk_from_server(location, offset, length, sink);
+            // A whole chunk is never empty; a range at its very end can be
+            bool complete = expected > 0 ? bytes == static_cast<long long>(expected)
+                                         : bytes > 0 || (bytes == 0 && offset > 0);
+            if (complete) {
+                replica_selector.succeeded(location.server_ip, static_cast<size_t>(bytes),
+                                           ReplicaSelector::Clock::now() - started);
+                return bytes;
+            }
+            if (bytes == SINK_FAILED) {
+                // Local write error: not the replica's fault, and retrying won't help
+                replica_selector.succeeded(location.server_ip, 0, ReplicaSelector::Clock::now() - started);
+                return SINK_FAILED;
+            }
+            replica_selector.failed(location.server_ip);
+            if (bytes >= 0) {
+                std::cerr << "Replica " << location.server_ip << " delivered " << bytes << " of " << expected
+                          << " bytes of chunk " << location.chunk_id << ", trying next replica" << std::endl;
+            } else {
+                std::cerr << "Replica " << location.server_ip << " failed for chunk " << location.chunk_id
+                          << ", trying next replica" << std::endl;
+            }
+        }
+        return READ_FAILED;
+    }
+
+    // The fragments of an erasure-coded chunk by stripe index (nullptr where
+    // the manifest has none), as named by fragment_id().
+    struct Stripe {
+        FragmentRef layout;
+        std::vector<const ChunkLocation*> fragments;
+    };
+
+    static std::optional<Stripe> stripe_of(const std::vector<ChunkLocation>& locations) {
+        auto first = locations.empty() ? std::nullopt : parse_fragment_id(locations.front().file_path);
+        if (!first) {
+            return std::nullopt;
+        }
+        Stripe stripe{*first, std::vector<const ChunkLocation*>(first->data + first->parity, nullptr)};
+        for (const auto& location : locations) {
+            auto f = parse_fragment_id(location.file_path);
+            if (f && f->data == first->data && f->parity == first->parity && f->chunk_size == first->chunk_size) {
+                stripe.fragments[f->index] = &location;
+            }
+        }
+        return stripe;
+    }
+
+    // read_chunk_from_server() with the selector's bookkeeping.
+    long long read_fragment(const ChunkLocation& location, size_t offset, size_t length, const ChunkSink& sink) {
+        replica_selector.begin(location.server_ip);
+        auto started = ReplicaSelector::Clock::now();
+        long long bytes = read_chunk_from_server(location, offset, length, sink);
+        if (bytes == static_cast<long long>(length) || bytes == SINK_FAILED) {
+            replica_selector.succeeded(location.server_ip, bytes > 0 ? static_cast<size_t>(bytes) : 0,
+                                       ReplicaSelector::Clock::now() - started);
+        } else {
+            replica_selector.failed(location.server_ip);
+        }
+        return bytes;
+    }
+
+    // Serves part of an erasure-coded chunk straight from the data fragments
+    // it covers. A data fragment that cannot be read is decoded from k of
+    // the others instead, overwriting whatever it delivered before failing.
+    long long fetch_coded_chunk(const Stripe& stripe, const ChunkSink& sink, size_t offset, size_t length) {
+        const uint64_t chunk_size = stripe.layout.chunk_size;
+        const uint64_t fragment_size = stripe.layout.size();
+        uint64_t end = length == 0 ? chunk_size : std::min<uint64_t>(chunk_size, offset + length);
+        if (offset >= end) {
+            return 0;
+        }
+
+        std::vector<bool> lost(stripe.fragments.size(), false);
+        for (int i = static_cast<int>(offset / fragment_size); i < stripe.layout.data && i * fragment_size < end; ++i) {
+            uint64_t from = std::max<uint64_t>(offset, i * fragment_size);
+            uint64_t to = std::min<uint64_t>(end, (i + 1) * fragment_size);
+            ChunkSink piece_sink = [&, from](const char* data, size_t len, size_t at) {
+                return sink(data, len, from - offset + at);
+            };
+            long long n = READ_FAILED;
+            if (stripe.fragments[i]) {
+                n = read_fragment(*stripe.fragments[i], from - i * fragment_size, to - from, piece_sink);
+            }
+            if (n == SINK_FAILED) {
+                return SINK_FAILED;
+            }
+            if (n != static_cast<long long>(to - from)) {
+                lost[i] = true;
+                std::cerr << "Rebuilding fragment " << i << " of " << stripe.layout.data << "+"
+                          << stripe.layout.parity << " stripe from the others" << std::endl;
+                n = decode_fragment(stripe, lost, i, from - i * fragment_size, to - from, piece_sink);
+                if (n < 0) {
+                    return n;
                 }
             }
-        } catch (const std::exception& e) {
-            std::cerr << "Error getting chunk locations: " << e.what() << std::endl;
         }
-        
-        return locations;
+        return static_cast<long long>(end - offset);
     }
-    
-    std::vector<char> read_chunk_from_server(const ChunkLocation& location) {
-        std::vector<char> chunk_data;
-        
-        try {
-            std::ifstream file(location.file_path, std::ios::binary);
-            if (!file) {
-                std::cerr << "Failed to read chunk from: " << location.file_path << std::endl;
-                return chunk_data;
-            }
-            
-            // Get file size
-            file.seekg(0, std::ios::end);
-            size_t file_size = file.tellg();
-            file.seekg(0, std::ios::beg);
-            
-            chunk_data.resize(file_size);
-            file.read(chunk_data.data(), file_size);
-            file.close();
-            
-            std::cout << "Read chunk " << location.chunk_id << " (" << file_size << " bytes) from " << location.server_ip << std::endl;
-        } catch (const std::exception& e) {
-            std::cerr << "Error reading chunk: " << e.what() << std::endl;
+
+    // Rebuilds [offset, offset + length) of fragment `target` a window at a
+    // time from the same range of k surviving fragments. Fragments that fail
+    // are added to `lost` and replaced by the next survivor.
+    long long decode_fragment(const Stripe& stripe, std::vector<bool>& lost, int target, uint64_t offset,
+                              uint64_t length, const ChunkSink& sink) {
+        const int k = stripe.layout.data;
+        const int total = k + stripe.layout.parity;
+        erasure::Codec codec(k, stripe.layout.parity);
+        std::vector<std::vector<uint8_t>> windows(total);
+        std::vector<uint8_t> rebuilt_window;
+
+        for (uint64_t done = 0; done < length;) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(DECODE_WINDOW, length - done));
+            std::vector<const uint8_t*> survivors(total, nullptr);
+            int found = 0;
+            for (int i = 0; i < total && found < k; ++i) {
+                if (i == target || lost[i] || !stripe.fragments[i]) {
+                    continue;
+                }
+                auto& window = windows[i];
+                window.resize(n);
+                long long got = read_fragment(*stripe.fragments[i], offset + done, n,
+                                              [&](const char* data, size_t len, size_t at) {
+                                                  std::memcpy(window.data() + at, data, len);
+                                                  return true;
+                                              });
+                if (got != static_cast<long long>(n)) {
+                    lost[i] = true;
+                    continue;
+                }
+                survivors[i] = window.data();
+                found++;
+            }
+            if (found < k) {
+                std::cerr << "Only " << found << " fragments of a " << k << "+" << stripe.layout.parity
+                          << " stripe are readable" << std::endl;
+                return READ_FAILED;
+            }
+
+            rebuilt_window.resize(n);
+            std::vector<uint8_t*> rebuilt(total, nullptr);
+            rebuilt[target] = rebuilt_window.data();
+            codec.decode(survivors.data(), rebuilt.data(), n);
+            if (!sink(reinterpret_cast<const char*>(rebuilt_window.data()), n, done)) {
+                return SINK_FAILED;
+            }
+            done += n;
         }
-        
-        return chunk_data;
+        return static_cast<long long>(length);
     }
 
-public:
-    bool reconstruct_file(const std::string& filename, const std::string& output_path) {
-        std::cout << "Reconstructing file: " << filename << std::endl;
-        
-        // Get chunk locations from Redis
+    // Every replica of a file grouped by chunk id, or nullopt if the file is
+    // unknown or its chunk list has gaps.
+    std::optional<std::map<int, std::vector<ChunkLocation>>> replicas_by_chunk(const std::string& filename) {
         auto chunk_locations = get_chunk_locations_from_redis(filename);
         if (chunk_locations.empty()) {
             std::cerr << "No chunks found for file: " << filename << std::endl;
-            return false;
+            return std::nullopt;
         }
-        
-        // Group chunks by chunk_id and select one location per chunk (for redundancy)
-        std::map<int, ChunkLocation> unique_chunks;
+
+        std::map<int, std::vector<ChunkLocation>> by_chunk;
         for (const auto& location : chunk_locations) {
-            if (unique_chunks.find(location.chunk_id) == unique_chunks.end()) {
-                unique_chunks[location.chunk_id] = location;
+            by_chunk[location.chunk_id].push_back(location);
+        }
+
+        // Chunk ids are dense; a gap means the metadata lost a chunk
+        if (by_chunk.begin()->first != 0 ||
+            by_chunk.rbegin()->first != static_cast<int>(by_chunk.size()) - 1) {
+            std::cerr << "Chunk list for " << filename << " is incomplete" << std::endl;
+            return std::nullopt;
+        }
+        return by_chunk;
+    }
+
+    // End offsets of a file's chunks when they are content-defined, where
+    // every chunk's size comes from its id; nullopt for fixed-size chunks.
+    static std::optional<std::vector<uint64_t>> content_chunk_ends(
+        const std::map<int, std::vector<ChunkLocation>>& chunks) {
+        std::vector<uint64_t> ends;
+        ends.reserve(chunks.size());
+        for (const auto& [chunk_id, replicas] : chunks) {
+            auto content = parse_content_chunk_id(replicas.front().file_path);
+            if (!content) {
+                return std::nullopt;
             }
+            ends.push_back((ends.empty() ? 0 : ends.back()) + content->size);
+        }
+        return ends;
+    }
+
+    // Per fragment read while decoding; k + 1 windows are held at once.
+    static constexpr size_t DECODE_WINDOW = 4 * 1024 * 1024;
+
+    ReplicaSelector replica_selector;
+    size_t download_workers = std::max(2u, std::thread::hardware_concurrency());
+
+public:
+    static bool pwrite_all(int fd, const char* data, size_t len, off_t offset) {
+        size_t written = 0;
+        while (written < len) {
+            ssize_t n = ::pwrite(fd, data + written, len - written, offset + written);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool reconstruct_file(const std::string& filename, const std::string& output_path) {
+        std::cout << "Reconstructing file: " << filename << std::endl;
+        
+        auto chunks = replicas_by_chunk(filename);
+        if (!chunks) {
+            return false;
         }
         
-        std::cout << "Found " << unique_chunks.size() << " unique chunks to reconstruct" << std::endl;
+        std::cout << "Found " << chunks->size() << " unique chunks to reconstruct" << std::endl;
+        int last_chunk = chunks->rbegin()->first;
+        auto ends = content_chunk_ends(*chunks);
         
-        // Create output file
-        std::ofstream output_file(output_path, std::ios::binary);
-        if (!output_file) {
+        // Create output file; chunks are written at their offsets as they arrive
+        int out_fd = ::open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out_fd < 0) {
             std::cerr << "Failed to create output file: " << output_path << std::endl;
             return false;
         }
         
-        // Read and write chunks in order
-        for (const auto& [chunk_id, location] : unique_chunks) {
-            auto chunk_data = read_chunk_from_server(location);
-            if (chunk_data.empty()) {
-                std::cerr << "Failed to read chunk " << chunk_id << std::endl;
-                output_file.close();
-                fs::remove(output_path);
-                return false;
+        std::atomic<bool> failed{false};
+        {
+            WorkerPool pool(std::min(download_workers, chunks->size()));
+            for (const auto& [chunk_id, replicas] : *chunks) {
+                pool.submit([&, chunk_id = chunk_id, replicas = &replicas] {
+                    if (failed) {
+                        return;
+                    }
+                    off_t base = ends ? static_cast<off_t>(chunk_id == 0 ? 0 : (*ends)[chunk_id - 1])
+                                      : static_cast<off_t>(chunk_id) * static_cast<off_t>(CHUNK_SIZE);
+                    // Every chunk but a fixed-size file's last one has a known size
+                    size_t expected = ends ? static_cast<size_t>((*ends)[chunk_id] - static_cast<uint64_t>(base))
+                                           : chunk_id == last_chunk ? 0 : CHUNK_SIZE;
+                    bool write_failed = false;
+                    bool ok = fetch_chunk(*replicas, [&](const char* data, size_t len, size_t offset) {
+                        if (pwrite_all(out_fd, data, len, base + static_cast<off_t>(offset))) {
+                            return true;
+                        }
+                        write_failed = true;
+                        return false;
+                    }, 0, 0, expected) > 0;
+                    if (write_failed) {
+                        std::cerr << "Failed to write chunk " << chunk_id << " to " << output_path << std::endl;
+                        failed = true;
+                    } else if (!ok) {
+                        std::cerr << "Failed to read chunk " << chunk_id << " from any replica" << std::endl;
+                        failed = true;
+                    }
+                });
             }
-            
-            output_file.write(chunk_data.data(), chunk_data.size());
+            pool.wait_idle();
+        }
+        
+        ::close(out_fd);
+        if (failed) {
+            fs::remove(output_path);
+            return false;
         }
         
-        output_file.close();
         std::cout << "File reconstructed successfully: " << output_path << std::endl;
         return true;
     }
     
+    // Reads the byte range [offset, offset + length) of a stored file into
+    // `sink` (length 0 = to the end); sink offsets are relative to `offset`.
+    // Only the chunks the range overlaps are contacted, and only the
+    // overlapping part of each is transferred. Returns the bytes read, which
+    // is short when the range runs past the end of the file, or -1.
+    long long read_range(const std::string& filename, uint64_t offset, uint64_t length, const ChunkSink& sink) {
+        auto chunks = replicas_by_chunk(filename);
+        if (!chunks) {
+            return -1;
+        }
+        int last_chunk = chunks->rbegin()->first;
+        auto ends = content_chunk_ends(*chunks);
+        auto spans = ends ? chunk_spans(offset, length, *ends) : chunk_spans(offset, length, last_chunk + 1);
+
+        std::atomic<bool> failed{false};
+        std::vector<long long> delivered(spans.size(), 0);
+        {
+            WorkerPool pool(std::max<size_t>(1, std::min(download_workers, spans.size())));
+            for (size_t i = 0; i < spans.size(); ++i) {
+                pool.submit([&, i] {
+                    const ChunkSpan& span = spans[i];
+                    if (failed) {
+                        return;
+                    }
+                    // Only the last fixed-size chunk may end early
+                    bool may_end_early = !ends && span.chunk_id == last_chunk;
+                    delivered[i] = fetch_chunk(
+                        chunks->at(span.chunk_id),
+                        [&](const char* data, size_t len, size_t at) {
+                            return sink(data, len, span.range_offset + at);
+                        },
+                        span.offset, span.length, may_end_early ? 0 : span.length);
+                    if (delivered[i] < 0 || (!may_end_early && static_cast<uint64_t>(delivered[i]) != span.length)) {
+                        std::cerr << "Failed to read chunk " << span.chunk_id << " of " << filename << std::endl;
+                        failed = true;
+                    }
+                });
+            }
+            pool.wait_idle();
+        }
+        if (failed) {
+            return -1;
+        }
+
+        long long total = 0;
+        for (long long n : delivered) {
+            total += n;
+        }
+        return total;
+    }
+
     bool file_exists(const std::string& filename) {
-        auto chunk_locations = get_chunk_locations_from_redis(filename);
-        return !chunk_locations.empty();
+        return manifest_exists(filename);
     }
 };
 
@@ -173,6 +492,28 @@ extern "C" {
         }
     }
     
+    // Writes bytes [offset, offset + length) of a stored file to output_path
+    // (length 0 = to the end). Returns the number of bytes written, or -1.
+    long long process_file_range_read(const char* filename, unsigned long long offset, unsigned long long length,
+                                      const char* output_path) {
+        try {
+            int out_fd = ::open(output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (out_fd < 0) {
+                std::cerr << "Failed to create output file: " << output_path << std::endl;
+                return -1;
+            }
+            long long n = g_file_reconstructor.read_range(filename, offset, length,
+                                                          [&](const char* data, size_t len, size_t at) {
+                                                              return FileReconstructor::pwrite_all(out_fd, data, len, static_cast<off_t>(at));
+                                                          });
+            ::close(out_fd);
+            return n;
+        } catch (const std::exception& e) {
+            std::cerr << "Error processing range read: " << e.what() << std::endl;
+            return -1;
+        }
+    }
+
     int check_file_exists(const char* filename) {
         try {
             return g_file_reconstructor.file_exists(filename) ? 1 : 0;
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "../include/buffer_pool.hpp"
+#include "../include/chunk_protocol.hpp"
+#include "./upload_pipeline.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+static_assert(IO_SLICE_SIZE % checksum::BLOCK_SIZE == 0, "slices must hold whole checksum blocks");
+
+// Blocking client for the chunk protocol spoken by cluster servers (see
+// chunk_protocol.hpp). Each operation uses its own connection, so a client
+// can be shared freely between upload and download workers.
+class ChunkClient {
+public:
+    using Sink = std::function<bool(const char* data, size_t len)>;
+
+    static constexpr long long READ_FAILED = -1;
+    static constexpr long long SINK_FAILED = -2;
+    static constexpr long long CHECKSUM_FAILED = -3;
+
+    // `server` is "host:port".
+    explicit ChunkClient(std::string server, int timeout_seconds = 30)
+        : server(std::move(server)), timeout_seconds(timeout_seconds) {}
+
+    // Connected socket, or -1. Also used by RemoteChunkWriter.
+    int connect_to_server() const {
+        auto colon = server.rfind(':');
+        sockaddr_in addr{};
+        if (colon == std::string::npos ||
+            !async_hb::resolve_ipv4(server.substr(0, colon),
+                                    static_cast<uint16_t>(std::atoi(server.c_str() + colon + 1)), addr)) {
+            std::cerr << "Invalid chunk server address: " << server << std::endl;
+            return -1;
+        }
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        // Bound every blocking call so a dead server cannot hang a worker.
+        timeval tv{timeout_seconds, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        chunk_proto::tune_socket(fd);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            std::cerr << "Failed to connect to chunk server " << server << ": " << std::strerror(errno) << std::endl;
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static bool send_all(int fd, const void* data, size_t len) {
+        auto p = static_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool recv_exact(int fd, void* data, size_t len) {
+        auto p = static_cast<char*>(data);
+        while (len > 0) {
+            ssize_t n = ::recv(fd, p, len, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool send_header(int fd, const chunk_proto::Header& h) {
+        auto frame = chunk_proto::encode_header(h);
+        return send_all(fd, frame.data(), frame.size());
+    }
+
+    static bool recv_header(int fd, chunk_proto::Header& h) {
+        uint8_t buf[async_hb::FRAME_PREFIX_SIZE + chunk_proto::MAX_HEADER_BODY];
+        if (!recv_exact(fd, buf, async_hb::FRAME_PREFIX_SIZE)) {
+            return false;
+        }
+        uint32_t body_len = async_hb::get_frame_length(buf);
+        if (body_len > chunk_proto::MAX_HEADER_BODY || !recv_exact(fd, buf + async_hb::FRAME_PREFIX_SIZE, body_len)) {
+            return false;
+        }
+        return chunk_proto::decode_header(buf + async_hb::FRAME_PREFIX_SIZE, body_len, h);
+    }
+
+    // Starts a PUT of exactly `size` bytes; nullptr if the server is unreachable.
+    std::unique_ptr<ChunkWriter> put(const std::string& chunk_id, size_t size) const;
+
+    // Streams [offset, offset + length) of a chunk into `sink` in pooled
+    // slices; length 0 means "to the end". Returns the bytes delivered,
+    // READ_FAILED, CHECKSUM_FAILED if a block did not match its CRC, or
+    // SINK_FAILED if the sink rejected a slice. Only verified blocks reach
+    // the sink; chunks stored without block CRCs are passed through as-is.
+    long long get(const std::string& chunk_id, size_t offset, size_t length, const Sink& sink) const {
+        int fd = connect_to_server();
+        if (fd < 0) {
+            return READ_FAILED;
+        }
+        chunk_proto::Header req;
+        req.op = chunk_proto::Op::Get;
+        req.flags = chunk_proto::FLAG_BLOCK_CRCS;
+        req.offset = offset;
+        req.length = length;
+        req.chunk_id = chunk_id;
+        chunk_proto::Header resp;
+        if (!send_header(fd, req) || !recv_header(fd, resp) || resp.status != chunk_proto::Status::Ok) {
+            if (resp.status == chunk_proto::Status::NotFound) {
+                std::cerr << "Chunk " << chunk_id << " not found on " << server << std::endl;
+            }
+            ::close(fd);
+            return READ_FAILED;
+        }
+        if (resp.flags & chunk_proto::FLAG_BLOCK_CRCS) {
+            long long n = receive_verified(fd, req, resp, sink);
+            ::close(fd);
+            return n;
+        }
+
+        auto slice = shared_io_buffers().acquire();
+        uint64_t left = resp.length;
+        long long total = 0;
+        while (left > 0) {
+            ssize_t n = ::recv(fd, slice.data(), static_cast<size_t>(std::min<uint64_t>(slice.size(), left)), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                ::close(fd);
+                return READ_FAILED;
+            }
+            if (!sink(slice.data(), static_cast<size_t>(n))) {
+                ::close(fd);
+                return SINK_FAILED;
+            }
+            left -= static_cast<uint64_t>(n);
+            total += n;
+        }
+        ::close(fd);
+        return total;
+    }
+
+    bool remove(const std::string& chunk_id) const {
+        chunk_proto::Header resp;
+        return round_trip(chunk_proto::Op::Delete, chunk_id, resp, nullptr) &&
+               resp.status == chunk_proto::Status::Ok;
+    }
+
+    std::optional<std::vector<std::string>> list() const {
+        chunk_proto::Header resp;
+        std::string payload;
+        if (!round_trip(chunk_proto::Op::List, "", resp, &payload) || resp.status != chunk_proto::Status::Ok) {
+            return std::nullopt;
+        }
+        std::vector<std::string> ids;
+        std::istringstream in(payload);
+        std::string id;
+        while (std::getline(in, id)) {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+    const std::string& address() const { return server; }
+
+private:
+    // GET body with block CRCs: the server sent whole blocks starting at or
+    // before the requested offset, preceded by their CRCs. Each slice is
+    // received whole, checked block by block, then trimmed to the request.
+    long long receive_verified(int fd, const chunk_proto::Header& req, const chunk_proto::Header& resp,
+                               const Sink& sink) const {
+        uint64_t resp_end = resp.offset + resp.length;
+        if (resp.offset % checksum::BLOCK_SIZE != 0 || resp.offset > req.offset) {
+            return READ_FAILED;
+        }
+        size_t count = chunk_proto::block_count(resp.length);
+        uint8_t prefix[async_hb::FRAME_PREFIX_SIZE];
+        if (!recv_exact(fd, prefix, sizeof(prefix)) || async_hb::get_frame_length(prefix) != 4 * count) {
+            return READ_FAILED;
+        }
+        std::vector<uint8_t> body(4 * count);
+        std::vector<uint32_t> crcs;
+        if (!recv_exact(fd, body.data(), body.size()) ||
+            !chunk_proto::decode_block_crcs(body.data(), body.size(), count, crcs)) {
+            return READ_FAILED;
+        }
+
+        uint64_t want_end = req.length == 0 ? resp_end : std::min<uint64_t>(resp_end, req.offset + req.length);
+        auto slice = shared_io_buffers().acquire();
+        uint64_t pos = resp.offset;
+        size_t block = 0;
+        long long total = 0;
+        while (pos < want_end) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(slice.size(), resp_end - pos));
+            if (!recv_exact(fd, slice.data(), n)) {
+                return READ_FAILED;
+            }
+            for (size_t done = 0; done < n; done += checksum::BLOCK_SIZE, ++block) {
+                size_t len = std::min(checksum::BLOCK_SIZE, n - done);
+                if (checksum::crc32c(0, slice.data() + done, len) != crcs[block]) {
+                    std::cerr << "Checksum mismatch in block " << pos / checksum::BLOCK_SIZE + done / checksum::BLOCK_SIZE
+                              << " of chunk " << req.chunk_id << " from " << server << std::endl;
+                    return CHECKSUM_FAILED;
+                }
+            }
+            uint64_t from = std::max<uint64_t>(pos, req.offset);
+            uint64_t to = std::min<uint64_t>(pos + n, want_end);
+            if (from < to) {
+                if (!sink(slice.data() + (from - pos), static_cast<size_t>(to - from))) {
+                    return SINK_FAILED;
+                }
+                total += static_cast<long long>(to - from);
+            }
+            pos += n;
+        }
+        return total;
+    }
+
+    // Control requests: LIST replies are small, so the payload is buffered.
+    bool round_trip(chunk_proto::Op op, const std::string& chunk_id, chunk_proto::Header& resp,
+                    std::string* payload) const {
+        int fd = connect_to_server();
+        if (fd < 0) {
+            return false;
+        }
+        chunk_proto::Header req;
+        req.op = op;
+        req.chunk_id = chunk_id;
+        bool ok = send_header(fd, req) && recv_header(fd, resp);
+        if (ok && payload && resp.length > 0) {
+            payload->resize(resp.length);
+            ok = recv_exact(fd, payload->data(), payload->size());
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    std::string server;
+    int timeout_seconds;
+};
+
+// One replica of an upload: the PUT header goes out on construction, slices
+// are written straight to the socket, and commit() sends the block CRCs and
+// waits for the server to confirm the chunk was stored. The stored location
+// is the chunk id.
+class RemoteChunkWriter : public ChunkWriter {
+public:
+    RemoteChunkWriter(const ChunkClient& client, std::string chunk_id, size_t size)
+        : chunk_id(std::move(chunk_id)), expected(size), server(client.address()) {
+        fd = client.connect_to_server();
+        if (fd < 0) {
+            return;
+        }
+        chunk_proto::Header req;
+        req.op = chunk_proto::Op::Put;
+        req.flags = chunk_proto::FLAG_BLOCK_CRCS;
+        req.length = size;
+        req.chunk_id = this->chunk_id;
+        if (!ChunkClient::send_header(fd, req)) {
+            close_socket();
+        }
+    }
+
+    ~RemoteChunkWriter() override { close_socket(); }
+
+    bool ok() const { return fd >= 0; }
+
+    bool write(const char* data, size_t len) override {
+        if (fd < 0 || written + len > expected || !ChunkClient::send_all(fd, data, len)) {
+            close_socket();
+            return false;
+        }
+        written += len;
+        return true;
+    }
+
+    std::optional<std::string> commit(const checksum::ChunkDigest& digest) override {
+        chunk_proto::Header resp;
+        bool sent = fd >= 0 && written == expected && digest.size == expected &&
+                    digest.blocks.size() == chunk_proto::block_count(expected);
+        if (sent) {
+            auto crc_frame = chunk_proto::encode_block_crcs(digest.blocks.data(), digest.blocks.size());
+            sent = ChunkClient::send_all(fd, crc_frame.data(), crc_frame.size());
+        }
+        bool stored = sent && ChunkClient::recv_header(fd, resp) &&
+                      resp.status == chunk_proto::Status::Ok && resp.length == expected;
+        close_socket();
+        if (!stored) {
+            std::cerr << "Server " << server << " failed to store chunk " << chunk_id << std::endl;
+            return std::nullopt;
+        }
+        return chunk_id;
+    }
+
+private:
+    void close_socket() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    std::string chunk_id;
+    size_t expected;
+    size_t written = 0;
+    std::string server;
+    int fd = -1;
+};
+
+inline std::unique_ptr<ChunkWriter> ChunkClient::put(const std::string& chunk_id, size_t size) const {
+    auto writer = std::make_unique<RemoteChunkWriter>(*this, chunk_id, size);
+    if (!writer->ok()) {
+        return nullptr;
+    }
+    return writer;
+}
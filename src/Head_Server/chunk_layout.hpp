@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+const size_t CHUNK_SIZE = 64 * 1024 * 1024; // 64MB chunks
+const int DEFAULT_REPLICATION_FACTOR = 3;
+
+// How a file's chunks survive a lost server: whole copies on `replicas`
+// servers, or a Reed-Solomon stripe of `data` + `parity` fragments of which
+// any `data` rebuild the chunk. 4+2 stores 1.5x the file instead of 3x.
+struct Redundancy {
+    int replicas = DEFAULT_REPLICATION_FACTOR;
+    int data = 0; // 0 = replicated
+    int parity = 0;
+
+    static Redundancy replicated(int copies = DEFAULT_REPLICATION_FACTOR) { return {copies, 0, 0}; }
+    static Redundancy erasure_coded(int data, int parity) { return {1, data, parity}; }
+
+    bool erasure_coded() const { return data > 0; }
+    int fragments() const { return erasure_coded() ? data + parity : replicas; }
+};
+
+// One fragment of an erasure-coded chunk. Data fragment i holds bytes
+// [i * size, (i + 1) * size) of the chunk, zero-padded past its end, and the
+// parity fragments follow.
+struct FragmentRef {
+    int data;
+    int parity;
+    int index;
+    uint64_t chunk_size;
+
+    uint64_t size() const { return (chunk_size + data - 1) / data; }
+};
+
+// Fragment ids carry their stripe position, so manifests keep listing plain
+// (chunk, server, id) locations: "<chunk key>@rs<k>+<m>.<index>.<chunk size>".
+inline std::string fragment_id(const std::string& chunk_key, const FragmentRef& f) {
+    return chunk_key + "@rs" + std::to_string(f.data) + "+" + std::to_string(f.parity) + "." +
+           std::to_string(f.index) + "." + std::to_string(f.chunk_size);
+}
+
+inline std::optional<FragmentRef> parse_fragment_id(const std::string& id) {
+    auto at = id.rfind("@rs");
+    if (at == std::string::npos) {
+        return std::nullopt;
+    }
+    FragmentRef f{};
+    unsigned long long size = 0;
+    int used = 0;
+    if (std::sscanf(id.c_str() + at, "@rs%d+%d.%d.%llu%n", &f.data, &f.parity, &f.index, &size, &used) != 4 ||
+        at + used != id.size() || f.data < 1 || f.parity < 0 || f.index < 0 || f.index >= f.data + f.parity) {
+        return std::nullopt;
+    }
+    f.chunk_size = size;
+    return f;
+}
+
+// Content-defined chunks are named by what they hold, "cas_<sha256>.<size>",
+// so identical chunks of any file share one stored copy. Sizes vary per
+// chunk, and the id is where a reader learns them.
+struct ContentChunk {
+    std::string digest; // hex SHA-256
+    uint64_t size;
+};
+
+inline std::string content_chunk_id(const std::string& digest, uint64_t size) {
+    return "cas_" + digest + "." + std::to_string(size);
+}
+
+// Also accepts the fragment ids of an erasure-coded content chunk.
+inline std::optional<ContentChunk> parse_content_chunk_id(const std::string& id) {
+    std::string key = id.substr(0, id.rfind("@rs"));
+    auto dot = key.find('.');
+    if (key.rfind("cas_", 0) != 0 || dot != 4 + 64 || dot + 1 == key.size() ||
+        key.find_first_not_of("0123456789", dot + 1) != std::string::npos) {
+        return std::nullopt;
+    }
+    return ContentChunk{key.substr(4, 64), std::stoull(key.substr(dot + 1))};
+}
+
+struct ChunkInfo {
+    int chunk_id;
+    std::string server_ip;
+    std::string file_path;
+    size_t size;
+    std::string checksum;
+};
+
+// The part of a file byte range that falls inside one chunk.
+struct ChunkSpan {
+    int chunk_id;
+    uint64_t offset;       // within the chunk
+    uint64_t length;
+    uint64_t range_offset; // where the bytes land within the range
+};
+
+// Maps the file range [offset, offset + length) onto a file stored as
+// `chunk_count` chunks of `chunk_size` bytes; length 0 means "to the end".
+// Only the last chunk may be short, so its span can return fewer bytes.
+inline std::vector<ChunkSpan> chunk_spans(uint64_t offset, uint64_t length, int chunk_count,
+                                          size_t chunk_size = CHUNK_SIZE) {
+    std::vector<ChunkSpan> spans;
+    uint64_t file_end = static_cast<uint64_t>(chunk_count) * chunk_size;
+    uint64_t end = length == 0 ? file_end : std::min(file_end, offset + length);
+    for (uint64_t pos = offset; pos < end;) {
+        uint64_t id = pos / chunk_size;
+        uint64_t in_chunk = pos % chunk_size;
+        uint64_t take = std::min<uint64_t>(chunk_size - in_chunk, end - pos);
+        spans.push_back(ChunkSpan{static_cast<int>(id), in_chunk, take, pos - offset});
+        pos += take;
+    }
+    return spans;
+}
+
+// The same for chunks of varying size: chunk i covers [ends[i - 1], ends[i])
+// of the file (ends[-1] = 0).
+inline std::vector<ChunkSpan> chunk_spans(uint64_t offset, uint64_t length, const std::vector<uint64_t>& chunk_ends) {
+    std::vector<ChunkSpan> spans;
+    uint64_t file_end = chunk_ends.empty() ? 0 : chunk_ends.back();
+    uint64_t end = length == 0 ? file_end : std::min(file_end, offset + length);
+    auto it = std::upper_bound(chunk_ends.begin(), chunk_ends.end(), offset);
+    for (uint64_t pos = offset; pos < end; ++it) {
+        uint64_t start = it == chunk_ends.begin() ? 0 : *(it - 1);
+        uint64_t take = std::min(*it, end) - pos;
+        spans.push_back(ChunkSpan{static_cast<int>(it - chunk_ends.begin()), pos - start, take, pos - offset});
+        pos += take;
+    }
+    return spans;
+}
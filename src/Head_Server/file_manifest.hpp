@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Typed metadata: one location per stored replica.
+struct ChunkLocation {
+  int chunk_id;
+  std::string server_ip; // cluster server "host:port"
+  std::string file_path; // chunk id on that server
+};
+
+struct FileManifest {
+  std::string file_name;
+  std::vector<ChunkLocation> chunks; // sorted by chunk_id
+  long long ttl_seconds{0};          // 0 = no expiry
+};
+
+// A content-addressed chunk shared by every manifest that lists it. `refs`
+// counts those listings; the chunk is garbage once it drops to zero.
+struct ContentEntry {
+  long long refs{0};
+  std::vector<ChunkLocation> locations; // chunk_id unused
+};
+
+inline void sort_manifest(FileManifest &m) {
+  std::stable_sort(m.chunks.begin(), m.chunks.end(),
+                   [](const ChunkLocation &a, const ChunkLocation &b) {
+                     return a.chunk_id < b.chunk_id;
+                   });
+}
@@ -0,0 +1,421 @@
+#pragma once
+
+#include "./file_manifest.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// In-process manifest store used when the head server is built without
+// Redis. Manifests live in a lock-striped hash map: each name hashes to one
+// of `shards` buckets guarded by its own shared_mutex, so lookups of
+// different files never contend and readers of the same file share a lock.
+// Reference counts of content-addressed chunks live in the same shards,
+// keyed by chunk id.
+//
+// If a log path is given, every mutation is appended to it as a
+// length-prefixed binary record and the log is replayed on construction.
+// A torn record at the tail (crash mid-append) is ignored and truncated.
+class InMemoryMetadataStore {
+public:
+  struct Options {
+    size_t shards{64};
+    std::string log_path; // empty = memory only
+    bool fsync_log{false};
+  };
+
+  explicit InMemoryMetadataStore(Options opts) : opts_(std::move(opts)) {
+    shard_count_ = 1;
+    while (shard_count_ < opts_.shards)
+      shard_count_ <<= 1; // power of two for cheap masking
+    shards_ = std::make_unique<Shard[]>(shard_count_);
+    if (!opts_.log_path.empty())
+      open_log();
+  }
+
+  ~InMemoryMetadataStore() {
+    if (log_fd_ >= 0)
+      ::close(log_fd_);
+  }
+
+  InMemoryMetadataStore(const InMemoryMetadataStore &) = delete;
+  InMemoryMetadataStore &operator=(const InMemoryMetadataStore &) = delete;
+
+  // Merges chunk locations into an existing entry, like HSET on a hash.
+  bool put(const FileManifest &m) {
+    Entry e;
+    e.manifest = m;
+    e.expires_at = m.ttl_seconds > 0 ? now_seconds() + m.ttl_seconds : 0;
+    auto &sh = shard(m.file_name);
+    // Append under the shard lock so log order matches apply order per file.
+    std::unique_lock<std::shared_mutex> lock(sh.mutex);
+    if (!append(encode_put(e)))
+      return false;
+    apply_put(sh, std::move(e));
+    return true;
+  }
+
+  std::optional<FileManifest> get(const std::string &file_name) const {
+    auto &sh = shard(file_name);
+    std::shared_lock<std::shared_mutex> lock(sh.mutex);
+    auto it = sh.entries.find(file_name);
+    if (it == sh.entries.end() || expired(it->second))
+      return std::nullopt;
+    return it->second.manifest;
+  }
+
+  bool exists(const std::string &file_name) const {
+    auto &sh = shard(file_name);
+    std::shared_lock<std::shared_mutex> lock(sh.mutex);
+    auto it = sh.entries.find(file_name);
+    return it != sh.entries.end() && !expired(it->second);
+  }
+
+  // Returns the number of removed entries (0 or 1).
+  long long erase(const std::string &file_name) {
+    auto &sh = shard(file_name);
+    std::unique_lock<std::shared_mutex> lock(sh.mutex);
+    if (!append(encode_erase(file_name, -1)))
+      return 0;
+    return static_cast<long long>(sh.entries.erase(file_name));
+  }
+
+  // Returns the number of removed replica locations.
+  long long erase_chunk(const std::string &file_name, int chunk_id) {
+    auto &sh = shard(file_name);
+    std::unique_lock<std::shared_mutex> lock(sh.mutex);
+    if (!append(encode_erase(file_name, chunk_id)))
+      return 0;
+    return apply_erase_chunk(sh, file_name, chunk_id);
+  }
+
+  // Takes one reference to a content-addressed chunk. The first reference
+  // records where the chunk is stored; later ones only count.
+  bool add_content_ref(const std::string &key,
+                       const std::vector<ChunkLocation> &locations) {
+    auto &sh = shard(key);
+    std::unique_lock<std::shared_mutex> lock(sh.mutex);
+    if (!append(encode_content(key, 1, locations)))
+      return false;
+    apply_content(sh, key, 1, locations);
+    return true;
+  }
+
+  // Drops one reference; returns the references left (0 = the entry is
+  // gone and nothing points at the chunk any more), or -1 on failure.
+  long long release_content(const std::string &key) {
+    auto &sh = shard(key);
+    std::unique_lock<std::shared_mutex> lock(sh.mutex);
+    if (sh.contents.find(key) == sh.contents.end())
+      return 0;
+    if (!append(encode_content(key, -1, {})))
+      return -1;
+    return apply_content(sh, key, -1, {});
+  }
+
+  std::optional<ContentEntry> find_content(const std::string &key) const {
+    auto &sh = shard(key);
+    std::shared_lock<std::shared_mutex> lock(sh.mutex);
+    auto it = sh.contents.find(key);
+    if (it == sh.contents.end())
+      return std::nullopt;
+    return it->second;
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+      n += shards_[i].entries.size();
+    }
+    return n;
+  }
+
+private:
+  struct Entry {
+    FileManifest manifest;
+    long long expires_at{0}; // unix seconds, 0 = never
+  };
+
+  struct Shard {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<std::string, ContentEntry> contents;
+  };
+
+  enum : uint8_t { REC_PUT = 'P', REC_ERASE = 'D', REC_CONTENT = 'R' };
+
+  static long long now_seconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static bool expired(const Entry &e) {
+    return e.expires_at != 0 && e.expires_at <= now_seconds();
+  }
+
+  Shard &shard(const std::string &name) const {
+    return shards_[std::hash<std::string>{}(name) & (shard_count_ - 1)];
+  }
+
+  static void apply_put(Shard &sh, Entry e) {
+    auto it = sh.entries.find(e.manifest.file_name);
+    if (it == sh.entries.end() || expired(it->second)) {
+      sort_manifest(e.manifest);
+      std::string name = e.manifest.file_name;
+      sh.entries[name] = std::move(e);
+      return;
+    }
+    // Same field replaces the chunk's locations, as HSET does in Redis.
+    auto &cur = it->second.manifest.chunks;
+    for (const auto &c : e.manifest.chunks)
+      cur.erase(std::remove_if(cur.begin(), cur.end(),
+                               [&](const ChunkLocation &o) {
+                                 return o.chunk_id == c.chunk_id;
+                               }),
+                cur.end());
+    cur.insert(cur.end(), e.manifest.chunks.begin(), e.manifest.chunks.end());
+    sort_manifest(it->second.manifest);
+    if (e.expires_at != 0)
+      it->second.expires_at = e.expires_at;
+  }
+
+  static long long apply_erase_chunk(Shard &sh, const std::string &name,
+                                     int chunk_id) {
+    auto it = sh.entries.find(name);
+    if (it == sh.entries.end())
+      return 0;
+    auto &cur = it->second.manifest.chunks;
+    size_t before = cur.size();
+    cur.erase(std::remove_if(cur.begin(), cur.end(),
+                             [&](const ChunkLocation &o) {
+                               return o.chunk_id == chunk_id;
+                             }),
+              cur.end());
+    long long removed = static_cast<long long>(before - cur.size());
+    if (cur.empty())
+      sh.entries.erase(it);
+    return removed;
+  }
+
+  static long long apply_content(Shard &sh, const std::string &key,
+                                 long long delta,
+                                 const std::vector<ChunkLocation> &locations) {
+    auto &e = sh.contents[key];
+    if (e.refs == 0)
+      e.locations = locations;
+    e.refs += delta;
+    long long refs = e.refs;
+    if (refs <= 0)
+      sh.contents.erase(key);
+    return std::max(refs, 0LL);
+  }
+
+  // --- log encoding: [u32 payload_len][u8 type][payload...] ---
+
+  static void put_u32(std::string &out, uint32_t v) {
+    out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+  static void put_i64(std::string &out, int64_t v) {
+    out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+  static void put_str(std::string &out, const std::string &s) {
+    put_u32(out, static_cast<uint32_t>(s.size()));
+    out.append(s);
+  }
+
+  struct Reader {
+    const char *p;
+    const char *end;
+    bool ok{true};
+    template <typename T> T get() {
+      T v{};
+      if (end - p < static_cast<ptrdiff_t>(sizeof(T))) {
+        ok = false;
+        return v;
+      }
+      std::memcpy(&v, p, sizeof(T));
+      p += sizeof(T);
+      return v;
+    }
+    std::string str() {
+      uint32_t n = get<uint32_t>();
+      if (!ok || end - p < static_cast<ptrdiff_t>(n)) {
+        ok = false;
+        return {};
+      }
+      std::string s(p, n);
+      p += n;
+      return s;
+    }
+  };
+
+  static std::string frame(uint8_t type, const std::string &payload) {
+    std::string rec;
+    put_u32(rec, static_cast<uint32_t>(payload.size() + 1));
+    rec.push_back(static_cast<char>(type));
+    rec.append(payload);
+    return rec;
+  }
+
+  static std::string encode_put(const Entry &e) {
+    std::string p;
+    put_str(p, e.manifest.file_name);
+    put_i64(p, e.expires_at);
+    put_u32(p, static_cast<uint32_t>(e.manifest.chunks.size()));
+    for (const auto &c : e.manifest.chunks) {
+      put_u32(p, static_cast<uint32_t>(c.chunk_id));
+      put_str(p, c.server_ip);
+      put_str(p, c.file_path);
+    }
+    return frame(REC_PUT, p);
+  }
+
+  static std::string encode_erase(const std::string &name, int chunk_id) {
+    std::string p;
+    put_str(p, name);
+    put_u32(p, static_cast<uint32_t>(chunk_id));
+    return frame(REC_ERASE, p);
+  }
+
+  static std::string encode_content(const std::string &key, long long delta,
+                                    const std::vector<ChunkLocation> &locs) {
+    std::string p;
+    put_str(p, key);
+    put_i64(p, delta);
+    put_u32(p, static_cast<uint32_t>(locs.size()));
+    for (const auto &c : locs) {
+      put_str(p, c.server_ip);
+      put_str(p, c.file_path);
+    }
+    return frame(REC_CONTENT, p);
+  }
+
+  bool append(const std::string &rec) {
+    if (log_fd_ < 0)
+      return true;
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    size_t off = 0;
+    while (off < rec.size()) {
+      ssize_t n = ::write(log_fd_, rec.data() + off, rec.size() - off);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        std::cerr << "metadata log append failed: " << std::strerror(errno)
+                  << "\n";
+        return false;
+      }
+      off += static_cast<size_t>(n);
+    }
+    if (opts_.fsync_log && ::fdatasync(log_fd_) < 0) {
+      std::cerr << "metadata log fdatasync failed: " << std::strerror(errno)
+                << "\n";
+      return false;
+    }
+    return true;
+  }
+
+  void open_log() {
+    std::error_code ec;
+    auto parent = std::filesystem::path(opts_.log_path).parent_path();
+    if (!parent.empty())
+      std::filesystem::create_directories(parent, ec);
+
+    log_fd_ = ::open(opts_.log_path.c_str(),
+                     O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd_ < 0) {
+      std::cerr << "Failed to open metadata log " << opts_.log_path << ": "
+                << std::strerror(errno) << " (running memory-only)\n";
+      return;
+    }
+    replay();
+  }
+
+  void replay() {
+    std::string data;
+    char buf[1 << 16];
+    ssize_t n;
+    while ((n = ::pread(log_fd_, buf, sizeof(buf), data.size())) > 0)
+      data.append(buf, static_cast<size_t>(n));
+
+    size_t off = 0, records = 0;
+    while (data.size() - off >= sizeof(uint32_t)) {
+      uint32_t len;
+      std::memcpy(&len, data.data() + off, sizeof(len));
+      if (len == 0 || data.size() - off - sizeof(len) < len)
+        break; // torn tail
+      const char *rec = data.data() + off + sizeof(len);
+      Reader r{rec + 1, rec + len};
+      if (rec[0] == REC_PUT) {
+        Entry e;
+        e.manifest.file_name = r.str();
+        e.expires_at = r.get<int64_t>();
+        uint32_t count = r.get<uint32_t>();
+        for (uint32_t i = 0; r.ok && i < count; ++i) {
+          ChunkLocation c;
+          c.chunk_id = static_cast<int>(r.get<uint32_t>());
+          c.server_ip = r.str();
+          c.file_path = r.str();
+          e.manifest.chunks.push_back(std::move(c));
+        }
+        if (!r.ok)
+          break;
+        Shard &sh = shard(e.manifest.file_name);
+        apply_put(sh, std::move(e));
+      } else if (rec[0] == REC_ERASE) {
+        std::string name = r.str();
+        int chunk_id = static_cast<int>(r.get<uint32_t>());
+        if (!r.ok)
+          break;
+        if (chunk_id < 0)
+          shard(name).entries.erase(name);
+        else
+          apply_erase_chunk(shard(name), name, chunk_id);
+      } else if (rec[0] == REC_CONTENT) {
+        std::string key = r.str();
+        long long delta = r.get<int64_t>();
+        uint32_t count = r.get<uint32_t>();
+        std::vector<ChunkLocation> locs;
+        for (uint32_t i = 0; r.ok && i < count; ++i) {
+          ChunkLocation c{0, r.str(), ""};
+          c.file_path = r.str();
+          locs.push_back(std::move(c));
+        }
+        if (!r.ok)
+          break;
+        apply_content(shard(key), key, delta, locs);
+      } else {
+        break;
+      }
+      off += sizeof(len) + len;
+      ++records;
+    }
+    if (off != data.size()) {
+      std::cerr << "metadata log: dropping " << (data.size() - off)
+                << " bytes of torn tail\n";
+      if (::ftruncate(log_fd_, static_cast<off_t>(off)) < 0)
+        std::cerr << "metadata log truncate failed\n";
+    }
+    std::cout << "Metadata log replayed " << records << " records, "
+              << size() << " files\n";
+  }
+
+  Options opts_;
+  std::unique_ptr<Shard[]> shards_;
+  size_t shard_count_{1};
+  int log_fd_{-1};
+  std::mutex log_mutex_;
+};
@@ -1,11 +1,22 @@
 #ifndef REDIS_HANDLER_HPP
 #define REDIS_HANDLER_HPP
 
+#include "../include/config_reader.hpp"
+#include "./chunk_layout.hpp"
+#include "./file_manifest.hpp"
+#include "./metadata_store.hpp"
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <fcntl.h>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <string>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -28,6 +39,10 @@ inline std::string gen_file_id() {
 
 inline std::string file_key(const std::string &id) { return "file:" + id; }
 
+inline std::string content_key(const std::string &chunk) {
+  return "content:" + chunk;
+}
+
 // Encode/decode "server|path" without JSON.
 inline std::string encode_loc(const std::string &server,
                               const std::string &path) {
@@ -41,128 +56,434 @@ inline std::pair<std::string, std::string> decode_loc(const std::string &v) {
   return {v.substr(0, p), v.substr(p + 1)};
 }
 
-#ifdef WITH_REDIS
-inline void create_entry(const std::string& request) {
-  try {
-    Redis redis("tcp://127.0.0.1:6379"); // primary for writes [1]
-
-    std::istringstream in(request);
-    std::string file_name;
-    std::getline(in, file_name);
-
-    if (file_name.empty())
-      file_name = gen_file_id();
-    const std::string key = file_key(file_name);
-
-    // Optional TTL line: "TTL=seconds"
-    long long ttl = 0;
-    std::streampos after_first_line = in.tellg();
-    std::string maybe_ttl;
-    if (std::getline(in, maybe_ttl)) {
-      if (maybe_ttl.rfind("TTL=", 0) == 0) {
-        ttl = std::stoll(maybe_ttl.substr(4));
-      } else {
-        // Not TTL; rewind to start parsing chunks from this line
-        in.clear();
-        in.seekg(after_first_line);
-      }
+// A chunk field holds every replica location, ';'-separated.
+inline std::vector<std::pair<std::string, std::string>>
+decode_locs(const std::string &v) {
+  std::vector<std::pair<std::string, std::string>> out;
+  size_t start = 0;
+  while (start <= v.size()) {
+    auto end = v.find(';', start);
+    if (end == std::string::npos)
+      end = v.size();
+    if (end > start)
+      out.push_back(decode_loc(v.substr(start, end - start)));
+    start = end + 1;
+  }
+  return out;
+}
+
+// Hash fields for a manifest: "chunk:<id>" -> every replica, ';'-separated.
+inline std::unordered_map<std::string, std::string>
+manifest_fields(const FileManifest &m) {
+  std::unordered_map<std::string, std::string> fields;
+  for (const auto &c : m.chunks) {
+    std::string &value = fields["chunk:" + std::to_string(c.chunk_id)];
+    if (!value.empty())
+      value += ';';
+    value += encode_loc(c.server_ip, c.file_path);
+  }
+  return fields;
+}
+
+inline void append_chunk_field(FileManifest &m, const std::string &field,
+                               const std::string &value) {
+  if (field.rfind("chunk:", 0) != 0)
+    return;
+  int chunk_id = std::stoi(field.substr(6));
+  for (auto &[server, path] : decode_locs(value))
+    m.chunks.push_back(ChunkLocation{chunk_id, std::move(server),
+                                     std::move(path)});
+}
+
+// Parses the text form used by create_entry:
+//   <file_name>\n[TTL=<seconds>\n](<chunk_id> <server> <path>\n)*
+inline FileManifest parse_manifest_request(const std::string &request) {
+  FileManifest m;
+  std::istringstream in(request);
+  std::getline(in, m.file_name);
+  if (m.file_name.empty())
+    m.file_name = gen_file_id();
+
+  std::string line;
+  bool first = true;
+  while (std::getline(in, line)) {
+    if (line.empty())
+      continue;
+    if (first && line.rfind("TTL=", 0) == 0) {
+      m.ttl_seconds = std::stoll(line.substr(4));
+      first = false;
+      continue;
     }
+    first = false;
+    std::istringstream ls(line);
+    ChunkLocation c;
+    if (!(ls >> c.chunk_id >> c.server_ip >> c.file_path))
+      continue; // skip malformed
+    m.chunks.push_back(std::move(c));
+  }
+  return m;
+}
+
+#ifdef WITH_REDIS
+struct RedisSettings {
+  std::string host{"127.0.0.1"};
+  int port{6379};
+  int timeout_seconds{5};
+  size_t max_connections{100};
+};
+
+inline RedisSettings load_redis_settings(const std::string &config_path) {
+  RedisSettings rs;
+  std::string json = read_config_file(config_path);
+  if (json.empty())
+    return rs; // defaults match config/head_server_config.json
+  rs.host = config_string(json, "redis", "host", rs.host);
+  rs.port = static_cast<int>(config_int(json, "redis", "port", rs.port));
+  rs.timeout_seconds = static_cast<int>(
+      config_int(json, "redis", "timeout_seconds", rs.timeout_seconds));
+  rs.max_connections = static_cast<size_t>(std::max<long long>(
+      1, config_int(json, "redis", "max_connections",
+                    static_cast<long long>(rs.max_connections))));
+  return rs;
+}
+
+// Process-wide metadata client. Owns one redis++ connection pool sized by
+// redis.max_connections, so metadata calls reuse warm connections instead of
+// opening a TCP connection each. Concurrent manifest writes are coalesced:
+// whichever caller finds no flush in progress sends everything queued so far
+// as one pipeline, and the others wait for that round trip.
+class MetadataClient {
+public:
+  static MetadataClient &instance() {
+    static MetadataClient client(load_redis_settings(head_server_config_path()));
+    return client;
+  }
 
-    // Batch fields for HSET key field value [5][1]
-    std::vector<std::pair<std::string, std::string>> fields;
-    std::string line;
-    while (std::getline(in, line)) {
-      if (line.empty())
+  Redis &redis() { return redis_; }
+  const RedisSettings &settings() const { return settings_; }
+
+  bool write(const FileManifest &m) {
+    auto req = std::make_shared<PendingWrite>();
+    req->manifest = &m;
+
+    std::unique_lock<std::mutex> lock(batch_mutex_);
+    pending_.push_back(req);
+    while (!req->done) {
+      if (flushing_) {
+        batch_cv_.wait(lock);
         continue;
-      std::istringstream ls(line);
-      long long chunk_id;
-      std::string server, path;
-      if (!(ls >> chunk_id >> server >> path)) {
-        continue; // skip malformed
       }
-      std::string field = "chunk:" + std::to_string(chunk_id);
-      fields.emplace_back(field, encode_loc(server, path));
+      flushing_ = true;
+      auto batch = std::move(pending_);
+      pending_.clear();
+      lock.unlock();
+      bool ok = flush(batch);
+      lock.lock();
+      for (auto &w : batch) {
+        w->ok = ok;
+        w->done = true;
+      }
+      flushing_ = false;
+      batch_cv_.notify_all();
     }
+    return req->ok;
+  }
 
-    if (!fields.empty()) {
-      redis.hset(key, fields.begin(), fields.end()); // bulk HSET [1][5]
-    } else {
-      // Optionally create a marker so the hash exists:
-      // redis.hset(key, "meta", "created");
+  // Writes many manifests in a single pipelined round trip.
+  bool write_all(const std::vector<FileManifest> &manifests) {
+    std::vector<std::shared_ptr<PendingWrite>> batch;
+    batch.reserve(manifests.size());
+    for (const auto &m : manifests) {
+      auto w = std::make_shared<PendingWrite>();
+      w->manifest = &m;
+      batch.push_back(std::move(w));
     }
+    return flush(batch);
+  }
+
+private:
+  struct PendingWrite {
+    const FileManifest *manifest{nullptr};
+    bool ok{false};
+    bool done{false};
+  };
+
+  explicit MetadataClient(RedisSettings rs)
+      : settings_(std::move(rs)), redis_(connection_options(settings_),
+                                         pool_options(settings_)) {
+    std::cout << "Metadata client: redis " << settings_.host << ":"
+              << settings_.port << " pool=" << settings_.max_connections
+              << "\n";
+  }
+
+  static ConnectionOptions connection_options(const RedisSettings &rs) {
+    ConnectionOptions opts;
+    opts.host = rs.host;
+    opts.port = rs.port;
+    opts.socket_timeout = std::chrono::seconds(rs.timeout_seconds);
+    opts.connect_timeout = std::chrono::seconds(rs.timeout_seconds);
+    return opts;
+  }
 
-    if (ttl > 0) {
-      redis.expire(key, std::chrono::seconds{ttl}); // set TTL on hash key [1]
+  static ConnectionPoolOptions pool_options(const RedisSettings &rs) {
+    ConnectionPoolOptions opts;
+    opts.size = rs.max_connections;
+    opts.wait_timeout = std::chrono::seconds(rs.timeout_seconds);
+    return opts;
+  }
+
+  bool flush(const std::vector<std::shared_ptr<PendingWrite>> &batch) {
+    try {
+      // Borrow a pooled connection rather than opening a dedicated one.
+      auto pipe = redis_.pipeline(false);
+      for (const auto &w : batch) {
+        const FileManifest &m = *w->manifest;
+        const std::string key = file_key(m.file_name);
+        auto fields = manifest_fields(m);
+        if (!fields.empty())
+          pipe.hset(key, fields.begin(), fields.end()); // bulk HSET [1][5]
+        if (m.ttl_seconds > 0)
+          pipe.expire(key, std::chrono::seconds{m.ttl_seconds}); // [1]
+      }
+      pipe.exec();
+      return true;
+    } catch (const std::exception &e) {
+      std::cerr << "metadata pipeline error: " << e.what() << "\n";
+      return false;
     }
+  }
 
-    std::cout << "Created file entry: " << file_name << "\n";
+  RedisSettings settings_;
+  Redis redis_;
+  std::mutex batch_mutex_;
+  std::condition_variable batch_cv_;
+  std::vector<std::shared_ptr<PendingWrite>> pending_;
+  bool flushing_{false};
+};
+
+inline Redis &metadata_redis() { return MetadataClient::instance().redis(); }
+
+inline bool write_manifest(const FileManifest &m) {
+  return MetadataClient::instance().write(m);
+}
+
+inline bool write_manifests(const std::vector<FileManifest> &manifests) {
+  return MetadataClient::instance().write_all(manifests);
+}
+
+inline std::optional<FileManifest> read_manifest(const std::string &file_name) {
+  try {
+    std::unordered_map<std::string, std::string> all;
+    metadata_redis().hgetall(file_key(file_name),
+                             std::inserter(all, all.end())); // [1][8]
+    if (all.empty())
+      return std::nullopt;
+
+    FileManifest m;
+    m.file_name = file_name;
+    for (const auto &[field, value] : all)
+      append_chunk_field(m, field, value);
+    sort_manifest(m);
+    return m;
   } catch (const std::exception &e) {
-    std::cerr << "create_entry error: " << e.what() << "\n";
+    std::cerr << "read_manifest error: " << e.what() << "\n";
+    return std::nullopt;
   }
 }
-#else
-inline void create_entry(const std::string& request) {
-  std::cout << "Redis disabled - create_entry not implemented\n";
-}
-#endif
 
-#ifdef WITH_REDIS
-inline void read_entry(const std::string& request) {
+inline bool manifest_exists(const std::string &file_name) {
   try {
-    std::istringstream in(request);
-    std::string file_name;
-    in >> file_name;
-    if (file_name.empty()) {
-      std::cerr << "read_entry: file_name required\n";
-      return;
-    }
-    const std::string key = file_key(file_name);
-
-    // If reading from a replica, point this connection to the replica host.
-    // [20]
-    Redis redis("tcp://127.0.0.1:6379"); // [1]
-
-    if (in.good()) {
-      // Specific chunk
-      long long chunk_id;
-      if (in >> chunk_id) {
-        std::string field = "chunk:" + std::to_string(chunk_id);
-        auto v = redis.hget(key, field); // optional<string> [1][15]
-        if (v) {
-          auto [server, path] = decode_loc(*v);
-          std::cout << field << " server=" << server << " path=" << path
-                    << "\n";
-        } else {
-          std::cout << "Chunk not found\n";
-        }
-        return;
-      }
-    }
+    return metadata_redis().exists(file_key(file_name)) > 0;
+  } catch (const std::exception &e) {
+    std::cerr << "manifest_exists error: " << e.what() << "\n";
+    return false;
+  }
+}
 
-    // All chunks
+// A content-addressed chunk is a "content:<chunk id>" hash: "refs" counts the
+// manifests listing it, "locations" is written once by the first of them.
+inline std::optional<ContentEntry> find_content(const std::string &chunk) {
+  try {
     std::unordered_map<std::string, std::string> all;
-    redis.hgetall(key, std::inserter(all, all.end())); // [1][8]
-    if (all.empty()) {
-      std::cout << "No chunks or file not found\n";
-      return;
-    }
-    for (const auto &kv : all) {
-      if (kv.first.rfind("chunk:", 0) == 0) {
-        auto [server, path] = decode_loc(kv.second);
-        std::cout << kv.first << " server=" << server << " path=" << path
-                  << "\n";
-      }
+    metadata_redis().hgetall(content_key(chunk), std::inserter(all, all.end()));
+    auto refs = all.find("refs");
+    if (refs == all.end() || std::stoll(refs->second) <= 0)
+      return std::nullopt;
+    ContentEntry e;
+    e.refs = std::stoll(refs->second);
+    for (auto &[server, path] : decode_locs(all["locations"]))
+      e.locations.push_back(ChunkLocation{0, std::move(server), std::move(path)});
+    return e;
+  } catch (const std::exception &e) {
+    std::cerr << "find_content error: " << e.what() << "\n";
+    return std::nullopt;
+  }
+}
+
+inline bool add_content_ref(const std::string &chunk,
+                            const std::vector<ChunkLocation> &locations) {
+  try {
+    std::string value;
+    for (const auto &c : locations) {
+      if (!value.empty())
+        value += ';';
+      value += encode_loc(c.server_ip, c.file_path);
     }
+    // One script, so a concurrent release never sees the locations without
+    // the reference that keeps them.
+    constexpr const char *script = R"lua(
+      redis.call('HSETNX', KEYS[1], 'locations', ARGV[1])
+      return redis.call('HINCRBY', KEYS[1], 'refs', 1)
+    )lua";
+    metadata_redis().eval<long long>(script, {content_key(chunk)}, {value});
+    return true;
   } catch (const std::exception &e) {
-    std::cerr << "read_entry error: " << e.what() << "\n";
+    std::cerr << "add_content_ref error: " << e.what() << "\n";
+    return false;
+  }
+}
+
+inline long long release_content(const std::string &chunk) {
+  try {
+    // Decrement and delete in one script: done as separate commands, an
+    // add_content_ref landing in between would be deleted with the entry.
+    constexpr const char *script = R"lua(
+      if redis.call('EXISTS', KEYS[1]) == 0 then
+        return 0
+      end
+      local refs = redis.call('HINCRBY', KEYS[1], 'refs', -1)
+      if refs <= 0 then
+        redis.call('DEL', KEYS[1])
+        return 0
+      end
+      return refs
+    )lua";
+    return metadata_redis().eval<long long>(script, {content_key(chunk)}, {});
+  } catch (const std::exception &e) {
+    std::cerr << "release_content error: " << e.what() << "\n";
+    return -1;
   }
 }
 #else
-inline void read_entry(const std::string& request) {
-  std::cout << "Redis disabled - read_entry not implemented\n";
+// Without Redis the head server keeps manifests in-process. Shard count and
+// the optional durability log come from the "metadata" config section.
+inline InMemoryMetadataStore &metadata_store() {
+  static InMemoryMetadataStore store([] {
+    InMemoryMetadataStore::Options opts;
+    std::string json = read_config_file(head_server_config_path());
+    opts.shards = static_cast<size_t>(std::max<long long>(
+        1, config_int(json, "metadata", "shards",
+                      static_cast<long long>(opts.shards))));
+    opts.log_path = config_string(json, "metadata", "log_path", "");
+    opts.fsync_log = config_int(json, "metadata", "log_fsync", 0) != 0;
+    return opts;
+  }());
+  return store;
+}
+
+inline bool write_manifest(const FileManifest &m) {
+  return metadata_store().put(m);
+}
+
+inline bool write_manifests(const std::vector<FileManifest> &manifests) {
+  bool ok = true;
+  for (const auto &m : manifests)
+    ok = metadata_store().put(m) && ok;
+  return ok;
+}
+
+inline std::optional<FileManifest> read_manifest(const std::string &file_name) {
+  return metadata_store().get(file_name);
+}
+
+inline bool manifest_exists(const std::string &file_name) {
+  return metadata_store().exists(file_name);
+}
+
+inline std::optional<ContentEntry> find_content(const std::string &chunk) {
+  return metadata_store().find_content(chunk);
+}
+
+inline bool add_content_ref(const std::string &chunk,
+                            const std::vector<ChunkLocation> &locations) {
+  return metadata_store().add_content_ref(chunk, locations);
+}
+
+inline long long release_content(const std::string &chunk) {
+  return metadata_store().release_content(chunk);
 }
 #endif
 
+// Content-addressed chunks of a manifest, one per listing: the key each
+// holds a reference on.
+inline std::vector<std::string> content_refs(const FileManifest &m) {
+  std::vector<std::string> refs;
+  for (size_t i = 0; i < m.chunks.size(); ++i) {
+    if (i > 0 && m.chunks[i].chunk_id == m.chunks[i - 1].chunk_id)
+      continue; // another replica or fragment of the same chunk
+    if (auto c = parse_content_chunk_id(m.chunks[i].file_path))
+      refs.push_back(content_chunk_id(c->digest, c->size));
+  }
+  return refs;
+}
+
+// Drops the references a deleted manifest held, or only those of chunk_id
+// when it is >= 0; `before` is the manifest as read before the delete, or
+// just the part of it that was deleted.
+inline void release_content_refs(const std::optional<FileManifest> &before,
+                                 int chunk_id) {
+  if (!before)
+    return;
+  FileManifest deleted = *before;
+  if (chunk_id >= 0)
+    deleted.chunks.erase(std::remove_if(deleted.chunks.begin(),
+                                        deleted.chunks.end(),
+                                        [&](const ChunkLocation &c) {
+                                          return c.chunk_id != chunk_id;
+                                        }),
+                         deleted.chunks.end());
+  for (const auto &key : content_refs(deleted))
+    release_content(key);
+}
+
+// Text wrappers kept for CLI/debug use; programmatic callers should use the
+// typed functions above.
+inline void create_entry(const std::string& request) {
+  FileManifest m = parse_manifest_request(request);
+  if (write_manifest(m))
+    std::cout << "Created file entry: " << m.file_name << "\n";
+}
+
+inline void read_entry(const std::string& request) {
+  std::istringstream in(request);
+  std::string file_name;
+  in >> file_name;
+  if (file_name.empty()) {
+    std::cerr << "read_entry: file_name required\n";
+    return;
+  }
+
+  // Optional chunk id selects a single chunk
+  long long chunk_id = -1;
+  bool single = static_cast<bool>(in >> chunk_id);
+
+  auto m = read_manifest(file_name);
+  if (!m) {
+    std::cout << "No chunks or file not found\n";
+    return;
+  }
+  bool found = false;
+  for (const auto &c : m->chunks) {
+    if (single && c.chunk_id != chunk_id)
+      continue;
+    found = true;
+    std::cout << "chunk:" << c.chunk_id << " server=" << c.server_ip
+              << " path=" << c.file_path << "\n";
+  }
+  if (single && !found)
+    std::cout << "Chunk not found\n";
+}
+
 #ifdef WITH_REDIS
 inline void delete_entry(const std::string& file_name) {
   try {
@@ -177,23 +498,58 @@ inline void delete_entry(const std::string& file_name) {
       field = file_name.substr(pos + 1); // "chunk:3"
     }
 
-    const std::string key = file_key(base);
-    Redis redis("tcp://127.0.0.1:6379"); // [1]
-
-    if (!field.empty()) {
-      long long n = redis.hdel(key, field); // [1][15]
-      std::cout << "Removed fields: " << n << "\n";
-    } else {
-      long long n = redis.del(key); // [1]
-      std::cout << "Removed keys: " << n << "\n";
-    }
+    // Deletes and returns what it deleted in one script, so the references
+    // released below are exactly those of the fields that went away.
+    constexpr const char *script = R"lua(
+      if ARGV[1] ~= '' then
+        local value = redis.call('HGET', KEYS[1], ARGV[1])
+        if not value then
+          return {}
+        end
+        redis.call('HDEL', KEYS[1], ARGV[1])
+        return {ARGV[1], value}
+      end
+      local all = redis.call('HGETALL', KEYS[1])
+      redis.call('DEL', KEYS[1])
+      return all
+    )lua";
+    std::vector<std::string> removed; // field, value, field, value, ...
+    metadata_redis().eval(script, {file_key(base)}, {field},
+                          std::back_inserter(removed)); // pooled [1]
+
+    FileManifest deleted;
+    deleted.file_name = base;
+    for (size_t i = 0; i + 1 < removed.size(); i += 2)
+      append_chunk_field(deleted, removed[i], removed[i + 1]);
+    sort_manifest(deleted);
+
+    if (!field.empty())
+      std::cout << "Removed fields: " << removed.size() / 2 << "\n";
+    else
+      std::cout << "Removed keys: " << (removed.empty() ? 0 : 1) << "\n";
+    release_content_refs(deleted, -1);
   } catch (const std::exception &e) {
     std::cerr << "delete_entry error: " << e.what() << "\n";
   }
 }
 #else
 inline void delete_entry(const std::string& file_name) {
-  std::cout << "Redis disabled - delete_entry not implemented\n";
+  auto pos = file_name.find("#chunk:");
+  if (pos != std::string::npos) {
+    std::string base = file_name.substr(0, pos);
+    int chunk_id = std::stoi(file_name.substr(pos + 7));
+    auto before = read_manifest(base);
+    long long n = metadata_store().erase_chunk(base, chunk_id);
+    std::cout << "Removed fields: " << n << "\n";
+    if (n > 0)
+      release_content_refs(before, chunk_id);
+  } else {
+    auto before = read_manifest(file_name);
+    long long n = metadata_store().erase(file_name);
+    std::cout << "Removed keys: " << n << "\n";
+    if (n > 0)
+      release_content_refs(before, -1);
+  }
 }
 #endif
 
@@ -213,7 +569,7 @@ inline int create_replication(const std::string& ip_address) {
                    ? 6379
                    : std::stoi(ip_address.substr(pos + 1));
 
-    Redis redis("tcp://127.0.0.1:6379"); // local node to become a replica [1]
+    Redis &redis = metadata_redis(); // local node to become a replica [1]
     redis.command("REPLICAOF", host,
                   std::to_string(port)); // server-side replication [19]
     return 0;
@@ -295,8 +651,8 @@ inline bool is_redis_running(const std::string& host = "127.0.0.1", int port = 6
 }
 
 inline int start_server() {
-  std::cout << "Redis disabled - using in-memory storage simulation" << std::endl;
-  return 0; // Return success since we're simulating
+  std::cout << "Redis disabled - using in-memory metadata store" << std::endl;
+  return 0;
 }
 #endif
 
@@ -326,8 +682,9 @@ inline void start_daemon() {
     std::cout << "Redis server started successfully" << std::endl;
   }
 #else
-  // Redis is disabled, just simulate successful startup
-  std::cout << "Redis disabled - using in-memory storage simulation" << std::endl;
+  // Redis is disabled; open (and replay) the in-process metadata store now
+  std::cout << "Redis disabled - using in-memory metadata store ("
+            << metadata_store().size() << " files)" << std::endl;
 #endif
   
   std::cout << "Head Server daemon is ready" << std::endl;
@@ -0,0 +1,478 @@
+#pragma once
+
+#include "../include/buffer_pool.hpp"
+#include "../include/checksum.hpp"
+#include "../include/erasure_code.hpp"
+#include "../include/fastcdc.hpp"
+#include "../include/sha256.hpp"
+#include "../include/worker_pool.hpp"
+#include "./chunk_layout.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Fixed chunks are chunk_size bytes by position. Content-defined chunks are
+// cut by fastcdc and named by their SHA-256, so bytes that were stored
+// before, by any file, are not sent again.
+enum class Chunking { Fixed, ContentDefined };
+
+struct UploadPipelineOptions {
+    size_t chunk_size = CHUNK_SIZE;
+    Chunking chunking = Chunking::Fixed;
+    // Chunk size bounds for Chunking::ContentDefined.
+    fastcdc::Params cdc;
+    // Threads streaming chunks to their replicas.
+    size_t workers = std::max(2u, std::thread::hardware_concurrency());
+    // Chunks queued or streaming at once.
+    size_t max_inflight_chunks = 4;
+    // Slices come from this pool; nullptr means shared_io_buffers().
+    BufferPool* buffers = nullptr;
+    // Replicas come from the placement; an erasure-coded upload sends each
+    // chunk as fragments instead, which needs an OpenFragmentFn.
+    Redundancy redundancy;
+};
+
+// What the last run() stored: every chunk of the file, and how many of
+// them were already stored and so skipped the transfer.
+struct UploadStats {
+    uint64_t chunks = 0;
+    uint64_t bytes = 0;
+    uint64_t reused_chunks = 0;
+    uint64_t reused_bytes = 0;
+};
+
+// Destination for one replica of one chunk. Data arrives in slices; commit()
+// receives the chunk's block checksums and returns the stored location, or
+// std::nullopt if the replica failed.
+class ChunkWriter {
+public:
+    virtual ~ChunkWriter() = default;
+    virtual bool write(const char* data, size_t len) = 0;
+    virtual std::optional<std::string> commit(const checksum::ChunkDigest& digest) = 0;
+};
+
+// Streams every chunk of a file to its replicas through pool-sized slices.
+// Chunks run concurrently on a bounded worker pool, so while one worker reads
+// chunk N+1 another is hashing chunk N and a third is fanning chunk N-1 out.
+// Peak memory is workers * slice size regardless of the chunk size. Each
+// chunk is checksummed per block (CRC32C) as it streams, and the whole-chunk
+// CRC is recorded in its ChunkInfo.
+//
+// Erasure-coded chunks are read a stripe row at a time: one slice is split
+// between the k data pieces and the m parity pieces encoded from them, so
+// the memory bound holds there too.
+//
+// Content-defined chunking adds one sequential pass that finds the cut
+// points and hashes each chunk through a window of 2 * cdc.max_size bytes.
+// Only chunks the ContentFn does not know are streamed, re-read by offset
+// as above; a chunk repeated within the file is stored once.
+class UploadPipeline {
+public:
+    // Servers for a chunk's replicas, or for its fragments in stripe order
+    // (a list shorter than the stripe is reused round-robin).
+    using PlacementFn = std::function<std::vector<std::string>(int chunk_id)>;
+    // Opens one replica stream; nullptr if the server cannot accept it.
+    using OpenReplicaFn = std::function<std::unique_ptr<ChunkWriter>(
+        const std::string& server, int chunk_id, size_t size)>;
+    // Opens one fragment stream of fragment.size() bytes.
+    using OpenFragmentFn = std::function<std::unique_ptr<ChunkWriter>(
+        const std::string& server, int chunk_id, const FragmentRef& fragment)>;
+
+    // Called for each content-defined chunk, in order and before the chunk
+    // is opened anywhere, with the content id it is stored under. Returns
+    // the locations of a stored copy, or nothing if it has to be sent.
+    using ContentFn = std::function<std::vector<ChunkInfo>(int chunk_id, const std::string& content_id)>;
+
+    UploadPipeline(UploadPipelineOptions options, PlacementFn placement, OpenReplicaFn open_replica,
+                   OpenFragmentFn open_fragment = nullptr, ContentFn content = nullptr)
+        : options_(options),
+          placement_(std::move(placement)),
+          open_replica_(std::move(open_replica)),
+          open_fragment_(std::move(open_fragment)),
+          content_(std::move(content)),
+          buffers_(options.buffers ? *options.buffers : shared_io_buffers()),
+          pool_(options.workers) {
+        if (options_.max_inflight_chunks == 0) {
+            options_.max_inflight_chunks = 1;
+        }
+        if (options_.redundancy.erasure_coded()) {
+            codec_.emplace(options_.redundancy.data, options_.redundancy.parity);
+        }
+    }
+
+    // Returns one ChunkInfo per stored replica (or fragment) ordered by chunk
+    // id, or an empty vector if the file could not be read or a chunk could
+    // not be stored readably.
+    std::vector<ChunkInfo> run(const std::string& filepath) {
+        int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Failed to open file: " << filepath << std::endl;
+            return {};
+        }
+        struct stat st{};
+        if (codec_ && (!open_fragment_ || !erasure::Codec::valid(codec_->data(), codec_->parity()))) {
+            std::cerr << "Invalid erasure-coded upload of " << filepath << std::endl;
+            ::close(fd);
+            return {};
+        }
+        if (::fstat(fd, &st) < 0) {
+            std::cerr << "Failed to stat file: " << filepath << std::endl;
+            ::close(fd);
+            return {};
+        }
+        size_t file_size = static_cast<size_t>(st.st_size);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        State state;
+        stats_ = UploadStats{};
+        if (options_.chunking == Chunking::ContentDefined) {
+            submit_content_chunks(state, fd, file_size);
+        } else {
+            int chunk_id = 0;
+            for (size_t offset = 0; offset < file_size && !state.failed; offset += options_.chunk_size) {
+                size_t len = std::min(options_.chunk_size, file_size - offset);
+                submit_chunk(state, fd, chunk_id++, offset, len);
+                stats_.chunks++;
+                stats_.bytes += len;
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.cv.wait(lock, [&] { return state.inflight == 0; });
+        }
+        ::close(fd);
+
+        if (state.failed) {
+            return {};
+        }
+
+        // Repeats within the file point at the first copy's locations
+        if (!state.repeats.empty()) {
+            std::unordered_map<int, std::vector<size_t>> stored; // chunk id -> its entries in results
+            for (size_t i = 0; i < state.results.size(); ++i) {
+                stored[state.results[i].chunk_id].push_back(i);
+            }
+            for (const auto& [chunk_id, first] : state.repeats) {
+                auto it = stored.find(first);
+                if (it == stored.end()) {
+                    continue;
+                }
+                for (size_t i : it->second) {
+                    ChunkInfo repeat = state.results[i];
+                    repeat.chunk_id = chunk_id;
+                    state.results.push_back(std::move(repeat));
+                }
+            }
+        }
+
+        auto chunks = std::move(state.results);
+        std::stable_sort(chunks.begin(), chunks.end(),
+                         [](const ChunkInfo& a, const ChunkInfo& b) { return a.chunk_id < b.chunk_id; });
+        return chunks;
+    }
+
+    const UploadPipelineOptions& options() const { return options_; }
+    const UploadStats& stats() const { return stats_; }
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t inflight = 0;
+        std::atomic<bool> failed{false};
+        std::vector<ChunkInfo> results;
+        std::vector<std::pair<int, int>> repeats; // (chunk id, first chunk with its content)
+    };
+
+    // Queues one chunk once the in-flight window has room.
+    void submit_chunk(State& state, int fd, int chunk_id, size_t offset, size_t len) {
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.cv.wait(lock, [&] { return state.inflight < options_.max_inflight_chunks; });
+            ++state.inflight;
+        }
+        pool_.submit([this, &state, fd, chunk_id, offset, len] {
+            if (codec_) {
+                stream_coded_chunk(state, fd, chunk_id, static_cast<off_t>(offset), len);
+            } else {
+                stream_chunk(state, fd, chunk_id, static_cast<off_t>(offset), len);
+            }
+        });
+    }
+
+    void submit_content_chunks(State& state, int fd, size_t file_size) {
+        try {
+            fastcdc::Chunker chunker(options_.cdc);
+            const size_t max_size = chunker.params().max_size;
+            std::vector<uint8_t> window(2 * max_size);
+            size_t begin = 0, end = 0; // unchunked bytes in the window
+            uint64_t offset = 0;       // file offset of window[begin]
+            uint64_t loaded = 0;       // file bytes read into the window
+            std::unordered_map<std::string, int> first_with;
+
+            for (int chunk_id = 0; offset < file_size && !state.failed; chunk_id++) {
+                if (end - begin < max_size && loaded < file_size) {
+                    std::memmove(window.data(), window.data() + begin, end - begin);
+                    end -= begin;
+                    begin = 0;
+                    size_t n = static_cast<size_t>(std::min<uint64_t>(window.size() - end, file_size - loaded));
+                    read_exact(fd, window.data() + end, n, static_cast<off_t>(loaded), chunk_id);
+                    end += n;
+                    loaded += n;
+                }
+                size_t len = chunker.next(window.data() + begin, end - begin);
+                std::string id = content_chunk_id(sha256::to_hex(sha256::hash(window.data() + begin, len)), len);
+                stats_.chunks++;
+                stats_.bytes += len;
+
+                auto first = first_with.find(id);
+                bool reused = true;
+                if (first != first_with.end()) {
+                    std::lock_guard<std::mutex> lock(state.mutex);
+                    state.repeats.emplace_back(chunk_id, first->second);
+                } else {
+                    first_with.emplace(id, chunk_id);
+                    auto stored = content_ ? content_(chunk_id, id) : std::vector<ChunkInfo>{};
+                    if (stored.empty()) {
+                        submit_chunk(state, fd, chunk_id, offset, len);
+                        reused = false;
+                    }
+                    std::lock_guard<std::mutex> lock(state.mutex);
+                    for (auto& chunk_info : stored) {
+                        chunk_info.chunk_id = chunk_id;
+                        state.results.push_back(std::move(chunk_info));
+                    }
+                }
+                if (reused) {
+                    stats_.reused_chunks++;
+                    stats_.reused_bytes += len;
+                }
+                begin += len;
+                offset += len;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error chunking file by content: " << e.what() << std::endl;
+            state.failed = true;
+        }
+    }
+
+    struct Replica {
+        std::string server;
+        std::unique_ptr<ChunkWriter> writer;
+    };
+
+    void stream_chunk(State& state, int fd, int chunk_id, off_t offset, size_t len) {
+        try {
+            std::vector<Replica> replicas;
+            for (const auto& server : placement_(chunk_id)) {
+                if (auto writer = open_replica_(server, chunk_id, len)) {
+                    replicas.push_back(Replica{server, std::move(writer)});
+                } else {
+                    std::cerr << "Server " << server << " rejected chunk " << chunk_id << std::endl;
+                }
+            }
+
+            checksum::BlockChecksummer checksummer;
+            auto slice = buffers_.acquire();
+            size_t done = 0;
+            while (done < len && !replicas.empty()) {
+                size_t want = std::min(slice.size(), len - done);
+                ssize_t n = ::pread(fd, slice.data(), want, offset + static_cast<off_t>(done));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    throw std::runtime_error("short read at chunk " + std::to_string(chunk_id));
+                }
+                checksummer.update(slice.data(), static_cast<size_t>(n));
+                // Fan the slice out; a replica that fails drops out of the set.
+                replicas.erase(std::remove_if(replicas.begin(), replicas.end(),
+                                              [&](Replica& r) {
+                                                  if (r.writer->write(slice.data(), static_cast<size_t>(n))) {
+                                                      return false;
+                                                  }
+                                                  std::cerr << "Replica " << r.server << " failed for chunk "
+                                                            << chunk_id << std::endl;
+                                                  return true;
+                                              }),
+                               replicas.end());
+                done += static_cast<size_t>(n);
+            }
+            slice.reset();
+
+            auto digest = checksummer.finish();
+            std::ostringstream hex;
+            hex << std::hex << digest.crc;
+
+            size_t stored = 0;
+            for (auto& r : replicas) {
+                auto location = r.writer->commit(digest);
+                if (!location) {
+                    continue;
+                }
+                ChunkInfo chunk_info;
+                chunk_info.chunk_id = chunk_id;
+                chunk_info.server_ip = r.server;
+                chunk_info.file_path = *location;
+                chunk_info.size = len;
+                chunk_info.checksum = hex.str();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.results.push_back(std::move(chunk_info));
+                stored++;
+            }
+            if (stored == 0) {
+                std::cerr << "Chunk " << chunk_id << " could not be stored on any server" << std::endl;
+                state.failed = true;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error streaming chunk " << chunk_id << ": " << e.what() << std::endl;
+            state.failed = true;
+        }
+        finish_chunk(state);
+    }
+
+    // Encodes one chunk into k + m fragments and streams each to its own
+    // server. The chunk counts as stored once any k fragments are.
+    void stream_coded_chunk(State& state, int fd, int chunk_id, off_t offset, size_t len) {
+        try {
+            const int k = codec_->data();
+            const int total = codec_->total();
+            auto servers = placement_(chunk_id);
+            if (servers.empty()) {
+                throw std::runtime_error("no servers for chunk " + std::to_string(chunk_id));
+            }
+
+            std::vector<Replica> fragments(total);
+            for (int i = 0; i < total; ++i) {
+                const auto& server = servers[i % servers.size()];
+                FragmentRef ref{k, codec_->parity(), i, len};
+                fragments[i] = Replica{server, open_fragment_(server, chunk_id, ref)};
+                if (!fragments[i].writer) {
+                    std::cerr << "Server " << server << " rejected fragment " << i << " of chunk " << chunk_id
+                              << std::endl;
+                }
+            }
+
+            const uint64_t fragment_size = FragmentRef{k, codec_->parity(), 0, len}.size();
+            auto slice = buffers_.acquire();
+            // Piece boundaries stay cache-line aligned for the SIMD kernels.
+            const size_t piece = slice.size() / total / 64 * 64;
+            if (piece == 0) {
+                throw std::runtime_error("slice too small for a " + std::to_string(total) + "-fragment stripe");
+            }
+            std::vector<uint8_t*> pieces(total);
+            for (int i = 0; i < total; ++i) {
+                pieces[i] = reinterpret_cast<uint8_t*>(slice.data()) + i * piece;
+            }
+
+            std::vector<checksum::BlockChecksummer> checksummers(total);
+            for (uint64_t done = 0; done < fragment_size; done += piece) {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(piece, fragment_size - done));
+                for (int i = 0; i < k; ++i) {
+                    uint64_t start = i * fragment_size + done;
+                    size_t have = start < len ? static_cast<size_t>(std::min<uint64_t>(n, len - start)) : 0;
+                    read_exact(fd, pieces[i], have, offset + static_cast<off_t>(start), chunk_id);
+                    std::memset(pieces[i] + have, 0, n - have);
+                }
+                codec_->encode(pieces.data(), pieces.data() + k, n);
+                for (int i = 0; i < total; ++i) {
+                    auto& f = fragments[i];
+                    if (!f.writer) {
+                        continue;
+                    }
+                    checksummers[i].update(pieces[i], n);
+                    if (!f.writer->write(reinterpret_cast<const char*>(pieces[i]), n)) {
+                        std::cerr << "Fragment " << i << " on " << f.server << " failed for chunk " << chunk_id
+                                  << std::endl;
+                        f.writer.reset();
+                    }
+                }
+            }
+            slice.reset();
+
+            int stored = 0;
+            for (int i = 0; i < total; ++i) {
+                auto& f = fragments[i];
+                if (!f.writer) {
+                    continue;
+                }
+                auto digest = checksummers[i].finish();
+                auto location = f.writer->commit(digest);
+                if (!location) {
+                    continue;
+                }
+                std::ostringstream hex;
+                hex << std::hex << digest.crc;
+                ChunkInfo chunk_info;
+                chunk_info.chunk_id = chunk_id;
+                chunk_info.server_ip = f.server;
+                chunk_info.file_path = *location;
+                chunk_info.size = fragment_size;
+                chunk_info.checksum = hex.str();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.results.push_back(std::move(chunk_info));
+                stored++;
+            }
+            if (stored < k) {
+                std::cerr << "Chunk " << chunk_id << " stored only " << stored << " of " << total
+                          << " fragments, too few to decode" << std::endl;
+                state.failed = true;
+            } else if (stored < total) {
+                std::cerr << "Chunk " << chunk_id << " stored " << stored << " of " << total << " fragments"
+                          << std::endl;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error streaming chunk " << chunk_id << ": " << e.what() << std::endl;
+            state.failed = true;
+        }
+        finish_chunk(state);
+    }
+
+    static void read_exact(int fd, uint8_t* buf, size_t len, off_t offset, int chunk_id) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = ::pread(fd, buf + done, len - done, offset + static_cast<off_t>(done));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw std::runtime_error("short read at chunk " + std::to_string(chunk_id));
+            }
+            done += static_cast<size_t>(n);
+        }
+    }
+
+    void finish_chunk(State& state) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        --state.inflight;
+        state.cv.notify_all();
+    }
+
+    UploadPipelineOptions options_;
+    PlacementFn placement_;
+    OpenReplicaFn open_replica_;
+    OpenFragmentFn open_fragment_;
+    ContentFn content_;
+    std::optional<erasure::Codec> codec_;
+    UploadStats stats_;
+    BufferPool& buffers_;
+    WorkerPool pool_;
+};
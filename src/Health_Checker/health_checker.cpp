@@ -8,6 +8,7 @@
 #include <mutex>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 
 struct ServerHealth {
     int server_id;
@@ -23,11 +24,11 @@ class HealthChecker {
 private:
     std::unordered_map<int, ServerHealth> servers;
     std::mutex servers_mutex;
-    bool running = false;
+    std::atomic<bool> running{false};
     const int MAX_MISSED_HEARTBEATS = 3;
     const std::chrono::seconds HEARTBEAT_TIMEOUT{60};
     
-    async_hb::task heartbeat_receiver(async_hb::Reactor& reactor) {
+    async_hb::task<> heartbeat_receiver(async_hb::Reactor& reactor) {
         std::cout << "Starting heartbeat receiver on port 9000" << std::endl;
         
         // Create a socket for receiving heartbeats
@@ -79,7 +80,7 @@ private:
         close(sockfd);
     }
     
-    async_hb::task health_monitor(async_hb::Reactor& reactor) {
+    async_hb::task<> health_monitor(async_hb::Reactor& reactor) {
         while (running) {
             check_server_health();
             co_await reactor.sleep_for(std::chrono::seconds(30));
@@ -152,16 +153,17 @@ public:
         running = true;
         std::cout << "Starting Health Checker service..." << std::endl;
         
-        async_hb::Reactor reactor;
+        // Heartbeats keep arriving while the monitor walks the server table
+        async_hb::Runtime runtime(2);
         
         // Start heartbeat receiver
-        reactor.spawn(heartbeat_receiver(reactor));
+        runtime.spawn_on(0, heartbeat_receiver(runtime.reactor(0)));
         
         // Start health monitor
-        reactor.spawn(health_monitor(reactor));
+        runtime.spawn_on(1, health_monitor(runtime.reactor(1)));
         
-        // Run the reactor
-        reactor.run();
+        // Run the reactor threads
+        runtime.run();
     }
     
     void stop() {
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Chunk data moves through the system in fixed-size slices instead of
+// whole-chunk buffers, so memory depends on concurrency, not CHUNK_SIZE.
+constexpr size_t IO_SLICE_SIZE = 1024 * 1024; // 1MB
+
+// Pool of reusable, page-aligned slices. acquire() blocks once `max_buffers`
+// slices are leased out, which caps the memory of the data path.
+class BufferPool {
+public:
+  class Lease {
+  public:
+    Lease() = default;
+    Lease(BufferPool *pool, char *data) : pool_(pool), data_(data) {}
+    Lease(Lease &&o) noexcept
+        : pool_(std::exchange(o.pool_, nullptr)),
+          data_(std::exchange(o.data_, nullptr)) {}
+    Lease &operator=(Lease &&o) noexcept {
+      if (this != &o) {
+        reset();
+        pool_ = std::exchange(o.pool_, nullptr);
+        data_ = std::exchange(o.data_, nullptr);
+      }
+      return *this;
+    }
+    ~Lease() { reset(); }
+
+    char *data() const { return data_; }
+    size_t size() const { return pool_ ? pool_->slice_size() : 0; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+    void reset() {
+      if (pool_ && data_)
+        pool_->release(data_);
+      pool_ = nullptr;
+      data_ = nullptr;
+    }
+
+  private:
+    BufferPool *pool_{nullptr};
+    char *data_{nullptr};
+  };
+
+  BufferPool(size_t slice_size, size_t max_buffers)
+      : slice_size_(slice_size), max_buffers_(max_buffers ? max_buffers : 1) {}
+
+  ~BufferPool() {
+    for (char *p : free_)
+      std::free(p);
+  }
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  Lease acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !free_.empty() || allocated_ < max_buffers_; });
+    if (!free_.empty()) {
+      char *p = free_.back();
+      free_.pop_back();
+      return Lease(this, p);
+    }
+    ++allocated_;
+    lock.unlock();
+    // Aligned so the slices also satisfy O_DIRECT-style alignment rules.
+    void *p = std::aligned_alloc(4096, round_up(slice_size_, 4096));
+    if (!p) {
+      std::lock_guard<std::mutex> relock(mutex_);
+      --allocated_;
+      cv_.notify_one();
+      throw std::bad_alloc();
+    }
+    return Lease(this, static_cast<char *>(p));
+  }
+
+  size_t slice_size() const { return slice_size_; }
+
+  size_t allocated() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return allocated_;
+  }
+
+private:
+  static size_t round_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+  }
+
+  void release(char *p) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_.push_back(p);
+    }
+    cv_.notify_one();
+  }
+
+  const size_t slice_size_;
+  const size_t max_buffers_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<char *> free_;
+  size_t allocated_{0};
+};
+
+// Process-wide pool shared by the upload, download and chunk-serving paths.
+inline BufferPool &shared_io_buffers() {
+  static BufferPool pool(IO_SLICE_SIZE, 64);
+  return pool;
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define DFG_CHECKSUM_X86 1
+#endif
+
+// CRC32C (Castagnoli) chunk checksums with a kernel picked at runtime:
+//
+//   Portable         slice-by-8 tables, any CPU
+//   Sse42            one stream of the SSE4.2 crc32 instruction
+//   Sse42Interleaved three independent crc32 streams per block, merged with
+//                    precomputed shift operators, which hides the
+//                    instruction's 3-cycle latency
+//
+// All kernels produce identical values, so data written on one machine
+// verifies on any other. crc32c() is incremental: pass the previous result
+// (0 to start) to continue over the next span.
+namespace checksum {
+
+enum class Kernel { Portable, Sse42, Sse42Interleaved };
+
+// Data is verified in fixed blocks so a partial read checks only the blocks
+// it touches.
+constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+namespace detail {
+
+constexpr uint32_t POLY = 0x82f63b78; // reflected Castagnoli polynomial
+
+struct SliceTables {
+  uint32_t t[8][256];
+  SliceTables() {
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t crc = n;
+      for (int k = 0; k < 8; ++k)
+        crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+      t[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; ++n)
+      for (int k = 1; k < 8; ++k)
+        t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xff];
+  }
+};
+
+inline const SliceTables &slice_tables() {
+  static const SliceTables tables;
+  return tables;
+}
+
+inline uint64_t load64(const unsigned char *p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// --- GF(2) operators that append `len` zero bytes to a CRC ---
+
+inline uint32_t gf2_times(const uint32_t *mat, uint32_t vec) {
+  uint32_t sum = 0;
+  for (; vec; vec >>= 1, ++mat)
+    if (vec & 1)
+      sum ^= *mat;
+  return sum;
+}
+
+inline void gf2_square(uint32_t *square, const uint32_t *mat) {
+  for (int n = 0; n < 32; ++n)
+    square[n] = gf2_times(mat, mat[n]);
+}
+
+// Operator for `len` zero bytes (any length), as a 32x32 bit matrix.
+inline std::array<uint32_t, 32> zeros_operator(size_t len) {
+  std::array<uint32_t, 32> result{};
+  for (int n = 0; n < 32; ++n)
+    result[n] = 1u << n; // identity
+  uint32_t odd[32], even[32];
+  odd[0] = POLY; // one zero bit
+  for (int n = 1; n < 32; ++n)
+    odd[n] = 1u << (n - 1);
+  gf2_square(even, odd); // two bits
+  gf2_square(odd, even); // four bits
+  gf2_square(even, odd); // one byte
+  uint32_t *power = even, *spare = odd;
+  while (len) {
+    if (len & 1) {
+      uint32_t next[32];
+      for (int n = 0; n < 32; ++n)
+        next[n] = gf2_times(power, result[n]);
+      std::memcpy(result.data(), next, sizeof(next));
+    }
+    len >>= 1;
+    if (len) {
+      gf2_square(spare, power);
+      std::swap(power, spare);
+    }
+  }
+  return result;
+}
+
+// Byte-wise lookup form of a zeros operator: four lookups per shift.
+struct ShiftTable {
+  uint32_t t[4][256];
+  explicit ShiftTable(size_t len) {
+    auto op = zeros_operator(len);
+    for (uint32_t n = 0; n < 256; ++n)
+      for (int k = 0; k < 4; ++k)
+        t[k][n] = gf2_times(op.data(), n << (8 * k));
+  }
+  uint32_t shift(uint32_t crc) const {
+    return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^
+           t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+  }
+};
+
+inline uint32_t crc32c_portable(uint32_t crc, const void *data, size_t len) {
+  const auto &t = slice_tables().t;
+  auto p = static_cast<const unsigned char *>(data);
+  crc = ~crc;
+  while (len && (reinterpret_cast<uintptr_t>(p) & 7)) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    --len;
+  }
+  while (len >= 8) {
+    uint64_t w = load64(p) ^ crc; // little-endian word
+    crc = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^ t[5][(w >> 16) & 0xff] ^
+          t[4][(w >> 24) & 0xff] ^ t[3][(w >> 32) & 0xff] ^
+          t[2][(w >> 40) & 0xff] ^ t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  return ~crc;
+}
+
+#ifdef DFG_CHECKSUM_X86
+
+__attribute__((target("sse4.2"))) inline uint32_t
+crc32c_sse42(uint32_t crc, const void *data, size_t len) {
+  auto p = static_cast<const unsigned char *>(data);
+  uint64_t c = ~crc;
+  while (len && (reinterpret_cast<uintptr_t>(p) & 7)) {
+    c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+    --len;
+  }
+  for (; len >= 8; p += 8, len -= 8)
+    c = _mm_crc32_u64(c, load64(p));
+  while (len--)
+    c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+  return ~static_cast<uint32_t>(c);
+}
+
+constexpr size_t LONG_STRIDE = 8192;
+constexpr size_t SHORT_STRIDE = 256;
+
+inline const ShiftTable &long_shift() {
+  static const ShiftTable table(LONG_STRIDE);
+  return table;
+}
+
+inline const ShiftTable &short_shift() {
+  static const ShiftTable table(SHORT_STRIDE);
+  return table;
+}
+
+__attribute__((target("sse4.2"))) inline uint64_t
+crc32c_three_way(uint64_t c0, const unsigned char *&p, size_t &len,
+                 size_t stride, const ShiftTable &shift) {
+  while (len >= 3 * stride) {
+    uint64_t c1 = 0, c2 = 0;
+    const unsigned char *end = p + stride;
+    do {
+      c0 = _mm_crc32_u64(c0, load64(p));
+      c1 = _mm_crc32_u64(c1, load64(p + stride));
+      c2 = _mm_crc32_u64(c2, load64(p + 2 * stride));
+      p += 8;
+    } while (p < end);
+    c0 = shift.shift(static_cast<uint32_t>(c0)) ^ c1;
+    c0 = shift.shift(static_cast<uint32_t>(c0)) ^ c2;
+    p += 2 * stride;
+    len -= 3 * stride;
+  }
+  return c0;
+}
+
+__attribute__((target("sse4.2"))) inline uint32_t
+crc32c_sse42_interleaved(uint32_t crc, const void *data, size_t len) {
+  auto p = static_cast<const unsigned char *>(data);
+  uint64_t c = ~crc;
+  while (len && (reinterpret_cast<uintptr_t>(p) & 7)) {
+    c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+    --len;
+  }
+  c = crc32c_three_way(c, p, len, LONG_STRIDE, long_shift());
+  c = crc32c_three_way(c, p, len, SHORT_STRIDE, short_shift());
+  for (; len >= 8; p += 8, len -= 8)
+    c = _mm_crc32_u64(c, load64(p));
+  while (len--)
+    c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+  return ~static_cast<uint32_t>(c);
+}
+
+#endif // DFG_CHECKSUM_X86
+
+using Fn = uint32_t (*)(uint32_t, const void *, size_t);
+
+} // namespace detail
+
+inline bool kernel_supported(Kernel k) {
+  if (k == Kernel::Portable)
+    return true;
+#ifdef DFG_CHECKSUM_X86
+  return __builtin_cpu_supports("sse4.2");
+#else
+  return false;
+#endif
+}
+
+inline const char *kernel_name(Kernel k) {
+  switch (k) {
+  case Kernel::Portable:
+    return "portable slice-by-8";
+  case Kernel::Sse42:
+    return "sse4.2";
+  case Kernel::Sse42Interleaved:
+    return "sse4.2 3-way interleaved";
+  }
+  return "unknown";
+}
+
+inline detail::Fn kernel_fn(Kernel k) {
+#ifdef DFG_CHECKSUM_X86
+  if (k == Kernel::Sse42)
+    return detail::crc32c_sse42;
+  if (k == Kernel::Sse42Interleaved)
+    return detail::crc32c_sse42_interleaved;
+#endif
+  (void)k;
+  return detail::crc32c_portable;
+}
+
+// Fastest kernel this CPU supports; chosen once per process.
+inline Kernel active_kernel() {
+  static const Kernel k = kernel_supported(Kernel::Sse42Interleaved)
+                              ? Kernel::Sse42Interleaved
+                              : Kernel::Portable;
+  return k;
+}
+
+inline uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+  static const detail::Fn fn = kernel_fn(active_kernel());
+  return fn(crc, data, len);
+}
+
+inline uint32_t crc32c(uint32_t crc, const void *data, size_t len, Kernel k) {
+  return kernel_fn(k)(crc, data, len);
+}
+
+// CRC of A followed by B, given crc(A), crc(B) and len(B).
+inline uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b) {
+  if (len_b == BLOCK_SIZE) {
+    static const detail::ShiftTable block_shift(BLOCK_SIZE);
+    return block_shift.shift(crc_a) ^ crc_b;
+  }
+  auto op = detail::zeros_operator(len_b);
+  return detail::gf2_times(op.data(), crc_a) ^ crc_b;
+}
+
+// Digest of one chunk: a CRC per BLOCK_SIZE block plus the whole-chunk CRC,
+// which is folded from the block CRCs rather than computed a second time.
+struct ChunkDigest {
+  uint32_t crc{0};
+  uint64_t size{0};
+  std::vector<uint32_t> blocks;
+};
+
+// Accumulates a ChunkDigest over data arriving in arbitrary slices.
+class BlockChecksummer {
+public:
+  void update(const void *data, size_t len) {
+    auto p = static_cast<const char *>(data);
+    while (len > 0) {
+      size_t take = std::min(len, BLOCK_SIZE - in_block_);
+      block_crc_ = crc32c(block_crc_, p, take);
+      in_block_ += take;
+      p += take;
+      len -= take;
+      if (in_block_ == BLOCK_SIZE)
+        close_block();
+    }
+  }
+
+  ChunkDigest finish() {
+    if (in_block_ > 0)
+      close_block();
+    ChunkDigest out = std::move(digest_);
+    digest_ = ChunkDigest{};
+    return out;
+  }
+
+private:
+  void close_block() {
+    digest_.crc = digest_.blocks.empty()
+                      ? block_crc_
+                      : crc32c_combine(digest_.crc, block_crc_, in_block_);
+    digest_.blocks.push_back(block_crc_);
+    digest_.size += in_block_;
+    block_crc_ = 0;
+    in_block_ = 0;
+  }
+
+  ChunkDigest digest_;
+  uint32_t block_crc_{0};
+  size_t in_block_{0};
+};
+
+} // namespace checksum
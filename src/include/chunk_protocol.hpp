@@ -0,0 +1,151 @@
+#pragma once
+#include "checksum.hpp"
+#include "heart_beat_signal.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+// Binary chunk-transfer protocol between head and cluster servers.
+//
+// Every request and response starts with a header frame using the same
+// length prefix as heartbeat frames:
+//
+//   [u32 body_len][u8 op][u8 status][u8 flags][u64 offset][u64 length][chunk id]
+//
+// all integers big-endian. `length` raw bytes follow the header when the
+// message carries data:
+//
+//   PUT    request:  header(length = N) + N bytes    response: header
+//   GET    request:  header(offset, length, 0 = all) response: header(N) + N bytes
+//                    (clamped to the chunk; past its end N = 0)
+//   DELETE request:  header                          response: header
+//   LIST   request:  header                          response: header(N) + N bytes
+//                                                    of '\n'-separated ids
+//
+// With FLAG_BLOCK_CRCS, chunk data is covered by per-block CRC32Cs (see
+// checksum.hpp) sent as a CRC frame, [u32 body_len][u32 crc]...:
+//
+//   PUT: the frame follows the data and is stored beside the chunk.
+//   GET: the server widens the range to whole blocks, echoes the flag and
+//        sends the frame for those blocks before the data, so the client
+//        verifies exactly the blocks it reads.
+namespace chunk_proto {
+
+enum class Op : uint8_t { Put = 1, Get = 2, Delete = 3, List = 4 };
+
+enum class Status : uint8_t { Ok = 0, NotFound = 1, Error = 2 };
+
+constexpr uint8_t FLAG_BLOCK_CRCS = 0x01;
+
+constexpr size_t HEADER_FIXED_SIZE = 1 + 1 + 1 + 8 + 8;
+constexpr size_t MAX_CHUNK_ID_SIZE = 255;
+constexpr size_t MAX_HEADER_BODY = HEADER_FIXED_SIZE + MAX_CHUNK_ID_SIZE;
+
+struct Header {
+  Op op{Op::Get};
+  Status status{Status::Ok};
+  uint8_t flags{0};
+  uint64_t offset{0};
+  uint64_t length{0};
+  std::string chunk_id;
+};
+
+inline void put_u64(uint8_t *out, uint64_t v) {
+  for (int i = 7; i >= 0; --i) {
+    out[i] = static_cast<uint8_t>(v & 0xff);
+    v >>= 8;
+  }
+}
+
+inline uint64_t get_u64(const uint8_t *in) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; ++i)
+    v = (v << 8) | in[i];
+  return v;
+}
+
+// Returns the complete frame, prefix included.
+inline std::vector<uint8_t> encode_header(const Header &h) {
+  size_t body = HEADER_FIXED_SIZE + h.chunk_id.size();
+  std::vector<uint8_t> frame(async_hb::FRAME_PREFIX_SIZE + body);
+  uint8_t *p = frame.data();
+  async_hb::put_frame_length(p, static_cast<uint32_t>(body));
+  p += async_hb::FRAME_PREFIX_SIZE;
+  p[0] = static_cast<uint8_t>(h.op);
+  p[1] = static_cast<uint8_t>(h.status);
+  p[2] = h.flags;
+  put_u64(p + 3, h.offset);
+  put_u64(p + 11, h.length);
+  memcpy(p + HEADER_FIXED_SIZE, h.chunk_id.data(), h.chunk_id.size());
+  return frame;
+}
+
+// Parses a header body (the bytes after the length prefix).
+inline bool decode_header(const uint8_t *body, size_t len, Header &out) {
+  if (len < HEADER_FIXED_SIZE || len > MAX_HEADER_BODY)
+    return false;
+  if (body[0] < static_cast<uint8_t>(Op::Put) ||
+      body[0] > static_cast<uint8_t>(Op::List))
+    return false;
+  out.op = static_cast<Op>(body[0]);
+  out.status = static_cast<Status>(body[1]);
+  out.flags = body[2];
+  out.offset = get_u64(body + 3);
+  out.length = get_u64(body + 11);
+  out.chunk_id.assign(reinterpret_cast<const char *>(body) + HEADER_FIXED_SIZE,
+                      len - HEADER_FIXED_SIZE);
+  return true;
+}
+
+// Number of BLOCK_SIZE blocks covering `len` bytes.
+inline size_t block_count(uint64_t len) {
+  return static_cast<size_t>((len + checksum::BLOCK_SIZE - 1) /
+                             checksum::BLOCK_SIZE);
+}
+
+inline std::vector<uint8_t> encode_block_crcs(const uint32_t *crcs,
+                                              size_t count) {
+  std::vector<uint8_t> frame(async_hb::FRAME_PREFIX_SIZE + 4 * count);
+  async_hb::put_frame_length(frame.data(), static_cast<uint32_t>(4 * count));
+  uint8_t *p = frame.data() + async_hb::FRAME_PREFIX_SIZE;
+  for (size_t i = 0; i < count; ++i, p += 4) {
+    uint32_t be = htonl(crcs[i]);
+    memcpy(p, &be, 4);
+  }
+  return frame;
+}
+
+// Parses a CRC frame body; `count` is the number of CRCs expected.
+inline bool decode_block_crcs(const uint8_t *body, size_t len, size_t count,
+                              std::vector<uint32_t> &out) {
+  if (len != 4 * count)
+    return false;
+  out.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t be;
+    memcpy(&be, body + 4 * i, 4);
+    out[i] = ntohl(be);
+  }
+  return true;
+}
+
+// Chunk ids become file names on the cluster server.
+inline bool valid_chunk_id(const std::string &id) {
+  return !id.empty() && id.size() <= MAX_CHUNK_ID_SIZE && id != "." &&
+         id != ".." && id.find('/') == std::string::npos &&
+         id.find('\0') == std::string::npos;
+}
+
+// Small frames and bulk data share the connection; don't let Nagle hold
+// back a header waiting for an ACK.
+inline void tune_socket(int fd) {
+  int yes = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
+} // namespace chunk_proto
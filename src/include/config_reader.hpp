@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+
+// Minimal reader for the flat two-level JSON files under config/, e.g.
+// config_int(text, "redis", "max_connections"). Not a general JSON parser:
+// it only understands "section": { "key": scalar, ... } lookups.
+
+inline std::string head_server_config_path() {
+  if (const char *p = std::getenv("DFG_HEAD_CONFIG"))
+    return p;
+  return "config/head_server_config.json";
+}
+
+inline std::string read_config_file(const std::string &path) {
+  std::ifstream in(path);
+  if (!in)
+    return {};
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+// Returns the raw scalar text (quotes stripped) of section.key, if present.
+inline std::optional<std::string> config_value(const std::string &json,
+                                               const std::string &section,
+                                               const std::string &key) {
+  auto sec = json.find("\"" + section + "\"");
+  if (sec == std::string::npos)
+    return std::nullopt;
+  auto open = json.find('{', sec);
+  if (open == std::string::npos)
+    return std::nullopt;
+
+  // Find the matching close brace so keys of sibling sections don't match.
+  int depth = 0;
+  size_t close = open;
+  for (; close < json.size(); ++close) {
+    if (json[close] == '{')
+      ++depth;
+    else if (json[close] == '}' && --depth == 0)
+      break;
+  }
+  std::string body = json.substr(open, close - open);
+
+  auto k = body.find("\"" + key + "\"");
+  if (k == std::string::npos)
+    return std::nullopt;
+  auto colon = body.find(':', k);
+  if (colon == std::string::npos)
+    return std::nullopt;
+  size_t b = colon + 1;
+  while (b < body.size() && std::isspace(static_cast<unsigned char>(body[b])))
+    ++b;
+  if (b < body.size() && body[b] == '"') {
+    auto e = body.find('"', b + 1);
+    if (e == std::string::npos)
+      return std::nullopt;
+    return body.substr(b + 1, e - b - 1);
+  }
+  size_t e = b;
+  while (e < body.size() && body[e] != ',' && body[e] != '}' &&
+         body[e] != '\n')
+    ++e;
+  while (e > b && std::isspace(static_cast<unsigned char>(body[e - 1])))
+    --e;
+  return body.substr(b, e - b);
+}
+
+inline long long config_int(const std::string &json, const std::string &section,
+                            const std::string &key, long long fallback) {
+  auto v = config_value(json, section, key);
+  if (!v)
+    return fallback;
+  try {
+    return std::stoll(*v);
+  } catch (const std::exception &) {
+    return fallback;
+  }
+}
+
+inline std::string config_string(const std::string &json,
+                                 const std::string &section,
+                                 const std::string &key,
+                                 const std::string &fallback) {
+  auto v = config_value(json, section, key);
+  return v ? *v : fallback;
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DFG_ERASURE_X86 1
+#endif
+
+// Reed-Solomon erasure coding over GF(2^8) with a multiply kernel picked at
+// runtime:
+//
+//   Portable one product table row per coefficient, a lookup per byte
+//   Ssse3    split-nibble product tables, 16 bytes per pshufb pair
+//   Avx2     the same tables in 256-bit registers, 32 bytes per pair
+//
+// The code is systematic: a stripe of k data fragments is stored as-is and
+// m parity fragments are added from a Cauchy matrix, any k x k submatrix of
+// which (identity rows included) is invertible. So any k of the k + m
+// fragments rebuild the others, and every kernel produces identical bytes.
+namespace erasure {
+
+enum class Kernel { Portable, Ssse3, Avx2 };
+
+// Cauchy rows need k + m distinct field elements; far beyond any useful
+// stripe width anyway.
+constexpr int MAX_FRAGMENTS = 64;
+
+namespace detail {
+
+constexpr unsigned POLY = 0x11d; // x^8 + x^4 + x^3 + x^2 + 1, generator 2
+
+struct Tables {
+  uint8_t exp[512];
+  uint8_t log[256];
+  uint8_t mul[256][256];
+  // c * n and c * (n << 4) for every nibble n, the pshufb form of mul[c].
+  alignas(16) uint8_t lo[256][16];
+  alignas(16) uint8_t hi[256][16];
+
+  Tables() {
+    unsigned x = 1;
+    for (int i = 0; i < 255; ++i) {
+      exp[i] = static_cast<uint8_t>(x);
+      log[x] = static_cast<uint8_t>(i);
+      x <<= 1;
+      if (x & 0x100)
+        x ^= POLY;
+    }
+    for (int i = 255; i < 512; ++i)
+      exp[i] = exp[i - 255];
+    log[0] = 0;
+    for (int a = 0; a < 256; ++a)
+      for (int b = 0; b < 256; ++b)
+        mul[a][b] = a && b ? exp[log[a] + log[b]] : 0;
+    for (int c = 0; c < 256; ++c)
+      for (int n = 0; n < 16; ++n) {
+        lo[c][n] = mul[c][n];
+        hi[c][n] = mul[c][n << 4];
+      }
+  }
+};
+
+inline const Tables &tables() {
+  static const Tables t;
+  return t;
+}
+
+inline uint8_t gf_mul(uint8_t a, uint8_t b) { return tables().mul[a][b]; }
+
+inline uint8_t gf_inv(uint8_t a) {
+  const auto &t = tables();
+  return t.exp[255 - t.log[a]];
+}
+
+// dst = c * src, or dst ^= c * src when `add`.
+using Fn = void (*)(uint8_t c, const uint8_t *src, uint8_t *dst, size_t len,
+                    bool add);
+
+inline void mul_portable(uint8_t c, const uint8_t *src, uint8_t *dst,
+                         size_t len, bool add) {
+  const uint8_t *row = tables().mul[c];
+  if (add) {
+    for (size_t i = 0; i < len; ++i)
+      dst[i] ^= row[src[i]];
+  } else {
+    for (size_t i = 0; i < len; ++i)
+      dst[i] = row[src[i]];
+  }
+}
+
+#ifdef DFG_ERASURE_X86
+
+__attribute__((target("ssse3"))) inline void
+mul_ssse3(uint8_t c, const uint8_t *src, uint8_t *dst, size_t len, bool add) {
+  const __m128i lo =
+      _mm_load_si128(reinterpret_cast<const __m128i *>(tables().lo[c]));
+  const __m128i hi =
+      _mm_load_si128(reinterpret_cast<const __m128i *>(tables().hi[c]));
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i p = _mm_xor_si128(
+        _mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+        _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+    auto out = reinterpret_cast<__m128i *>(dst + i);
+    if (add)
+      p = _mm_xor_si128(p, _mm_loadu_si128(out));
+    _mm_storeu_si128(out, p);
+  }
+  mul_portable(c, src + i, dst + i, len - i, add);
+}
+
+__attribute__((target("avx2"))) inline void
+mul_avx2(uint8_t c, const uint8_t *src, uint8_t *dst, size_t len, bool add) {
+  const __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i *>(tables().lo[c])));
+  const __m256i hi = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i *>(tables().hi[c])));
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+  // Two vectors per iteration keep both shuffle ports busy.
+  for (; i + 64 <= len; i += 64) {
+    __m256i s0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i s1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 32));
+    __m256i p0 = _mm256_xor_si256(
+        _mm256_shuffle_epi8(lo, _mm256_and_si256(s0, mask)),
+        _mm256_shuffle_epi8(hi,
+                            _mm256_and_si256(_mm256_srli_epi64(s0, 4), mask)));
+    __m256i p1 = _mm256_xor_si256(
+        _mm256_shuffle_epi8(lo, _mm256_and_si256(s1, mask)),
+        _mm256_shuffle_epi8(hi,
+                            _mm256_and_si256(_mm256_srli_epi64(s1, 4), mask)));
+    auto out0 = reinterpret_cast<__m256i *>(dst + i);
+    auto out1 = reinterpret_cast<__m256i *>(dst + i + 32);
+    if (add) {
+      p0 = _mm256_xor_si256(p0, _mm256_loadu_si256(out0));
+      p1 = _mm256_xor_si256(p1, _mm256_loadu_si256(out1));
+    }
+    _mm256_storeu_si256(out0, p0);
+    _mm256_storeu_si256(out1, p1);
+  }
+  mul_ssse3(c, src + i, dst + i, len - i, add);
+}
+
+#endif // DFG_ERASURE_X86
+
+// Inverts the n x n matrix `m` (row-major) in place; false if singular.
+inline bool invert(std::vector<uint8_t> &m, int n) {
+  std::vector<uint8_t> inv(static_cast<size_t>(n) * n, 0);
+  for (int i = 0; i < n; ++i)
+    inv[i * n + i] = 1;
+  for (int col = 0; col < n; ++col) {
+    int pivot = col;
+    while (pivot < n && m[pivot * n + col] == 0)
+      ++pivot;
+    if (pivot == n)
+      return false;
+    if (pivot != col)
+      for (int j = 0; j < n; ++j) {
+        std::swap(m[pivot * n + j], m[col * n + j]);
+        std::swap(inv[pivot * n + j], inv[col * n + j]);
+      }
+    uint8_t scale = gf_inv(m[col * n + col]);
+    for (int j = 0; j < n; ++j) {
+      m[col * n + j] = gf_mul(m[col * n + j], scale);
+      inv[col * n + j] = gf_mul(inv[col * n + j], scale);
+    }
+    for (int row = 0; row < n; ++row) {
+      uint8_t f = m[row * n + col];
+      if (row == col || f == 0)
+        continue;
+      for (int j = 0; j < n; ++j) {
+        m[row * n + j] ^= gf_mul(f, m[col * n + j]);
+        inv[row * n + j] ^= gf_mul(f, inv[col * n + j]);
+      }
+    }
+  }
+  m.swap(inv);
+  return true;
+}
+
+} // namespace detail
+
+inline bool kernel_supported(Kernel k) {
+  if (k == Kernel::Portable)
+    return true;
+#ifdef DFG_ERASURE_X86
+  if (k == Kernel::Ssse3)
+    return __builtin_cpu_supports("ssse3");
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+inline const char *kernel_name(Kernel k) {
+  switch (k) {
+  case Kernel::Portable:
+    return "portable table";
+  case Kernel::Ssse3:
+    return "ssse3 pshufb";
+  case Kernel::Avx2:
+    return "avx2 vpshufb";
+  }
+  return "unknown";
+}
+
+inline detail::Fn kernel_fn(Kernel k) {
+#ifdef DFG_ERASURE_X86
+  if (k == Kernel::Ssse3)
+    return detail::mul_ssse3;
+  if (k == Kernel::Avx2)
+    return detail::mul_avx2;
+#endif
+  (void)k;
+  return detail::mul_portable;
+}
+
+// Fastest kernel this CPU supports; chosen once per process.
+inline Kernel active_kernel() {
+  static const Kernel k = kernel_supported(Kernel::Avx2)    ? Kernel::Avx2
+                          : kernel_supported(Kernel::Ssse3) ? Kernel::Ssse3
+                                                            : Kernel::Portable;
+  return k;
+}
+
+// A k + m stripe code. Fragments are equal-length byte arrays; fragment i < k
+// is data, the rest parity. Stateless after construction, so one codec can
+// be shared between threads.
+class Codec {
+public:
+  Codec(int data, int parity, Kernel kernel = active_kernel())
+      : k_(data), m_(parity), fn_(kernel_fn(kernel)),
+        rows_(static_cast<size_t>(data + parity) * data, 0) {
+    for (int i = 0; i < k_; ++i)
+      rows_[i * k_ + i] = 1;
+    for (int p = 0; p < m_; ++p)
+      for (int j = 0; j < k_; ++j)
+        rows_[(k_ + p) * k_ + j] =
+            detail::gf_inv(static_cast<uint8_t>((k_ + p) ^ j));
+  }
+
+  static bool valid(int data, int parity) {
+    return data >= 1 && parity >= 0 && data + parity <= MAX_FRAGMENTS;
+  }
+
+  int data() const { return k_; }
+  int parity() const { return m_; }
+  int total() const { return k_ + m_; }
+
+  // Fills the m parity fragments from the k data fragments.
+  void encode(const uint8_t *const *data, uint8_t *const *parity,
+              size_t len) const {
+    apply(rows_.data() + static_cast<size_t>(k_) * k_, m_, data, parity, len);
+  }
+
+  // `fragments` holds total() pointers, nullptr for each lost fragment. Every
+  // lost fragment i with a non-null rebuilt[i] is recomputed into it. False
+  // if fewer than k fragments survive.
+  bool decode(const uint8_t *const *fragments, uint8_t *const *rebuilt,
+              size_t len) const {
+    std::vector<int> used;
+    for (int i = 0; i < total() && static_cast<int>(used.size()) < k_; ++i)
+      if (fragments[i])
+        used.push_back(i);
+    if (static_cast<int>(used.size()) < k_)
+      return false;
+
+    // Data = inverse(rows of the survivors) * survivors, so each lost row
+    // is its generator row times that inverse.
+    std::vector<uint8_t> inv(static_cast<size_t>(k_) * k_);
+    for (int r = 0; r < k_; ++r)
+      std::copy_n(&rows_[used[r] * k_], k_, &inv[r * k_]);
+    if (!detail::invert(inv, k_))
+      return false;
+
+    std::vector<uint8_t> coefs;
+    std::vector<uint8_t *> outs;
+    for (int i = 0; i < total(); ++i) {
+      if (fragments[i] || !rebuilt[i])
+        continue;
+      for (int t = 0; t < k_; ++t) {
+        uint8_t c = 0;
+        for (int j = 0; j < k_; ++j)
+          c ^= detail::gf_mul(rows_[i * k_ + j], inv[j * k_ + t]);
+        coefs.push_back(c);
+      }
+      outs.push_back(rebuilt[i]);
+    }
+    std::vector<const uint8_t *> srcs;
+    for (int i : used)
+      srcs.push_back(fragments[i]);
+    apply(coefs.data(), static_cast<int>(outs.size()), srcs.data(),
+          outs.data(), len);
+    return true;
+  }
+
+private:
+  // Small enough that the k source blocks and the output stay in L1/L2
+  // while every coefficient of a row is applied.
+  static constexpr size_t BLOCK = 16 * 1024;
+
+  // outs[o] = sum over t of coefs[o * k + t] * srcs[t].
+  void apply(const uint8_t *coefs, int n_out, const uint8_t *const *srcs,
+             uint8_t *const *outs, size_t len) const {
+    for (size_t off = 0; off < len; off += BLOCK) {
+      size_t n = std::min(BLOCK, len - off);
+      for (int o = 0; o < n_out; ++o)
+        for (int t = 0; t < k_; ++t)
+          fn_(coefs[o * k_ + t], srcs[t] + off, outs[o] + off, n, t > 0);
+    }
+  }
+
+  int k_;
+  int m_;
+  detail::Fn fn_;
+  std::vector<uint8_t> rows_; // (k + m) x k generator matrix
+};
+
+} // namespace erasure
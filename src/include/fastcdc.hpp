@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DFG_FASTCDC_X86 1
+#endif
+
+// FastCDC content-defined chunking: a Gear rolling hash picks cut points
+// from the bytes themselves, so an insertion early in a file only moves the
+// boundaries next to it and every later chunk keeps its content and id.
+// Cut-point search runs on a kernel picked at runtime:
+//
+//   Portable one serial Gear hash, (h << 1) + gear[byte] per byte
+//   Avx2     four hashes over adjacent 4 KB segments at once, gathering the
+//            gear values, which hides the serial chain's latency
+//
+// Bit k of the hash depends on the last k + 1 bytes only, so bits 63..0
+// form a 64-byte rolling window. The masks test the top bits, and every
+// kernel evaluates the same window hash, so all of them cut identically.
+// Normalized chunking (FastCDC level 2) tests a harder mask before the
+// average size and an easier one after it, tightening the size spread.
+namespace fastcdc {
+
+enum class Kernel { Portable, Avx2 };
+
+struct Params {
+  size_t min_size = 256 * 1024;
+  size_t avg_size = 1024 * 1024; // power of two
+  size_t max_size = 4 * 1024 * 1024;
+};
+
+namespace detail {
+
+// Fixed forever: changing a single entry moves every cut point and so
+// defeats deduplication against everything stored before.
+struct GearTable {
+  alignas(32) uint64_t v[256];
+  GearTable() {
+    uint64_t x = 0x6a09e667f3bcc908ULL; // splitmix64
+    for (auto &g : v) {
+      uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      g = z ^ (z >> 31);
+    }
+  }
+};
+
+inline const GearTable &gear() {
+  static const GearTable t;
+  return t;
+}
+
+// `bits` ones at the top of the hash.
+constexpr uint64_t top_mask(int bits) { return ~0ULL << (64 - bits); }
+
+struct Masks {
+  uint64_t hard; // before avg_size
+  uint64_t easy; // after; a subset of `hard`
+};
+
+// A hash matching `easy` at position `pos` of a chunk is a cut if it is past
+// the average size, or matches `hard` as well.
+inline bool is_cut(uint64_t h, size_t pos, size_t avg, const Masks &m) {
+  return pos >= avg || (h & m.hard) == 0;
+}
+
+// First cut in [from, to), or `to`. Positions before from - 64 never reach
+// the window, so hashing starts there.
+inline size_t find_portable(const uint8_t *data, size_t from, size_t to,
+                            size_t avg, const Masks &m) {
+  const uint64_t *g = gear().v;
+  uint64_t h = 0;
+  for (size_t i = from - 64; i < from; ++i)
+    h = (h << 1) + g[data[i]];
+  for (size_t i = from; i < to; ++i) {
+    h = (h << 1) + g[data[i]];
+    if ((h & m.easy) == 0 && is_cut(h, i, avg, m))
+      return i;
+  }
+  return to;
+}
+
+using Fn = size_t (*)(const uint8_t *data, size_t from, size_t to, size_t avg,
+                      const Masks &m);
+
+#ifdef DFG_FASTCDC_X86
+
+__attribute__((target("avx2"))) inline size_t
+find_avx2(const uint8_t *data, size_t from, size_t to, size_t avg,
+          const Masks &m) {
+  constexpr size_t SEG = 4096;
+  const auto *g = reinterpret_cast<const long long *>(gear().v);
+  const __m256i easy = _mm256_set1_epi64x(static_cast<long long>(m.easy));
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i byte = _mm256_set1_epi64x(0xff);
+
+  size_t base = from;
+  for (; base + 4 * SEG <= to; base += 4 * SEG) {
+    // Lane l hashes [base + l * SEG, base + (l + 1) * SEG), primed with
+    // the 64 bytes before it.
+    const __m256i starts = _mm256_set_epi64x(
+        static_cast<long long>(base + 3 * SEG - 64),
+        static_cast<long long>(base + 2 * SEG - 64),
+        static_cast<long long>(base + SEG - 64),
+        static_cast<long long>(base - 64));
+    __m256i h = zero;
+    size_t cut[4] = {to, to, to, to};
+    for (size_t i = 0; i < SEG + 64; i += 8) {
+      // Eight bytes of each lane per load, consumed low byte first.
+      __m256i words = _mm256_i64gather_epi64(
+          reinterpret_cast<const long long *>(data + i),
+          starts, 1);
+      for (int b = 0; b < 8; ++b) {
+        __m256i idx = _mm256_and_si256(_mm256_srli_epi64(words, 8 * b), byte);
+        h = _mm256_add_epi64(_mm256_slli_epi64(h, 1),
+                             _mm256_i64gather_epi64(g, idx, 8));
+        if (i < 64)
+          continue;
+        int hits = _mm256_movemask_pd(_mm256_castsi256_pd(
+            _mm256_cmpeq_epi64(_mm256_and_si256(h, easy), zero)));
+        if (__builtin_expect(hits != 0, 0)) {
+          alignas(32) uint64_t lanes[4];
+          _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), h);
+          for (int l = 0; l < 4; ++l) {
+            size_t pos = base + l * SEG + i - 64 + b;
+            if ((hits >> l & 1) && cut[l] == to && is_cut(lanes[l], pos, avg, m))
+              cut[l] = pos;
+          }
+        }
+      }
+    }
+    for (size_t c : cut)
+      if (c != to)
+        return c;
+  }
+  return base < to ? find_portable(data, base, to, avg, m) : to;
+}
+
+#endif // DFG_FASTCDC_X86
+
+} // namespace detail
+
+inline bool kernel_supported(Kernel k) {
+  if (k == Kernel::Portable)
+    return true;
+#ifdef DFG_FASTCDC_X86
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+inline const char *kernel_name(Kernel k) {
+  switch (k) {
+  case Kernel::Portable:
+    return "portable gear";
+  case Kernel::Avx2:
+    return "avx2 4-lane gear";
+  }
+  return "unknown";
+}
+
+inline detail::Fn kernel_fn(Kernel k) {
+#ifdef DFG_FASTCDC_X86
+  if (k == Kernel::Avx2)
+    return detail::find_avx2;
+#endif
+  (void)k;
+  return detail::find_portable;
+}
+
+// Fastest kernel this CPU supports; chosen once per process.
+inline Kernel active_kernel() {
+  static const Kernel k =
+      kernel_supported(Kernel::Avx2) ? Kernel::Avx2 : Kernel::Portable;
+  return k;
+}
+
+class Chunker {
+public:
+  explicit Chunker(Params params = {}, Kernel kernel = active_kernel())
+      : params_(params), fn_(kernel_fn(kernel)) {
+    params_.min_size = std::max<size_t>(params_.min_size, 64);
+    params_.avg_size = std::max(params_.avg_size, params_.min_size);
+    params_.max_size = std::max(params_.max_size, params_.avg_size);
+    int bits = 0;
+    while ((size_t{2} << bits) <= params_.avg_size)
+      ++bits;
+    masks_ = {detail::top_mask(bits + 2), detail::top_mask(std::max(bits - 2, 1))};
+  }
+
+  const Params &params() const { return params_; }
+
+  // Length of the chunk starting at data[0]. `len` must reach max_size
+  // unless the data ends there.
+  size_t next(const uint8_t *data, size_t len) const {
+    if (len <= params_.min_size)
+      return len;
+    size_t to = std::min(len, params_.max_size);
+    size_t cut = fn_(data, params_.min_size, to, params_.avg_size, masks_);
+    return cut < to ? cut + 1 : to;
+  }
+
+private:
+  Params params_;
+  detail::Fn fn_;
+  detail::Masks masks_;
+};
+
+} // namespace fastcdc
@@ -7,18 +7,31 @@
 #include <netinet/in.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
-#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
 #include <coroutine>
 #include <cstdint>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <queue>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "../protos/v1/generate/heart_beat.pb.h"
@@ -29,24 +42,159 @@ namespace async_hb {
 
 // Forward declare Reactor here for promise_type
 struct Reactor;
+class Runtime;
 
-// Coroutine task with promise_type
-struct task {
-  struct promise_type {
-    Reactor *reactor{nullptr};
+// Free lists of coroutine frames in 64-byte size classes, one set per
+// thread, so each reactor thread recycles the frames of its short-lived
+// I/O coroutines instead of going to malloc. A frame freed on another
+// thread than the one that made it joins that thread's lists. Each class
+// keeps at most MAX_CACHED frames; frames over MAX_FRAME bypass the pool.
+class FramePool {
+public:
+  static constexpr size_t GRANULE = 64;
+  static constexpr size_t MAX_FRAME = 4096;
+  static constexpr size_t MAX_CACHED = 1024;
 
-    task get_return_object();
-    std::suspend_always initial_suspend() noexcept { return {}; }
-    struct final_awaitable {
-      bool await_ready() noexcept { return false; }
-      void await_suspend(std::coroutine_handle<promise_type> h) noexcept;
-      void await_resume() noexcept {}
-    };
-    final_awaitable final_suspend() noexcept { return {}; }
-    void unhandled_exception() { std::terminate(); }
-    void return_void() {}
+  struct Stats {
+    uint64_t allocations{0}; // frames handed out
+    uint64_t reused{0};      // of those, from a free list
+  };
+
+  static void *allocate(size_t n) {
+    if (n > MAX_FRAME || exited_)
+      return ::operator new(n);
+    auto &pool = local();
+    ++pool.stats_.allocations;
+    auto &list = pool.free_[size_class(n)];
+    if (!list.head)
+      return ::operator new(rounded(n));
+    ++pool.stats_.reused;
+    Block *b = list.head;
+    list.head = b->next;
+    --list.count;
+    return b;
+  }
+
+  static void deallocate(void *p, size_t n) noexcept {
+    if (n > MAX_FRAME || exited_) {
+      ::operator delete(p);
+      return;
+    }
+    auto &list = local().free_[size_class(n)];
+    if (list.count == MAX_CACHED) {
+      ::operator delete(p);
+      return;
+    }
+    list.head = new (p) Block{list.head};
+    ++list.count;
+  }
+
+  // Counters of the calling thread.
+  static Stats stats() { return local().stats_; }
+
+  ~FramePool() {
+    exited_ = true;
+    for (auto &list : free_)
+      while (list.head)
+        ::operator delete(std::exchange(list.head, list.head->next));
+  }
+
+private:
+  struct Block {
+    Block *next;
   };
+  struct FreeList {
+    Block *head{nullptr};
+    size_t count{0};
+  };
+
+  static size_t size_class(size_t n) { return n ? (n - 1) / GRANULE : 0; }
+  static size_t rounded(size_t n) { return (size_class(n) + 1) * GRANULE; }
+
+  static FramePool &local() {
+    thread_local FramePool pool;
+    return pool;
+  }
+
+  // Trivially destructible, so it stays valid for frames freed while the
+  // thread's destructors run.
+  static inline thread_local bool exited_{false};
+
+  FreeList free_[MAX_FRAME / GRANULE];
+  Stats stats_;
+};
+
+template <typename T = void> struct task;
+
+namespace detail {
 
+// What every task's promise shares. A task either is awaited by another
+// coroutine, which it resumes by symmetric transfer when it finishes, or
+// is spawned on a Reactor, which then owns the frame.
+struct promise_base {
+  Reactor *reactor{nullptr}; // set by spawn
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+
+  static void *operator new(size_t n) { return FramePool::allocate(n); }
+  static void operator delete(void *p, size_t n) noexcept {
+    FramePool::deallocate(p, n);
+  }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  struct final_awaitable {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      return h.promise().finish(h);
+    }
+    void await_resume() noexcept {}
+  };
+  final_awaitable final_suspend() noexcept { return {}; }
+
+  // An awaiter gets the exception from co_await; nobody would see one
+  // thrown out of a spawned task.
+  void unhandled_exception() {
+    if (reactor)
+      std::terminate();
+    exception = std::current_exception();
+  }
+
+  // The coroutine to run next once `self` finished.
+  std::coroutine_handle<> finish(std::coroutine_handle<> self) noexcept;
+};
+
+template <typename T> struct promise : promise_base {
+  std::optional<T> value;
+
+  task<T> get_return_object();
+  template <typename U> void return_value(U &&v) {
+    value.emplace(std::forward<U>(v));
+  }
+  T result() {
+    if (exception)
+      std::rethrow_exception(exception);
+    return std::move(*value);
+  }
+};
+
+template <> struct promise<void> : promise_base {
+  task<void> get_return_object();
+  void return_void() {}
+  void result() {
+    if (exception)
+      std::rethrow_exception(exception);
+  }
+};
+
+} // namespace detail
+
+// Lazily started coroutine producing a T. Either co_await it, which runs it
+// and yields its value (or rethrows what it threw), or hand a task<> to
+// Reactor::spawn to run on its own. Finishing resumes the awaiter by
+// symmetric transfer, so long chains of nested tasks use no extra stack.
+template <typename T> struct task {
+  using promise_type = detail::promise<T>;
   using handle_type = std::coroutine_handle<promise_type>;
   handle_type h;
 
@@ -65,18 +213,39 @@ struct task {
       h.destroy();
   }
 
-  bool await_ready() const noexcept { return false; }
-  void await_suspend(std::coroutine_handle<> /*unused*/) const noexcept {
-    h.resume();
+  bool await_ready() const noexcept { return !h || h.done(); }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    h.promise().continuation = awaiter;
+    return h;
   }
-  void await_resume() const noexcept {}
+  T await_resume() { return h.promise().result(); }
+
+  // Waits for the task to finish without taking its result.
+  struct completion_awaiter {
+    handle_type h;
+    bool await_ready() const noexcept { return !h || h.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+      h.promise().continuation = awaiter;
+      return h;
+    }
+    void await_resume() const noexcept {}
+  };
+  completion_awaiter completion() const noexcept { return {h}; }
 };
 
-inline task task::promise_type::get_return_object() {
-  return task{handle_type::from_promise(*this)};
+template <typename T> task<T> detail::promise<T>::get_return_object() {
+  return task<T>{task<T>::handle_type::from_promise(*this)};
 }
 
-// Reactor class definition
+inline task<void> detail::promise<void>::get_return_object() {
+  return task<void>{task<void>::handle_type::from_promise(*this)};
+}
+
+// Reactor class definition. A Reactor made directly runs every coroutine
+// on the thread that calls run(). One owned by a Runtime is a worker: it
+// resumes coroutines from a run queue other workers steal from, and a
+// coroutine's waits and sleeps go to the worker running it, whichever
+// reactor of the runtime it names. The same coroutine code runs either way.
 struct Reactor {
   Reactor() {
     epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
@@ -86,14 +255,19 @@ struct Reactor {
   ~Reactor() {
     if (epfd_ >= 0)
       ::close(epfd_);
+    if (wake_fd_ >= 0)
+      ::close(wake_fd_);
   }
 
+  Reactor(const Reactor &) = delete;
+  Reactor &operator=(const Reactor &) = delete;
+
   struct ReadAwaiter {
     Reactor *r;
     int fd;
     bool await_ready() const noexcept { return false; }
-    void await_suspend(std::coroutine_handle<> h) {
-      r->add_waiter(fd, EPOLLIN, h);
+    bool await_suspend(std::coroutine_handle<> h) {
+      return r->local()->add_waiter(fd, EPOLLIN, h);
     }
     void await_resume() const noexcept {}
   };
@@ -103,169 +277,652 @@ struct Reactor {
     Reactor *r;
     int fd;
     bool await_ready() const noexcept { return false; }
-    void await_suspend(std::coroutine_handle<> h) {
-      r->add_waiter(fd, EPOLLOUT, h);
+    bool await_suspend(std::coroutine_handle<> h) {
+      return r->local()->add_waiter(fd, EPOLLOUT, h);
     }
     void await_resume() const noexcept {}
   };
   WriteAwaiter wait_writable(int fd) { return WriteAwaiter{this, fd}; }
 
+  // One coroutine at a time may wait for each direction of an fd. A wait
+  // arms a one-shot registration, a single epoll_ctl. watch() instead
+  // registers the fd once, edge-triggered, for both directions: events
+  // with nobody waiting are latched for the next wait, and waits make no
+  // syscalls at all. A watched fd must be unwatched before it is closed.
+  // Not available (false) on a runtime with several workers, where the
+  // coroutine using the fd can move to another worker's epoll.
+  bool watch(int fd);
+  void unwatch(int fd);
+
+  // epoll_ctl calls made so far, for measuring registration overhead.
+  uint64_t epoll_ctl_calls() const { return ctl_calls_; }
+
+  using Clock = std::chrono::steady_clock;
+
+  // Sleepers wait in a min-heap of deadlines that run() turns into the
+  // epoll_wait timeout, so a sleep is a heap push: no syscall and no fd.
+  // A deadline already passed still yields to the rest of the loop once.
   struct SleepAwaiter {
     Reactor *r;
-    int tfd{-1};
-    explicit SleepAwaiter(Reactor *r_, std::chrono::nanoseconds ns) : r(r_) {
-      tfd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-      if (tfd < 0)
-        throw std::runtime_error("timerfd_create failed");
-      itimerspec its{};
-      auto secs = std::chrono::duration_cast<std::chrono::seconds>(ns);
-      auto nsec =
-          std::chrono::duration_cast<std::chrono::nanoseconds>(ns - secs);
-      its.it_value.tv_sec = secs.count();
-      its.it_value.tv_nsec = nsec.count();
-      if (::timerfd_settime(tfd, 0, &its, nullptr) < 0) {
-        ::close(tfd);
-        tfd = -1;
-        throw std::runtime_error("timerfd_settime failed");
-      }
-    }
+    Clock::time_point deadline;
     bool await_ready() const noexcept { return false; }
     void await_suspend(std::coroutine_handle<> h) {
-      r->add_waiter(tfd, EPOLLIN, h, true);
-    }
-    void await_resume() {
-      uint64_t expirations = 0;
-      (void)::read(tfd, &expirations, sizeof(expirations));
-      ::close(tfd);
+      r->local()->add_timer(deadline, h);
     }
+    void await_resume() const noexcept {}
   };
   SleepAwaiter sleep_for(std::chrono::nanoseconds ns) {
-    return SleepAwaiter{this, ns};
+    return SleepAwaiter{this, Clock::now() + ns};
+  }
+  // For periodic work without drift: advance the deadline by the period.
+  SleepAwaiter sleep_until(Clock::time_point deadline) {
+    return SleepAwaiter{this, deadline};
   }
 
-  void spawn(task t);
+  size_t pending_timers() const { return timers_.size(); }
 
+  // Starts the task at once on this thread; in a runtime it is queued on
+  // the calling worker (or this one, from outside) and may be stolen.
+  void spawn(task<> t);
+
+  // Returns when every task has finished. For a worker, runs the whole
+  // runtime.
   void run();
 
+  // The runtime this reactor is a worker of, or nullptr.
+  Runtime *runtime() const { return runtime_; }
+
 private:
-  // Friend whole task to allow promise_type access
-  friend struct task;
+  // Spawned tasks report to their reactor when they finish
+  friend struct detail::promise_base;
+  friend class Runtime;
+
+  explicit Reactor(Runtime *runtime);
 
   int epfd_{-1};
   int active_tasks_{0};
 
-  struct Waiters {
-    std::vector<std::coroutine_handle<>> rd;
-    std::vector<std::coroutine_handle<>> wr;
-    uint32_t mask{0};
-    bool is_timer{false};
+  // Worker state; shared with other threads only through the run queue.
+  Runtime *runtime_{nullptr};
+  int wake_fd_{-1}; // eventfd that interrupts epoll_wait
+  std::mutex ready_mutex_;
+  std::deque<std::coroutine_handle<>> ready_;
+  std::atomic<bool> sleeping_{false};
+  static inline thread_local Reactor *current_{nullptr};
+
+  // Indexed by fd. `armed` is the interest enabled in the kernel; a
+  // one-shot registration drops to 0 when it fires but stays in the epoll
+  // set, so the next wait re-arms it with a MOD.
+  struct FdState {
+    std::coroutine_handle<> rd;
+    std::coroutine_handle<> wr;
+    uint32_t armed{0};
+    bool registered{false};
+    bool watched{false};
+    bool readable{false}; // watched only: edges nobody waited for
+    bool writable{false};
+  };
+  std::vector<FdState> fds_;
+  uint64_t ctl_calls_{0};
+
+  // Ties break by insertion order, so equal deadlines fire FIFO.
+  struct Timer {
+    Clock::time_point deadline;
+    uint64_t seq;
+    std::coroutine_handle<> h;
+    bool operator>(const Timer &o) const {
+      return deadline != o.deadline ? deadline > o.deadline : seq > o.seq;
+    }
   };
-  std::unordered_map<int, Waiters> fds_;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+  uint64_t timer_seq_{0};
+  std::vector<std::coroutine_handle<>> due_;
 
-  void ctl_add_or_mod(int fd, uint32_t newmask);
-  void add_waiter(int fd, uint32_t edge, std::coroutine_handle<> h,
-                  bool is_timer = false);
-  std::vector<std::coroutine_handle<>> take_waiters(int fd, uint32_t edge);
+  FdState &fd_state(int fd);
+  void ctl(int fd, uint32_t events);
+  bool add_waiter(int fd, uint32_t edge, std::coroutine_handle<> h);
+  void dispatch(int fd, uint32_t flags);
+  void add_timer(Clock::time_point deadline, std::coroutine_handle<> h);
+  int next_timeout_ms() const;
+  void fire_timers();
+
+  Reactor *local();
+  void task_finished();
+  void ready(std::coroutine_handle<> h);
+  void post(std::coroutine_handle<> h);
+  void wake();
+  bool has_ready();
+  size_t run_ready(size_t limit);
+  bool steal();
+  void poll(std::vector<epoll_event> &evs, int timeout);
+  void run_worker();
 };
 
-inline void Reactor::ctl_add_or_mod(int fd, uint32_t newmask) {
+// N worker threads, each with its own Reactor: an epoll, a timer heap and a
+// run queue. A worker that runs out of ready coroutines steals half of a
+// busy sibling's queue, so connections accepted on one worker spread over
+// all of them. Coroutines may resume on a different thread after any
+// co_await, so state they share needs the usual locking.
+class Runtime {
+public:
+  explicit Runtime(size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+    for (size_t i = 0; i < std::max<size_t>(1, threads); ++i)
+      workers_.emplace_back(new Reactor(this));
+  }
+
+  size_t size() const { return workers_.size(); }
+  Reactor &reactor(size_t i) { return *workers_[i]; }
+
+  // Queues on the workers in turn.
+  void spawn(task<> t) { spawn_on(next_++ % workers_.size(), std::move(t)); }
+
+  // Affinity hint: the task starts on `worker`, and only moves if another
+  // worker goes idle while it waits in the queue.
+  void spawn_on(size_t worker, task<> t);
+
+  // Runs the workers, one on the calling thread, until every task finished.
+  void run();
+
+private:
+  friend struct Reactor;
+
+  // Wakes one sleeping worker other than `busy`, to steal from it.
+  void wake_idle(const Reactor *busy) {
+    for (auto &w : workers_)
+      if (w.get() != busy && w->sleeping_.exchange(false)) {
+        w->wake();
+        return;
+      }
+  }
+
+  std::vector<std::unique_ptr<Reactor>> workers_;
+  std::atomic<int> active_{0};
+  std::atomic<size_t> next_{0};
+};
+
+inline Reactor::Reactor(Runtime *runtime) : Reactor() {
+  runtime_ = runtime;
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event ev{};
+  ev.data.fd = wake_fd_;
+  ev.events = EPOLLIN;
+  if (wake_fd_ < 0 || ::epoll_ctl(epfd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0)
+    throw std::runtime_error("reactor wakeup eventfd failed");
+}
+
+// Waits belong to the worker running the coroutine; off the runtime's
+// threads (or without one) to this reactor.
+inline Reactor *Reactor::local() {
+  return runtime_ && current_ && current_->runtime_ == runtime_ ? current_
+                                                                : this;
+}
+
+inline Reactor::FdState &Reactor::fd_state(int fd) {
+  if (fd < 0)
+    throw std::runtime_error("waiting on an invalid fd");
+  if (static_cast<size_t>(fd) >= fds_.size())
+    fds_.resize(std::max<size_t>(fd + 1, fds_.size() * 2));
+  return fds_[fd];
+}
+
+// Registers `fd` with `events`. The table can be stale after the fd was
+// closed (epoll dropped it) or reused, so ADD and MOD fall back to each
+// other.
+inline void Reactor::ctl(int fd, uint32_t events) {
+  auto &st = fds_[fd];
   epoll_event ev{};
   ev.data.fd = fd;
-  ev.events = newmask;
-  if (fds_[fd].mask == 0) {
-    if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0)
-      throw std::runtime_error("epoll_ctl ADD failed");
+  ev.events = events;
+  int op = st.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  ++ctl_calls_;
+  if (::epoll_ctl(epfd_, op, fd, &ev) < 0) {
+    if (errno != (op == EPOLL_CTL_MOD ? ENOENT : EEXIST))
+      throw std::runtime_error("epoll_ctl failed");
+    op = op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    ++ctl_calls_;
+    if (::epoll_ctl(epfd_, op, fd, &ev) < 0)
+      throw std::runtime_error("epoll_ctl failed");
+  }
+  st.registered = true;
+}
+
+// False if a watched fd already saw the edge, so the caller goes on.
+inline bool Reactor::add_waiter(int fd, uint32_t edge,
+                                std::coroutine_handle<> h) {
+  auto &st = fd_state(fd);
+  bool &latched = edge == EPOLLIN ? st.readable : st.writable;
+  if (latched) {
+    latched = false;
+    return false;
+  }
+  auto &slot = edge == EPOLLIN ? st.rd : st.wr;
+  if (slot)
+    throw std::runtime_error("fd already has a waiter in that direction");
+  slot = h;
+  if (!st.watched && !(st.armed & edge)) {
+    st.armed |= edge;
+    ctl(fd, st.armed | EPOLLONESHOT);
+  }
+  return true;
+}
+
+inline bool Reactor::watch(int fd) {
+  if (runtime_ && runtime_->size() > 1)
+    return false;
+  auto &st = fd_state(fd);
+  if (!st.watched) {
+    st.watched = true;
+    ctl(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+  }
+  return true;
+}
+
+inline void Reactor::unwatch(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= fds_.size() || !fds_[fd].watched)
+    return;
+  ++ctl_calls_;
+  (void)::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+  fds_[fd] = FdState{};
+}
+
+// Resumes (or queues) the waiters an event is for. A one-shot
+// registration is disabled now; it is re-armed only for a waiter left in
+// the other direction.
+inline void Reactor::dispatch(int fd, uint32_t flags) {
+  if (static_cast<size_t>(fd) >= fds_.size())
+    return;
+  auto &st = fds_[fd];
+  bool failed = flags & (EPOLLERR | EPOLLHUP | EPOLLRDHUP);
+  bool in = failed || (flags & EPOLLIN);
+  bool out = failed || (flags & EPOLLOUT);
+  auto rd = in ? std::exchange(st.rd, {}) : std::coroutine_handle<>{};
+  auto wr = out ? std::exchange(st.wr, {}) : std::coroutine_handle<>{};
+  if (st.watched) {
+    st.readable |= in && !rd;
+    st.writable |= out && !wr;
   } else {
-    if (::epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) < 0)
-      throw std::runtime_error("epoll_ctl MOD failed");
-  }
-  fds_[fd].mask = newmask;
-}
-
-inline void Reactor::add_waiter(int fd, uint32_t edge,
-                                std::coroutine_handle<> h, bool is_timer) {
-  auto &w = fds_[fd];
-  w.is_timer = w.is_timer || is_timer;
-  if (edge & EPOLLIN)
-    w.rd.push_back(h);
-  if (edge & EPOLLOUT)
-    w.wr.push_back(h);
-  uint32_t want = w.mask | edge;
-  ctl_add_or_mod(fd, want);
-}
-
-inline std::vector<std::coroutine_handle<>>
-Reactor::take_waiters(int fd, uint32_t edge) {
-  std::vector<std::coroutine_handle<>> out;
-  auto it = fds_.find(fd);
-  if (it == fds_.end())
-    return out;
-  auto &w = it->second;
-  if (edge & EPOLLIN) {
-    out.insert(out.end(), w.rd.begin(), w.rd.end());
-    w.rd.clear();
-  }
-  if (edge & EPOLLOUT) {
-    out.insert(out.end(), w.wr.begin(), w.wr.end());
-    w.wr.clear();
-  }
-  uint32_t newmask = 0;
-  if (!w.rd.empty())
-    newmask |= EPOLLIN;
-  if (!w.wr.empty())
-    newmask |= EPOLLOUT;
-  if (newmask != w.mask) {
-    if (newmask == 0) {
-      (void)::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
-      fds_.erase(it);
-    } else {
-      ctl_add_or_mod(fd, newmask);
+    st.armed = (st.rd ? uint32_t{EPOLLIN} : 0u) |
+               (st.wr ? uint32_t{EPOLLOUT} : 0u);
+    if (st.armed)
+      ctl(fd, st.armed | EPOLLONESHOT);
+  }
+  ready(rd);
+  ready(wr);
+}
+
+inline void Reactor::add_timer(Clock::time_point deadline,
+                               std::coroutine_handle<> h) {
+  timers_.push(Timer{deadline, timer_seq_++, h});
+}
+
+// epoll_wait counts whole milliseconds; round up so no timer fires early.
+inline int Reactor::next_timeout_ms() const {
+  if (timers_.empty())
+    return -1;
+  auto left = timers_.top().deadline - Clock::now();
+  if (left <= Clock::duration::zero())
+    return 0;
+  auto ms = std::chrono::ceil<std::chrono::milliseconds>(left).count();
+  return static_cast<int>(std::min<long long>(ms, INT_MAX));
+}
+
+// Resumes every timer due now. Timers the resumed coroutines add wait for
+// the next pass, so a loop of zero-length sleeps cannot starve the fds.
+inline void Reactor::fire_timers() {
+  if (timers_.empty())
+    return;
+  auto now = Clock::now();
+  due_.clear();
+  while (!timers_.empty() && timers_.top().deadline <= now) {
+    due_.push_back(timers_.top().h);
+    timers_.pop();
+  }
+  for (size_t i = 0; i < due_.size(); ++i)
+    ready(due_[i]);
+}
+
+inline void Reactor::task_finished() {
+  if (!runtime_) {
+    --active_tasks_;
+    return;
+  }
+  // The last task out wakes every worker so they all return
+  if (--runtime_->active_ == 0)
+    for (auto &w : runtime_->workers_)
+      w->wake();
+}
+
+// A coroutine that can continue: resumed now, or queued on a worker.
+inline void Reactor::ready(std::coroutine_handle<> h) {
+  if (!h || h.done())
+    return;
+  if (!runtime_) {
+    h.resume();
+    return;
+  }
+  size_t queued;
+  {
+    std::lock_guard<std::mutex> lock(ready_mutex_);
+    ready_.push_back(h);
+    queued = ready_.size();
+  }
+  if (queued > 1)
+    runtime_->wake_idle(this);
+}
+
+// ready() from any thread.
+inline void Reactor::post(std::coroutine_handle<> h) {
+  ready(h);
+  if (sleeping_.exchange(false))
+    wake();
+}
+
+inline void Reactor::wake() {
+  uint64_t one = 1;
+  (void)::write(wake_fd_, &one, sizeof(one));
+}
+
+inline bool Reactor::has_ready() {
+  std::lock_guard<std::mutex> lock(ready_mutex_);
+  return !ready_.empty();
+}
+
+inline size_t Reactor::run_ready(size_t limit) {
+  size_t ran = 0;
+  for (; ran < limit; ++ran) {
+    std::coroutine_handle<> h;
+    {
+      std::lock_guard<std::mutex> lock(ready_mutex_);
+      if (ready_.empty())
+        break;
+      h = ready_.front();
+      ready_.pop_front();
     }
+    if (!h.done())
+      h.resume();
   }
-  return out;
+  return ran;
 }
 
-inline void Reactor::spawn(task t) {
+// Takes the newer half of the first sibling queue with work in it, trying
+// the siblings after this one first so thieves spread over the victims.
+inline bool Reactor::steal() {
+  auto &workers = runtime_->workers_;
+  size_t self = 0;
+  while (workers[self].get() != this)
+    ++self;
+  std::vector<std::coroutine_handle<>> loot;
+  for (size_t i = 1; i < workers.size() && loot.empty(); ++i) {
+    Reactor &victim = *workers[(self + i) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.ready_mutex_);
+    size_t take = (victim.ready_.size() + 1) / 2;
+    loot.assign(victim.ready_.end() - take, victim.ready_.end());
+    victim.ready_.resize(victim.ready_.size() - take);
+  }
+  if (loot.empty())
+    return false;
+  std::lock_guard<std::mutex> lock(ready_mutex_);
+  ready_.insert(ready_.end(), loot.begin(), loot.end());
+  return true;
+}
+
+inline void Reactor::spawn(task<> t) {
   if (!t.h)
     return;
-  t.h.promise().reactor = this;
-  ++active_tasks_;
-  t.h.resume();
+  // The reactor owns the frame from here on; final_suspend destroys it.
+  auto h = std::exchange(t.h, {});
+  h.promise().reactor = this;
+  if (!runtime_) {
+    ++active_tasks_;
+    h.resume();
+    return;
+  }
+  ++runtime_->active_;
+  local()->post(h);
+}
+
+inline void Reactor::poll(std::vector<epoll_event> &evs, int timeout) {
+  int n = ::epoll_wait(epfd_, evs.data(), static_cast<int>(evs.size()),
+                       timeout);
+  if (n < 0) {
+    if (errno == EINTR)
+      return;
+    throw std::runtime_error("epoll_wait failed");
+  }
+  for (int i = 0; i < n; ++i) {
+    int fd = evs[i].data.fd;
+    uint32_t flags = evs[i].events;
+    if (fd == wake_fd_) {
+      uint64_t count;
+      (void)::read(wake_fd_, &count, sizeof(count));
+      continue;
+    }
+    dispatch(fd, flags);
+  }
 }
 
 inline void Reactor::run() {
+  if (runtime_) {
+    runtime_->run();
+    return;
+  }
   std::vector<epoll_event> evs(32);
   while (active_tasks_ > 0) {
-    int n = ::epoll_wait(epfd_, evs.data(), static_cast<int>(evs.size()), -1);
-    if (n < 0) {
-      if (errno == EINTR)
-        continue;
-      throw std::runtime_error("epoll_wait failed");
+    poll(evs, next_timeout_ms());
+    fire_timers();
+  }
+}
+
+// A worker runs a batch of ready coroutines between polls so descriptors
+// and timers keep being served. Before blocking in epoll_wait it publishes
+// `sleeping_` and looks for work once more: a poster either sees the flag
+// and wakes it, or posted before that last look.
+inline void Reactor::run_worker() {
+  constexpr size_t READY_BATCH = 64;
+  current_ = this;
+  std::vector<epoll_event> evs(32);
+  while (runtime_->active_ > 0) {
+    int timeout = 0;
+    if (run_ready(READY_BATCH) == 0 && !steal()) {
+      sleeping_ = true;
+      if (has_ready() || steal() || runtime_->active_ == 0)
+        sleeping_ = false;
+      else
+        timeout = next_timeout_ms();
     }
-    for (int i = 0; i < n; ++i) {
-      int fd = evs[i].data.fd;
-      uint32_t flags = evs[i].events;
-      if (flags & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
-        auto rw = take_waiters(fd, EPOLLIN | EPOLLOUT);
-        for (auto h : rw)
-          if (h && !h.done())
-            h.resume();
-        continue;
-      }
-      if (flags & EPOLLIN) {
-        auto readers = take_waiters(fd, EPOLLIN);
-        for (auto h : readers)
-          if (h && !h.done())
-            h.resume();
-      }
-      if (flags & EPOLLOUT) {
-        auto writers = take_waiters(fd, EPOLLOUT);
-        for (auto h : writers)
-          if (h && !h.done())
-            h.resume();
+    poll(evs, timeout);
+    sleeping_ = false;
+    fire_timers();
+  }
+  current_ = nullptr;
+}
+
+inline void Runtime::spawn_on(size_t worker, task<> t) {
+  if (!t.h)
+    return;
+  Reactor &r = *workers_[worker % workers_.size()];
+  auto h = std::exchange(t.h, {});
+  h.promise().reactor = &r;
+  ++active_;
+  r.post(h);
+}
+
+inline void Runtime::run() {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers_.size(); ++i)
+    threads.emplace_back([this, i] { workers_[i]->run_worker(); });
+  workers_[0]->run_worker();
+  for (auto &t : threads)
+    t.join();
+}
+
+namespace detail {
+
+// Resumes the parent once its own share and every task's have arrived;
+// whoever arrives last does it.
+struct join_counter {
+  std::atomic<size_t> left{0};
+  std::coroutine_handle<> parent;
+  bool arrive() { return left.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+};
+
+// Awaits one task of a when_all, then arrives at the counter.
+struct join_task {
+  struct promise_type {
+    join_counter *counter{nullptr};
+
+    static void *operator new(size_t n) { return FramePool::allocate(n); }
+    static void operator delete(void *p, size_t n) noexcept {
+      FramePool::deallocate(p, n);
+    }
+
+    join_task get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct final_awaitable {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        auto *c = h.promise().counter;
+        return c->arrive() ? c->parent : std::noop_coroutine();
       }
+      void await_resume() noexcept {}
+    };
+    final_awaitable final_suspend() noexcept { return {}; }
+    void unhandled_exception() { std::terminate(); }
+    void return_void() {}
+  };
+
+  std::coroutine_handle<promise_type> h;
+
+  join_task(std::coroutine_handle<promise_type> h_) : h(h_) {}
+  join_task(join_task &&o) noexcept : h(std::exchange(o.h, {})) {}
+  ~join_task() {
+    if (h)
+      h.destroy();
+  }
+};
+
+template <typename T> join_task join_one(task<T> &t) {
+  co_await t.completion();
+}
+
+// Starts every task in turn, each running until it first suspends, then
+// waits for the last of them.
+template <typename T> struct join_all {
+  std::vector<join_task> joins;
+  join_counter counter;
+
+  explicit join_all(std::vector<task<T>> &tasks) {
+    joins.reserve(tasks.size());
+    for (auto &t : tasks)
+      joins.push_back(join_one(t));
+  }
+
+  bool await_ready() const noexcept { return joins.empty(); }
+  bool await_suspend(std::coroutine_handle<> parent) {
+    counter.parent = parent;
+    counter.left = joins.size() + 1;
+    for (auto &j : joins) {
+      j.h.promise().counter = &counter;
+      j.h.resume();
     }
+    return !counter.arrive();
   }
+  void await_resume() const noexcept {}
+};
+
+// Shared by a when_any and its racers. The parent holds one share of
+// `left` and the winner the other; the second to let go resumes the parent.
+template <typename T> struct race_state {
+  std::atomic<size_t> left{2};
+  std::atomic<bool> decided{false};
+  std::coroutine_handle<> parent;
+  size_t index{0};
+  std::optional<task<T>> winner; // finished, holding its value or exception
+};
+
+// Hands over to `next` once the running spawned task has finished.
+struct continue_with {
+  std::coroutine_handle<> next;
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<promise<void>> self) noexcept {
+    self.promise().continuation = next;
+    return false;
+  }
+  void await_resume() const noexcept {}
+};
+
+template <typename T>
+task<> race_one(std::shared_ptr<race_state<T>> state, task<T> t, size_t i) {
+  co_await t.completion();
+  if (state->decided.exchange(true))
+    co_return; // lost: the result is dropped
+  state->index = i;
+  state->winner.emplace(std::move(t));
+  if (state->left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    co_await continue_with{state->parent};
+}
+
+template <typename T> struct race {
+  Reactor &r;
+  std::vector<task<T>> &tasks;
+  std::shared_ptr<race_state<T>> state = std::make_shared<race_state<T>>();
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> parent) {
+    state->parent = parent;
+    for (size_t i = 0; i < tasks.size(); ++i)
+      r.spawn(race_one(state, std::move(tasks[i]), i));
+    return state->left.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+  size_t await_resume() const noexcept { return state->index; }
+};
+
+} // namespace detail
+
+// Runs the tasks concurrently and returns their values in order once all
+// have finished; rethrows the first failure in order, after every task
+// finished. Needs no reactor: each task resumes the next step itself.
+template <typename T>
+  requires(!std::is_void_v<T>)
+task<std::vector<T>> when_all(std::vector<task<T>> tasks) {
+  co_await detail::join_all<T>(tasks);
+  std::vector<T> values;
+  values.reserve(tasks.size());
+  for (auto &t : tasks)
+    values.push_back(t.h.promise().result());
+  co_return values;
+}
+
+inline task<> when_all(std::vector<task<>> tasks) {
+  co_await detail::join_all<void>(tasks);
+  for (auto &t : tasks)
+    t.h.promise().result();
+}
+
+// Runs the tasks concurrently and returns as soon as one of them finishes,
+// with its index and value (or rethrowing its exception). The others go
+// on as tasks spawned on `r` and their results are dropped, so anything
+// they use must outlive them.
+template <typename T>
+  requires(!std::is_void_v<T>)
+task<std::pair<size_t, T>> when_any(Reactor &r, std::vector<task<T>> tasks) {
+  if (tasks.empty())
+    throw std::runtime_error("when_any of no tasks");
+  detail::race<T> race{r, tasks};
+  size_t index = co_await race;
+  co_return std::pair<size_t, T>(index, race.state->winner->h.promise().result());
+}
+
+inline task<size_t> when_any(Reactor &r, std::vector<task<>> tasks) {
+  if (tasks.empty())
+    throw std::runtime_error("when_any of no tasks");
+  detail::race<void> race{r, tasks};
+  size_t index = co_await race;
+  race.state->winner->h.promise().result();
+  co_return index;
 }
 
 // Coroutine helpers and utilities
@@ -276,7 +933,7 @@ inline int set_nonblock(int fd) {
   return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-inline task async_connect(Reactor &r, int fd, const sockaddr_in &addr) {
+inline task<> async_connect(Reactor &r, int fd, const sockaddr_in &addr) {
   int rc =
       ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
   if (rc == 0)
@@ -292,7 +949,7 @@ inline task async_connect(Reactor &r, int fd, const sockaddr_in &addr) {
   throw std::runtime_error("connect error");
 }
 
-inline task async_send_all(Reactor &r, int fd, const uint8_t *data,
+inline task<> async_send_all(Reactor &r, int fd, const uint8_t *data,
                            size_t len) {
   size_t off = 0;
   while (off < len) {
@@ -308,7 +965,7 @@ inline task async_send_all(Reactor &r, int fd, const uint8_t *data,
   co_return;
 }
 
-inline task async_read_exact(Reactor &r, int fd, uint8_t *buf, size_t total) {
+inline task<> async_read_exact(Reactor &r, int fd, uint8_t *buf, size_t total) {
   size_t off = 0;
   while (off < total) {
     ssize_t n = ::recv(fd, buf + off, total - off, 0);
@@ -325,14 +982,27 @@ inline task async_read_exact(Reactor &r, int fd, uint8_t *buf, size_t total) {
   co_return;
 }
 
+// Every framed message on the wire is [u32 big-endian body length][body].
+constexpr size_t FRAME_PREFIX_SIZE = 4;
+
+inline void put_frame_length(uint8_t *out, uint32_t body_len) {
+  uint32_t be = htonl(body_len);
+  memcpy(out, &be, FRAME_PREFIX_SIZE);
+}
+
+inline uint32_t get_frame_length(const uint8_t *in) {
+  uint32_t be;
+  memcpy(&be, in, FRAME_PREFIX_SIZE);
+  return ntohl(be);
+}
+
 inline std::vector<uint8_t> build_frame(const heart_beat::v1::HeartBeat &hb) {
   std::string payload;
   if (!hb.SerializeToString(&payload))
     throw std::runtime_error("Failed to serialize heartbeat");
-  uint32_t be = htonl(static_cast<uint32_t>(payload.size()));
-  std::vector<uint8_t> frame(4 + payload.size());
-  memcpy(frame.data(), &be, 4);
-  memcpy(frame.data() + 4, payload.data(), payload.size());
+  std::vector<uint8_t> frame(FRAME_PREFIX_SIZE + payload.size());
+  put_frame_length(frame.data(), static_cast<uint32_t>(payload.size()));
+  memcpy(frame.data() + FRAME_PREFIX_SIZE, payload.data(), payload.size());
   return frame;
 }
 
@@ -350,7 +1020,7 @@ inline bool resolve_ipv4(const std::string &host, uint16_t port,
   return true;
 }
 
-inline task send_heartbeats(Reactor &r, int sfd, int server_id) {
+inline task<> send_heartbeats(Reactor &r, int sfd, int server_id) {
   heart_beat::v1::HeartBeat hb;
   hb.set_server_id(server_id);
   while (true) {
@@ -362,16 +1032,14 @@ inline task send_heartbeats(Reactor &r, int sfd, int server_id) {
   }
 }
 
-inline task
+inline task<>
 recv_heartbeats(Reactor &r, int sfd,
                 std::function<void(const heart_beat::v1::HeartBeat &)> on_msg) {
   std::vector<uint8_t> buf;
-  uint8_t sz[4];
+  uint8_t sz[FRAME_PREFIX_SIZE];
   while (true) {
-    co_await async_read_exact(r, sfd, sz, 4);
-    uint32_t be_len;
-    memcpy(&be_len, sz, 4);
-    uint32_t body_len = ntohl(be_len);
+    co_await async_read_exact(r, sfd, sz, FRAME_PREFIX_SIZE);
+    uint32_t body_len = get_frame_length(sz);
     buf.resize(body_len);
     if (body_len > 0)
       co_await async_read_exact(r, sfd, buf.data(), buf.size());
@@ -444,7 +1112,7 @@ inline int recieve_signal(int port = 9000) {
 
     Reactor r;
 
-    auto accept_and_recv = [&]() -> task {
+    auto accept_and_recv = [&]() -> task<> {
       int cfd = -1;
       while (true) {
         sockaddr_in peer{};
@@ -478,14 +1146,16 @@ inline int recieve_signal(int port = 9000) {
   }
 }
 
-// Implementation of final_awaitable::await_suspend after Reactor is fully defined
-inline void task::promise_type::final_awaitable::await_suspend(
-    std::coroutine_handle<promise_type> h) noexcept {
-  auto &p = h.promise();
-  if (p.reactor) {
-    --p.reactor->active_tasks_;
+// Defined after Reactor is complete. A spawned task frees its own frame;
+// it can still hand over to a continuation (see when_any).
+inline std::coroutine_handle<>
+detail::promise_base::finish(std::coroutine_handle<> self) noexcept {
+  auto next = continuation ? continuation : std::noop_coroutine();
+  if (reactor) {
+    reactor->task_finished();
+    self.destroy();
   }
-  h.destroy();
+  return next;
 }
 
 } // namespace async_hb
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DFG_SHA256_X86 1
+#endif
+
+// SHA-256 for content-addressed chunk ids, with a block kernel picked at
+// runtime:
+//
+//   Portable plain FIPS 180-4 rounds
+//   ShaNi    the x86 SHA extensions (sha256rnds2/msg1/msg2)
+//
+// Chunks are named by their digest, so two uploads of the same bytes land
+// on the same id whichever kernel hashed them.
+namespace sha256 {
+
+enum class Kernel { Portable, ShaNi };
+
+using Digest = std::array<uint8_t, 32>;
+
+namespace detail {
+
+alignas(16) constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+// Compresses `blocks` 64-byte blocks into `state`.
+using Fn = void (*)(uint32_t *state, const uint8_t *data, size_t blocks);
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline void compress_portable(uint32_t *state, const uint8_t *data,
+                              size_t blocks) {
+  for (; blocks--; data += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+      w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16 |
+             uint32_t(data[4 * i + 2]) << 8 | data[4 * i + 3];
+    for (int i = 16; i < 64; ++i) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+                    ((e & f) ^ (~e & g)) + K[i] + w[i];
+      uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) +
+                    ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef DFG_SHA256_X86
+
+// The SHA extensions keep the state as ABEF/CDGH halves and run two rounds
+// per sha256rnds2; msg1/msg2 extend the message schedule four words at a
+// time, so the 16 groups of four rounds below rotate through msg[0..3].
+__attribute__((target("sha,sse4.1,ssse3"))) inline void
+compress_shani(uint32_t *state, const uint8_t *data, size_t blocks) {
+  const __m128i BSWAP =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i tmp = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0xB1);
+  __m128i state1 = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4)), 0x1B);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);      // CDGH
+
+  for (; blocks--; data += 64) {
+    const __m128i abef = state0, cdgh = state1;
+    __m128i msg[4];
+    for (int i = 0; i < 16; ++i) {
+      __m128i &cur = msg[i & 3];
+      if (i < 4)
+        cur = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * i)),
+            BSWAP);
+      __m128i wk = _mm_add_epi32(
+          cur, _mm_load_si128(reinterpret_cast<const __m128i *>(K + 4 * i)));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+      if (i >= 3 && i < 15) {
+        __m128i &next = msg[(i + 1) & 3];
+        next = _mm_add_epi32(next, _mm_alignr_epi8(cur, msg[(i + 3) & 3], 4));
+        next = _mm_sha256msg2_epu32(next, cur);
+      }
+      state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                     _mm_shuffle_epi32(wk, 0x0E));
+      if (i >= 1 && i < 13)
+        msg[(i + 3) & 3] = _mm_sha256msg1_epu32(msg[(i + 3) & 3], cur);
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+  state1 = _mm_alignr_epi8(state1, tmp, 8);     // HGFE
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), state1);
+}
+
+#endif // DFG_SHA256_X86
+
+} // namespace detail
+
+inline bool kernel_supported(Kernel k) {
+  if (k == Kernel::Portable)
+    return true;
+#ifdef DFG_SHA256_X86
+  return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+#else
+  return false;
+#endif
+}
+
+inline const char *kernel_name(Kernel k) {
+  switch (k) {
+  case Kernel::Portable:
+    return "portable";
+  case Kernel::ShaNi:
+    return "sha-ni";
+  }
+  return "unknown";
+}
+
+inline detail::Fn kernel_fn(Kernel k) {
+#ifdef DFG_SHA256_X86
+  if (k == Kernel::ShaNi)
+    return detail::compress_shani;
+#endif
+  (void)k;
+  return detail::compress_portable;
+}
+
+// Fastest kernel this CPU supports; chosen once per process.
+inline Kernel active_kernel() {
+  static const Kernel k =
+      kernel_supported(Kernel::ShaNi) ? Kernel::ShaNi : Kernel::Portable;
+  return k;
+}
+
+// Incremental hash over data arriving in arbitrary pieces.
+class Hasher {
+public:
+  explicit Hasher(Kernel kernel = active_kernel()) : fn_(kernel_fn(kernel)) {}
+
+  void update(const void *data, size_t len) {
+    auto p = static_cast<const uint8_t *>(data);
+    total_ += len;
+    if (buffered_ > 0) {
+      size_t take = std::min(len, sizeof(buf_) - buffered_);
+      std::memcpy(buf_ + buffered_, p, take);
+      buffered_ += take;
+      p += take;
+      len -= take;
+      if (buffered_ < sizeof(buf_))
+        return;
+      fn_(state_, buf_, 1);
+      buffered_ = 0;
+    }
+    fn_(state_, p, len / 64);
+    p += len / 64 * 64;
+    buffered_ = len % 64;
+    std::memcpy(buf_, p, buffered_);
+  }
+
+  Digest finish() {
+    uint64_t bits = total_ * 8;
+    uint8_t pad[72] = {0x80};
+    size_t pad_len = (buffered_ < 56 ? 56 : 120) - buffered_;
+    for (int i = 0; i < 8; ++i)
+      pad[pad_len + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+    update(pad, pad_len + 8);
+    Digest out;
+    for (int i = 0; i < 8; ++i)
+      for (int j = 0; j < 4; ++j)
+        out[4 * i + j] = static_cast<uint8_t>(state_[i] >> (24 - 8 * j));
+    return out;
+  }
+
+private:
+  detail::Fn fn_;
+  uint32_t state_[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  uint8_t buf_[64];
+  size_t buffered_{0};
+  uint64_t total_{0};
+};
+
+inline Digest hash(const void *data, size_t len) {
+  Hasher h;
+  h.update(data, len);
+  return h.finish();
+}
+
+inline std::string to_hex(const Digest &d) {
+  static const char digits[] = "0123456789abcdef";
+  std::string out(64, '0');
+  for (size_t i = 0; i < d.size(); ++i) {
+    out[2 * i] = digits[d[i] >> 4];
+    out[2 * i + 1] = digits[d[i] & 0xf];
+  }
+  return out;
+}
+
+} // namespace sha256
@@ -0,0 +1,406 @@
+#pragma once
+#include "heart_beat_signal.hpp"
+
+#include <linux/io_uring.h>
+// Pulled in with <linux/fs.h>; would clash with checksum::BLOCK_SIZE.
+#undef BLOCK_SIZE
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace async_hb {
+
+// io_uring driven by a Reactor, so file I/O shares the event loop with the
+// sockets. The kernel signals completions on an eventfd, which a reaper
+// coroutine waits on like any other descriptor; nothing blocks and no worker
+// thread is involved. Talks to the kernel through the raw syscalls.
+//
+// Submissions are batched: operations queued while completions are being
+// dispatched reach the kernel together, in one io_uring_enter() after the
+// batch. Only the reactor's thread may use a Uring, and it must outlive the
+// reactor's run() (which keeps going while operations are in flight).
+class Uring {
+  struct Slot {
+    int result{0};
+    bool done{true};
+    bool orphaned{false};
+    std::coroutine_handle<> waiter;
+  };
+
+public:
+  // A submitted read or write. co_await it for the bytes transferred or a
+  // negative errno. Its buffer must not be reused until it completes;
+  // dropping an Op early only stops the completion from resuming anyone.
+  class Op {
+  public:
+    Op() = default;
+    Op(Op &&o) noexcept
+        : ring_(std::exchange(o.ring_, nullptr)), slot_(o.slot_),
+          result_(o.result_) {}
+    Op &operator=(Op &&o) noexcept {
+      if (this != &o) {
+        reset();
+        ring_ = std::exchange(o.ring_, nullptr);
+        slot_ = o.slot_;
+        result_ = o.result_;
+      }
+      return *this;
+    }
+    ~Op() { reset(); }
+
+    bool pending() const { return ring_ && !ring_->slots_[slot_].done; }
+
+    bool await_ready() const noexcept { return !pending(); }
+    void await_suspend(std::coroutine_handle<> h) noexcept {
+      ring_->slots_[slot_].waiter = h;
+    }
+    int await_resume() const noexcept {
+      return ring_ ? ring_->slots_[slot_].result : result_;
+    }
+
+  private:
+    friend class Uring;
+
+    explicit Op(int result) : result_(result) {}
+    Op(Uring *ring, uint32_t slot) : ring_(ring), slot_(slot) {}
+
+    void reset() {
+      if (!ring_)
+        return;
+      if (ring_->slots_[slot_].done)
+        ring_->release_slot(slot_);
+      else
+        ring_->slots_[slot_].orphaned = true;
+      ring_ = nullptr;
+    }
+
+    Uring *ring_{nullptr};
+    uint32_t slot_{0};
+    int result_{-ECANCELED};
+  };
+
+  // One of the ring's page-aligned buffers, registered with the kernel when
+  // it allows. Goes back to the ring on destruction.
+  class Buffer {
+  public:
+    Buffer() = default;
+    Buffer(Buffer &&o) noexcept
+        : ring_(std::exchange(o.ring_, nullptr)), index_(o.index_) {}
+    Buffer &operator=(Buffer &&o) noexcept {
+      if (this != &o) {
+        reset();
+        ring_ = std::exchange(o.ring_, nullptr);
+        index_ = o.index_;
+      }
+      return *this;
+    }
+    ~Buffer() { reset(); }
+
+    char *data() const { return ring_->buffer_data(index_); }
+    size_t size() const { return ring_ ? ring_->buffer_size_ : 0; }
+    explicit operator bool() const { return ring_ != nullptr; }
+
+  private:
+    friend class Uring;
+
+    Buffer(Uring *ring, int index) : ring_(ring), index_(index) {}
+
+    void reset() {
+      if (ring_)
+        ring_->free_buffers_.push_back(index_);
+      ring_ = nullptr;
+    }
+
+    Uring *ring_{nullptr};
+    int index_{-1};
+  };
+
+  // `buffer_count` buffers of `buffer_size` bytes (a multiple of 4096) are
+  // set aside for acquire_buffer(). Check ok() before use.
+  Uring(Reactor &reactor, unsigned entries, size_t buffer_count,
+        size_t buffer_size)
+      : reactor_(reactor), buffer_size_(buffer_size) {
+    if (!setup(entries) || !setup_buffers(buffer_count)) {
+      error_ = errno ? errno : EINVAL;
+      teardown();
+    }
+  }
+  ~Uring() { teardown(); }
+
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  bool ok() const { return ring_fd_ >= 0; }
+  // errno of the failed setup, 0 if ok().
+  int error() const { return error_; }
+  // Whether the buffers are registered, so reads and writes skip the
+  // kernel's per-operation page pinning.
+  bool registered_buffers() const { return registered_; }
+
+  // An empty Buffer if all are in use.
+  Buffer acquire_buffer() {
+    if (free_buffers_.empty())
+      return {};
+    int index = free_buffers_.back();
+    free_buffers_.pop_back();
+    return Buffer(this, index);
+  }
+
+  // Reads `len` bytes at `offset` of `fd` into the start of `buf`.
+  Op read(int fd, const Buffer &buf, size_t len, uint64_t offset) {
+    return submit(registered_ ? IORING_OP_READ_FIXED : IORING_OP_READ, fd,
+                  buf, len, offset);
+  }
+
+  // Writes the first `len` bytes of `buf` at `offset` of `fd`.
+  Op write(int fd, const Buffer &buf, size_t len, uint64_t offset) {
+    return submit(registered_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd,
+                  buf, len, offset);
+  }
+
+  // Submissions that have not completed yet.
+  unsigned in_flight() const { return in_flight_; }
+
+private:
+  template <typename T> static T *at(void *base, uint32_t offset) {
+    return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+  }
+
+  bool setup(unsigned entries) {
+    io_uring_params p{};
+    ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+    if (ring_fd_ < 0)
+      return false;
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED)
+      return false;
+    cq_ring_ = single_mmap
+                   ? sq_ring_
+                   : ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd_,
+                            IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED)
+      return false;
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+      return false;
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    sq_entries_ = p.sq_entries;
+    sq_head_ = at<uint32_t>(sq_ring_, p.sq_off.head);
+    sq_tail_ = at<uint32_t>(sq_ring_, p.sq_off.tail);
+    sq_mask_ = *at<uint32_t>(sq_ring_, p.sq_off.ring_mask);
+    sq_array_ = at<uint32_t>(sq_ring_, p.sq_off.array);
+    cq_head_ = at<uint32_t>(cq_ring_, p.cq_off.head);
+    cq_tail_ = at<uint32_t>(cq_ring_, p.cq_off.tail);
+    cq_mask_ = *at<uint32_t>(cq_ring_, p.cq_off.ring_mask);
+    cqes_ = at<io_uring_cqe>(cq_ring_, p.cq_off.cqes);
+    local_tail_ = *sq_tail_;
+
+    // No more operations in flight than the completion ring holds, so it
+    // can never overflow.
+    slots_.resize(p.cq_entries);
+    for (uint32_t i = p.cq_entries; i-- > 0;)
+      free_slots_.push_back(i);
+
+    efd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return efd_ >= 0 && ::syscall(__NR_io_uring_register, ring_fd_,
+                                  IORING_REGISTER_EVENTFD, &efd_, 1) == 0;
+  }
+
+  bool setup_buffers(size_t count) {
+    if (count == 0 || buffer_size_ == 0 || buffer_size_ % 4096 != 0) {
+      errno = EINVAL;
+      return false;
+    }
+    buffers_ = static_cast<char *>(std::aligned_alloc(4096, count * buffer_size_));
+    if (!buffers_) {
+      errno = ENOMEM;
+      return false;
+    }
+    std::vector<iovec> iovs(count);
+    for (size_t i = 0; i < count; ++i) {
+      iovs[i].iov_base = buffers_ + i * buffer_size_;
+      iovs[i].iov_len = buffer_size_;
+      free_buffers_.push_back(static_cast<int>(count - 1 - i));
+    }
+    // Pinning can exceed RLIMIT_MEMLOCK; plain reads and writes still work.
+    registered_ = ::syscall(__NR_io_uring_register, ring_fd_,
+                            IORING_REGISTER_BUFFERS, iovs.data(),
+                            static_cast<unsigned>(count)) == 0;
+    return true;
+  }
+
+  void teardown() {
+    if (sqes_)
+      ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+      ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ && sq_ring_ != MAP_FAILED)
+      ::munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0)
+      ::close(ring_fd_); // also drops the registrations
+    if (efd_ >= 0)
+      ::close(efd_);
+    std::free(buffers_);
+    sqes_ = nullptr;
+    sq_ring_ = cq_ring_ = nullptr;
+    ring_fd_ = efd_ = -1;
+    buffers_ = nullptr;
+  }
+
+  char *buffer_data(int index) const {
+    return buffers_ + static_cast<size_t>(index) * buffer_size_;
+  }
+
+  Op submit(uint8_t opcode, int fd, const Buffer &buf, size_t len,
+            uint64_t offset) {
+    if (free_slots_.empty())
+      return Op(-EBUSY);
+    uint32_t head = std::atomic_ref<uint32_t>(*sq_head_).load(std::memory_order_acquire);
+    if (local_tail_ - head == sq_entries_) {
+      enter();
+      head = std::atomic_ref<uint32_t>(*sq_head_).load(std::memory_order_acquire);
+      if (local_tail_ - head == sq_entries_)
+        return Op(-EBUSY);
+    }
+    uint32_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    slots_[slot] = Slot{0, false, false, {}};
+
+    uint32_t index = local_tail_ & sq_mask_;
+    io_uring_sqe &sqe = sqes_[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.off = offset;
+    sqe.addr = reinterpret_cast<uint64_t>(buf.data());
+    sqe.len = static_cast<uint32_t>(std::min(len, buf.size()));
+    if (opcode == IORING_OP_READ_FIXED || opcode == IORING_OP_WRITE_FIXED)
+      sqe.buf_index = static_cast<uint16_t>(buf.index_);
+    sqe.user_data = slot;
+    sq_array_[index] = index;
+    std::atomic_ref<uint32_t>(*sq_tail_).store(++local_tail_, std::memory_order_release);
+    ++unsubmitted_;
+    ++in_flight_;
+
+    if (!reaping_) {
+      reaping_ = true;
+      reactor_.spawn(reap());
+    }
+    if (!dispatching_)
+      enter();
+    return Op(this, slot);
+  }
+
+  // Hands the queued submissions to the kernel.
+  void enter() {
+    while (unsubmitted_ > 0) {
+      long n = ::syscall(__NR_io_uring_enter, ring_fd_, unsubmitted_, 0, 0,
+                         nullptr, 0);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        // Left queued; the next completion retries them.
+        std::cerr << "io_uring_enter failed: " << std::strerror(errno)
+                  << std::endl;
+        return;
+      }
+      unsubmitted_ -= static_cast<unsigned>(n);
+    }
+  }
+
+  void release_slot(uint32_t slot) { free_slots_.push_back(slot); }
+
+  // Alive while anything is in flight, which also keeps the reactor running.
+  task<> reap() {
+    while (in_flight_ > 0) {
+      co_await reactor_.wait_readable(efd_);
+      uint64_t count = 0;
+      (void)::read(efd_, &count, sizeof(count));
+      complete();
+    }
+    reaping_ = false;
+  }
+
+  void complete() {
+    std::vector<std::coroutine_handle<>> ready;
+    uint32_t head = *cq_head_;
+    uint32_t tail = std::atomic_ref<uint32_t>(*cq_tail_).load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+      uint32_t slot = static_cast<uint32_t>(cqe.user_data);
+      Slot &s = slots_[slot];
+      s.result = cqe.res;
+      s.done = true;
+      --in_flight_;
+      if (s.orphaned)
+        release_slot(slot);
+      else if (s.waiter)
+        ready.push_back(std::exchange(s.waiter, {}));
+    }
+    std::atomic_ref<uint32_t>(*cq_head_).store(head, std::memory_order_release);
+
+    dispatching_ = true;
+    for (auto h : ready)
+      h.resume();
+    dispatching_ = false;
+    enter();
+  }
+
+  Reactor &reactor_;
+  int ring_fd_{-1};
+  int efd_{-1};
+  int error_{0};
+
+  void *sq_ring_{nullptr};
+  void *cq_ring_{nullptr};
+  size_t sq_ring_size_{0};
+  size_t cq_ring_size_{0};
+  io_uring_sqe *sqes_{nullptr};
+  size_t sqes_size_{0};
+  uint32_t sq_entries_{0};
+  uint32_t *sq_head_{nullptr};
+  uint32_t *sq_tail_{nullptr};
+  uint32_t sq_mask_{0};
+  uint32_t *sq_array_{nullptr};
+  uint32_t *cq_head_{nullptr};
+  uint32_t *cq_tail_{nullptr};
+  uint32_t cq_mask_{0};
+  io_uring_cqe *cqes_{nullptr};
+  uint32_t local_tail_{0};
+  unsigned unsubmitted_{0};
+  unsigned in_flight_{0};
+
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_slots_;
+  bool reaping_{false};
+  bool dispatching_{false};
+
+  char *buffers_{nullptr};
+  size_t buffer_size_;
+  std::vector<int> free_buffers_;
+  bool registered_{false};
+};
+
+} // namespace async_hb
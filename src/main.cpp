@@ -1,4 +1,5 @@
 #include "include/version.h"
+#include <cstdio>
 #include <iostream>
 #include <string>
 #include <thread>
@@ -12,8 +13,14 @@ extern "C" {
     int start_health_checker();
     void stop_health_checker();
     int process_file_upload(const char* filepath, const char* filename);
+    int process_file_upload_erasure_coded(const char* filepath, const char* filename, int data_fragments,
+                                          int parity_fragments);
+    int process_file_upload_deduplicated(const char* filepath, const char* filename, int data_fragments,
+                                         int parity_fragments);
     int process_file_download(const char* filename, const char* output_path);
     int check_file_exists(const char* filename);
+    long long process_file_range_read(const char* filename, unsigned long long offset, unsigned long long length,
+                                      const char* output_path);
 }
 
 // Global flag for graceful shutdown
@@ -33,6 +40,7 @@ void print_usage() {
     std::cout << "  health-checker  Start the health monitoring service\n";
     std::cout << "  upload          Upload a file to the distributed storage\n";
     std::cout << "  download        Download a file from the distributed storage\n";
+    std::cout << "  read            Read a byte range of a stored file\n";
     std::cout << "  list            List files in the distributed storage\n";
     std::cout << "  test            Run system tests\n\n";
     std::cout << "Options:\n";
@@ -40,13 +48,18 @@ void print_usage() {
     std::cout << "  -v, --version   Show version information\n";
     std::cout << "  --server-id ID  Set server ID (for cluster-server)\n";
     std::cout << "  --port PORT     Set port number\n";
-    std::cout << "  --ip IP         Set IP address\n\n";
+    std::cout << "  --ip IP         Set IP address\n";
+    std::cout << "  --ec K+M        Upload as K data + M parity Reed-Solomon fragments instead of 3 replicas\n";
+    std::cout << "  --dedup         Upload as content-defined chunks, sending only chunks not stored yet\n\n";
     std::cout << "Examples:\n";
     std::cout << "  ./main head-server\n";
     std::cout << "  ./main cluster-server --server-id 1 --port 8080\n";
     std::cout << "  ./main health-checker\n";
     std::cout << "  ./main upload /path/to/file.txt myfile.txt\n";
+    std::cout << "  ./main upload /path/to/archive.tar archive.tar --ec 4+2\n";
+    std::cout << "  ./main upload /path/to/backup-v2.img backup-v2.img --dedup\n";
     std::cout << "  ./main download myfile.txt /path/to/output.txt\n";
+    std::cout << "  ./main read myfile.txt 1048576 4096 /path/to/range.bin\n";
 }
 
 int run_head_server() {
@@ -73,10 +86,16 @@ int run_health_checker() {
     return start_health_checker();
 }
 
-int upload_file(const std::string& filepath, const std::string& filename) {
+int upload_file(const std::string& filepath, const std::string& filename, int data_fragments = 0,
+                int parity_fragments = 0, bool dedup = false) {
     std::cout << "Uploading file: " << filepath << " as " << filename << std::endl;
     
-    int result = process_file_upload(filepath.c_str(), filename.c_str());
+    int result = dedup ? process_file_upload_deduplicated(filepath.c_str(), filename.c_str(), data_fragments,
+                                                          parity_fragments)
+                 : data_fragments > 0
+                     ? process_file_upload_erasure_coded(filepath.c_str(), filename.c_str(), data_fragments,
+                                                         parity_fragments)
+                     : process_file_upload(filepath.c_str(), filename.c_str());
     if (result == 0) {
         std::cout << "File uploaded successfully!" << std::endl;
     } else {
@@ -105,6 +124,21 @@ int download_file(const std::string& filename, const std::string& output_path) {
     return result;
 }
 
+int read_file_range(const std::string& filename, unsigned long long offset, unsigned long long length,
+                    const std::string& output_path) {
+    std::cout << "Reading " << length << " bytes at offset " << offset << " of " << filename
+              << " to " << output_path << std::endl;
+    
+    long long result = process_file_range_read(filename.c_str(), offset, length, output_path.c_str());
+    if (result < 0) {
+        std::cout << "Range read failed!" << std::endl;
+        return -1;
+    }
+    
+    std::cout << "Read " << result << " bytes" << std::endl;
+    return 0;
+}
+
 int run_tests() {
     std::cout << "Running system tests..." << std::endl;
     
@@ -187,6 +221,9 @@ int main(int argc, char* argv[]) {
     int server_id = 1;
     std::string ip = "127.0.0.1";
     int port = 8080;
+    int data_fragments = 0;
+    int parity_fragments = 0;
+    bool dedup = false;
     
     for (int i = 2; i < argc; i++) {
         std::string arg = argv[i];
@@ -196,6 +233,13 @@ int main(int argc, char* argv[]) {
             ip = argv[++i];
         } else if (arg == "--port" && i + 1 < argc) {
             port = std::stoi(argv[++i]);
+        } else if (arg == "--ec" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%d+%d", &data_fragments, &parity_fragments) != 2) {
+                std::cout << "Expected --ec K+M, e.g. --ec 4+2" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--dedup") {
+            dedup = true;
         }
     }
     
@@ -208,16 +252,22 @@ int main(int argc, char* argv[]) {
             return run_health_checker();
         } else if (command == "upload") {
             if (argc < 4) {
-                std::cout << "Usage: ./main upload <filepath> <filename>" << std::endl;
+                std::cout << "Usage: ./main upload <filepath> <filename> [--ec K+M] [--dedup]" << std::endl;
                 return 1;
             }
-            return upload_file(argv[2], argv[3]);
+            return upload_file(argv[2], argv[3], data_fragments, parity_fragments, dedup);
         } else if (command == "download") {
             if (argc < 4) {
                 std::cout << "Usage: ./main download <filename> <output_path>" << std::endl;
                 return 1;
             }
             return download_file(argv[2], argv[3]);
+        } else if (command == "read") {
+            if (argc < 6) {
+                std::cout << "Usage: ./main read <filename> <offset> <length> <output_path>" << std::endl;
+                return 1;
+            }
+            return read_file_range(argv[2], std::stoull(argv[3]), std::stoull(argv[4]), argv[5]);
         } else if (command == "test") {
             return run_tests();
         } else {